@@ -21,8 +21,10 @@
 #include <osgGIS/FeatureLayerResource>
 #include <osgGIS/Utils>
 #include <osg/Notify>
+#include <OpenThreads/ScopedLock>
 
 using namespace osgGIS;
+using namespace OpenThreads;
 
 #include <osgGIS/Registry>
 OSGGIS_DEFINE_FILTER( AlignFilter );
@@ -113,98 +115,30 @@ AlignFilter::getProperties() const
 #define METERS_IN_ONE_DEG_OF_LAT 111120.0
 
 
-struct SegmentVisitor : public GeoPartVisitor
+// Gets the segment index for the named alignment layer, creating it and storing
+// it in the session the first time so that all compilers can share it.
+static SegmentIndex*
+getOrCreateSegmentIndex( FeatureLayer* layer, const std::string& layer_name, Session* session )
 {
-    SegmentVisitor( const GeoPoint& _point, GeoShape::ShapeType _type ) : 
-        point( _point ),
-        type( _type ),
-        best_heading( 0.0 ),
-        best_distance( DBL_MAX ) { }
-
-    bool
-    visitPart( const GeoPointList& part )
-    {
-        // skip over CW polygons (i.e. holes)
-        if ( type == GeoShape::TYPE_POLYGON && !GeomUtils::isPolygonCCW( part ) )
-            return true;
-        
-        if ( type == GeoShape::TYPE_LINE )
-        {
-            for( GeoPointList::const_iterator i = part.begin(); i != part.end()-1; i++ )
-            {
-                visitSegment( *i, *(i+1) );
-            }
-        }
-        else if ( type == GeoShape::TYPE_POLYGON )
-        {
-            for( GeoPointList::const_iterator i = part.begin(); i != part.end(); i++ )
-            {
-                const GeoPoint& p1 = i != part.end()-1? *(i+1) : *(part.begin() );
-                visitSegment( *i, p1 );
-            }
-        }
+    const std::string prop_name = "AlignFilter:segment_index:" + layer_name;
 
-        return true;
-    }
-
-    void
-    visitSegment( const GeoPoint& p0, const GeoPoint& p1 )
+    Property p = session->getProperty( prop_name );
+    SegmentIndex* index = dynamic_cast<SegmentIndex*>( p.getRefValue() );
+    if ( !index )
     {
-        double ax = p0.x(), ay = p0.y(), bx = p1.x(), by = p1.y(), cx = point.x(), cy = point.y();
-
-        // shortest-distance-from-point-to-line-segment algorithm by Philip Nicoletti
-        // http://www.codeguru.com/forum/printthread.php?t=194400
+        ScopedLock<ReentrantMutex> create_index_lock( session->getSessionMutex() );
 
-        double r_numerator = (cx-ax)*(bx-ax) + (cy-ay)*(by-ay);
-	    double r_denomenator = (bx-ax)*(bx-ax) + (by-ay)*(by-ay);
-        if ( r_denomenator != 0.0 )
+        // check AGAIN just in case another thread created the index before we acquired the lock:
+        p = session->getProperty( prop_name );
+        index = dynamic_cast<SegmentIndex*>( p.getRefValue() );
+        if ( !index )
         {
-	        double r = r_numerator / r_denomenator;
-            double px = ax + r*(bx-ax);
-            double py = ay + r*(by-ay);
-            double s =  ((ay-cy)*(bx-ax)-(ax-cx)*(by-ay) ) / r_denomenator;
-	        double distance_line = fabs(s)*sqrt(r_denomenator);
-            // (xx,yy) is the point on the lineSegment closest to (cx,cy)
-	        double xx = px;
-	        double yy = py;
-            double distance_segment = 0.0;
-        	if ( (r >= 0) && (r <= 1) )
-	        {
-		        distance_segment = distance_line;
-	        }
-	        else
-	        {
-        		double dist1 = (cx-ax)*(cx-ax) + (cy-ay)*(cy-ay);
-        		double dist2 = (cx-bx)*(cx-bx) + (cy-by)*(cy-by);
-        		if (dist1 < dist2)
-        		{
-			        xx = ax;
-			        yy = ay;
-			        distance_segment = sqrt(dist1);
-		        }
-		        else
-		        {
-			        xx = bx;
-			        yy = by;
-			        distance_segment = sqrt(dist2);
-		        
-                }
-            }
-
-            if ( distance_segment < best_distance )
-            {
-                best_distance = distance_segment;
-                best_heading = osg::RadiansToDegrees( atan2( xx-cx, yy-cy ) );
-            }
+            index = new SegmentIndex( layer );
+            session->setProperty( Property( prop_name, index ) );
         }
     }
-
-    const GeoPoint& point;
-    GeoShape::ShapeType type;
-
-    double best_distance;
-    double best_heading;
-};
+    return index;
+}
 
 
 FeatureList
@@ -228,9 +162,14 @@ AlignFilter::process( Feature* input, FilterEnv* env )
                     << getAlignmentLayerResourceName()
                     << std::endl;
             }
+            else
+            {
+                segment_index = getOrCreateSegmentIndex(
+                    alignment_layer.get(), getAlignmentLayerResourceName(), env->getSession() );
+            }
         }
 
-        if ( alignment_layer.valid() )
+        if ( segment_index.valid() )
         {
             double radius_srs = radius;
 
@@ -244,28 +183,13 @@ AlignFilter::process( Feature* input, FilterEnv* env )
             // get the point's coordinates and transform them into absolute space:
             GeoPoint c = input->getExtent().getCentroid().getAbsolute();
 
-            GeoExtent search_extent( 
-                c.x()-radius_srs, c.y()-radius_srs,
-                c.x()+radius_srs, c.y()+radius_srs,
-                c.getSRS() );
+            // find the nearest segment within the search radius and face it:
+            double best_heading = 0.0;
 
-            double best_distance = DBL_MAX;
-            double best_heading  = 0.0;
-
-            FeatureCursor cursor = alignment_layer->getCursor( search_extent );
-            while( cursor.hasNext() )
+            SegmentHitList hits;
+            if ( segment_index->getNearestSegments( c, 1, radius_srs, hits ) )
             {
-                Feature* a = cursor.next();
-
-                SegmentVisitor vis( c, a->getShapeType() );
-                const GeoShapeList& shapes = a->getShapes();
-                shapes.accept( vis );
-
-                if ( vis.best_distance < best_distance )
-                {
-                    best_distance = vis.best_distance;
-                    best_heading = vis.best_heading;
-                }
+                best_heading = osg::RadiansToDegrees( atan2( hits[0].x-c.x(), hits[0].y-c.y() ) );
             }
 
             input->setAttribute( getOutputAttribute(), best_heading );
@@ -0,0 +1,236 @@
+/**
+/* osgGIS - GIS Library for OpenSceneGraph
+ * Copyright 2007-2008 Glenn Waldron and Pelican Ventures, Inc.
+ * http://osggis.org
+ *
+ * osgGIS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <osgGIS/AttributeIndex>
+#include <osgGIS/Registry>
+#include <osgGIS/Utils>
+#include <osg/Notify>
+#include <osgDB/FileNameUtils>
+#include <algorithm>
+#include <fstream>
+#include <cctype>
+#include <sys/stat.h>
+#include <stdio.h>
+
+using namespace osgGIS;
+
+
+AttributeIndex::AttributeIndex( FeatureStore* _store, const std::string& _attr_name )
+{
+    store = _store;
+    attr_name = StringUtils::toLower( _attr_name );
+    buildIndex();
+}
+
+
+AttributeIndex::~AttributeIndex()
+{
+    //NOP
+}
+
+
+const std::string&
+AttributeIndex::getAttributeName() const
+{
+    return attr_name;
+}
+
+
+const FeatureOIDList&
+AttributeIndex::getOIDs( const std::string& value ) const
+{
+    static FeatureOIDList s_empty;
+    ValueTable::const_iterator i = table.find( value );
+    return i != table.end()? i->second : s_empty;
+}
+
+
+bool
+AttributeIndex::canEvaluate( const AttributeQuery::Term& term )
+{
+    return
+        term.getType() == Attribute::TYPE_STRING &&
+        ( term.getOperator() == AttributeQuery::OP_EQUAL || term.getOperator() == AttributeQuery::OP_NOT_EQUAL );
+}
+
+
+bool
+AttributeIndex::getOIDs( const AttributeQuery::Term& term, FeatureOIDList& output ) const
+{
+    if ( !canEvaluate( term ) || term.getName() != attr_name )
+        return false;
+
+    if ( term.getOperator() == AttributeQuery::OP_EQUAL )
+    {
+        const FeatureOIDList& oids = getOIDs( term.getStringValue() );
+        output.insert( output.end(), oids.begin(), oids.end() );
+    }
+    else // OP_NOT_EQUAL
+    {
+        FeatureOIDList::size_type start = output.size();
+        for( ValueTable::const_iterator i = table.begin(); i != table.end(); i++ )
+        {
+            if ( i->first != term.getStringValue() )
+                output.insert( output.end(), i->second.begin(), i->second.end() );
+        }
+        std::sort( output.begin() + start, output.end() );
+    }
+    return true;
+}
+
+
+FeatureCursor
+AttributeIndex::getCursor( const std::string& value )
+{
+    return FeatureCursor( getOIDs( value ), store.get(), GeoExtent::infinite(), false );
+}
+
+
+void
+AttributeIndex::getValues( std::vector<std::string>& output ) const
+{
+    for( ValueTable::const_iterator i = table.begin(); i != table.end(); i++ )
+        output.push_back( i->first );
+}
+
+
+// Makes a string safe for use in a file name.
+static std::string
+toFileName( const std::string& in )
+{
+    std::string out = in;
+    for( unsigned int i=0; i<out.length(); i++ )
+    {
+        if ( !isalnum( out[i] ) )
+            out[i] = '_';
+    }
+    return out;
+}
+
+
+bool
+AttributeIndex::buildIndex()
+{
+    bool loaded = false;
+
+    std::string cache_path = FileUtils::getWorkFilePath( store->getName(), toFileName( attr_name ) + "_attrindex" );
+    bool cache_index = cache_path.length() > 0;
+
+    if ( cache_index )
+    {
+        // the cached index is only valid if it is newer than the feature store.
+        struct stat statbuf;
+        if ( ::stat( cache_path.c_str(), &statbuf ) == 0 && statbuf.st_mtime > store->getModTime() )
+        {
+            std::ifstream input( cache_path.c_str(), std::ios::binary );
+            if ( input.is_open() )
+            {
+                loaded = readFrom( input );
+                input.close();
+                if ( loaded )
+                    osgGIS::notify(osg::INFO) << "Loaded cached attribute index \"" << attr_name << "\"" << std::endl;
+                else
+                    table.clear();
+            }
+        }
+    }
+
+    if ( !loaded )
+    {
+        for( FeatureCursor cursor = store->getCursor(); cursor.hasNext(); )
+        {
+            Feature* f = cursor.next();
+            table[ f->getAttribute( attr_name ).asString() ].push_back( f->getOID() );
+        }
+
+        for( ValueTable::iterator i = table.begin(); i != table.end(); i++ )
+            std::sort( i->second.begin(), i->second.end() );
+
+        // now cache it to disk, by way of a temporary file so that another
+        // process never reads a partial index:
+        if ( cache_index )
+        {
+            std::string temp_path = FileUtils::getPartialPath( cache_path );
+            std::ofstream output( temp_path.c_str(), std::ios::binary );
+            bool written = writeTo( output );
+            output.close();
+            if ( written && !output.fail() )
+                FileUtils::replaceFile( temp_path, cache_path );
+            else
+                ::remove( temp_path.c_str() );
+        }
+
+        loaded = true;
+    }
+
+    return loaded;
+}
+
+
+// Format: a header line, the attribute name, the number of values, and then
+// for each value its length-prefixed text followed by its OID list.
+bool
+AttributeIndex::writeTo( std::ostream& out ) const
+{
+    out << "OSGGIS_ATTRIBUTE_INDEX_1.0" << std::endl;
+    out << attr_name << std::endl;
+    out << table.size() << std::endl;
+    for( ValueTable::const_iterator i = table.begin(); i != table.end(); i++ )
+    {
+        out << i->first.length() << ' ' << i->first << ' ' << i->second.size();
+        for( FeatureOIDList::const_iterator j = i->second.begin(); j != i->second.end(); j++ )
+            out << ' ' << *j;
+        out << std::endl;
+    }
+    return out.good();
+}
+
+
+bool
+AttributeIndex::readFrom( std::istream& in )
+{
+    std::string line;
+    std::getline( in, line );
+    if ( line != "OSGGIS_ATTRIBUTE_INDEX_1.0" ) return false;
+    std::getline( in, line );
+    if ( line != attr_name ) return false;
+
+    unsigned int num_values = 0;
+    in >> num_values;
+    for( unsigned int i=0; i<num_values && in.good(); i++ )
+    {
+        unsigned int len = 0, num_oids = 0;
+        in >> len;
+        in.get();
+        std::string value( len, ' ' );
+        if ( len > 0 )
+            in.read( &value[0], len );
+        in >> num_oids;
+
+        FeatureOIDList& oids = table[value];
+        oids.reserve( num_oids );
+        for( unsigned int j=0; j<num_oids && in.good(); j++ )
+        {
+            FeatureOID oid;
+            in >> oid;
+            oids.push_back( oid );
+        }
+    }
+    return !in.fail();
+}
@@ -0,0 +1,447 @@
+/**
+/* osgGIS - GIS Library for OpenSceneGraph
+ * Copyright 2007-2008 Glenn Waldron and Pelican Ventures, Inc.
+ * http://osggis.org
+ *
+ * osgGIS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <osgGIS/AttributeQuery>
+#include <osgGIS/Feature>
+#include <osgGIS/Utils>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <vector>
+
+using namespace osgGIS;
+
+
+AttributeQuery::Term::Term( const std::string& _name, Operator _op, const std::string& _value )
+: name( StringUtils::toLower( _name ) ),
+  type( Attribute::TYPE_STRING ),
+  op( _op ),
+  string_value( _value ),
+  number_value( 0.0 )
+{
+    //NOP
+}
+
+AttributeQuery::Term::Term( const std::string& _name, Attribute::Type _type, Operator _op, double _value )
+: name( StringUtils::toLower( _name ) ),
+  type( _type ),
+  op( _op ),
+  number_value( _value )
+{
+    //NOP
+}
+
+const std::string&
+AttributeQuery::Term::getName() const
+{
+    return name;
+}
+
+Attribute::Type
+AttributeQuery::Term::getType() const
+{
+    return type;
+}
+
+AttributeQuery::Operator
+AttributeQuery::Term::getOperator() const
+{
+    return op;
+}
+
+const std::string&
+AttributeQuery::Term::getStringValue() const
+{
+    return string_value;
+}
+
+double
+AttributeQuery::Term::getNumberValue() const
+{
+    return number_value;
+}
+
+template<typename T>
+static bool
+compare( const T& a, AttributeQuery::Operator op, const T& b )
+{
+    switch( op )
+    {
+    case AttributeQuery::OP_EQUAL:         return a == b;
+    case AttributeQuery::OP_NOT_EQUAL:     return !(a == b);
+    case AttributeQuery::OP_LESS:          return a < b;
+    case AttributeQuery::OP_LESS_EQUAL:    return !(b < a);
+    case AttributeQuery::OP_GREATER:       return b < a;
+    case AttributeQuery::OP_GREATER_EQUAL: return !(a < b);
+    }
+    return false;
+}
+
+bool
+AttributeQuery::Term::matches( const Feature* feature ) const
+{
+    // convert the attribute exactly the way the script accessors do, so that
+    // the result is identical to running the original expression:
+    Attribute attr = feature->getAttribute( name );
+
+    if ( type == Attribute::TYPE_STRING )
+    {
+        return compare( std::string( attr.asString() ), op, string_value );
+    }
+    else
+    {
+        double value = type == Attribute::TYPE_INT? (double)attr.asInt() : attr.asDouble();
+        return compare( value, op, number_value );
+    }
+}
+
+static const char*
+opToString( AttributeQuery::Operator op )
+{
+    return
+        op == AttributeQuery::OP_EQUAL?         "==" :
+        op == AttributeQuery::OP_NOT_EQUAL?     "~=" :
+        op == AttributeQuery::OP_LESS?          "<"  :
+        op == AttributeQuery::OP_LESS_EQUAL?    "<=" :
+        op == AttributeQuery::OP_GREATER?       ">"  :
+        ">=";
+}
+
+std::string
+AttributeQuery::Term::toString() const
+{
+    std::stringstream buf;
+    buf.precision( 17 );
+    if ( type == Attribute::TYPE_STRING )
+        buf << "attr_string(feature,\"" << name << "\") " << opToString( op ) << " \"" << string_value << "\"";
+    else if ( type == Attribute::TYPE_INT )
+        buf << "attr_int(feature,\"" << name << "\") " << opToString( op ) << " " << number_value;
+    else
+        buf << "attr_double(feature,\"" << name << "\") " << opToString( op ) << " " << number_value;
+    return buf.str();
+}
+
+/*****************************************************************************/
+
+// Splits an expression on top-level occurrances of the "and" keyword. Returns
+// false if the expression uses any construct we do not understand.
+static bool
+splitConjunction( const std::string& expr, std::vector<std::string>& out )
+{
+    std::string current;
+    char quote = 0;
+    int depth = 0;
+
+    for( unsigned int i=0; i<expr.length(); i++ )
+    {
+        char c = expr[i];
+        if ( quote )
+        {
+            if ( c == '\\' ) return false; // no escapes
+            if ( c == quote ) quote = 0;
+            current += c;
+        }
+        else if ( c == '"' || c == '\'' )
+        {
+            quote = c;
+            current += c;
+        }
+        else if ( c == '(' ) { depth++; current += c; }
+        else if ( c == ')' ) { if ( --depth < 0 ) return false; current += c; }
+        else if ( isalpha( c ) || c == '_' )
+        {
+            // read a whole identifier:
+            std::string word;
+            unsigned int j = i;
+            while( j < expr.length() && ( isalnum( expr[j] ) || expr[j] == '_' ) )
+                word += expr[j++];
+
+            if ( word == "or" || word == "not" || word == "nil" || word == "function" )
+                return false;
+
+            if ( word == "and" )
+            {
+                if ( depth > 0 ) return false;
+                out.push_back( current );
+                current.clear();
+            }
+            else
+            {
+                current += word;
+            }
+            i = j-1;
+        }
+        else
+        {
+            current += c;
+        }
+    }
+
+    if ( quote || depth != 0 )
+        return false;
+
+    out.push_back( current );
+    return true;
+}
+
+// Parses a quoted string literal.
+static bool
+parseString( const std::string& in, std::string& out )
+{
+    if ( in.length() >= 2 && ( in[0] == '"' || in[0] == '\'' ) && in[in.length()-1] == in[0] )
+    {
+        out = in.substr( 1, in.length()-2 );
+        return out.find( in[0] ) == std::string::npos;
+    }
+    return false;
+}
+
+// Parses a numeric literal.
+static bool
+parseNumber( const std::string& in, double& out )
+{
+    if ( in.empty() )
+        return false;
+    char* end = NULL;
+    out = strtod( in.c_str(), &end );
+    return end && *end == 0;
+}
+
+// Removes all whitespace outside of quotes.
+static std::string
+compact( const std::string& in )
+{
+    std::string out;
+    char quote = 0;
+    for( unsigned int i=0; i<in.length(); i++ )
+    {
+        char c = in[i];
+        if ( quote )
+        {
+            if ( c == quote ) quote = 0;
+            out += c;
+        }
+        else if ( c == '"' || c == '\'' )
+        {
+            quote = c;
+            out += c;
+        }
+        else if ( !isspace( c ) )
+        {
+            out += c;
+        }
+    }
+    return out;
+}
+
+// Parses one of the supported attribute accessors (see Lua_ScriptEngine):
+//    attr_string(feature,"name")
+//    feature:getAttribute("name"):asString()
+static bool
+parseAccessor( const std::string& in, std::string& out_name, Attribute::Type& out_type )
+{
+    std::string s = compact( in );
+
+    const char* funcs[] = { "attr_string(feature,", "attr_int(feature,", "attr_double(feature," };
+    const Attribute::Type types[] = { Attribute::TYPE_STRING, Attribute::TYPE_INT, Attribute::TYPE_DOUBLE };
+
+    for( int k=0; k<3; k++ )
+    {
+        std::string prefix( funcs[k] );
+        if ( s.length() > prefix.length() && s.compare( 0, prefix.length(), prefix ) == 0 && s[s.length()-1] == ')' )
+        {
+            out_type = types[k];
+            return parseString( s.substr( prefix.length(), s.length()-prefix.length()-1 ), out_name );
+        }
+    }
+
+    const std::string prefix = "feature:getAttribute(";
+    const char* methods[] = { "):asString()", "):asInt()", "):asDouble()" };
+
+    if ( s.compare( 0, prefix.length(), prefix ) == 0 )
+    {
+        for( int k=0; k<3; k++ )
+        {
+            std::string suffix( methods[k] );
+            if ( s.length() > prefix.length()+suffix.length() &&
+                 s.compare( s.length()-suffix.length(), suffix.length(), suffix ) == 0 )
+            {
+                out_type = types[k];
+                return parseString( s.substr( prefix.length(), s.length()-prefix.length()-suffix.length() ), out_name );
+            }
+        }
+    }
+
+    return false;
+}
+
+static bool
+parseTerm( const std::string& in, AttributeQuery::TermList& out )
+{
+    // locate the comparison operator (outside of any quotes):
+    const char* ops[] = { "==", "~=", "<=", ">=", "<", ">" };
+    const AttributeQuery::Operator codes[] = {
+        AttributeQuery::OP_EQUAL, AttributeQuery::OP_NOT_EQUAL, AttributeQuery::OP_LESS_EQUAL,
+        AttributeQuery::OP_GREATER_EQUAL, AttributeQuery::OP_LESS, AttributeQuery::OP_GREATER };
+
+    char quote = 0;
+    for( unsigned int i=0; i<in.length(); i++ )
+    {
+        char c = in[i];
+        if ( quote )
+        {
+            if ( c == quote ) quote = 0;
+            continue;
+        }
+        if ( c == '"' || c == '\'' )
+        {
+            quote = c;
+            continue;
+        }
+
+        for( int k=0; k<6; k++ )
+        {
+            unsigned int len = strlen( ops[k] );
+            if ( in.compare( i, len, ops[k] ) == 0 )
+            {
+                std::string lhs = StringUtils::trim( in.substr( 0, i ) );
+                std::string rhs = StringUtils::trim( in.substr( i+len ) );
+
+                std::string name;
+                Attribute::Type type;
+                if ( !parseAccessor( lhs, name, type ) )
+                    return false;
+
+                // the literal type must match the accessor type, just as in the script
+                // language; mismatched comparisons are left to the script engine.
+                if ( type == Attribute::TYPE_STRING )
+                {
+                    std::string value;
+                    if ( !parseString( rhs, value ) )
+                        return false;
+                    out.push_back( AttributeQuery::Term( name, codes[k], value ) );
+                }
+                else
+                {
+                    double value;
+                    if ( !parseNumber( rhs, value ) )
+                        return false;
+                    out.push_back( AttributeQuery::Term( name, type, codes[k], value ) );
+                }
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+AttributeQuery*
+AttributeQuery::parse( const std::string& expr )
+{
+    std::vector<std::string> parts;
+    if ( !splitConjunction( expr, parts ) )
+        return NULL;
+
+    TermList terms;
+    for( std::vector<std::string>::const_iterator i = parts.begin(); i != parts.end(); i++ )
+    {
+        if ( !parseTerm( *i, terms ) )
+            return NULL;
+    }
+
+    AttributeQuery* query = new AttributeQuery();
+    for( TermList::const_iterator j = terms.begin(); j != terms.end(); j++ )
+        query->addTerm( *j );
+    return query;
+}
+
+bool
+AttributeQuery::parseAttribute( const std::string& expr, std::string& out_name, Attribute::Type& out_type )
+{
+    if ( !parseAccessor( expr, out_name, out_type ) )
+        return false;
+    out_name = StringUtils::toLower( out_name );
+    return true;
+}
+
+AttributeQuery::AttributeQuery()
+{
+    //NOP
+}
+
+AttributeQuery::AttributeQuery( const AttributeQuery& rhs )
+: osg::Referenced(),
+  terms( rhs.terms )
+{
+    //NOP
+}
+
+AttributeQuery::~AttributeQuery()
+{
+    //NOP
+}
+
+void
+AttributeQuery::addTerm( const Term& term )
+{
+    terms.push_back( term );
+}
+
+void
+AttributeQuery::addTerms( const AttributeQuery& rhs )
+{
+    terms.insert( terms.end(), rhs.terms.begin(), rhs.terms.end() );
+}
+
+const AttributeQuery::TermList&
+AttributeQuery::getTerms() const
+{
+    return terms;
+}
+
+bool
+AttributeQuery::isEmpty() const
+{
+    return terms.empty();
+}
+
+bool
+AttributeQuery::matches( const Feature* feature ) const
+{
+    for( TermList::const_iterator i = terms.begin(); i != terms.end(); i++ )
+    {
+        if ( !i->matches( feature ) )
+            return false;
+    }
+    return true;
+}
+
+std::string
+AttributeQuery::toString() const
+{
+    std::string result;
+    for( TermList::const_iterator i = terms.begin(); i != terms.end(); i++ )
+    {
+        if ( i != terms.begin() )
+            result += " and ";
+        result += i->toString();
+    }
+    return result;
+}
@@ -18,13 +18,15 @@
  */
 
 #include <osgGIS/BuildGeomFilter>
+#include <osgGIS/Triangulator>
 #include <osg/Geometry>
 #include <osg/Geode>
-#include <osgUtil/Tessellator>
 #include <osgUtil/Optimizer>
 #include <osgUtil/SmoothingVisitor>
 #include <osgText/Text>
 #include <sstream>
+#include <algorithm>
+#include <map>
 
 using namespace osgGIS;
 
@@ -32,12 +34,14 @@ using namespace osgGIS;
 OSGGIS_DEFINE_FILTER( BuildGeomFilter );
 
 #define DEFAULT_RASTER_OVERLAY_MAX_SIZE 0
+#define DEFAULT_MERGE_GEOMETRY          false
 
 
 BuildGeomFilter::BuildGeomFilter()
 {
     overall_color = osg::Vec4f(1,1,1,1);
     setRasterOverlayMaxSize( DEFAULT_RASTER_OVERLAY_MAX_SIZE );
+    setMergeGeometry( DEFAULT_MERGE_GEOMETRY );
 }
 
 BuildGeomFilter::BuildGeomFilter( const BuildGeomFilter& rhs )
@@ -46,7 +50,8 @@ BuildGeomFilter::BuildGeomFilter( const BuildGeomFilter& rhs )
   raster_overlay_max_size( rhs.raster_overlay_max_size ),
   raster_overlay_script( rhs.raster_overlay_script.get() ),
   color_script( rhs.color_script.get() ),
-  feature_name_script( rhs.feature_name_script.get() )
+  feature_name_script( rhs.feature_name_script.get() ),
+  merge_geometry( rhs.merge_geometry )
 {
     //NOP
 }
@@ -117,6 +122,18 @@ BuildGeomFilter::getFeatureNameScript() const
     return feature_name_script.get();
 }
 
+void
+BuildGeomFilter::setMergeGeometry( bool value )
+{
+    merge_geometry = value;
+}
+
+bool
+BuildGeomFilter::getMergeGeometry() const
+{
+    return merge_geometry;
+}
+
 void
 BuildGeomFilter::setProperty( const Property& prop )
 {
@@ -128,6 +145,8 @@ BuildGeomFilter::setProperty( const Property& prop )
         setRasterOverlayMaxSize( prop.getIntValue( DEFAULT_RASTER_OVERLAY_MAX_SIZE ) );
     else if ( prop.getName() == "feature_name" )
         setFeatureNameScript( new Script( prop.getValue() ) );
+    else if ( prop.getName() == "merge_geometry" )
+        setMergeGeometry( prop.getBoolValue( getMergeGeometry() ) );
 
     FragmentFilter::setProperty( prop );
 }
@@ -145,9 +164,296 @@ BuildGeomFilter::getProperties() const
         p.push_back( Property( "raster_overlay_max_size", getRasterOverlayMaxSize() ) );
     if ( getFeatureNameScript() )
         p.push_back( Property( "feature_name", getFeatureNameScript() ) );
+    if ( getMergeGeometry() != DEFAULT_MERGE_GEOMETRY )
+        p.push_back( Property( "merge_geometry", getMergeGeometry() ) );
     return p;
 }
 
+// Geometries that can go into the same merged geometry: they share a state set
+// and the same set of vertex arrays.
+struct MergeKey
+{
+    MergeKey( osg::StateSet* _ss, bool _normals, bool _texcoords )
+        : ss( _ss ), normals( _normals ), texcoords( _texcoords ) { }
+
+    bool operator < ( const MergeKey& rhs ) const {
+        if ( ss.get() != rhs.ss.get() ) return ss.get() < rhs.ss.get();
+        if ( normals != rhs.normals ) return normals < rhs.normals;
+        return texcoords < rhs.texcoords;
+    }
+
+    osg::ref_ptr<osg::StateSet> ss;
+    bool normals;
+    bool texcoords;
+};
+
+typedef std::vector< osg::ref_ptr<osg::Geometry> > GeometryList;
+typedef std::map<MergeKey, GeometryList> MergeTable;
+
+
+// Whether a geometry only uses the arrays and bindings that BuildGeomFilter (and
+// its subclasses) generate, and can therefore be merged.
+static bool
+isMergeable( osg::Geometry* geom, bool& out_normals, bool& out_texcoords )
+{
+    osg::Vec3Array* verts = dynamic_cast<osg::Vec3Array*>( geom->getVertexArray() );
+    if ( !verts )
+        return false;
+
+    osg::Vec4Array* colors = dynamic_cast<osg::Vec4Array*>( geom->getColorArray() );
+    if ( !colors ||
+         !( geom->getColorBinding() == osg::Geometry::BIND_OVERALL && colors->size() >= 1 ) &&
+         !( geom->getColorBinding() == osg::Geometry::BIND_PER_VERTEX && colors->size() == verts->size() ) )
+    {
+        return false;
+    }
+
+    osg::Vec3Array* normals = dynamic_cast<osg::Vec3Array*>( geom->getNormalArray() );
+    out_normals = normals && geom->getNormalBinding() == osg::Geometry::BIND_PER_VERTEX;
+    if ( out_normals? normals->size() != verts->size() : geom->getNormalBinding() != osg::Geometry::BIND_OFF )
+        return false;
+
+    osg::Vec2Array* texcoords = dynamic_cast<osg::Vec2Array*>( geom->getTexCoordArray( 0 ) );
+    out_texcoords = texcoords != NULL;
+    if ( !out_texcoords && geom->getTexCoordArray( 0 ) )
+        return false;
+    if ( ( out_texcoords && texcoords->size() != verts->size() ) || geom->getTexCoordArray( 1 ) )
+        return false;
+
+    return geom->getNumVertexAttribArrays() == 0;
+}
+
+
+// Appends one run of vertices, drawn with the given mode, to the triangle, line
+// and point index lists of a merged geometry.
+static void
+addIndices( GLenum mode, const std::vector<GLuint>& run,
+            std::vector<GLuint>& tris, std::vector<GLuint>& lines, std::vector<GLuint>& points )
+{
+    unsigned int n = run.size();
+    unsigned int i;
+
+    switch( mode )
+    {
+    case osg::PrimitiveSet::POINTS:
+        points.insert( points.end(), run.begin(), run.end() );
+        break;
+
+    case osg::PrimitiveSet::LINES:
+        lines.insert( lines.end(), run.begin(), run.begin() + n - n%2 );
+        break;
+
+    case osg::PrimitiveSet::LINE_STRIP:
+    case osg::PrimitiveSet::LINE_LOOP:
+        for( i = 0; i+1 < n; i++ ) {
+            lines.push_back( run[i] ); lines.push_back( run[i+1] );
+        }
+        if ( mode == osg::PrimitiveSet::LINE_LOOP && n > 2 ) {
+            lines.push_back( run[n-1] ); lines.push_back( run[0] );
+        }
+        break;
+
+    case osg::PrimitiveSet::TRIANGLES:
+        tris.insert( tris.end(), run.begin(), run.begin() + n - n%3 );
+        break;
+
+    case osg::PrimitiveSet::TRIANGLE_STRIP:
+        for( i = 0; i+2 < n; i++ ) {
+            tris.push_back( run[i%2? i+1 : i] ); tris.push_back( run[i%2? i : i+1] ); tris.push_back( run[i+2] );
+        }
+        break;
+
+    case osg::PrimitiveSet::TRIANGLE_FAN:
+    case osg::PrimitiveSet::POLYGON:
+        for( i = 1; i+1 < n; i++ ) {
+            tris.push_back( run[0] ); tris.push_back( run[i] ); tris.push_back( run[i+1] );
+        }
+        break;
+
+    case osg::PrimitiveSet::QUADS:
+        for( i = 0; i+3 < n; i += 4 ) {
+            tris.push_back( run[i] ); tris.push_back( run[i+1] ); tris.push_back( run[i+2] );
+            tris.push_back( run[i] ); tris.push_back( run[i+2] ); tris.push_back( run[i+3] );
+        }
+        break;
+
+    case osg::PrimitiveSet::QUAD_STRIP:
+        for( i = 0; i+3 < n; i += 2 ) {
+            tris.push_back( run[i] ); tris.push_back( run[i+1] ); tris.push_back( run[i+3] );
+            tris.push_back( run[i] ); tris.push_back( run[i+3] ); tris.push_back( run[i+2] );
+        }
+        break;
+    }
+}
+
+
+// Merges a group of compatible geometries into a single, pre-sized geometry with
+// (at most) one indexed primitive set each for triangles, lines and points.
+static osg::Geometry*
+mergeGeometries( const MergeKey& key, const GeometryList& geoms )
+{
+    unsigned int num_verts = 0;
+    bool uniform_color = true;
+    osg::Vec4 first_color = (*static_cast<osg::Vec4Array*>( geoms.front()->getColorArray() ))[0];
+
+    for( GeometryList::const_iterator g = geoms.begin(); g != geoms.end(); g++ )
+    {
+        num_verts += g->get()->getVertexArray()->getNumElements();
+
+        osg::Vec4Array* colors = static_cast<osg::Vec4Array*>( g->get()->getColorArray() );
+        for( osg::Vec4Array::const_iterator c = colors->begin(); c != colors->end() && uniform_color; c++ )
+            uniform_color = *c == first_color;
+    }
+
+    osg::Geometry* result = new osg::Geometry();
+    result->setStateSet( key.ss.get() );
+
+    osg::Vec3Array* verts = new osg::Vec3Array( num_verts );
+    result->setVertexArray( verts );
+
+    osg::Vec4Array* colors = new osg::Vec4Array( uniform_color? 1 : num_verts );
+    result->setColorArray( colors );
+    result->setColorBinding( uniform_color? osg::Geometry::BIND_OVERALL : osg::Geometry::BIND_PER_VERTEX );
+    if ( uniform_color )
+        (*colors)[0] = first_color;
+
+    osg::Vec3Array* normals = NULL;
+    if ( key.normals )
+    {
+        normals = new osg::Vec3Array( num_verts );
+        result->setNormalArray( normals );
+        result->setNormalBinding( osg::Geometry::BIND_PER_VERTEX );
+    }
+
+    osg::Vec2Array* texcoords = NULL;
+    if ( key.texcoords )
+    {
+        texcoords = new osg::Vec2Array( num_verts );
+        result->setTexCoordArray( 0, texcoords );
+    }
+
+    std::vector<GLuint> tris, lines, points, run;
+    unsigned int offset = 0;
+
+    for( GeometryList::const_iterator g = geoms.begin(); g != geoms.end(); g++ )
+    {
+        osg::Geometry* geom = g->get();
+        osg::Vec3Array* in_verts = static_cast<osg::Vec3Array*>( geom->getVertexArray() );
+        unsigned int n = in_verts->size();
+
+        std::copy( in_verts->begin(), in_verts->end(), verts->begin() + offset );
+        if ( !uniform_color )
+        {
+            osg::Vec4Array* in_colors = static_cast<osg::Vec4Array*>( geom->getColorArray() );
+            if ( geom->getColorBinding() == osg::Geometry::BIND_OVERALL )
+                std::fill( colors->begin() + offset, colors->begin() + offset + n, (*in_colors)[0] );
+            else
+                std::copy( in_colors->begin(), in_colors->end(), colors->begin() + offset );
+        }
+        if ( normals )
+        {
+            osg::Vec3Array* in_normals = static_cast<osg::Vec3Array*>( geom->getNormalArray() );
+            std::copy( in_normals->begin(), in_normals->end(), normals->begin() + offset );
+        }
+        if ( texcoords )
+        {
+            osg::Vec2Array* in_texcoords = static_cast<osg::Vec2Array*>( geom->getTexCoordArray( 0 ) );
+            std::copy( in_texcoords->begin(), in_texcoords->end(), texcoords->begin() + offset );
+        }
+
+        for( unsigned int p = 0; p < geom->getNumPrimitiveSets(); p++ )
+        {
+            osg::PrimitiveSet* prim = geom->getPrimitiveSet( p );
+            osg::DrawArrayLengths* dal = dynamic_cast<osg::DrawArrayLengths*>( prim );
+            if ( dal )
+            {
+                GLuint first = offset + dal->getFirst();
+                for( osg::DrawArrayLengths::const_iterator len = dal->begin(); len != dal->end(); len++ )
+                {
+                    run.clear();
+                    for( GLsizei k = 0; k < *len; k++ )
+                        run.push_back( first++ );
+                    addIndices( prim->getMode(), run, tris, lines, points );
+                }
+            }
+            else
+            {
+                run.clear();
+                run.reserve( prim->getNumIndices() );
+                for( unsigned int k = 0; k < prim->getNumIndices(); k++ )
+                    run.push_back( offset + prim->index( k ) );
+                addIndices( prim->getMode(), run, tris, lines, points );
+            }
+        }
+
+        offset += n;
+    }
+
+    if ( tris.size() > 0 )
+        result->addPrimitiveSet( new osg::DrawElementsUInt( osg::PrimitiveSet::TRIANGLES, tris.begin(), tris.end() ) );
+    if ( lines.size() > 0 )
+        result->addPrimitiveSet( new osg::DrawElementsUInt( osg::PrimitiveSet::LINES, lines.begin(), lines.end() ) );
+    if ( points.size() > 0 )
+        result->addPrimitiveSet( new osg::DrawElementsUInt( osg::PrimitiveSet::POINTS, points.begin(), points.end() ) );
+
+    return result;
+}
+
+
+// Merges the geometry of a batch of fragments into as few geometries as the
+// state sets allow. Drawables that cannot be merged are passed along as they are.
+static FragmentList
+mergeFragments( FragmentList& input )
+{
+    MergeTable table;
+    std::vector<MergeKey> key_order;
+    osg::ref_ptr<Fragment> merged = new Fragment();
+
+    for( FragmentList::iterator i = input.begin(); i != input.end(); i++ )
+    {
+        // named fragments must stay separate:
+        if ( i->get()->hasName() )
+            return input;
+    }
+
+    merged->addAttributes( input.front()->getAttributes() );
+
+    for( FragmentList::iterator i = input.begin(); i != input.end(); i++ )
+    {
+        for( DrawableList::iterator d = i->get()->getDrawables().begin(); d != i->get()->getDrawables().end(); d++ )
+        {
+            osg::Geometry* geom = dynamic_cast<osg::Geometry*>( d->get() );
+            bool normals, texcoords;
+            if ( geom && isMergeable( geom, normals, texcoords ) )
+            {
+                MergeKey key( geom->getStateSet(), normals, texcoords );
+                GeometryList& group = table[key];
+                if ( group.size() == 0 )
+                    key_order.push_back( key );
+                group.push_back( geom );
+            }
+            else
+            {
+                merged->addDrawable( d->get() );
+            }
+        }
+    }
+
+    for( std::vector<MergeKey>::const_iterator k = key_order.begin(); k != key_order.end(); k++ )
+    {
+        const GeometryList& group = table[*k];
+        if ( group.size() == 1 )
+            merged->addDrawable( group.front().get() );
+        else
+            merged->addDrawable( mergeGeometries( *k, group ) );
+    }
+
+    FragmentList output;
+    output.push_back( merged.get() );
+    return output;
+}
+
+
 FragmentList
 BuildGeomFilter::process( FeatureList& input, FilterEnv* env )
 {
@@ -164,7 +470,17 @@ BuildGeomFilter::process( FeatureList& input, FilterEnv* env )
             env->getReport()->error( r.asString() );
     }
 
-    return FragmentFilter::process( input, env );
+    FragmentList output = FragmentFilter::process( input, env );
+
+    if ( getMergeGeometry() && !getFeatureNameScript() && output.size() > 1 )
+    {
+        output = mergeFragments( output );
+
+        // nothing left for the optimizer to merge:
+        env->getOptimizerHints().exclude( osgUtil::Optimizer::MERGE_GEOMETRY );
+    }
+
+    return output;
 }
 
 
@@ -197,14 +513,17 @@ BuildGeomFilter::process( Feature* input, FilterEnv* env )
 
         osg::Geometry* geom = new osg::Geometry();
 
-        // TODO: pre-total points and pre-allocate these arrays:
+        unsigned int num_points = shape.getTotalPointCount();
+
         osg::Vec3Array* verts = new osg::Vec3Array();
+        verts->reserve( num_points );
         geom->setVertexArray( verts );
         unsigned int vert_ptr = 0;
 
         // per-vertex coloring takes more memory than per-primitive-set coloring,
         // but it renders faster.
         osg::Vec4Array* colors = new osg::Vec4Array();
+        colors->reserve( num_points );
         geom->setColorArray( colors );
         geom->setColorBinding( osg::Geometry::BIND_PER_VERTEX );
 
@@ -232,15 +551,12 @@ BuildGeomFilter::process( Feature* input, FilterEnv* env )
             geom->addPrimitiveSet( new osg::DrawArrays( prim_type, part_ptr, vert_ptr-part_ptr ) );
         }
         
-        // tessellate all polygon geometries. Tessellating each geometry separately
-        // with TESS_TYPE_GEOMETRY is much faster than doing the whole bunch together
-        // using TESS_TYPE_DRAWABLE.
+        // triangulate all polygon geometries. Triangulating each geometry separately
+        // is much faster than doing the whole bunch together.
         if ( needs_tessellation )
         {
-            osgUtil::Tessellator tess;
-            tess.setTessellationType( osgUtil::Tessellator::TESS_TYPE_GEOMETRY );
-            tess.setWindingType( osgUtil::Tessellator::TESS_WINDING_POSITIVE );
-            tess.retessellatePolygons( *geom );
+            Triangulator triangulator;
+            triangulator.triangulate( geom );
 
             applyOverlayTexturing( geom, input, env );
         }
@@ -36,6 +36,7 @@
 #include <osg/TriangleFunctor>
 #include <osgSim/ShapeAttribute>
 #include <osgUtil/Optimizer>
+#include <osg/Timer>
 #include <sstream>
 #include <iomanip>
 
@@ -512,10 +513,18 @@ BuildNodesFilter::process( AttributedNodeList& input, FilterEnv* env )
         opt_mask |= env->getOptimizerHints().getIncludedOptions();
         opt_mask &= ~( env->getOptimizerHints().getExcludedOptions() );
 
+        osg::Timer_t start = osg::Timer::instance()->tick();
+
         opt.optimize( result.get(), opt_mask );
 
         GeometryCleaner cleaner;
         cleaner.clean( result.get() );
+
+        // the optimizer is often the most expensive part of a build, so time it
+        // separately from the rest of the filter:
+        osg::Timer_t end = osg::Timer::instance()->tick();
+        env->getReport()->incrementCounter( "optimizer_time", osg::Timer::instance()->delta_s( start, end ) );
+        Registry::instance()->getTraceLog()->addEvent( "Optimizer", "optimizer", start, end );
     }
 
     AttributedNodeList output;
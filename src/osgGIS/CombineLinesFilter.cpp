@@ -21,8 +21,8 @@
 #include <osgGIS/SimpleFeature>
 #include <osg/Notify>
 #include <map>
-#include <list>
-#include <algorithm>
+#include <vector>
+#include <math.h>
 
 using namespace osgGIS;
 
@@ -32,11 +32,12 @@ OSGGIS_DEFINE_FILTER( CombineLinesFilter );
 
 CombineLinesFilter::CombineLinesFilter()
 {
-    //NOP
+    snapping_tolerance = 0.0;
 }
 
 CombineLinesFilter::CombineLinesFilter( const CombineLinesFilter& rhs )
-: FeatureFilter( rhs )
+: FeatureFilter( rhs ),
+  snapping_tolerance( rhs.snapping_tolerance )
 {
     //NOP
 }
@@ -47,9 +48,24 @@ CombineLinesFilter::~CombineLinesFilter()
 }
 
 
+void
+CombineLinesFilter::setSnappingTolerance( double value )
+{
+    snapping_tolerance = value;
+}
+
+double
+CombineLinesFilter::getSnappingTolerance() const
+{
+    return snapping_tolerance;
+}
+
 void
 CombineLinesFilter::setProperty( const Property& p )
 {
+    if ( p.getName() == "snapping_tolerance" )
+        setSnappingTolerance( p.getDoubleValue( getSnappingTolerance() ) );
+
     FeatureFilter::setProperty( p );
 }
 
@@ -57,174 +73,306 @@ Properties
 CombineLinesFilter::getProperties() const
 {
     Properties p = FeatureFilter::getProperties();
+    if ( getSnappingTolerance() > 0.0 )
+        p.push_back( Property( "snapping_tolerance", getSnappingTolerance() ) );
     return p;
 }
 
 
-struct Segment : public osg::Referenced {
-    Segment( int _id, const GeoPointList& _points ) : id(_id), points(_points), active(true) { }
-    Segment() : active(false) { }
-    int id;
-    GeoPointList points;
-    bool active;
-};
-
-FeatureList
-CombineLinesFilter::process( FeatureList& input, FilterEnv* env )
+// Assigns line endpoints to graph nodes. Endpoints within the snapping tolerance
+// of an existing node map to that node; the lookup hashes points into a grid of
+// tolerance-sized buckets and checks the neighboring buckets.
+class NodeIndex
 {
-    FeatureList output;
+public:
+    NodeIndex( double _tolerance ) : tolerance( _tolerance ), num_nodes( 0 ) { }
 
-    typedef std::list<osg::ref_ptr<Segment> > SegmentList;
-    typedef std::map<GeoPoint,osg::ref_ptr<Segment> > EndpointMap;
-
-    EndpointMap ep_map;
-    SegmentList segments;
-    int seg_id = 0;
-    int num_active_segs = 0;
-
-    // first collect all the parts into a segment list.
-    for( FeatureList::iterator i = input.begin(); i != input.end(); i++ )
+    unsigned int getNode( const GeoPoint& p )
     {
-        Feature* f = i->get();
+        if ( tolerance <= 0.0 )
+        {
+            std::pair<ExactTable::iterator,bool> result = exact.insert( ExactTable::value_type( p, num_nodes ) );
+            if ( result.second )
+                num_nodes++;
+            return result.first->second;
+        }
 
-        for( GeoShapeList::iterator j = f->getShapes().begin(); j != f->getShapes().end(); j++ )
+        long long bx = (long long)floor( p.x() / tolerance );
+        long long by = (long long)floor( p.y() / tolerance );
+        double t2 = tolerance * tolerance;
+
+        for( long long x = bx-1; x <= bx+1; x++ )
         {
-            GeoShape& shape = *j;
-            for( GeoPartList::iterator k = shape.getParts().begin(); k != shape.getParts().end(); k++ )
+            for( long long y = by-1; y <= by+1; y++ )
             {
-                GeoPointList& part = *k;
-                if ( part.size() > 0 )
+                GridTable::const_iterator bucket = grid.find( GridKey( x, y ) );
+                if ( bucket != grid.end() )
                 {
-                    segments.push_back( new Segment( seg_id++, part ) );
-                    num_active_segs++;
+                    for( NodeList::const_iterator n = bucket->second.begin(); n != bucket->second.end(); n++ )
+                    {
+                        if ( (n->first - p).length2() <= t2 )
+                            return n->second;
+                    }
                 }
             }
         }
+
+        grid[ GridKey( bx, by ) ].push_back( NodeList::value_type( p, num_nodes ) );
+        return num_nodes++;
+    }
+
+    unsigned int getNumNodes() const {
+        return num_nodes;
     }
 
-    int start_count = segments.size();
-    //osgGIS::notify(osg::WARN) << "[Combine] combining " << segments.size() << " segments..." << std::endl;
+private:
+    typedef std::map<GeoPoint,unsigned int> ExactTable;
+    typedef std::pair<long long,long long> GridKey;
+    typedef std::vector< std::pair<GeoPoint,unsigned int> > NodeList;
+    typedef std::map<GridKey,NodeList> GridTable;
+
+    double tolerance;
+    unsigned int num_nodes;
+    ExactTable exact;
+    GridTable grid;
+};
+
+// A single input line part and the nodes at its two ends.
+struct Segment
+{
+    Segment( const GeoPointList* _points, unsigned int _front, unsigned int _back )
+        : points( _points ), front( _front ), back( _back ) { }
+    const GeoPointList* points;
+    unsigned int front, back;
+};
+
+// One step along a strip: a segment, and whether it is traversed back-to-front.
+struct StripStep
+{
+    StripStep( unsigned int _seg, bool _reversed ) : seg( _seg ), reversed( _reversed ) { }
+    unsigned int seg;
+    bool reversed;
+};
 
-    // next run through the segments list and combine segments w/ matching endpoints
-    for( SegmentList::iterator i = segments.begin(); i != segments.end(); i++ )
+typedef std::vector<Segment>   SegmentList;
+typedef std::vector<StripStep> Strip;
+
+
+// The endpoint graph: for each node, the list of segment ends that touch it
+// (packed into a single array).
+class EndpointGraph
+{
+public:
+    EndpointGraph( const SegmentList& _segments, unsigned int num_nodes )
+        : segments( _segments ),
+          offsets( num_nodes+1, 0 ),
+          ends( 2*_segments.size() ),
+          used( _segments.size(), false )
     {
-        Segment* seg = i->get();
-        
-        if ( !seg->active )
+        for( SegmentList::const_iterator i = segments.begin(); i != segments.end(); i++ )
         {
-            i = segments.erase( i ); i--;
-            continue;
+            offsets[i->front+1]++;
+            offsets[i->back+1]++;
         }
+        for( unsigned int n = 0; n < num_nodes; n++ )
+            offsets[n+1] += offsets[n];
 
-        //osgGIS::notify(osg::WARN)<< "[Combine]   segment " << seg->id << ": ";
+        cursors.assign( offsets.begin(), offsets.end()-1 );
+        std::vector<unsigned int> fill( cursors );
+        for( unsigned int s = 0; s < segments.size(); s++ )
+        {
+            ends[ fill[segments[s].front]++ ] = s;
+            ends[ fill[segments[s].back]++ ] = s;
+        }
+    }
+
+    unsigned int getDegree( unsigned int node ) const {
+        return offsets[node+1] - offsets[node];
+    }
+
+    bool isUsed( unsigned int seg ) const {
+        return used[seg];
+    }
 
-        // see if one of this segment's endpoints is in the ep map:
-        bool found = false;
-        EndpointMap::iterator ep = ep_map.find( seg->points.front() );
-        if ( ep != ep_map.end() && ep->second->active && seg->id != ep->second->id )
+    // Takes the next unused segment at the node, if any, returning the step.
+    bool next( unsigned int node, StripStep& step )
+    {
+        // each node's cursor only moves forward, so the total cost of all
+        // walks is linear in the number of segments.
+        unsigned int& c = cursors[node];
+        while( c < offsets[node+1] && used[ ends[c] ] )
+            c++;
+        if ( c == offsets[node+1] )
+            return false;
+
+        unsigned int seg = ends[c];
+        used[seg] = true;
+        step = StripStep( seg, segments[seg].front != node );
+        return true;
+    }
+
+    // Gets the node at which a step ends.
+    unsigned int getEndNode( const StripStep& step ) const {
+        return step.reversed? segments[step.seg].front : segments[step.seg].back;
+    }
+
+    // Walks from the node along unused segments until reaching a node with no
+    // unused segments left, recording the path.
+    void walk( unsigned int node, Strip& strip )
+    {
+        StripStep step( 0, false );
+        while( next( node, step ) )
         {
-            found = true;
-            GeoPointList new_part;
+            strip.push_back( step );
+            node = getEndNode( step );
+        }
+    }
 
-            new_part.insert( new_part.begin(), seg->points.begin()+1, seg->points.end() );
+    // Splices every unused segment reachable from the strip into it as closed
+    // loops (Hierholzer's algorithm). Only valid once every node has an even
+    // number of unused segments left, so that each detour returns to the node
+    // it left from.
+    void splice( unsigned int start, Strip& strip )
+    {
+        Strip stack;
+        stack.swap( strip );
+        Strip reversed;
+        reversed.reserve( stack.size() );
 
-            if ( seg->points.front() == ep->second->points.front() ) // front matches front
+        StripStep step( 0, false );
+        for( ;; )
+        {
+            unsigned int node = stack.empty()? start : getEndNode( stack.back() );
+            if ( next( node, step ) )
             {
-                std::reverse( new_part.begin(), new_part.end() );
-                new_part.insert( new_part.end(), ep->second->points.begin(), ep->second->points.end() );
+                stack.push_back( step );
             }
-            else // front matches back
+            else if ( stack.size() > 0 )
             {
-                new_part.insert( new_part.begin(), ep->second->points.begin(), ep->second->points.end() );
+                reversed.push_back( stack.back() );
+                stack.pop_back();
             }
-
-            // add the new combined segment to the end of our list (so we'll hit it later)
-            Segment* new_seg = new Segment( seg_id++, new_part );
-            segments.push_back( new_seg );
-            num_active_segs--;
-            
-            //osgGIS::notify(osg::WARN) << "combined with seg " << ep->second->id << " to form seg " << new_seg->id 
-            //    << ", now there are " << num_active_segs << " active segs." << std::endl;
-
-            // deactivate the old segments
-            seg->active = false; 
-            ep->second->active = false;
-            i = segments.erase( i ); i--;
-            ep_map.erase( ep );
-
-            // stick it in the index too
-            ep_map[new_seg->points.front()] = new_seg;
-            ep_map[new_seg->points.back()] = new_seg;
-        }
-        else if ( seg->points.size() > 1 ) // next try the back point:
-        {
-            ep = ep_map.find( seg->points.back() );
-            if ( ep != ep_map.end() && ep->second->active && seg->id != ep->second->id )
+            else
             {
-                found = true;
-                GeoPointList new_part;
+                break;
+            }
+        }
 
-                new_part.insert( new_part.begin(), seg->points.begin(), seg->points.end()-1 );
+        strip.assign( reversed.rbegin(), reversed.rend() );
+    }
 
-                if ( seg->points.back() == ep->second->points.front() ) // back matches front
+private:
+    const SegmentList& segments;
+    std::vector<unsigned int> offsets;
+    std::vector<unsigned int> ends;
+    std::vector<unsigned int> cursors;
+    std::vector<bool> used;
+};
+
+
+// Creates a new line feature holding the points of all the segments in the strip.
+static Feature*
+createStripFeature( const Strip& strip, const SegmentList& segments, FilterEnv* env )
+{
+    // count the points first so we only allocate once. Each segment after the
+    // first shares its starting point with the end of the previous one.
+    unsigned int num_points = 0;
+    for( Strip::const_iterator i = strip.begin(); i != strip.end(); i++ )
+    {
+        unsigned int size = segments[i->seg].points->size();
+        num_points += i == strip.begin()? size : size-1;
+    }
+
+    Feature* f = new SimpleFeature();
+    f->getShapes().push_back( GeoShape( GeoShape::TYPE_LINE, env->getInputSRS() ) );
+    GeoShape& shape = f->getShapes().back();
+    shape.getParts().push_back( GeoPointList() );
+    GeoPointList& part = shape.getParts().back();
+    part.reserve( num_points );
+
+    for( Strip::const_iterator i = strip.begin(); i != strip.end(); i++ )
+    {
+        const GeoPointList& points = *segments[i->seg].points;
+        unsigned int skip = i == strip.begin()? 0 : 1;
+        if ( i->reversed )
+            part.insert( part.end(), points.rbegin()+skip, points.rend() );
+        else
+            part.insert( part.end(), points.begin()+skip, points.end() );
+    }
+
+    return f;
+}
+
+
+FeatureList
+CombineLinesFilter::process( FeatureList& input, FilterEnv* env )
+{
+    FeatureList output;
+
+    // first collect all the parts into a segment list, assigning each endpoint
+    // to a node in the endpoint graph.
+    NodeIndex nodes( snapping_tolerance );
+    SegmentList segments;
+
+    for( FeatureList::iterator i = input.begin(); i != input.end(); i++ )
+    {
+        Feature* f = i->get();
+
+        for( GeoShapeList::iterator j = f->getShapes().begin(); j != f->getShapes().end(); j++ )
+        {
+            GeoShape& shape = *j;
+            for( GeoPartList::iterator k = shape.getParts().begin(); k != shape.getParts().end(); k++ )
+            {
+                GeoPointList& part = *k;
+                if ( part.size() > 0 )
                 {
-                    new_part.insert( new_part.end(), ep->second->points.begin(), ep->second->points.end() );
+                    unsigned int front = nodes.getNode( part.front() );
+                    unsigned int back = nodes.getNode( part.back() );
+                    segments.push_back( Segment( &part, front, back ) );
                 }
-                else // back matches back
-                {
-                    std::reverse( new_part.begin(), new_part.end() );
-                    new_part.insert( new_part.begin(), ep->second->points.begin(), ep->second->points.end() );
-                }           
-
-                // add the new combined segment to the end of our list (so we'll hit it later)
-                Segment* new_seg = new Segment( seg_id++, new_part );
-                segments.push_back( new_seg );
-                num_active_segs--;
-                
-                //osgGIS::notify(osg::WARN) << "combined with seg " << ep->second->id << " to form seg " << new_seg->id 
-                //    << ", now there are " << num_active_segs << " active segs." << std::endl;
-
-                // deactivate the old segments
-                seg->active = false; 
-                ep->second->active = false;
-                i = segments.erase( i ); i--;
-                ep_map.erase( ep );
-
-                // stick it in the index too
-                ep_map[new_seg->points.front()] = new_seg;
-                ep_map[new_seg->points.back()] = new_seg;
             }
         }
+    }
 
-        if ( !found ) // no ep match, so just log this seg in the endpoint map.
-        {
-            ep_map[seg->points.front()] = seg;
-            if ( seg->points.front() != seg->points.back() )
-                ep_map[seg->points.back()] = seg;   
+    EndpointGraph graph( segments, nodes.getNumNodes() );
 
-            //osgGIS::notify(osg::WARN) << "added" << std::endl;
+    // strips that start at an odd-degree node (line ends and odd junctions) will
+    // end at another one. Walking those first leaves every node with an even
+    // number of unused segments, i.e. only closed loops behind.
+    std::vector<unsigned int> starts;
+    std::vector<Strip> strips;
+    for( unsigned int n = 0; n < nodes.getNumNodes(); n++ )
+    {
+        if ( graph.getDegree( n ) % 2 == 1 )
+        {
+            Strip strip;
+            graph.walk( n, strip );
+            if ( strip.size() > 0 )
+            {
+                starts.push_back( n );
+                strips.push_back( strip );
+            }
         }
     }
 
-    // finally, collect all remaining "active" segments.
-    for( SegmentList::iterator i = segments.begin(); i != segments.end(); i++ )
+    // splice the loops that touch a strip into it, so that each connected group of
+    // lines yields one strip per pair of odd nodes and no extra strips for loops.
+    for( unsigned int i = 0; i < strips.size(); i++ )
     {
-        Segment* seg = i->get();
-        if ( seg->active )
-        {
-            GeoShape shape( GeoShape::TYPE_LINE, env->getInputSRS() );
-            shape.getParts().push_back( seg->points );
-            Feature* f = new SimpleFeature();
-            f->getShapes().push_back( shape );
-            output.push_back( f );
-        }
+        graph.splice( starts[i], strips[i] );
+        output.push_back( createStripFeature( strips[i], segments, env ) );
     }
 
-    if ( start_count > 0 )
+    // what remains are groups of lines with no odd nodes at all; each one becomes
+    // a single closed strip.
+    for( unsigned int s = 0; s < segments.size(); s++ )
     {
-        //osgGIS::notify(osg::NOTICE) << "[Combine] combined " << start_count << " segments into " << output.size()
-        //    << " features (" << (100-(int)(100.0f*(float)output.size()/(float)start_count)) << "% reduction)"
-        //    << std::endl;
+        if ( !graph.isUsed( s ) )
+        {
+            Strip strip;
+            graph.splice( segments[s].front, strip );
+            output.push_back( createStripFeature( strip, segments, env ) );
+        }
     }
 
     return output;
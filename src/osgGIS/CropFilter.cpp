@@ -21,6 +21,7 @@
 #include <osgGIS/SimpleFeature>
 #include <osg/Notify>
 #include <stack>
+#include <algorithm>
 
 using namespace osgGIS;
 
@@ -182,108 +183,119 @@ findIsectSegmentAndPoint(const GeoPoint& p1,
 //}
 
 
-bool
-pointInsideOrOnLine( const GeoPoint& p, const GeoPoint& s1, const GeoPoint& s2 )
-{
-    osg::Vec3d cross = (s2-s1) ^ (p-s1);
-    return cross.z() >= 0.0;
-}
-
-
-bool
-extentInsideOrOnLine( const GeoExtent& p, const GeoPoint& s1, const GeoPoint& s2 )
-{
-    return 
-        pointInsideOrOnLine( p.getSouthwest(), s1, s2 ) &&
-        pointInsideOrOnLine( p.getNortheast(), s1, s2 );
-}
+#define STAGE_SOUTH 0
+#define STAGE_EAST  1
+#define STAGE_NORTH 2
+#define STAGE_WEST  3
 
 
-bool
-getIsectPoint( const GeoPoint& p1, const GeoPoint& p2, const GeoPoint& p3, const GeoPoint& p4, GeoPoint& out )
+// One side of the crop window, treated as a half-plane. Since the window is
+// always axis-aligned, the inside tests and intersections reduce to simple
+// comparisons and a single interpolation.
+struct ClipEdge
 {
-    double denom = (p4.y()-p3.y())*(p2.x()-p1.x()) - (p4.x()-p3.x())*(p2.y()-p1.y());
-    if ( denom == 0.0 )
+    ClipEdge( UINT _stage, const GeoExtent& window ) : stage( _stage )
     {
-        out = GeoPoint::invalid(); // parallel lines
-        return false;
+        switch( stage )
+        {
+            case STAGE_SOUTH: value = window.getYMin(); break;
+            case STAGE_EAST:  value = window.getXMax(); break;
+            case STAGE_NORTH: value = window.getYMax(); break;
+            default:          value = window.getXMin(); break;
+        }
     }
 
-    double ua_num = (p4.x()-p3.x())*(p1.y()-p3.y()) - (p4.y()-p3.y())*(p1.x()-p3.x());
-    double ub_num = (p2.x()-p1.x())*(p1.y()-p3.y()) - (p2.y()-p1.y())*(p1.x()-p3.x());
-
-    double ua = ua_num/denom;
-    double ub = ub_num/denom;
+    // whether the point lies inside of (or on) the edge
+    bool isInside( const GeoPoint& p ) const
+    {
+        switch( stage )
+        {
+            case STAGE_SOUTH: return p.y() >= value;
+            case STAGE_EAST:  return p.x() <= value;
+            case STAGE_NORTH: return p.y() <= value;
+            default:          return p.x() >= value;
+        }
+    }
 
-    if ( ua < 0.0 || ua > 1.0 ) // || ub < 0.0 || ub > 1.0 )
+    // whether the entire extent lies inside of (or on) the edge
+    bool isInside( const GeoExtent& e ) const
     {
-        out = GeoPoint::invalid(); // isect point is on line, but not on line segment
-        return false;
+        switch( stage )
+        {
+            case STAGE_SOUTH: return e.getYMin() >= value;
+            case STAGE_EAST:  return e.getXMax() <= value;
+            case STAGE_NORTH: return e.getYMax() <= value;
+            default:          return e.getXMin() >= value;
+        }
     }
 
-    double x = p1.x() + ua*(p2.x()-p1.x());
-    double y = p1.y() + ua*(p2.y()-p1.y());
-    double z = p1.getDim() > 2? p1.z() + ua*(p2.z()-p1.z()) : 0.0; //right?
-    out = GeoPoint( x, y, z, p1.getSRS() );
-    return true;
-}
+    // whether the entire extent lies outside of (or on) the edge
+    bool isOutside( const GeoExtent& e ) const
+    {
+        switch( stage )
+        {
+            case STAGE_SOUTH: return e.getYMax() <= value;
+            case STAGE_EAST:  return e.getXMin() >= value;
+            case STAGE_NORTH: return e.getYMin() >= value;
+            default:          return e.getXMax() <= value;
+        }
+    }
 
+    // the point at which the segment (p1,p2) crosses the edge; p1 and p2 must
+    // lie on opposite sides of it.
+    GeoPoint getIsectPoint( const GeoPoint& p1, const GeoPoint& p2 ) const
+    {
+        bool horizontal = stage == STAGE_SOUTH || stage == STAGE_NORTH;
+        double t = horizontal?
+            (value-p1.y())/(p2.y()-p1.y()) :
+            (value-p1.x())/(p2.x()-p1.x());
+        double x = horizontal? p1.x() + t*(p2.x()-p1.x()) : value;
+        double y = horizontal? value : p1.y() + t*(p2.y()-p1.y());
+        return p1.getDim() > 2?
+            GeoPoint( x, y, p1.z() + t*(p2.z()-p1.z()), p1.getSRS() ) :
+            GeoPoint( x, y, p1.getSRS() );
+    }
 
+    // sort key that orders points on the edge from its end back to its start
+    double getSpatialOrderKey( const GeoPoint& p ) const
+    {
+        switch( stage )
+        {
+            case STAGE_SOUTH: return -p.x();
+            case STAGE_EAST:  return -p.y();
+            case STAGE_NORTH: return p.x();
+            default:          return p.y();
+        }
+    }
 
-#define STAGE_SOUTH 0
-#define STAGE_EAST  1
-#define STAGE_NORTH 2
-#define STAGE_WEST  3
+    UINT stage;
+    double value;
+};
 
 
-void
-spatialInsert( UINTList& list, UINT value, UINT stage, const GeoPointList& points )
+// orders isect points along the clip edge; when two coincide, the one
+// encountered later in traversal order comes first.
+struct SpatialOrderLess
 {
-    UINTList::iterator i;
-    double x, y;
-    
-    switch( stage )
+    SpatialOrderLess( const ClipEdge& _edge, const GeoPointList& _points ) 
+        : edge( _edge ), points( _points ) { }
+
+    bool operator()( UINT a, UINT b ) const
     {
-    case STAGE_SOUTH:
-        x = points[value].x();
-        for( i = list.begin(); i != list.end() && x < points[*i].x(); i++ );
-        list.insert( i, value );
-        break;
-
-    case STAGE_EAST:
-        y = points[value].y();
-        for( i = list.begin(); i != list.end() && y < points[*i].y(); i++ );
-        list.insert( i, value );
-        break;
-
-    case STAGE_NORTH:
-        x = points[value].x();
-        for( i = list.begin(); i != list.end() && x > points[*i].x(); i++ );
-        list.insert( i, value );
-        break;
-
-    case STAGE_WEST:
-        y = points[value].y();
-        for( i = list.begin(); i != list.end() && y > points[*i].y(); i++ );
-        list.insert( i, value );
-        break;
+        double ka = edge.getSpatialOrderKey( points[a] );
+        double kb = edge.getSpatialOrderKey( points[b] );
+        return ka < kb || ( ka == kb && a > b );
     }
-}
 
-UINT
-findIndexOf( const UINTList& list, UINT value )
-{
-    for( UINT i=0; i<list.size(); i++ )
-        if ( list[i] == value )
-            return i;
-    return 0;
-}
+    const ClipEdge& edge;
+    const GeoPointList& points;
+};
+
 
 class DeferredPart {
 public:
-    DeferredPart( const GeoPointList& a, UINT b, UINT c )
-        : part( a ), 
-          part_start_ptr( b ),
+    DeferredPart( UINT b, UINT c )
+        : part_start_ptr( b ),
           waiting_on_ptr( c ) { }
     GeoPointList part;
     UINT part_start_ptr;
@@ -294,12 +306,17 @@ public:
 static void
 scrubPart( GeoPointList& part )
 {
-    while( part.size() >= 0 && part.front() == part.back() )
+    while( part.size() > 0 && part.front() == part.back() )
         part.erase( part.end()-1 );
 }
 
 
 // poly clipping algorithm Aug 2007
+//
+// Each side of the window is processed in turn. The part is traversed once to
+// find its crossings with the side; the crossings are then sorted along the side,
+// and the rank lookups that stitch the output parts together take constant time,
+// so each stage runs in O(n + k log k) for n points and k crossings.
 bool
 cropPolygonPart( const GeoPointList& initial_input, const GeoExtent& window, GeoPartList& final_outputs )
 {
@@ -323,14 +340,7 @@ cropPolygonPart( const GeoPointList& initial_input, const GeoExtent& window, Geo
     // run the algorithm against all four sides of the window in succession.
     for( UINT stage = 0; stage < 4; stage++ )
     {
-        GeoPoint s1, s2;
-        switch( stage )
-        {
-            case STAGE_SOUTH: s1 = window.getSouthwest(), s2 = window.getSoutheast(); break;
-            case STAGE_EAST:  s1 = window.getSoutheast(), s2 = window.getNortheast(); break;
-            case STAGE_NORTH: s1 = window.getNortheast(), s2 = window.getNorthwest(); break;
-            case STAGE_WEST:  s1 = window.getNorthwest(), s2 = window.getSouthwest(); break;
-        }
+        ClipEdge edge( stage, window );
 
         // output parts to send to the next stage (or to return).
         GeoPartList outputs;
@@ -338,8 +348,7 @@ cropPolygonPart( const GeoPointList& initial_input, const GeoExtent& window, Geo
         // run against each input part.
         for( GeoPartList::iterator i = inputs.begin(); i != inputs.end(); i++ )
         {
-            //GeoPointList& input = *i;
-            GeoPointList input = *i;
+            GeoPointList& input = *i;
             scrubPart( input );
 
             // trivially reject a degenerate part (should never happen ;)
@@ -348,19 +357,19 @@ cropPolygonPart( const GeoPointList& initial_input, const GeoExtent& window, Geo
                 continue;
             }
             
-            // trivially accept if the window contains the entire extent of the part:
             GeoExtent input_extent;
             input_extent.expandToInclude( input );
 
             // trivially accept when the part lies entirely within the line:
-            if ( extentInsideOrOnLine( input_extent, s1, s2 ) )
+            if ( edge.isInside( input_extent ) )
             {
-                outputs.push_back( input );
+                outputs.push_back( GeoPointList() );
+                outputs.back().swap( input );
                 continue;
             }
 
             // trivially reject when there's no overlap:
-            if ( !window.intersects( input_extent ) || extentInsideOrOnLine( input_extent, s2, s1 ) )
+            if ( !window.intersects( input_extent ) || edge.isOutside( input_extent ) )
             {
                 continue;
             }                
@@ -373,53 +382,50 @@ cropPolygonPart( const GeoPointList& initial_input, const GeoExtent& window, Geo
             // 1b. Create a traversal-order list, ordering the isect points in the order in which they are encountered.
             // 1c. Create a spatial-order list, ordering the isect points along the boundary segment in the direction of the segment.
             GeoPointList working;
+            working.reserve( input.size() + 16 );
             UINTList traversal_order;
-            UINTList spatial_order;
-            GeoPoint prev_p;
             bool was_inside = true;
 
             for( UINT input_i = 0; input_i < input.size(); input_i++ )
             {
                 const GeoPoint& p = input[ input_i ];
-                bool is_inside = pointInsideOrOnLine( p, s1, s2 );
+                bool is_inside = edge.isInside( p );
 
-                if ( input_i > 0 )
+                if ( input_i > 0 && was_inside != is_inside ) // entering or exiting
                 {
-                    if ( was_inside != is_inside ) // entering or exiting
-                    {
-                        GeoPoint isect_p;
-                        if ( getIsectPoint( prev_p, p, s1, s2, /*out*/ isect_p ) )
-                        {
-                            working.push_back( isect_p );
-                            traversal_order.push_back( working.size()-1 );
-                            spatialInsert( spatial_order, working.size()-1, stage, working );
-                        }
-                        else
-                        {
-                            osgGIS::notify( osg::WARN ) 
-                                << "getIsectPoint failed" << std::endl;
-                        }
-                    }
+                    working.push_back( edge.getIsectPoint( input[input_i-1], p ) );
+                    traversal_order.push_back( working.size()-1 );
                 }
 
                 working.push_back( p );
-                prev_p = p;
                 was_inside = is_inside;
             }
 
-            if ( spatial_order.size() == 0 )
+            if ( traversal_order.size() == 0 )
             {
                 outputs.push_back( input );
                 continue;
             }
 
+            UINTList spatial_order( traversal_order );
+            std::sort( spatial_order.begin(), spatial_order.end(), SpatialOrderLess( edge, working ) );
+
+            // position of each isect point (by working index) in the two orderings:
+            UINTList traversal_rank( working.size(), 0 );
+            UINTList spatial_rank( working.size(), 0 );
+            for( UINT k = 0; k < traversal_order.size(); k++ )
+            {
+                traversal_rank[ traversal_order[k] ] = k;
+                spatial_rank[ spatial_order[k] ] = k;
+            }
+
             // 2. Start at the point preceding the first isect point (in spatial order). This will be the first
             //    outside point (since the first isect point is always an ENTRY.
             UINT overall_start_ptr = spatial_order[0];
             UINT shape_ptr = overall_start_ptr;
 
             // initialize the isect traversal pointer to start at the spatial order's first isect point:
-            UINT trav_ptr = findIndexOf( traversal_order, spatial_order[0] );
+            UINT trav_ptr = traversal_rank[ spatial_order[0] ];
             UINT traversals = 0;
 
             std::stack<DeferredPart> part_stack;
@@ -436,19 +442,16 @@ cropPolygonPart( const GeoPointList& initial_input, const GeoExtent& window, Geo
 
                 UINT part_start_ptr = shape_ptr;
 
+                current_part.clear();
+
                 if ( part_stack.size() > 0 && part_stack.top().waiting_on_ptr == part_start_ptr )
                 {
                     // time to resume a part that we deferred earlier.
                     DeferredPart& top = part_stack.top();
-                    current_part = top.part;
+                    current_part.swap( top.part );
                     part_start_ptr = top.part_start_ptr;
                     part_stack.pop();
                 }
-                else
-                {
-                    // start a new part
-                    current_part = GeoPointList();
-                }
 
                 // 5. Traverse to the next EXIT, adding all points along the way. 
                 //    Then check the spatial order of the EXIT against the part's starting point. If the former
@@ -467,11 +470,12 @@ cropPolygonPart( const GeoPointList& initial_input, const GeoExtent& window, Geo
                     // record the exit point:
                     current_part.push_back( working[next_exit_ptr] );
 
-                    UINT part_start_order = findIndexOf( spatial_order, part_start_ptr );
-                    UINT next_exit_order = findIndexOf( spatial_order, next_exit_ptr );
+                    UINT part_start_order = spatial_rank[ part_start_ptr ];
+                    UINT next_exit_order = spatial_rank[ next_exit_ptr ];
                     if ( next_exit_order - part_start_order == 1 )
                     {
-                        outputs.push_back( current_part );
+                        outputs.push_back( GeoPointList() );
+                        outputs.back().swap( current_part );
                         part_done = true;
                         continue;
                     }
@@ -490,7 +494,7 @@ cropPolygonPart( const GeoPointList& initial_input, const GeoExtent& window, Geo
                     }
 
                     // check whether we are continuing the current part:
-                    UINT next_entry_order = findIndexOf( spatial_order, next_entry_ptr );
+                    UINT next_entry_order = spatial_rank[ next_entry_ptr ];
                     if ( next_exit_order - next_entry_order == 1 )
                     {
                         shape_ptr = next_entry_ptr; // skip ahead to the entry point
@@ -500,12 +504,11 @@ cropPolygonPart( const GeoPointList& initial_input, const GeoExtent& window, Geo
                     // 7. We encountered an out-of-order traversal, so need to push the current part onto
                     //    the deferral stack until later, and start a new part.
                     part_stack.push( DeferredPart(
-                        current_part,
                         part_start_ptr,
                         spatial_order[next_exit_order-1] ) );
+                    part_stack.top().part.swap( current_part );
 
-                    current_part = GeoPointList();
-                    //current_part.push_back( working[next_entry_ptr] );
+                    current_part.clear();
                     part_start_ptr = next_entry_ptr;
                     shape_ptr = next_entry_ptr;
                 }
@@ -516,7 +519,8 @@ cropPolygonPart( const GeoPointList& initial_input, const GeoExtent& window, Geo
             {
                 GeoPointList& part = part_stack.top().part;
                 part.push_back( working[part_stack.top().waiting_on_ptr] );
-                outputs.push_back( part );
+                outputs.push_back( GeoPointList() );
+                outputs.back().swap( part );
                 part_stack.pop();
             }
         }
@@ -525,93 +529,96 @@ cropPolygonPart( const GeoPointList& initial_input, const GeoExtent& window, Geo
         outputs.swap( inputs );
     }
 
-    // go through and make sure no polys are "closed" (probably unnecessary).
-    //for( GeoPartList::iterator k = inputs.begin(); k != inputs.end(); k++ )
-    //{
-    //    while ( k->size() > 3 && k->front() == k->back() )
-    //        k->erase( k->end()-1 );
-    //}
-
     final_outputs.swap( inputs );
     return true;
 }
 
 
+// Liang-Barsky: narrows the parametric range [t0,t1] of a segment against one
+// side of the window. Returns false if the segment lies entirely outside it.
+static bool
+clipParameter( double p, double q, double& t0, double& t1 )
+{
+    if ( p == 0.0 )
+        return q >= 0.0;
+
+    double r = q/p;
+    if ( p < 0.0 )
+    {
+        if ( r > t1 ) return false;
+        if ( r > t0 ) t0 = r;
+    }
+    else
+    {
+        if ( r < t0 ) return false;
+        if ( r < t1 ) t1 = r;
+    }
+    return true;
+}
+
+static GeoPoint
+interpolate( const GeoPoint& p0, const GeoPoint& p1, double t )
+{
+    double x = p0.x() + t*(p1.x()-p0.x());
+    double y = p0.y() + t*(p1.y()-p0.y());
+    return p0.getDim() > 2?
+        GeoPoint( x, y, p0.z() + t*(p1.z()-p0.z()), p0.getSRS() ) :
+        GeoPoint( x, y, p0.getSRS() );
+}
+
+static void
+flushLinePart( GeoPointList& current_part, GeoPartList& output )
+{
+    if ( current_part.size() > 1 )
+    {
+        output.push_back( GeoPointList() );
+        output.back().swap( current_part );
+    }
+    current_part.clear();
+}
 
+// clips each segment against the whole window in a single pass.
 bool
 cropLinePart( const GeoPointList& part, const GeoExtent& extent, GeoPartList& output )
 {
-    GeoPartList working_parts;
-    working_parts.push_back( part );
+    double xmin = extent.getXMin(), ymin = extent.getYMin();
+    double xmax = extent.getXMax(), ymax = extent.getYMax();
+
+    GeoPointList current_part;
 
-    for( UINT s=0; s<4; s++ )
+    for( UINT i = 0; i+1 < part.size(); i++ )
     {
-        GeoPartList new_parts;
+        const GeoPoint& p0 = part[i];
+        const GeoPoint& p1 = part[i+1];
 
-        GeoPoint s1, s2;
-        switch( s )
-        {
-            case 0: s1 = extent.getSouthwest(), s2 = extent.getSoutheast(); break;
-            case 1: s1 = extent.getSoutheast(), s2 = extent.getNortheast(); break;
-            case 2: s1 = extent.getNortheast(), s2 = extent.getNorthwest(); break;
-            case 3: s1 = extent.getNorthwest(), s2 = extent.getSouthwest(); break;
-        }
+        double dx = p1.x()-p0.x(), dy = p1.y()-p0.y();
+        double t0 = 0.0, t1 = 1.0;
 
-        for( UINT part_i = 0; part_i < working_parts.size(); part_i++ )
+        if (clipParameter( -dx, p0.x()-xmin, t0, t1 ) &&
+            clipParameter(  dx, xmax-p0.x(), t0, t1 ) &&
+            clipParameter( -dy, p0.y()-ymin, t0, t1 ) &&
+            clipParameter(  dy, ymax-p0.y(), t0, t1 ) )
         {
-            bool inside = true;
-            GeoPoint prev_p;
-            GeoPointList current_part;
-
-            const GeoPointList& working_part = working_parts[ part_i ];
-            for( UINT point_i = 0; point_i < working_part.size(); point_i++ )
+            // entering the window starts a new part:
+            if ( t0 > 0.0 || current_part.size() == 0 )
             {
-                const GeoPoint& p = working_part[ point_i ];
-
-                if ( pointInsideOrOnLine( p, s1, s2 ) )
-                {
-                    if ( inside )
-                    {
-                        current_part.push_back( p );
-                    }
-                    else if ( prev_p.isValid() )
-                    {
-                        GeoPoint isect_p;
-                        if ( getIsectPoint( prev_p, p, s1, s2, /*out*/ isect_p ) )
-                        {
-                            current_part.push_back( isect_p );
-                            current_part.push_back( p );
-                        }
-                    }
-                    inside = true;
-                }
-                else // outside.
-                {
-                    if ( inside && point_i > 0 ) // inside heading out
-                    {
-                        GeoPoint isect_p;
-                        if ( getIsectPoint( prev_p, p, s1, s2, /*out*/ isect_p ) )
-                        {
-                            current_part.push_back( isect_p );
-                            if ( current_part.size() > 1 )
-                                new_parts.push_back( current_part );
-                            current_part = GeoPointList();
-                        }
-                    }
-                    inside = false;
-                }
-
-                prev_p = p;
+                flushLinePart( current_part, output );
+                current_part.push_back( t0 > 0.0? interpolate( p0, p1, t0 ) : p0 );
             }
 
-            if ( current_part.size() > 1 )
-                new_parts.push_back( current_part );
-        }
+            current_part.push_back( t1 < 1.0? interpolate( p0, p1, t1 ) : p1 );
 
-        working_parts.swap( new_parts );
+            // exiting the window ends it:
+            if ( t1 < 1.0 )
+                flushLinePart( current_part, output );
+        }
+        else
+        {
+            flushLinePart( current_part, output );
+        }
     }
 
-    output.swap( working_parts );
+    flushLinePart( current_part, output );
     return true;
 }
 
@@ -18,6 +18,7 @@
  */
 
 #include <osgGIS/DecimateFilter>
+#include <osgGIS/SimplificationIndex>
 #include <osg/Notify>
 
 using namespace osgGIS;
@@ -29,11 +30,13 @@ OSGGIS_DEFINE_FILTER( DecimateFilter );
 DecimateFilter::DecimateFilter()
 {
     distance_threshold = 0.0;
+    tolerance = 0.0;
 }
 
 DecimateFilter::DecimateFilter( const DecimateFilter& rhs )
 : FeatureFilter( rhs ),
-  distance_threshold( rhs.distance_threshold )
+  distance_threshold( rhs.distance_threshold ),
+  tolerance( rhs.tolerance )
 {
     //NOP
 }
@@ -41,6 +44,7 @@ DecimateFilter::DecimateFilter( const DecimateFilter& rhs )
 DecimateFilter::DecimateFilter( double _dist_threshold )
 {
     distance_threshold = _dist_threshold;
+    tolerance = 0.0;
 }
 
 
@@ -61,12 +65,26 @@ DecimateFilter::getDistanceThreshold() const
     return distance_threshold;
 }
 
+void
+DecimateFilter::setTolerance( double value )
+{
+    tolerance = value;
+}
+
+double
+DecimateFilter::getTolerance() const
+{
+    return tolerance;
+}
+
 
 void
 DecimateFilter::setProperty( const Property& p )
 {
     if ( p.getName() == "distance_threshold" )
         setDistanceThreshold( p.getDoubleValue( getDistanceThreshold() ) );
+    else if ( p.getName() == "tolerance" )
+        setTolerance( p.getDoubleValue( getTolerance() ) );
     FeatureFilter::setProperty( p );
 }
 
@@ -75,6 +93,7 @@ DecimateFilter::getProperties() const
 {
     Properties p = FeatureFilter::getProperties();
     p.push_back( Property( "distance_threshold", getDistanceThreshold() ) );
+    p.push_back( Property( "tolerance", getTolerance() ) );
     return p;
 }
 
@@ -119,6 +138,21 @@ DecimateFilter::process( Feature* input, FilterEnv* env )
 {
     FeatureList output;
 
+    if ( tolerance > 0.0 )
+    {
+        // same ranking the SimplificationIndex uses. (When the features come from a
+        // cursor that already simplified them, the graph skips this filter.)
+        std::vector<float> importance;
+        SimplificationIndex::computeImportance( input, importance );
+        SimplificationIndex::simplify( input, importance, tolerance );
+
+        if ( input->getShapes().size() > 0 )
+        {
+            output.push_back( input );
+        }
+        return output;
+    }
+
     GeoShapeList new_shapes;
 
     for( GeoShapeList::iterator i = input->getShapes().begin(); i != input->getShapes().end(); i++ )
@@ -65,6 +65,57 @@ Ellipsoid::latLongToGeocentric(const osg::Vec3d& input_deg ) const
     return osg::Vec3d( X, Y, Z );
 }
 
+void
+Ellipsoid::latLongToGeocentric(double* x, double* y, double* z, unsigned int count,
+                               const osg::Matrixd* ref_frame ) const
+{
+    // the reference frame is folded into the conversion when it is affine
+    // (the usual case: a rotation plus a translation).
+    osg::Matrixd m;
+    bool fold = !ref_frame || (
+        (*ref_frame)(0,3) == 0.0 && (*ref_frame)(1,3) == 0.0 &&
+        (*ref_frame)(2,3) == 0.0 && (*ref_frame)(3,3) == 1.0 );
+    if ( fold && ref_frame )
+        m = *ref_frame;
+
+    const double m00 = m(0,0), m01 = m(0,1), m02 = m(0,2);
+    const double m10 = m(1,0), m11 = m(1,1), m12 = m(1,2);
+    const double m20 = m(2,0), m21 = m(2,1), m22 = m(2,2);
+    const double m30 = m(3,0), m31 = m(3,1), m32 = m(3,2);
+    const double a = semi_major_axis;
+    const double e2 = ecc2;
+    const double one_minus_e2 = 1.0 - ecc2;
+    const double to_rad = osg::PI/180.0;
+
+    // transform the whole batch in one pass over the coordinate arrays, with the
+    // matrix and ellipsoid terms hoisted out of the loop.
+    for( unsigned int i = 0; i < count; i++ )
+    {
+        double latitude = y[i] * to_rad;
+        double longitude = x[i] * to_rad;
+        double height = z[i];
+        double sin_latitude = sin( latitude );
+        double cos_latitude = cos( latitude );
+        double N = a/sqrt( 1.0 - e2*sin_latitude*sin_latitude );
+        double r = (N+height)*cos_latitude;
+        double X = r*cos( longitude );
+        double Y = r*sin( longitude );
+        double Z = (N*one_minus_e2+height)*sin_latitude;
+        x[i] = X*m00 + Y*m10 + Z*m20 + m30;
+        y[i] = X*m01 + Y*m11 + Z*m21 + m31;
+        z[i] = X*m02 + Y*m12 + Z*m22 + m32;
+    }
+
+    if ( !fold )
+    {
+        for( unsigned int i = 0; i < count; i++ )
+        {
+            osg::Vec3d p = osg::Vec3d( x[i], y[i], z[i] ) * (*ref_frame);
+            x[i] = p.x(); y[i] = p.y(); z[i] = p.z();
+        }
+    }
+}
+
 osg::Vec3d
 Ellipsoid::geocentricToLatLong( const osg::Vec3d& input ) const
 {
@@ -19,13 +19,14 @@
 
 #include <osgGIS/ExtrudeGeomFilter>
 #include <osgGIS/Utils>
+#include <osgGIS/Triangulator>
 #include <osg/Geometry>
 #include <osg/Texture2D>
 #include <osg/TexEnv>
 #include <osg/Image>
 #include <osgDB/ReadFile>
-#include <osgUtil/Tessellator>
 #include <float.h>
+#include <algorithm>
 
 using namespace osgGIS;
 
@@ -34,18 +35,21 @@ OSGGIS_DEFINE_FILTER( ExtrudeGeomFilter );
 
 
 #define DEFAULT_UNIFORM_HEIGHT true
+#define DEFAULT_CREASE_ANGLE   0.0
 
 
 ExtrudeGeomFilter::ExtrudeGeomFilter()
 {
     setUniformHeight( DEFAULT_UNIFORM_HEIGHT );
+    setCreaseAngle( DEFAULT_CREASE_ANGLE );
 }
 
 ExtrudeGeomFilter::ExtrudeGeomFilter( const ExtrudeGeomFilter& rhs )
 : BuildGeomFilter( rhs ),
   height_script( rhs.height_script.get() ),
   wall_skin_script( rhs.wall_skin_script.get() ),
-  uniform_height( rhs.uniform_height )
+  uniform_height( rhs.uniform_height ),
+  crease_angle( rhs.crease_angle )
 {
     //NOP
 }
@@ -92,6 +96,18 @@ ExtrudeGeomFilter::getUniformHeight() const
     return uniform_height;
 }
 
+void
+ExtrudeGeomFilter::setCreaseAngle( double value )
+{
+    crease_angle = osg::clampBetween( value, 0.0, 180.0 );
+}
+
+double
+ExtrudeGeomFilter::getCreaseAngle() const
+{
+    return crease_angle;
+}
+
 void
 ExtrudeGeomFilter::setProperty( const Property& p )
 {
@@ -101,6 +117,8 @@ ExtrudeGeomFilter::setProperty( const Property& p )
         setWallSkinScript( new Script( p.getValue() ) );
     else if ( p.getName() == "uniform_height" )
         setUniformHeight( p.getBoolValue( getUniformHeight() ) );
+    else if ( p.getName() == "crease_angle" )
+        setCreaseAngle( p.getDoubleValue( getCreaseAngle() ) );
     BuildGeomFilter::setProperty( p );
 }
 
@@ -115,6 +133,8 @@ ExtrudeGeomFilter::getProperties() const
         p.push_back( Property( "wall_skin", getWallSkinScript()->getCode() ) );
     if ( getUniformHeight() != DEFAULT_UNIFORM_HEIGHT )
         p.push_back( Property( "uniform_height", getUniformHeight() ) );
+    if ( getCreaseAngle() != DEFAULT_CREASE_ANGLE )
+        p.push_back( Property( "crease_angle", getCreaseAngle() ) );
     return p;
 }
 
@@ -362,6 +382,108 @@ ExtrudeGeomFilter::getProperties() const
 //}
 
 
+// Generates exact normals for the wall strip of one part, which occupies the
+// (top, bottom) vertex pairs in [first, last). Every wall face gets its own flat
+// normal. Where two faces meet at a corner sharper than the crease angle, the
+// vertex pair is split in two so that both faces stay flat (the duplicate pair
+// only adds degenerate triangles to the strip); otherwise the pair is shared and
+// takes the average normal. Returns the new end of the part's vertices.
+static int
+generateWallNormals(osg::Vec3Array*  verts,
+                    osg::Vec2Array*  texcoords,
+                    osg::Vec4Array*  colors,
+                    osg::Vec3Array*  normals,
+                    int              first,
+                    int              last,
+                    bool             is_ring,
+                    double           cos_crease )
+{
+    int num_pairs = (last-first)/2;
+    if ( num_pairs < 2 )
+        return last;
+
+    // the normal of each wall face, from the winding of its first triangle:
+    std::vector<osg::Vec3> faces( num_pairs-1 );
+    int num_valid = 0;
+    for( int j = 0; j < num_pairs-1; j++ )
+    {
+        const osg::Vec3& top = (*verts)[first+2*j];
+        faces[j] = ((*verts)[first+2*j+1] - top) ^ ((*verts)[first+2*j+2] - top);
+        if ( faces[j].normalize() > 0.0f )
+            num_valid++;
+    }
+    if ( num_valid == 0 )
+        return last;
+
+    // degenerate (zero-length) faces borrow the normal of a neighbor:
+    for( int j = 1; j < num_pairs-1; j++ )
+        if ( faces[j].length2() == 0.0f )
+            faces[j] = faces[j-1];
+    for( int j = num_pairs-3; j >= 0; j-- )
+        if ( faces[j].length2() == 0.0f )
+            faces[j] = faces[j+1];
+
+    std::vector<osg::Vec3> part_verts( verts->begin() + first, verts->begin() + last );
+    std::vector<osg::Vec2> part_texcoords( texcoords->begin() + first, texcoords->begin() + last );
+    std::vector<osg::Vec4> part_colors( colors->begin() + first, colors->begin() + last );
+
+    int p = first;
+    for( int k = 0; k < num_pairs; k++ )
+    {
+        bool has_prev = k > 0 || is_ring;
+        bool has_next = k < num_pairs-1 || is_ring;
+        const osg::Vec3& prev = k > 0? faces[k-1] : faces.back();
+        const osg::Vec3& next = k < num_pairs-1? faces[k] : faces.front();
+
+        bool crease = has_prev && has_next && prev * next < cos_crease;
+        osg::Vec3 smooth = prev + next;
+        smooth.normalize();
+
+        // the first/last pair of a ring sit at the same corner; each only needs
+        // the normal of the face it belongs to:
+        int copies = crease && k > 0 && k < num_pairs-1? 2 : 1;
+        for( int c = 0; c < copies; c++ )
+        {
+            (*verts)[p]       = part_verts[2*k];
+            (*verts)[p+1]     = part_verts[2*k+1];
+            (*texcoords)[p]   = part_texcoords[2*k];
+            (*texcoords)[p+1] = part_texcoords[2*k+1];
+            (*colors)[p]      = part_colors[2*k];
+            (*colors)[p+1]    = part_colors[2*k+1];
+
+            osg::Vec3 n =
+                !has_prev? next :
+                !has_next? prev :
+                !crease? smooth :
+                k == 0? next :
+                k == num_pairs-1? prev :
+                c == 0? prev : next;
+
+            (*normals)[p++] = n;
+            (*normals)[p++] = n;
+        }
+    }
+
+    return p;
+}
+
+// Accumulates the (unnormalized) Newell normal of a ring of cap vertices.
+static void
+addCapNormal( const osg::Vec3Array* verts, int first, int last, osg::Vec3d& normal )
+{
+    if ( last - first < 3 )
+        return;
+
+    osg::Vec3d origin = (*verts)[first];
+    for( int i = first; i < last; i++ )
+    {
+        osg::Vec3d a = osg::Vec3d( (*verts)[i] ) - origin;
+        osg::Vec3d b = osg::Vec3d( (*verts)[i+1 < last? i+1 : first] ) - origin;
+        normal += a ^ b;
+    }
+}
+
+
 bool
 ExtrudeGeomFilter::extrudeWallsUp(const GeoShape&         shape, 
                                   const SpatialReference* srs, 
@@ -386,6 +508,10 @@ ExtrudeGeomFilter::extrudeWallsUp(const GeoShape&         shape,
     if ( shape.getShapeType() == GeoShape::TYPE_POLYGON )
         num_verts += 2 * shape.getPartCount();
 
+    // leave room for splitting the wall vertices at creases:
+    if ( shape.getShapeType() != GeoShape::TYPE_POINT )
+        num_verts *= 2;
+
     osg::Vec3Array* verts = new osg::Vec3Array( num_verts );
     walls->setVertexArray( verts );
 
@@ -402,6 +528,7 @@ ExtrudeGeomFilter::extrudeWallsUp(const GeoShape&         shape,
 
     osg::Vec3Array* top_verts = NULL;
     osg::Vec4Array* top_colors = NULL;
+    osg::Vec3Array* top_normals = NULL;
     if ( top_cap )
     {
         top_verts = new osg::Vec3Array( point_count );
@@ -410,15 +537,27 @@ ExtrudeGeomFilter::extrudeWallsUp(const GeoShape&         shape,
         top_colors = new osg::Vec4Array( point_count );
         top_cap->setColorArray( top_colors );
         top_cap->setColorBinding( osg::Geometry::BIND_PER_VERTEX );
+
+        top_normals = new osg::Vec3Array( point_count );
+        top_cap->setNormalArray( top_normals );
+        top_cap->setNormalBinding( osg::Geometry::BIND_PER_VERTEX );
     }
 
     osg::Vec3Array* bottom_verts = NULL;
+    osg::Vec3Array* bottom_normals = NULL;
     if ( bottom_cap )
     {
         bottom_verts = new osg::Vec3Array( point_count );
         bottom_cap->setVertexArray( bottom_verts );
+
+        bottom_normals = new osg::Vec3Array( point_count );
+        bottom_cap->setNormalArray( bottom_normals );
+        bottom_cap->setNormalBinding( osg::Geometry::BIND_PER_VERTEX );
     }
 
+    double cos_crease = cos( osg::DegreesToRadians( getCreaseAngle() ) );
+    osg::Vec3d cap_normal;
+
     int wall_vert_ptr = 0;
     int top_vert_ptr = 0;
     int bottom_vert_ptr = 0;
@@ -597,6 +736,36 @@ ExtrudeGeomFilter::extrudeWallsUp(const GeoShape&         shape,
             (*texcoords)[p].set( part_len/tex_width_m, (*texcoords)[wall_part_ptr+1].y() );
         }
 
+        // the walls are flat, so we know their normals exactly:
+        if ( prim_type == osg::PrimitiveSet::TRIANGLE_STRIP )
+        {
+            wall_vert_ptr = generateWallNormals(
+                verts, texcoords, colors, normals,
+                wall_part_ptr, wall_vert_ptr,
+                shape.getShapeType() == GeoShape::TYPE_POLYGON,
+                cos_crease );
+        }
+        else
+        {
+            // extruded points are just vertical lines:
+            for( int i = wall_part_ptr; i+1 < wall_vert_ptr; i += 2 )
+            {
+                osg::Vec3 up = (*verts)[i] - (*verts)[i+1];
+                up.normalize();
+                (*normals)[i] = up;
+                (*normals)[i+1] = up;
+            }
+        }
+
+        if ( top_cap )
+        {
+            addCapNormal( top_verts, top_part_ptr, top_vert_ptr, cap_normal );
+        }
+        else if ( bottom_cap )
+        {
+            addCapNormal( bottom_verts, bottom_part_ptr, bottom_vert_ptr, cap_normal );
+        }
+
         walls->addPrimitiveSet( new osg::DrawArrays(
             prim_type,
             wall_part_ptr, wall_vert_ptr - wall_part_ptr ) );
@@ -620,6 +789,30 @@ ExtrudeGeomFilter::extrudeWallsUp(const GeoShape&         shape,
         }
     }
 
+    verts->resize( wall_vert_ptr );
+    texcoords->resize( wall_vert_ptr );
+    colors->resize( wall_vert_ptr );
+    normals->resize( wall_vert_ptr );
+
+    // the caps are flat too; point the normal the same way as the extrusion:
+    if ( top_cap || bottom_cap )
+    {
+        osg::Vec3d up = wall_vert_ptr >= 2?
+            osg::Vec3d( (*verts)[0] - (*verts)[1] ) :
+            osg::Vec3d( 0, 0, 1 );
+
+        if ( cap_normal * up < 0.0 )
+            cap_normal = -cap_normal;
+        if ( cap_normal.normalize() == 0.0 )
+            cap_normal = up;
+        cap_normal.normalize();
+
+        if ( top_cap )
+            std::fill( top_normals->begin(), top_normals->end(), osg::Vec3( cap_normal ) );
+        if ( bottom_cap )
+            std::fill( bottom_normals->begin(), bottom_normals->end(), -osg::Vec3( cap_normal ) );
+    }
+
     return made_geom;
 }
 
@@ -724,22 +917,13 @@ ExtrudeGeomFilter::process( Feature* input, FilterEnv* env )
                 walls->getOrCreateStateSet()->setTextureMode(0, GL_TEXTURE_2D, osg::StateAttribute::OFF);
             }
 
-            // generate per-vertex normals
-            generateNormals( walls.get() );
-
             Fragment* new_fragment = new Fragment( walls.get() );
 
             // tessellate and add the roofs if necessary:
             if ( rooflines.valid() )
             {
-                osgUtil::Tessellator tess;
-                tess.setTessellationType( osgUtil::Tessellator::TESS_TYPE_GEOMETRY );
-                tess.setWindingType( osgUtil::Tessellator::TESS_WINDING_POSITIVE );
-                tess.retessellatePolygons( *(rooflines.get()) );
-
-                // generate/smooth the normals.. TODO: replace this maybe
-                generateNormals( rooflines.get() );
-                //smoother.smooth( *(rooflines.get()) );
+                Triangulator triangulator;
+                triangulator.triangulate( rooflines.get() );
 
                 // texture the rooflines if necessary
                 applyOverlayTexturing( rooflines.get(), input, env );
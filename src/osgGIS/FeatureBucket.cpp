@@ -0,0 +1,369 @@
+/**
+/* osgGIS - GIS Library for OpenSceneGraph
+ * Copyright 2007-2008 Glenn Waldron and Pelican Ventures, Inc.
+ * http://osggis.org
+ *
+ * osgGIS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <osgGIS/FeatureBucket>
+#include <osgGIS/SimpleFeature>
+#include <osg/Notify>
+#include <fstream>
+#include <string.h>
+#include <sys/stat.h>
+
+using namespace osgGIS;
+
+// A feature decoded from a bucket, which keeps the OID of its source feature.
+class BucketFeature : public SimpleFeature
+{
+public:
+    BucketFeature( FeatureOID _oid ) : oid( _oid ) { }
+
+    const FeatureOID& getOID() const {
+        return oid;
+    }
+
+private:
+    FeatureOID oid;
+};
+
+
+// Record layout (native byte order; buckets never leave the machine that wrote them):
+//
+//   uint32  length of the rest of the record
+//   uint8   1 if the feature has a valid extent
+//   double  xmin, ymin, xmax, ymax
+//   int64   source OID
+//   uint32  attribute count; each: key, uint8 type, value
+//   uint32  shape count; each: uint8 type, uint32 part count;
+//           each part: uint32 point count, uint8 dim, then x,y[,z] per point
+//
+// Strings are a uint32 length followed by the characters.
+
+template<typename T>
+static void
+put( std::string& output, const T& value )
+{
+    output.append( reinterpret_cast<const char*>( &value ), sizeof(T) );
+}
+
+static void
+putString( std::string& output, const std::string& value )
+{
+    put( output, (unsigned int)value.length() );
+    output.append( value );
+}
+
+template<typename T>
+static T
+get( const char*& ptr )
+{
+    T value;
+    memcpy( &value, ptr, sizeof(T) );
+    ptr += sizeof(T);
+    return value;
+}
+
+static std::string
+getString( const char*& ptr )
+{
+    unsigned int len = get<unsigned int>( ptr );
+    std::string value( ptr, len );
+    ptr += len;
+    return value;
+}
+
+
+void
+FeatureBucket::encode( Feature* feature, std::string& output )
+{
+    std::string::size_type start = output.length();
+    put( output, (unsigned int)0 ); // length, filled in below
+
+    const GeoExtent& f_extent = feature->getExtent();
+    bool has_extent = f_extent.isValid() && !f_extent.isInfinite();
+    put( output, (unsigned char)( has_extent? 1 : 0 ) );
+    put( output, has_extent? f_extent.getXMin() : 0.0 );
+    put( output, has_extent? f_extent.getYMin() : 0.0 );
+    put( output, has_extent? f_extent.getXMax() : 0.0 );
+    put( output, has_extent? f_extent.getYMax() : 0.0 );
+
+    put( output, (long long)feature->getOID() );
+
+    AttributeList attrs = feature->getAttributes();
+    put( output, (unsigned int)attrs.size() );
+    for( AttributeList::const_iterator i = attrs.begin(); i != attrs.end(); i++ )
+    {
+        putString( output, i->getKey() );
+        put( output, (unsigned char)i->getType() );
+        switch( i->getType() )
+        {
+        case Attribute::TYPE_INT:    put( output, i->asInt() ); break;
+        case Attribute::TYPE_DOUBLE: put( output, i->asDouble() ); break;
+        case Attribute::TYPE_BOOL:   put( output, (unsigned char)( i->asBool()? 1 : 0 ) ); break;
+        default:                     putString( output, std::string( i->asString() ) ); break;
+        }
+    }
+
+    const GeoShapeList& shapes = feature->getShapes();
+    put( output, (unsigned int)shapes.size() );
+    for( GeoShapeList::const_iterator i = shapes.begin(); i != shapes.end(); i++ )
+    {
+        put( output, (unsigned char)i->getShapeType() );
+        put( output, (unsigned int)i->getPartCount() );
+        for( GeoPartList::const_iterator j = i->getParts().begin(); j != i->getParts().end(); j++ )
+        {
+            const GeoPointList& part = *j;
+            unsigned char dim = part.size() > 0 && part[0].getDim() > 2? 3 : 2;
+            put( output, (unsigned int)part.size() );
+            put( output, dim );
+            for( GeoPointList::const_iterator k = part.begin(); k != part.end(); k++ )
+            {
+                put( output, k->x() );
+                put( output, k->y() );
+                if ( dim > 2 )
+                    put( output, k->z() );
+            }
+        }
+    }
+
+    unsigned int length = (unsigned int)( output.length() - start - sizeof(unsigned int) );
+    memcpy( &output[start], &length, sizeof(length) );
+}
+
+
+Feature*
+FeatureBucket::decode( const char* record, SpatialReference* srs )
+{
+    // skip the length and the extent header:
+    const char* ptr = record + sizeof(unsigned int) + sizeof(unsigned char) + 4*sizeof(double);
+
+    BucketFeature* feature = new BucketFeature( (FeatureOID)get<long long>( ptr ) );
+
+    unsigned int num_attrs = get<unsigned int>( ptr );
+    for( unsigned int i=0; i<num_attrs; i++ )
+    {
+        std::string key = getString( ptr );
+        Attribute::Type type = (Attribute::Type)get<unsigned char>( ptr );
+        switch( type )
+        {
+        case Attribute::TYPE_INT:    feature->setAttribute( key, get<int>( ptr ) ); break;
+        case Attribute::TYPE_DOUBLE: feature->setAttribute( key, get<double>( ptr ) ); break;
+        case Attribute::TYPE_BOOL:   feature->setAttribute( key, get<unsigned char>( ptr ) != 0 ); break;
+        default:                     feature->setAttribute( key, getString( ptr ) ); break;
+        }
+    }
+
+    unsigned int num_shapes = get<unsigned int>( ptr );
+    GeoShapeList& shapes = feature->getShapes();
+    shapes.reserve( num_shapes );
+    for( unsigned int i=0; i<num_shapes; i++ )
+    {
+        GeoShape::ShapeType type = (GeoShape::ShapeType)get<unsigned char>( ptr );
+        shapes.push_back( GeoShape( type, srs ) );
+        GeoPartList& parts = shapes.back().getParts();
+
+        unsigned int num_parts = get<unsigned int>( ptr );
+        parts.resize( num_parts );
+        for( unsigned int j=0; j<num_parts; j++ )
+        {
+            unsigned int num_points = get<unsigned int>( ptr );
+            unsigned char dim = get<unsigned char>( ptr );
+            GeoPointList& part = parts[j];
+            part.reserve( num_points );
+            for( unsigned int k=0; k<num_points; k++ )
+            {
+                double x = get<double>( ptr );
+                double y = get<double>( ptr );
+                if ( dim > 2 )
+                    part.push_back( GeoPoint( x, y, get<double>( ptr ), srs ) );
+                else
+                    part.push_back( GeoPoint( x, y, srs ) );
+            }
+        }
+    }
+
+    return feature;
+}
+
+
+FeatureBucket::FeatureBucket( const std::string& _abs_path, SpatialReference* _srs )
+: abs_path( _abs_path ),
+  srs( _srs ),
+  extent( GeoExtent::invalid() ),
+  mtime( 0 ),
+  ready( false )
+{
+    load();
+}
+
+
+FeatureBucket::~FeatureBucket()
+{
+    //NOP
+}
+
+
+void
+FeatureBucket::load()
+{
+    struct stat buf;
+    if ( ::stat( abs_path.c_str(), &buf ) != 0 )
+    {
+        // no bucket file means that no features were assigned to it.
+        ready = true;
+        return;
+    }
+    mtime = buf.st_mtime;
+
+    std::ifstream input( abs_path.c_str(), std::ios::in | std::ios::binary );
+    if ( !input.is_open() )
+    {
+        osgGIS::warn() << "[FeatureBucket] Unable to open " << abs_path << std::endl;
+        return;
+    }
+
+    data.resize( (std::string::size_type)buf.st_size );
+    if ( data.length() > 0 && !input.read( &data[0], data.length() ) )
+    {
+        osgGIS::warn() << "[FeatureBucket] Unable to read " << abs_path << std::endl;
+        data.clear();
+        return;
+    }
+
+    // index the records and accumulate the extent from their headers:
+    unsigned int offset = 0;
+    while( offset + sizeof(unsigned int) <= data.length() )
+    {
+        const char* ptr = data.c_str() + offset;
+        unsigned int length = get<unsigned int>( ptr );
+        if ( offset + sizeof(unsigned int) + length > data.length() )
+        {
+            osgGIS::warn() << "[FeatureBucket] Truncated record in " << abs_path << std::endl;
+            break;
+        }
+
+        if ( get<unsigned char>( ptr ) )
+        {
+            double xmin = get<double>( ptr );
+            double ymin = get<double>( ptr );
+            double xmax = get<double>( ptr );
+            double ymax = get<double>( ptr );
+            GeoExtent f_extent( xmin, ymin, xmax, ymax, srs.get() );
+            if ( extent.isValid() )
+                extent.expandToInclude( f_extent );
+            else
+                extent = f_extent;
+        }
+
+        offsets.push_back( offset );
+        offset += sizeof(unsigned int) + length;
+    }
+
+    ready = true;
+}
+
+
+bool
+FeatureBucket::isReady() const
+{
+    return ready;
+}
+
+const std::string&
+FeatureBucket::getName() const
+{
+    return abs_path;
+}
+
+SpatialReference*
+FeatureBucket::getSRS() const
+{
+    return srs.get();
+}
+
+int
+FeatureBucket::getFeatureCount() const
+{
+    return (int)offsets.size();
+}
+
+const GeoExtent&
+FeatureBucket::getExtent() const
+{
+    return extent;
+}
+
+Feature*
+FeatureBucket::getFeature( const FeatureOID& oid )
+{
+    if ( oid < 0 || oid >= (FeatureOID)offsets.size() )
+        return NULL;
+
+    return decode( data.c_str() + offsets[oid], srs.get() );
+}
+
+FeatureCursor
+FeatureBucket::getCursor()
+{
+    FeatureOIDList oids( offsets.size() );
+    for( unsigned int i=0; i<offsets.size(); i++ )
+        oids[i] = (FeatureOID)i;
+
+    return FeatureCursor( oids, this, GeoExtent::infinite(), false );
+}
+
+bool
+FeatureBucket::getOIDs( const AttributeQuery* query, FeatureOIDList& output )
+{
+    return false;
+}
+
+bool
+FeatureBucket::insertFeature( Feature* feature )
+{
+    return false; // read-only
+}
+
+bool
+FeatureBucket::insertFeatures( const FeatureList& features )
+{
+    return false; // read-only
+}
+
+Feature*
+FeatureBucket::createFeature() const
+{
+    return new SimpleFeature();
+}
+
+bool
+FeatureBucket::supportsRandomRead() const
+{
+    return true;
+}
+
+const AttributeSchemaTable&
+FeatureBucket::getAttributeSchemas()
+{
+    return schema;
+}
+
+const time_t
+FeatureBucket::getModTime() const
+{
+    return mtime;
+}
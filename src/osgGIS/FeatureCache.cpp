@@ -0,0 +1,290 @@
+/**
+/* osgGIS - GIS Library for OpenSceneGraph
+ * Copyright 2007-2008 Glenn Waldron and Pelican Ventures, Inc.
+ * http://osggis.org
+ *
+ * osgGIS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <osgGIS/FeatureCache>
+#include <osgGIS/FeatureStore>
+#include <osgGIS/Utils>
+#include <OpenThreads/ScopedLock>
+#include <string.h>
+
+using namespace osgGIS;
+using namespace OpenThreads;
+
+
+// A caller's view of a cached feature. It reads through to the shared feature
+// until the caller asks to modify the shapes, at which point it takes its own
+// copy. Attributes set by the caller are kept in the view.
+class CachedFeature : public FeatureBase
+{
+public:
+    CachedFeature( Feature* _shared )
+        : shared( _shared ), copied( false ), extent( GeoExtent::invalid() ) { }
+
+    const FeatureOID& getOID() const {
+        return shared->getOID();
+    }
+
+    const GeoShapeList& getShapes() const {
+        return copied? shapes : static_cast<const Feature*>( shared.get() )->getShapes();
+    }
+
+    GeoShapeList& getShapes() {
+        if ( !copied )
+        {
+            shapes = static_cast<const Feature*>( shared.get() )->getShapes();
+            copied = true;
+        }
+        extent = GeoExtent::invalid();
+        return shapes;
+    }
+
+    const GeoExtent& getExtent() const {
+        if ( !extent.isValid() )
+        {
+            CachedFeature* non_const_this = const_cast<CachedFeature*>( this );
+            const GeoShapeList& my_shapes = getShapes();
+            for( GeoShapeList::const_iterator i = my_shapes.begin(); i != my_shapes.end(); i++ )
+            {
+                if ( i == my_shapes.begin() )
+                    non_const_this->extent = i->getExtent();
+                else
+                    non_const_this->extent.expandToInclude( i->getExtent() );
+            }
+        }
+        return extent;
+    }
+
+    Attribute getAttribute( const std::string& key ) const {
+        Attribute attr = AttributedBase::getAttribute( key );
+        return attr.isValid()? attr : shared->getAttribute( key );
+    }
+
+    AttributeList getAttributes() const {
+        // start with the shared attrs, and let the user attrs override them:
+        AttributeTable attrs;
+        AttributeList shared_attrs = shared->getAttributes();
+        for( AttributeList::const_iterator i = shared_attrs.begin(); i != shared_attrs.end(); i++ )
+            attrs[ i->getKey() ] = *i;
+        for( AttributeTable::const_iterator i = getUserAttrs().begin(); i != getUserAttrs().end(); i++ )
+            attrs[ i->first ] = i->second;
+
+        AttributeList result;
+        for( AttributeTable::const_iterator i = attrs.begin(); i != attrs.end(); i++ )
+            result.push_back( i->second );
+        return result;
+    }
+
+    AttributeSchemaList getAttributeSchemas() const {
+        return shared->getAttributeSchemas();
+    }
+
+private:
+    osg::ref_ptr<Feature> shared;
+    bool                  copied;
+    GeoShapeList          shapes;
+    GeoExtent             extent;
+};
+
+
+// Estimates the memory taken up by a decoded feature.
+static unsigned int
+estimateSize( Feature* feature )
+{
+    unsigned int size = 256; // the feature object itself and the cache overhead
+
+    const GeoShapeList& shapes = static_cast<const Feature*>( feature )->getShapes();
+    for( GeoShapeList::const_iterator i = shapes.begin(); i != shapes.end(); i++ )
+    {
+        size += sizeof(GeoShape);
+        for( GeoPartList::const_iterator j = i->getParts().begin(); j != i->getParts().end(); j++ )
+        {
+            size += sizeof(GeoPointList) + j->size() * sizeof(GeoPoint);
+        }
+    }
+
+    AttributeList attrs = feature->getAttributes();
+    for( AttributeList::const_iterator i = attrs.begin(); i != attrs.end(); i++ )
+    {
+        size += sizeof(Attribute) + i->getKey().length();
+        if ( i->getType() == Attribute::TYPE_STRING )
+            size += strlen( i->asString() );
+    }
+
+    return size;
+}
+
+
+FeatureCache::FeatureCache( unsigned long long _max_size )
+: max_size( _max_size ),
+  size( 0 ),
+  hits( 0 ),
+  misses( 0 )
+{
+    //NOP
+}
+
+FeatureCache::~FeatureCache()
+{
+    //NOP
+}
+
+void
+FeatureCache::setMaxSize( unsigned long long value )
+{
+    FeatureList evicted;
+    {
+        ScopedLock<Mutex> lock( mutex );
+        max_size = value;
+        evict( evicted );
+    }
+}
+
+unsigned long long
+FeatureCache::getMaxSize() const
+{
+    return max_size;
+}
+
+unsigned long long
+FeatureCache::getSize() const
+{
+    return size;
+}
+
+unsigned int
+FeatureCache::getHits() const
+{
+    return hits;
+}
+
+unsigned int
+FeatureCache::getMisses() const
+{
+    return misses;
+}
+
+double
+FeatureCache::getHitRate() const
+{
+    unsigned int total = hits + misses;
+    return total > 0? 100.0 * (double)hits / (double)total : 0.0;
+}
+
+void
+FeatureCache::clear()
+{
+    // release the features after unlocking, since deleting a feature can take
+    // the store's own lock:
+    EntryList released;
+    {
+        ScopedLock<Mutex> lock( mutex );
+        released.swap( lru );
+        entries.clear();
+        size = 0;
+    }
+}
+
+// Removes least-recently-used entries until the cache fits in its budget. The
+// caller must hold the mutex, and release the evicted features after unlocking.
+void
+FeatureCache::evict( FeatureList& evicted )
+{
+    while( size > max_size && !lru.empty() )
+    {
+        Entry& last = lru.back();
+        evicted.push_back( last.feature.get() );
+        size -= last.size;
+        entries.erase( last.key );
+        lru.pop_back();
+    }
+}
+
+Feature*
+FeatureCache::getFeature( FeatureStore* store, const FeatureOID& oid )
+{
+    if ( !store )
+        return NULL;
+
+    Key key;
+    {
+        ScopedLock<Mutex> lock( mutex );
+
+        std::map<std::string, unsigned int>::iterator s = store_ids.find( store->getName() );
+        if ( s == store_ids.end() )
+            s = store_ids.insert( std::make_pair( store->getName(), (unsigned int)store_ids.size() ) ).first;
+        key = Key( s->second, oid );
+
+        EntryTable::iterator i = entries.find( key );
+        if ( i != entries.end() )
+        {
+            // move the entry to the front of the LRU list:
+            lru.splice( lru.begin(), lru, i->second );
+            hits++;
+            return new CachedFeature( i->second->feature.get() );
+        }
+
+        misses++;
+    }
+
+    // decode the feature without holding the lock, so that other threads can
+    // use the cache in the meantime:
+    osg::ref_ptr<Feature> feature = store->getFeature( oid );
+    if ( !feature.valid() )
+        return NULL;
+
+    // settle the extents now, since they are cached lazily and the shared feature
+    // must not be modified once other threads can see it:
+    const GeoShapeList& shapes = static_cast<const Feature*>( feature.get() )->getShapes();
+    for( GeoShapeList::const_iterator i = shapes.begin(); i != shapes.end(); i++ )
+        i->getExtent();
+    feature->getExtent();
+
+    unsigned int feature_size = estimateSize( feature.get() );
+    if ( feature_size > max_size )
+    {
+        // too big to cache; hand it over as is.
+        return feature.release();
+    }
+
+    FeatureList evicted;
+    {
+        ScopedLock<Mutex> lock( mutex );
+
+        EntryTable::iterator i = entries.find( key );
+        if ( i != entries.end() )
+        {
+            // another thread cached the feature while we were decoding it.
+            lru.splice( lru.begin(), lru, i->second );
+            feature = i->second->feature.get();
+        }
+        else
+        {
+            Entry entry;
+            entry.key = key;
+            entry.feature = feature.get();
+            entry.size = feature_size;
+            lru.push_front( entry );
+            entries[key] = lru.begin();
+            size += feature_size;
+            evict( evicted );
+        }
+    }
+
+    return new CachedFeature( feature.get() );
+}
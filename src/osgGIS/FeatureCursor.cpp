@@ -29,12 +29,15 @@ using namespace osgGIS;
 FeatureCursor::FeatureCursor(const FeatureOIDList& _oids,
                              FeatureStore*         _store,
                              const GeoExtent&      _search_extent,
-                             bool                  _match_exactly)
+                             bool                  _match_exactly,
+                             FeatureCache*         _cache )
 {
     oids  = _oids;
     store = _store;
+    cache = _cache;
     search_extent = _search_extent;
     match_exactly = _match_exactly;
+    tolerance = 0.0;
     prefetch_size = DEFAULT_PREFETCH_SIZE;
     at_bof = false;
     reset();
@@ -43,12 +46,16 @@ FeatureCursor::FeatureCursor(const FeatureOIDList& _oids,
 FeatureCursor::FeatureCursor()
 {
     iter = 0;
+    tolerance = 0.0;
     at_bof = false;
 }
 
 FeatureCursor::FeatureCursor( const FeatureCursor& rhs )
 : oids( rhs.oids ),
   store( rhs.store.get() ),
+  cache( rhs.cache.get() ),
+  simplifier( rhs.simplifier.get() ),
+  tolerance( rhs.tolerance ),
   iter( rhs.iter ),
   search_extent( rhs.search_extent ),
   match_exactly( rhs.match_exactly ),
@@ -71,6 +78,41 @@ FeatureCursor::setPrefetchSize( int value )
     prefetch_size = std::max( value, 1 );
 }
 
+FeatureCursor
+FeatureCursor::getPartition( unsigned int index, unsigned int count ) const
+{
+    if ( count == 0 || index >= count )
+        return FeatureCursor();
+
+    unsigned int first = (unsigned int)( ( (double)oids.size() * index ) / count );
+    unsigned int last  = (unsigned int)( ( (double)oids.size() * (index+1) ) / count );
+
+    FeatureOIDList part( oids.begin() + first, oids.begin() + last );
+    FeatureCursor result( part, store.get(), search_extent, match_exactly, cache.get() );
+    result.setSimplification( simplifier.get(), tolerance );
+    return result;
+}
+
+void
+FeatureCursor::setSimplification( SimplificationIndex* index, double value )
+{
+    simplifier = index;
+    tolerance = value;
+
+    // the cursor has already fetched its first features, so simplify those now:
+    FeatureList queued;
+    for( ; !prefetched_results.empty(); prefetched_results.pop() )
+        queued.push_back( prefetched_results.front() );
+    queueResults( queued );
+    prefetch();
+}
+
+double
+FeatureCursor::getSimplificationTolerance() const
+{
+    return tolerance;
+}
+
 void
 FeatureCursor::reset()
 {
@@ -114,28 +156,48 @@ FeatureCursor::next()
 void
 FeatureCursor::prefetch()
 {
-    if ( store.valid() && prefetched_results.size() <= 1 )
+    // simplification can drop features, so keep fetching until some remain:
+    while( store.valid() && prefetched_results.size() <= 1 && iter < oids.size() )
     {
-        //TODO: make this implementation-independent:
-        OGR_SCOPE_LOCK();
-
-        while( prefetched_results.size() < prefetch_size && iter < oids.size() )
+        FeatureList fetched;
         {
-            Feature* f = store->getFeature( oids[iter++] );
-            if ( f )
-            {
-                bool match = true;
-                if ( match_exactly )
-                {
-                    match = f->getShapes().intersects( search_extent );
-                }
+            //TODO: make this implementation-independent:
+            OGR_SCOPE_LOCK();
 
-                if ( match )
+            while( prefetched_results.size() + fetched.size() < prefetch_size && iter < oids.size() )
+            {
+                Feature* f = cache.valid()?
+                    cache->getFeature( store.get(), oids[iter++] ) :
+                    store->getFeature( oids[iter++] );
+                if ( f )
                 {
-                    prefetched_results.push( f );
+                    bool match = true;
+                    if ( match_exactly )
+                    {
+                        match = f->getShapes().intersects( search_extent );
+                    }
+
+                    if ( match )
+                    {
+                        fetched.push_back( f );
+                    }
                 }
             }
         }
+
+        queueResults( fetched );
     }
 }
 
+void
+FeatureCursor::queueResults( FeatureList& features )
+{
+    for( FeatureList::iterator i = features.begin(); i != features.end(); i++ )
+    {
+        // skip features that simplify away entirely, as a decimate filter would:
+        if ( simplifier.valid() && simplifier->simplify( i->get(), tolerance ) && i->get()->getShapes().size() == 0 )
+            continue;
+
+        prefetched_results.push( i->get() );
+    }
+}
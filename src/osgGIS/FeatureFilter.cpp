@@ -40,6 +40,13 @@ FeatureFilter::newState() const
 }
 
 
+void
+FeatureFilter::checkpoint( FilterEnv* env )
+{
+    //NOP
+}
+
+
 FeatureList
 FeatureFilter::process( FeatureList& input, FilterEnv* env )
 {
@@ -55,7 +55,9 @@ FeatureFilterState::traverse( FilterEnv* in_env )
     // clone a new environment:
     current_env = in_env->advance();
 
+    beginProcess( current_env.get() );
     FeatureList output = filter->process( in_features, current_env.get() );
+    endProcess( current_env.get(), "features", in_features.size(), "features", output.size() );
     
     FilterState* next = getNextState();
     if ( next )
@@ -97,3 +99,9 @@ FeatureFilterState::traverse( FilterEnv* in_env )
     return result;
 }
 
+FilterStateResult
+FeatureFilterState::signalCheckpoint()
+{
+    filter->checkpoint( current_env.get() );
+    return FilterState::signalCheckpoint();
+}
@@ -21,9 +21,12 @@
 #include <osgGIS/SimpleSpatialIndex>
 #include <osgGIS/RTreeSpatialIndex>
 #include <osgGIS/Registry>
+#include <osgGIS/Utils>
 #include <osg/Notify>
 #include <OpenThreads/ScopedLock>
 #include <OpenThreads/ReentrantMutex>
+#include <algorithm>
+#include <iterator>
 
 using namespace osgGIS;
 using namespace OpenThreads;
@@ -79,7 +82,24 @@ FeatureLayer::getExtent() const
 Feature*
 FeatureLayer::getFeature( const FeatureOID& oid )
 {
-    return store.valid()? store->getFeature( oid ) : NULL;
+    return 
+        !store.valid()? NULL :
+        cache.valid()? cache->getFeature( store.get(), oid ) :
+        store->getFeature( oid );
+}
+
+
+void
+FeatureLayer::setFeatureCache( FeatureCache* _cache )
+{
+    cache = _cache;
+}
+
+
+FeatureCache*
+FeatureLayer::getFeatureCache() const
+{
+    return cache.get();
 }
 
 
@@ -144,7 +164,13 @@ FeatureLayer::getCursor( const GeoExtent& extent )
     else
     {
         assertSpatialIndex();
-        if ( index.valid() )
+        if ( index.valid() && cache.valid() )
+        {
+            FeatureOIDList oids;
+            index->getOIDs( extent, oids );
+            return FeatureCursor( oids, store.get(), extent, false, cache.get() );
+        }
+        else if ( index.valid() )
         {
             return index->getCursor( extent );
         }
@@ -170,3 +196,183 @@ FeatureLayer::getCursor( const GeoPoint& point )
     }
 }
 
+
+AttributeIndex*
+FeatureLayer::getAttributeIndex( const std::string& attr_name )
+{
+    if ( !store.valid() )
+        return NULL;
+
+    std::string key = StringUtils::toLower( attr_name );
+
+    // the layer's own lock, so that building the index (a full scan of the
+    // store) does not hold up work on other layers:
+    ScopedLock<Mutex> lock( index_mutex );
+    osg::ref_ptr<AttributeIndex>& attr_index = attribute_indexes[key];
+    if ( !attr_index.valid() )
+    {
+        osgGIS::notice() << "Initializing attribute index \"" << key << "\"..." << std::flush;
+        attr_index = new AttributeIndex( store.get(), key );
+        osgGIS::notice() << "OK." << std::endl;
+    }
+    return attr_index.get();
+}
+
+
+SimplificationIndex*
+FeatureLayer::getSimplificationIndex()
+{
+    if ( !store.valid() )
+        return NULL;
+
+    ScopedLock<Mutex> lock( index_mutex );
+    if ( !simplification_index.valid() )
+    {
+        osgGIS::notice() << "Initializing simplification index..." << std::flush;
+        simplification_index = new SimplificationIndex( store.get() );
+        osgGIS::notice() << "OK." << std::endl;
+    }
+    return simplification_index.get();
+}
+
+
+// Finds the (sorted) OIDs of the features that might satisfy a query. Returns
+// false if neither the attribute indexes nor the store could evaluate it.
+bool
+FeatureLayer::computeQueryOIDs( const AttributeQuery* query, FeatureOIDList& output )
+{
+    bool found = false;
+    osg::ref_ptr<AttributeQuery> store_query = new AttributeQuery();
+
+    for( AttributeQuery::TermList::const_iterator i = query->getTerms().begin(); i != query->getTerms().end(); i++ )
+    {
+        FeatureOIDList term_oids;
+        if ( !AttributeIndex::canEvaluate( *i ) || !getAttributeIndex( i->getName() )->getOIDs( *i, term_oids ) )
+        {
+            store_query->addTerm( *i );
+        }
+        else if ( !found )
+        {
+            output.swap( term_oids );
+            found = true;
+        }
+        else
+        {
+            FeatureOIDList temp;
+            std::set_intersection(
+                output.begin(), output.end(),
+                term_oids.begin(), term_oids.end(),
+                std::back_inserter( temp ) );
+            output.swap( temp );
+        }
+    }
+
+    if ( !store_query->isEmpty() )
+    {
+        FeatureOIDList store_oids;
+        if ( store->getOIDs( store_query.get(), store_oids ) )
+        {
+            std::sort( store_oids.begin(), store_oids.end() );
+            if ( !found )
+            {
+                output.swap( store_oids );
+                found = true;
+            }
+            else
+            {
+                FeatureOIDList temp;
+                std::set_intersection(
+                    output.begin(), output.end(),
+                    store_oids.begin(), store_oids.end(),
+                    std::back_inserter( temp ) );
+                output.swap( temp );
+            }
+        }
+    }
+
+    return found;
+}
+
+
+FeatureCursor
+FeatureLayer::getCursor( const GeoExtent& extent, const AttributeQuery* query )
+{
+    if ( !query || query->isEmpty() || !store.valid() )
+    {
+        return getCursor( extent );
+    }
+
+    // find the features that pass the query, evaluating it only once per
+    // distinct query. Holding the lock during the evaluation prevents other
+    // cells from redundantly running the same query at the same time; the
+    // cursor itself is built after releasing it.
+    std::string key = query->toString();
+    FeatureOIDList selected;
+    bool supported;
+    {
+        ScopedLock<Mutex> lock( query_mutex );
+
+        if ( query_supported.find( key ) == query_supported.end() )
+        {
+            bool ok = computeQueryOIDs( query, query_results[key] );
+            if ( !ok )
+                query_results.erase( key );
+            query_supported[key] = ok;
+        }
+
+        supported = query_supported[key];
+        if ( supported )
+            selected = query_results[key];
+    }
+
+    if ( !supported )
+    {
+        return getCursor( extent );
+    }
+
+    return createCursor( extent, selected );
+}
+
+
+FeatureCursor
+FeatureLayer::getCursor( const GeoExtent& extent, const std::string& attr_name, const std::string& value )
+{
+    AttributeIndex* attr_index = getAttributeIndex( attr_name );
+    if ( !attr_index )
+    {
+        return FeatureCursor(); // empty
+    }
+
+    return createCursor( extent, attr_index->getOIDs( value ) );
+}
+
+
+// Gets a cursor over the subset of a sorted OID list that falls within an extent.
+FeatureCursor
+FeatureLayer::createCursor( const GeoExtent& extent, const FeatureOIDList& selected )
+{
+    if ( extent.isInfinite() )
+    {
+        return FeatureCursor( selected, store.get(), extent, false, cache.get() );
+    }
+
+    assertSpatialIndex();
+    if ( index.valid() )
+    {
+        FeatureOIDList candidates;
+        index->getOIDs( extent, candidates );
+        std::sort( candidates.begin(), candidates.end() );
+
+        FeatureOIDList result;
+        std::set_intersection(
+            candidates.begin(), candidates.end(),
+            selected.begin(), selected.end(),
+            std::back_inserter( result ) );
+
+        return FeatureCursor( result, store.get(), extent, false, cache.get() );
+    }
+
+    osgGIS::notify( osg::WARN )
+        << "osgGIS::FeatureLayer::createCursor, no spatial index available" << std::endl;
+    return FeatureCursor();
+}
@@ -18,6 +18,7 @@
 */
 
 #include <osgGIS/FeatureLayerCompiler>
+#include <osgGIS/Registry>
 #include <osg/Notify>
 
 using namespace osgGIS;
@@ -61,6 +62,24 @@ FeatureLayerCompiler::getFeatureLayer() const {
     return layer.get();
 }
 
+FilterGraph*
+FeatureLayerCompiler::getFilterGraph() const {
+    return filter_graph.get();
+}
+
+FeatureCursor
+FeatureLayerCompiler::createSourceCursor( const AttributeQuery* query )
+{
+    FeatureCursor cursor = layer->getCursor( env->getExtent(), query );
+
+    // let the layer's simplification index thin the features as they are read:
+    double tolerance = filter_graph.valid()? filter_graph->getSourceTolerance() : 0.0;
+    if ( tolerance > 0.0 )
+        cursor.setSimplification( layer->getSimplificationIndex(), tolerance );
+
+    return cursor;
+}
+
 void
 FeatureLayerCompiler::run()
 {
@@ -83,8 +102,10 @@ FeatureLayerCompiler::run()
         // ensure the input SRS matches that of the layer:
         env->setInputSRS( layer->getSRS() );
 
-        // retrieve the features in the given extent:
-        FeatureCursor cursor = layer->getCursor( env->getExtent() );
+        // retrieve the features in the given extent (pre-filtered by the
+        // graph's leading selection criteria, if any):
+        osg::ref_ptr<AttributeQuery> query = filter_graph->createSourceQuery();
+        FeatureCursor cursor = createSourceCursor( query.get() );
 
         // and compile the filter graph:
         osg::Group* temp = NULL;
@@ -92,5 +113,9 @@ FeatureLayerCompiler::run()
         result_node = temp;
 
         env->getReport()->markEndTime();
+
+        Registry::instance()->getTraceLog()->addEvent(
+            getName(), "cell",
+            env->getReport()->getStartTime(), env->getReport()->getEndTime() );
     }
 }
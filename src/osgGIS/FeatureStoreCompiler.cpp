@@ -23,7 +23,10 @@
 #include <osgGIS/FragmentFilter>
 #include <osgGIS/NodeFilter>
 #include <osgGIS/Registry>
+#include <osgGIS/TaskManager>
 #include <osg/Notify>
+#include <sstream>
+#include <map>
 
 using namespace osgGIS;
 
@@ -32,6 +35,8 @@ FeatureStoreCompiler::FeatureStoreCompiler( FeatureLayer* _layer, FilterGraph* _
 {
     layer = _layer;
     graph = _graph;
+    num_threads = 1;
+    memory_budget = 0;
 }
 
 
@@ -40,6 +45,34 @@ FeatureStoreCompiler::~FeatureStoreCompiler()
 }
 
 
+void
+FeatureStoreCompiler::setNumThreads( int value )
+{
+    num_threads = std::max( value, 1 );
+}
+
+
+int
+FeatureStoreCompiler::getNumThreads() const
+{
+    return num_threads;
+}
+
+
+void
+FeatureStoreCompiler::setMemoryBudget( unsigned long long bytes )
+{
+    memory_budget = bytes;
+}
+
+
+unsigned long long
+FeatureStoreCompiler::getMemoryBudget() const
+{
+    return memory_budget;
+}
+
+
 FeatureLayer*
 FeatureStoreCompiler::getFeatureLayer() 
 {
@@ -82,10 +115,172 @@ FeatureStoreCompiler::compile( const std::string& output_uri, FilterEnv* env_tem
     env->setOutputSRS( layer->getSRS() );
 
     // Get the input feature set:
-    FeatureCursor cursor = layer->getCursor( env->getExtent() );
+    osg::ref_ptr<AttributeQuery> query = graph->createSourceQuery();
+    FeatureCursor cursor = layer->getCursor( env->getExtent(), query.get() );
+
+    if ( num_threads > 1 )
+    {
+        return compileInParallel( cursor, output_uri, env.get() );
+    }
 
     // Run the filter graph.
     FilterGraphResult r = graph->computeFeatureStore( cursor, env.get(), output_uri );
     return r.isOK();
 }
 
+
+// Runs the filter graph on one partition of the input features, collecting the
+// results in memory.
+class CompilePartitionTask : public Task
+{
+public:
+    CompilePartitionTask(unsigned int     _index,
+                         unsigned int     _count,
+                         FeatureCursor&   _cursor,
+                         FilterGraph*     _graph,
+                         FilterEnv*       _env )
+        : index( _index ),
+          count( _count ),
+          cursor( _cursor ),
+          graph( _graph ),
+          is_ok( false ),
+          output_bytes( 0 )
+    {
+        std::stringstream buf;
+        buf << "Partition " << index+1 << "/" << count;
+        setName( buf.str() );
+
+        // each partition gets its own environment (and therefore its own script
+        // engine and report), since they will run in separate threads.
+        env = _env->getSession()->createFilterEnv();
+        env->setExtent( _env->getExtent() );
+        env->setInputSRS( _env->getInputSRS() );
+        env->setOutputSRS( _env->getOutputSRS() );
+        for( Properties::iterator i = _env->getProperties().begin(); i != _env->getProperties().end(); i++ )
+            env->setProperty( *i );
+    }
+
+    void run()
+    {
+        FeatureCursor part = cursor.getPartition( index, count );
+        FilterGraphResult r = graph->computeFeatures( part, env.get(), output );
+        is_ok = r.isOK();
+        if ( is_ok && r.getSRS() )
+            output_srs = const_cast<SpatialReference*>( r.getSRS() );
+
+        // approximate size of the results, for the compiler's memory budget:
+        for( FeatureList::const_iterator i = output.begin(); i != output.end(); i++ )
+        {
+            const GeoShapeList& shapes = static_cast<const Feature*>( i->get() )->getShapes();
+            output_bytes += 256;
+            for( GeoShapeList::const_iterator j = shapes.begin(); j != shapes.end(); j++ )
+                output_bytes += j->getTotalPointCount() * sizeof(GeoPoint);
+        }
+    }
+
+    unsigned int getIndex() const { return index; }
+    bool isOK() const { return is_ok; }
+    FeatureList& getOutput() { return output; }
+    const SpatialReference* getOutputSRS() const { return output_srs.get(); }
+    unsigned long long getOutputBytes() const { return output_bytes; }
+
+private:
+    unsigned int                   index, count;
+    FeatureCursor&                 cursor;
+    osg::ref_ptr<FilterGraph>      graph;
+    osg::ref_ptr<FilterEnv>        env;
+    bool                           is_ok;
+    FeatureList                    output;
+    osg::ref_ptr<SpatialReference> output_srs;
+    unsigned long long             output_bytes;
+};
+
+
+bool
+FeatureStoreCompiler::compileInParallel( FeatureCursor& cursor, const std::string& output_uri, FilterEnv* env )
+{
+    // use many more partitions than threads so that the results merge in small
+    // steps and an expensive partition does not leave the other threads idle.
+    unsigned int num_parts = num_threads * 16;
+
+    // the partition outputs merge in order, so that the output store is identical
+    // to that of a single-threaded compile. Results that finish ahead of their
+    // turn wait in memory, so only start partitions within a window ahead of the
+    // next one to merge (and within the memory budget, if any):
+    unsigned int window = num_threads * 2;
+    unsigned int num_queued = 0;
+    unsigned long long buffered_bytes = 0;
+
+    osg::ref_ptr<TaskManager> manager = new TaskManager( num_threads );
+
+    typedef std::map<unsigned int, osg::ref_ptr<CompilePartitionTask> > PartitionMap;
+    PartitionMap completed;
+    unsigned int next_part = 0;
+    osg::ref_ptr<FeatureStore> output;
+    bool ok = true;
+
+    for( ;; )
+    {
+        // the next partition to merge is always queued, since nothing is buffered
+        // once all the queued ones have merged:
+        while( ok && num_queued < num_parts && num_queued < next_part + window &&
+               ( memory_budget == 0 || buffered_bytes < memory_budget ) )
+        {
+            manager->queueTask( new CompilePartitionTask( num_queued++, num_parts, cursor, graph.get(), env ) );
+        }
+
+        if ( !manager->wait() )
+            break;
+
+        osg::ref_ptr<Task> completed_task = manager->getNextCompletedTask();
+        if ( !completed_task.valid() )
+            continue;
+
+        CompilePartitionTask* task = static_cast<CompilePartitionTask*>( completed_task.get() );
+        if ( task->isInExceptionState() || !task->isOK() )
+        {
+            osgGIS::warn() << "FeatureStoreCompiler: " << task->getName() << " failed" << std::endl;
+            manager->cancelPendingTasks();
+            ok = false;
+            continue;
+        }
+        completed[ task->getIndex() ] = task;
+        buffered_bytes += task->getOutputBytes();
+
+        for( PartitionMap::iterator i = completed.find( next_part ); ok && i != completed.end(); i = completed.find( ++next_part ) )
+        {
+            FeatureList& features = i->second->getOutput();
+            if ( !features.empty() )
+            {
+                Feature* f = features.front().get();
+                if ( !output.valid() )
+                {
+                    const SpatialReference* srs = i->second->getOutputSRS()?
+                        i->second->getOutputSRS() : env->getInputSRS();
+
+                    output = Registry::instance()->getFeatureStoreFactory()->createFeatureStore(
+                        output_uri,
+                        f->getShapeType(),
+                        f->getAttributeSchemas(),
+                        f->getShapeDim(),
+                        srs,
+                        Properties() );
+
+                    if ( !output.valid() )
+                    {
+                        osgGIS::warn() << "FeatureStoreCompiler: cannot create feature store \"" << output_uri << "\"" << std::endl;
+                        manager->cancelPendingTasks();
+                        ok = false;
+                        break;
+                    }
+                }
+                output->insertFeatures( features );
+            }
+            buffered_bytes -= i->second->getOutputBytes();
+            completed.erase( i );
+        }
+    }
+
+    return ok;
+}
+
@@ -26,7 +26,7 @@ FilterEnv::FilterEnv( Session* _session )
     session = _session;
     feature_extent = GeoExtent::infinite();  
     cell_extent = GeoExtent::infinite();
-    resource_cache = new ResourceCache();
+    resource_cache = new ResourceCache( session.valid()? session->getSharedResourceCache() : NULL );
     report = new Report();
 }
 
@@ -189,6 +189,12 @@ FilterEnv::getScriptEngine()
     return script_engine.get();
 }
 
+double
+FilterEnv::getScriptRunTime() const
+{
+    return script_engine.valid()? script_engine->getRunTime() : 0.0;
+}
+
 Session*
 FilterEnv::getSession()
 {
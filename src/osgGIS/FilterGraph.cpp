@@ -23,6 +23,10 @@
 #include <osgGIS/NodeFilterState>
 #include <osgGIS/CollectionFilterState>
 #include <osgGIS/WriteFeaturesFilter>
+#include <osgGIS/SelectFilter>
+#include <osgGIS/DecimateFilter>
+#include <osgGIS/BuildGeomFilter>
+#include <osgGIS/BuildNodesFilter>
 #include <osgGIS/Registry>
 #include <osgGIS/Utils>
 #include <osg/Notify>
@@ -161,27 +165,119 @@ FilterGraph::getFilter( const std::string& name )
     return NULL;
 }
 
-FilterGraphResult
-FilterGraph::computeFeatureStore(FeatureCursor&     cursor,
-                                 FilterEnv*         env,
-                                 const std::string& output_uri )
+AttributeQuery*
+FilterGraph::createSourceQuery() const
+{
+    AttributeQuery* result = NULL;
+
+    // only the leading run of select filters can be pushed down to the source,
+    // since any other filter might alter the features' attributes
+    for( FilterList::const_iterator i = filter_prototypes.begin(); i != filter_prototypes.end(); i++ )
+    {
+        SelectFilter* select = dynamic_cast<SelectFilter*>( i->get() );
+        if ( !select )
+            break;
+
+        if ( select->getAttributeQuery() )
+        {
+            if ( !result )
+                result = new AttributeQuery();
+            result->addTerms( *select->getAttributeQuery() );
+        }
+    }
+
+    return result;
+}
+
+double
+FilterGraph::getSourceTolerance() const
+{
+    for( FilterList::const_iterator i = filter_prototypes.begin(); i != filter_prototypes.end(); i++ )
+    {
+        if ( dynamic_cast<SelectFilter*>( i->get() ) )
+            continue;
+
+        DecimateFilter* decimate = dynamic_cast<DecimateFilter*>( i->get() );
+        return decimate? decimate->getTolerance() : 0.0;
+    }
+    return 0.0;
+}
+
+// Creates the state for a filter, naming the state's report after the filter.
+static FilterState*
+createState( Filter* filter )
+{
+    FilterState* state = filter->newState();
+    state->getReport()->setName( filter->getName().length() > 0? filter->getName() : filter->getFilterType() );
+    return state;
+}
+
+// Finds the DecimateFilter at the head of the graph whose work the cursor already
+// did by simplifying the features as it read them (see getSourceTolerance), if any.
+static Filter*
+findPresimplifiedFilter( const FilterList& filters, const FeatureCursor& cursor )
+{
+    double tolerance = cursor.getSimplificationTolerance();
+    if ( tolerance <= 0.0 )
+        return NULL;
+
+    for( FilterList::const_iterator i = filters.begin(); i != filters.end(); i++ )
+    {
+        if ( dynamic_cast<SelectFilter*>( i->get() ) )
+            continue;
+
+        // never skip the last filter, which would leave the graph without an output
+        DecimateFilter* decimate = dynamic_cast<DecimateFilter*>( i->get() );
+        bool is_last = i+1 == filters.end();
+        return decimate && !is_last && decimate->getTolerance() == tolerance? decimate : NULL;
+    }
+    return NULL;
+}
+
+// Merging a batch's geometry keeps only the first feature's attributes, so in a
+// graph that embeds the attributes in its nodes, each BuildGeomFilter builds
+// every feature's geometry separately.
+static Filter*
+createGraphFilter( Filter* filter, const FilterList& filters )
 {
-    bool ok = false;
+    BuildGeomFilter* build_geom = dynamic_cast<BuildGeomFilter*>( filter );
+    if ( !build_geom || !build_geom->getMergeGeometry() )
+        return filter;
+
+    for( FilterList::const_iterator i = filters.begin(); i != filters.end(); i++ )
+    {
+        BuildNodesFilter* build_nodes = dynamic_cast<BuildNodesFilter*>( i->get() );
+        if ( build_nodes && build_nodes->getEmbedAttributes() )
+        {
+            BuildGeomFilter* copy = static_cast<BuildGeomFilter*>( build_geom->clone() );
+            copy->setMergeGeometry( false );
+            return copy;
+        }
+    }
+    return filter;
+}
+
+// Builds a state chain for the filter graph, validating that there are ONLY
+// feature filters present. Returns NULL if the graph is empty or invalid.
+FilterState*
+FilterGraph::createFeatureStates( const FeatureCursor& cursor ) const
+{
+    Filter* presimplified = findPresimplifiedFilter( filter_prototypes, cursor );
 
-    // first build the filter state chain, validating that there are ONLY feature filters
-    // present. No other filter type is permitted when generating a feature store.
     osg::ref_ptr<FilterState> first = NULL;
-    for( FilterList::iterator i = filter_prototypes.begin(); i != filter_prototypes.end(); i++ )
+    for( FilterList::const_iterator i = filter_prototypes.begin(); i != filter_prototypes.end(); i++ )
     {
         Filter* filter = i->get();
+        if ( filter == presimplified )
+            continue;
 
         if ( !dynamic_cast<FeatureFilter*>( filter ) )
         {
             osgGIS::notify(osg::WARN) << "Error: illegal filter of type \"" << filter->getFilterType() << "\" in graph. Only feature features are allowed." << std::endl;
-            return FilterGraphResult::error( "Illegal first filter type in filter graph" );
+            return NULL;
         }
 
-        FilterState* next_state = filter->newState();
+        FilterState* next_state = createState( filter );
         if ( !first.valid() )
         {
             first = next_state;
@@ -195,7 +291,20 @@ FilterGraph::computeFeatureStore(FeatureCursor&     cursor,
     if ( !first.valid() )
     {
         osgGIS::notify(osg::WARN) << "Error: filter graph \"" << getName() << "\" is empty." << std::endl;
-        return FilterGraphResult::error( "Illegal: empty filter graph" );
+    }
+
+    return first.release();
+}
+
+FilterGraphResult
+FilterGraph::computeFeatureStore(FeatureCursor&     cursor,
+                                 FilterEnv*         env,
+                                 const std::string& output_uri )
+{
+    osg::ref_ptr<FilterState> first = createFeatureStates( cursor );
+    if ( !first.valid() )
+    {
+        return FilterGraphResult::error( "Illegal filter graph for feature store generation" );
     }
 
     // next, append a WriteFeatures filter that will generate the output
@@ -204,7 +313,7 @@ FilterGraph::computeFeatureStore(FeatureCursor&     cursor,
     writer->setOutputURI( output_uri );
     //writer->setAppendMode( WriteFeaturesFilter::OVERWRITE );
 
-    osg::ref_ptr<FilterState> output_state = writer->newState();
+    osg::ref_ptr<FilterState> output_state = createState( writer );
     first->appendState( output_state.get() );
 
     // now run the graph.
@@ -241,6 +350,72 @@ FilterGraph::computeFeatureStore(FeatureCursor&     cursor,
 }
 
 
+
+// Terminal filter that collects the features reaching the end of a feature graph.
+class CollectFeaturesFilter : public FeatureFilter
+{
+    OSGGIS_META_FILTER( CollectFeaturesFilter );
+
+public:
+    CollectFeaturesFilter() : output( NULL ) { }
+
+    CollectFeaturesFilter( FeatureList* _output ) : output( _output ) { }
+
+    CollectFeaturesFilter( const CollectFeaturesFilter& rhs ) : FeatureFilter( rhs ), output( rhs.output ) { }
+
+    virtual FeatureList process( Feature* input, FilterEnv* env )
+    {
+        if ( output && input->hasShapeData() )
+            output->push_back( input );
+
+        FeatureList result;
+        result.push_back( input );
+        return result;
+    }
+
+private:
+    FeatureList* output;
+};
+
+
+FilterGraphResult
+FilterGraph::computeFeatures( FeatureCursor& cursor, FilterEnv* env, FeatureList& output )
+{
+    osg::ref_ptr<FilterState> first = createFeatureStates( cursor );
+    if ( !first.valid() )
+    {
+        return FilterGraphResult::error( "Illegal filter graph for feature generation" );
+    }
+
+    osg::ref_ptr<CollectFeaturesFilter> collector = new CollectFeaturesFilter( &output );
+    osg::ref_ptr<FilterState> output_state = collector->newState();
+    first->appendState( output_state.get() );
+
+    FilterStateResult state_result;
+    env->setOutputSRS( env->getInputSRS() );
+
+    FeatureFilterState* state = static_cast<FeatureFilterState*>( first.get() );
+    while( state_result.isOK() && cursor.hasNext() )
+    {
+        state->push( cursor.next() );
+        state_result = state->traverse( env );
+    }
+
+    if ( state_result.isOK() )
+    {
+        state_result = state->signalCheckpoint();
+    }
+
+    if ( state_result.isOK() )
+    {
+        return FilterGraphResult::ok( output_state->getLastKnownFilterEnv() );
+    }
+    else
+    {
+        return FilterGraphResult::error( "Filter graph failed to compute features" );
+    }
+}
+
 // ensures that all single-part shapes have their verts wound CCW.
 static Feature* 
 wind( Feature* input )
@@ -273,10 +448,15 @@ FilterGraph::computeNodes( FeatureCursor& cursor, FilterEnv* env, osg::Group*& o
     osg::ref_ptr<NodeFilterState> output_state;
 
     // first build a new state chain corresponding to our filter prototype chain.
+    Filter* presimplified = findPresimplifiedFilter( filter_prototypes, cursor );
     osg::ref_ptr<FilterState> first = NULL;
     for( FilterList::iterator i = filter_prototypes.begin(); i != filter_prototypes.end(); i++ )
     {
-        FilterState* next_state = i->get()->newState();
+        if ( i->get() == presimplified )
+            continue;
+
+        osg::ref_ptr<Filter> filter = createGraphFilter( i->get(), filter_prototypes );
+        FilterState* next_state = createState( filter.get() );
         if ( !first.valid() )
         {
             first = next_state;
@@ -296,7 +476,6 @@ FilterGraph::computeNodes( FeatureCursor& cursor, FilterEnv* env, osg::Group*& o
     if ( first.valid() )
     {
         int count = 0;
-        osg::Timer_t start = osg::Timer::instance()->tick();
         
         env->setOutputSRS( env->getInputSRS() );
 
@@ -343,10 +522,12 @@ FilterGraph::computeNodes( FeatureCursor& cursor, FilterEnv* env, osg::Group*& o
             }
         }
 
-        osg::Timer_t end = osg::Timer::instance()->tick();
-
-        double dur = osg::Timer::instance()->delta_s( start, end );
-        //osgGIS::notify( osg::ALWAYS ) << std::endl << "Time = " << dur << " s; Per Feature Avg = " << (dur/(double)count) << " s" << std::endl;
+        // roll the per-filter statistics up into the caller's report:
+        env->getReport()->incrementCounter( "features_read", count );
+        for( FilterState* state = first.get(); state; state = state->getNextState() )
+        {
+            env->getReport()->addSubReport( state->getReport() );
+        }
     }
     else
     {
@@ -19,6 +19,7 @@
 
 #include <osgGIS/FilterState>
 #include <osgGIS/Filter>
+#include <osgGIS/Registry>
 
 using namespace osgGIS;
 
@@ -51,7 +52,9 @@ FilterStateResult::set( Status _status, Filter* _filter, const std::string& _msg
 /* ========================================================================= */
 
 FilterState::FilterState()
-: report( new Report() )
+: report( new Report() ),
+  process_start( 0 ),
+  script_start( 0.0 )
 {
     //NOP
 }
@@ -104,4 +107,38 @@ FilterState::signalCheckpoint()
     return next? next->signalCheckpoint() : FilterStateResult();
 }
 
+void
+FilterState::beginProcess( FilterEnv* env )
+{
+    process_start = osg::Timer::instance()->tick();
+    script_start = env->getScriptRunTime();
+    report->markStartTime();
+}
+
+void
+FilterState::endProcess(FilterEnv*         env,
+                        const std::string& input_type,
+                        unsigned int       num_inputs,
+                        const std::string& output_type,
+                        unsigned int       num_outputs )
+{
+    report->markEndTime();
+    osg::Timer_t process_end = osg::Timer::instance()->tick();
+
+    double script_time = env->getScriptRunTime() - script_start;
+
+    report->incrementCounter( input_type + "_in", num_inputs );
+    report->incrementCounter( output_type + "_out", num_outputs );
+    report->incrementCounter( "script_time", script_time );
+
+    TraceLog* trace = Registry::instance()->getTraceLog();
+    if ( trace->isEnabled() )
+    {
+        Properties args;
+        args.push_back( Property( input_type + "_in", (int)num_inputs ) );
+        args.push_back( Property( output_type + "_out", (int)num_outputs ) );
+        args.push_back( Property( "script_time", script_time ) );
+        trace->addEvent( report->getName(), "filter", process_start, process_end, args );
+    }
+}
 
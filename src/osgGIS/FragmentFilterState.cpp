@@ -66,10 +66,17 @@ FragmentFilterState::traverse( FilterEnv* in_env )
     FilterState* next = getNextState();
     if ( next )
     {
+        beginProcess( current_env.get() );
+
         FragmentList output =
             in_features.size() > 0? filter->process( in_features, current_env.get() ) :
             in_fragments.size() > 0? filter->process( in_fragments, current_env.get() ) :
             FragmentList();
+
+        if ( in_features.size() > 0 )
+            endProcess( current_env.get(), "features", in_features.size(), "fragments", output.size() );
+        else
+            endProcess( current_env.get(), "fragments", in_fragments.size(), "fragments", output.size() );
         
         if ( output.size() > 0 )
         {
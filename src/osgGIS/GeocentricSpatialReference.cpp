@@ -166,9 +166,82 @@ GeocentricSpatialReference::transform( const GeoShape& input ) const
 }
 
 
+bool
+GeocentricSpatialReference::transformPointsInPlace(const SpatialReference* input_srs,
+                                                   double* x, double* y, double* z,
+                                                   unsigned int count ) const
+{
+    if ( !input_srs )
+        return false;
+
+    // first bring the input points out of their reference frame if necessary:
+    osg::ref_ptr<const SpatialReference> abs_srs = input_srs;
+    if ( !input_srs->getReferenceFrame().isIdentity() )
+    {
+        transformPoints( input_srs->getInverseReferenceFrame(), x, y, z, count );
+        abs_srs = input_srs->cloneWithNewReferenceFrame( osg::Matrixd::identity() );
+    }
+
+    // next transform them to lat/lon, if necessary:
+    if ( !abs_srs->isGeographic() )
+    {
+        if ( !abs_srs->getGeographicSRS()->transformPointsInPlace( abs_srs.get(), x, y, z, count ) )
+            return false;
+    }
+
+    // finally convert them to geocentric and into the target reference frame,
+    // in one pass:
+    getEllipsoid().latLongToGeocentric( x, y, z, count,
+        getReferenceFrame().isIdentity()? NULL : &getReferenceFrame() );
+
+    return true;
+}
+
+
 bool
 GeocentricSpatialReference::transformInPlace( GeoShape& input ) const
 {
+    if ( input.getSRS() )
+    {
+        // copy the points into coordinate arrays and transform them in one batch:
+        unsigned int count = 0;
+        for( GeoPartList::const_iterator i = input.getParts().begin(); i != input.getParts().end(); i++ )
+            count += i->size();
+
+        if ( count == 0 )
+        {
+            applyTo( input );
+            return true;
+        }
+
+        std::vector<double> x( count ), y( count ), z( count );
+        unsigned int n = 0;
+        for( GeoPartList::const_iterator i = input.getParts().begin(); i != input.getParts().end(); i++ )
+        {
+            for( GeoPointList::const_iterator j = i->begin(); j != i->end(); j++, n++ )
+            {
+                x[n] = j->x(); y[n] = j->y(); z[n] = j->z();
+            }
+        }
+
+        if ( !transformPointsInPlace( input.getSRS(), &x[0], &y[0], &z[0], count ) )
+            return false;
+
+        n = 0;
+        for( GeoPartList::iterator i = input.getParts().begin(); i != input.getParts().end(); i++ )
+        {
+            for( GeoPointList::iterator j = i->begin(); j != i->end(); j++, n++ )
+            {
+                j->set( x[n], y[n], z[n] );
+                j->setDim( 3 );
+                applyTo( *j );
+            }
+        }
+
+        applyTo( input );
+        return true;
+    }
+
     struct XformVisitor : public GeoPointVisitor {
         XformVisitor( const SpatialReference* _sr, const Ellipsoid& _e ) 
             : sr(_sr), e(_e) { }
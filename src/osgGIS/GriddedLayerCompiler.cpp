@@ -307,7 +307,8 @@ private:
         env->setTerrainReadCallback( read_cb.get() );
 
         //osg::Group* output = NULL;
-        FeatureCursor cursor = layer->getCursor( env->getExtent() );
+        osg::ref_ptr<AttributeQuery> query = graph->createSourceQuery();
+        FeatureCursor cursor = layer->getCursor( env->getExtent(), query.get() );
         return graph->computeNodes( cursor, env.get(), out_node );
         //out_node = r.isOK()? output : NULL;
         //return r;
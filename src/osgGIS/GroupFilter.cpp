@@ -18,6 +18,7 @@
  */
 
 #include <osgGIS/GroupFilter>
+#include <osgGIS/AttributeQuery>
 #include <osg/Notify>
 #include <sstream>
 
@@ -34,7 +35,8 @@ GroupFilter::GroupFilter()
 
 GroupFilter::GroupFilter( const GroupFilter& rhs )
 : CollectionFilter( rhs ),
-  group_script( rhs.group_script.get() )
+  group_script( rhs.group_script.get() ),
+  group_attr( rhs.group_attr )
 {
     //NOP
 }
@@ -48,6 +50,10 @@ void
 GroupFilter::setGroupScript( Script* value )
 {
     group_script = value;
+
+    Attribute::Type type;
+    if ( !value || !AttributeQuery::parseAttribute( value->getCode(), group_attr, type ) || type != Attribute::TYPE_STRING )
+        group_attr = "";
 }
 
 Script*
@@ -56,6 +62,12 @@ GroupFilter::getGroupScript() const
     return group_script.get();
 }
 
+const std::string&
+GroupFilter::getGroupAttribute() const
+{
+    return group_attr;
+}
+
 void
 GroupFilter::setProperty( const Property& p )
 {
@@ -77,7 +89,11 @@ GroupFilter::getProperties() const
 std::string 
 GroupFilter::assign( Feature* input, FilterEnv* env )
 {
-    if ( getGroupScript() )
+    if ( !group_attr.empty() )
+    {
+        return input->getAttribute( group_attr ).asString();
+    }
+    else if ( getGroupScript() )
     {
         ScriptResult r = env->getScriptEngine()->run( getGroupScript(), input, env );
         if ( r.isValid() )
@@ -20,6 +20,7 @@
 #include <osgGIS/Lua_ScriptEngine>
 #include <osgGIS/FilterEnv>
 #include <osg/Notify>
+#include <osg/Timer>
 #include <sstream>
 extern "C" {
 #include "tolua.h"
@@ -65,6 +66,8 @@ Lua_ScriptEngine::install( Script* script )
 ScriptResult 
 Lua_ScriptEngine::run( Script* script )
 {
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
     std::stringstream stream;
 
     for( ScriptList::iterator i = scripts.begin(); i != scripts.end(); i++ )
@@ -103,12 +106,16 @@ Lua_ScriptEngine::run( Script* script )
         osgGIS::notify(osg::WARN) << result.str() << std::endl;
     }
 
+    run_time += osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
     return ok? ScriptResult( result.str() ) : ScriptResult::Error( result.str() );
 }
 
 ScriptResult 
 Lua_ScriptEngine::run( Script* script, FilterEnv* env )
 {
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
     std::stringstream stream;
 
     for( ScriptList::iterator i = scripts.begin(); i != scripts.end(); i++ )
@@ -160,12 +167,16 @@ Lua_ScriptEngine::run( Script* script, FilterEnv* env )
         osgGIS::notify(osg::WARN) << result.str() << std::endl;
     }
 
+    run_time += osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
     return ok? ScriptResult( result.str() ) : ScriptResult::Error( result.str() );
 }
 
 ScriptResult 
 Lua_ScriptEngine::run( Script* script, Feature* feature, FilterEnv* env )
 {
+    osg::Timer_t start = osg::Timer::instance()->tick();
+
     std::stringstream stream;
 
     for( ScriptList::iterator i = scripts.begin(); i != scripts.end(); i++ )
@@ -225,6 +236,8 @@ Lua_ScriptEngine::run( Script* script, Feature* feature, FilterEnv* env )
         osgGIS::notify(osg::WARN) << result.str() << std::endl;
     }
 
+    run_time += osg::Timer::instance()->delta_s( start, osg::Timer::instance()->tick() );
+
     return ok? ScriptResult( result.str() ) : ScriptResult::Error( result.str() );
 }
 
@@ -22,6 +22,7 @@
 #include <osgDB/ReadFile>
 #include <osgDB/FileNameUtils>
 #include <osg/ProxyNode>
+#include <sstream>
 
 using namespace osgGIS;
 
@@ -99,6 +100,7 @@ void
 ModelResourceQuery::addTag( const char* tag )
 {
     tags.push_back( tag );
+    updateHashCode();
 }
 
 const TagList& 
@@ -109,9 +111,23 @@ ModelResourceQuery::getTags() const
 
 
 const std::string& 
-ModelResourceQuery::getHashCode()
+ModelResourceQuery::getHashCode() const
 {
-    //TODO
-    return EMPTY_STRING;
+    return hash_code;
+}
+
+void
+ModelResourceQuery::updateHashCode()
+{
+    // tags match regardless of case or order.
+    TagSet tag_set;
+    for( TagList::const_iterator i = tags.begin(); i != tags.end(); i++ )
+        tag_set.insert( StringUtils::toLower( *i ) );
+
+    std::stringstream buf;
+    for( TagSet::const_iterator i = tag_set.begin(); i != tag_set.end(); i++ )
+        buf << "tag=" << *i << ";";
+
+    hash_code = buf.str();
 }
 
@@ -77,17 +77,22 @@ NodeFilterState::traverse( FilterEnv* in_env )
 
     current_env = in_env->advance();
 
+    beginProcess( current_env.get() );
+
     if ( in_features.size() > 0 )
     {
         out_nodes = filter->process( in_features, current_env.get() );
+        endProcess( current_env.get(), "features", in_features.size(), "nodes", out_nodes.size() );
     }
     else if ( in_fragments.size() > 0 )
     {
         out_nodes = filter->process( in_fragments, current_env.get() );
+        endProcess( current_env.get(), "fragments", in_fragments.size(), "nodes", out_nodes.size() );
     }
     else if ( in_nodes.size() > 0 )
     {
         out_nodes = filter->process( in_nodes, current_env.get() );
+        endProcess( current_env.get(), "nodes", in_nodes.size(), "nodes", out_nodes.size() );
     }
     
     FilterState* next = getNextState();
@@ -27,6 +27,7 @@
 #include <osg/Notify>
 #include <ogr_api.h>
 #include <sys/stat.h>
+#include <sstream>
 
 
 using namespace osgGIS;
@@ -40,6 +41,7 @@ OGR_FeatureStore::OGR_FeatureStore( const std::string& abs_path )
     uri = abs_path;
 	bool for_update = false;
     supports_random_read = false;
+    write_layout_ready = false;
 	ds_handle = OGROpenShared( abs_path.c_str(), (for_update? 1 : 0), NULL );
 	if ( ds_handle )
 	{
@@ -97,6 +99,7 @@ OGR_FeatureStore::OGR_FeatureStore(const std::string&         abs_path,
 
     uri = abs_path;
     supports_random_read = false;
+    write_layout_ready = false;
 
     // pull the appropriate OGR driver, defaulting to shapefile.
     std::string driver_name = props.getValue( "ogr-driver", "ESRI Shapefile" );
@@ -306,6 +309,108 @@ OGR_FeatureStore::getCursor()
 }
 
 
+// Builds an OGR SQL WHERE clause that selects a superset of the features matching
+// an attribute query. Only the terms whose semantics OGR shares exactly with the
+// script accessors are translated; the rest are left for the caller to evaluate.
+static std::string
+buildWhereClause( const AttributeQuery* query, const AttributeSchemaTable& schema )
+{
+    std::stringstream buf;
+    buf.precision( 17 );
+    int count = 0;
+
+    for( AttributeQuery::TermList::const_iterator i = query->getTerms().begin(); i != query->getTerms().end(); i++ )
+    {
+        const AttributeQuery::Term& term = *i;
+
+        // find the field (case-insensitive, like OGR_Feature::getAttribute):
+        const AttributeSchema* field = NULL;
+        std::string field_name;
+        for( AttributeSchemaTable::const_iterator j = schema.begin(); j != schema.end() && !field; j++ )
+        {
+            if ( StringUtils::toLower( j->first ) == term.getName() )
+            {
+                field = &j->second;
+                field_name = j->first;
+            }
+        }
+        if ( !field )
+            continue;
+
+        bool numeric =
+            ( term.getType() == Attribute::TYPE_INT && field->getType() == Attribute::TYPE_INT ) ||
+            ( term.getType() == Attribute::TYPE_DOUBLE && field->getType() != Attribute::TYPE_STRING && field->getType() != Attribute::TYPE_UNSPECIFIED );
+
+        // string comparison rules differ between OGR SQL and the script engine, so
+        // we only push down equality tests for strings.
+        bool string_eq =
+            term.getType() == Attribute::TYPE_STRING && field->getType() == Attribute::TYPE_STRING &&
+            term.getOperator() == AttributeQuery::OP_EQUAL &&
+            term.getStringValue().find( '\'' ) == std::string::npos;
+
+        if ( !numeric && !string_eq )
+            continue;
+
+        const char* op =
+            term.getOperator() == AttributeQuery::OP_EQUAL?         "=" :
+            term.getOperator() == AttributeQuery::OP_NOT_EQUAL?     "<>" :
+            term.getOperator() == AttributeQuery::OP_LESS?          "<" :
+            term.getOperator() == AttributeQuery::OP_LESS_EQUAL?    "<=" :
+            term.getOperator() == AttributeQuery::OP_GREATER?       ">" :
+            ">=";
+
+        // unset fields read as zero/empty in a Feature, but as NULL in SQL; so always
+        // let NULLs through and let the caller decide.
+        if ( count++ > 0 )
+            buf << " AND ";
+        buf << "(\"" << field_name << "\" " << op << " ";
+        if ( numeric )
+            buf << term.getNumberValue();
+        else
+            buf << "'" << term.getStringValue() << "'";
+        buf << " OR \"" << field_name << "\" IS NULL)";
+    }
+
+    return buf.str();
+}
+
+
+bool
+OGR_FeatureStore::getOIDs( const AttributeQuery* query, FeatureOIDList& output )
+{
+    if ( !layer_handle || !query )
+        return false;
+
+    std::string where = buildWhereClause( query, getAttributeSchemas() );
+    if ( where.empty() )
+        return false;
+
+    OGR_SCOPE_LOCK();
+
+    if ( OGR_L_SetAttributeFilter( layer_handle, where.c_str() ) != OGRERR_NONE )
+    {
+        osgGIS::notify( osg::INFO ) << "OGR_FeatureStore: cannot apply attribute filter: " << where << std::endl;
+        OGR_L_SetAttributeFilter( layer_handle, NULL );
+        return false;
+    }
+
+    OGR_L_ResetReading( layer_handle );
+    void* feature_handle;
+    while( (feature_handle = OGR_L_GetNextFeature( layer_handle )) != NULL )
+    {
+        output.push_back( (FeatureOID)OGR_F_GetFID( feature_handle ) );
+        OGR_F_Destroy( feature_handle );
+    }
+
+    // restore the layer's default state for other readers:
+    OGR_L_SetAttributeFilter( layer_handle, NULL );
+    OGR_L_ResetReading( layer_handle );
+
+    osgGIS::notify( osg::INFO ) << "OGR_FeatureStore: " << output.size() << " features pass [" << where << "]" << std::endl;
+    return true;
+}
+
+
 int
 OGR_FeatureStore::getFeatureCount() const
 {
@@ -400,72 +505,92 @@ encodeShape( const GeoShape& shape, OGRwkbGeometryType shape_type, OGRwkbGeometr
 }
 
 
+// Caches the information needed to encode features for this layer: the field
+// layout and the geometry types. Neither changes once the layer exists.
+void
+OGR_FeatureStore::assertWriteLayout()
+{
+    if ( write_layout_ready )
+        return;
+
+    OGRFeatureDefnH def = ::OGR_L_GetLayerDefn( layer_handle );
+
+    field_map.clear();
+    int num_fields = OGR_FD_GetFieldCount( def );
+    for( int i=0; i<num_fields; i++ )
+    {
+        OGRFieldDefnH field_handle_ref = OGR_FD_GetFieldDefn( def, i );
+        FieldMapping mapping;
+        mapping.index = i;
+        mapping.type = (int)OGR_Fld_GetType( field_handle_ref );
+        mapping.name = OGR_Fld_GetNameRef( field_handle_ref );
+        field_map.push_back( mapping );
+    }
+
+    OGRwkbGeometryType reported_type = OGR_FD_GetGeomType( def );
+
+    group_type = 
+        reported_type == wkbPolygon? wkbMultiPolygon : 
+        reported_type == wkbPolygon25D? wkbMultiPolygon25D :
+        wkbNone;
+
+    shape_type =
+        reported_type == wkbPolygon || reported_type == wkbMultiPolygon ? wkbPolygon :
+        reported_type == wkbPolygon25D || reported_type == wkbMultiPolygon25D? wkbPolygon25D :
+        reported_type == wkbLineString || reported_type == wkbMultiLineString? wkbMultiLineString :
+        reported_type == wkbLineString25D || reported_type == wkbMultiLineString25D? wkbMultiLineString25D :
+        reported_type == wkbPoint || reported_type == wkbMultiPoint? wkbMultiPoint :
+        reported_type == wkbPoint25D || reported_type == wkbMultiPoint25D? wkbMultiPoint25D :
+        wkbNone;
+
+    part_type =
+        shape_type == wkbPolygon || shape_type == wkbPolygon25D? wkbLinearRing :
+        shape_type == wkbMultiLineString? wkbLineString :
+        shape_type == wkbMultiLineString25D? wkbLineString25D :
+        shape_type == wkbMultiPoint? wkbPoint :
+        shape_type == wkbMultiPoint25D? wkbPoint25D :
+        wkbNone;
+
+    write_layout_ready = true;
+}
+
+
+// Encodes and writes one feature. Caller must hold the OGR lock and have
+// called assertWriteLayout().
 bool
-OGR_FeatureStore::insertFeature( Feature* input )
+OGR_FeatureStore::writeFeature( Feature* input )
 {
-    OGR_SCOPE_LOCK();
     OGRFeatureH feature_handle = OGR_F_Create( OGR_L_GetLayerDefn( layer_handle ) );
     if ( feature_handle )
     {
         // assign the attributes:
-        int num_fields = OGR_F_GetFieldCount( feature_handle );
-        for( int i=0; i<num_fields; i++ )
+        for( FieldMappingList::const_iterator i = field_map.begin(); i != field_map.end(); i++ )
         {
-            OGRFieldDefnH field_handle_ref = OGR_F_GetFieldDefnRef( feature_handle, i );
-            std::string name = OGR_Fld_GetNameRef( field_handle_ref );
-            int field_index = OGR_F_GetFieldIndex( feature_handle, name.c_str() );
-            Attribute attr = input->getAttribute( name );
+            Attribute attr = input->getAttribute( i->name );
             if ( attr.isValid() )
             {
-                switch( OGR_Fld_GetType( field_handle_ref ) )
+                switch( i->type )
                 {
                 case OFTInteger:
-                    OGR_F_SetFieldInteger( feature_handle, field_index, attr.asInt() );
+                    OGR_F_SetFieldInteger( feature_handle, i->index, attr.asInt() );
                     break;
                 case OFTReal:
-                    OGR_F_SetFieldDouble( feature_handle, field_index, attr.asDouble() );
+                    OGR_F_SetFieldDouble( feature_handle, i->index, attr.asDouble() );
                     break;
                 case OFTString:
-                    OGR_F_SetFieldString( feature_handle, field_index, attr.asString() );
+                    OGR_F_SetFieldString( feature_handle, i->index, attr.asString() );
                     break;                    
                 }
             }
         }
 
         // assign the geometry:
-        OGRFeatureDefnH def = ::OGR_L_GetLayerDefn( layer_handle );
-
-        OGRwkbGeometryType reported_type = OGR_FD_GetGeomType( def );
-
-        OGRwkbGeometryType group_type = 
-            reported_type == wkbPolygon? wkbMultiPolygon : 
-            reported_type == wkbPolygon25D? wkbMultiPolygon25D :
-            wkbNone;
-
-        OGRwkbGeometryType shape_type =
-            reported_type == wkbPolygon || reported_type == wkbMultiPolygon ? wkbPolygon :
-            reported_type == wkbPolygon25D || reported_type == wkbMultiPolygon25D? wkbPolygon25D :
-            reported_type == wkbLineString || reported_type == wkbMultiLineString? wkbMultiLineString :
-            reported_type == wkbLineString25D || reported_type == wkbMultiLineString25D? wkbMultiLineString25D :
-            reported_type == wkbPoint || reported_type == wkbMultiPoint? wkbMultiPoint :
-            reported_type == wkbPoint25D || reported_type == wkbMultiPoint25D? wkbMultiPoint25D :
-            wkbNone;
-
-        OGRwkbGeometryType part_type =
-            shape_type == wkbPolygon || shape_type == wkbPolygon25D? wkbLinearRing :
-            shape_type == wkbMultiLineString? wkbLineString :
-            shape_type == wkbMultiLineString25D? wkbLineString25D :
-            shape_type == wkbMultiPoint? wkbPoint :
-            shape_type == wkbMultiPoint25D? wkbPoint25D :
-            wkbNone;
-
-
         if ( group_type != wkbNone )
         {
-            OGRGeometryH group_handle = OGR_G_CreateGeometry( group_type );
+            OGRGeometryH group_handle = OGR_G_CreateGeometry( (OGRwkbGeometryType)group_type );
             for( GeoShapeList::const_iterator j = input->getShapes().begin(); j != input->getShapes().end(); j++ )
             {
-                OGRGeometryH shape_handle = encodeShape( *j, shape_type, part_type );
+                OGRGeometryH shape_handle = encodeShape( *j, (OGRwkbGeometryType)shape_type, (OGRwkbGeometryType)part_type );
                 if ( shape_handle )
                 {
                     if ( OGR_G_AddGeometryDirectly( group_handle, shape_handle ) != OGRERR_NONE )
@@ -484,7 +609,7 @@ OGR_FeatureStore::insertFeature( Feature* input )
         else if ( input->getShapes().size() > 0 )
         {
             const GeoShape& shape = *input->getShapes().begin();
-            OGRGeometryH shape_handle = encodeShape( shape, shape_type, part_type );
+            OGRGeometryH shape_handle = encodeShape( shape, (OGRwkbGeometryType)shape_type, (OGRwkbGeometryType)part_type );
             if ( shape_handle )
             {
                 // transfers ownership to the feature:
@@ -516,6 +641,47 @@ OGR_FeatureStore::insertFeature( Feature* input )
     return true;
 }
 
+
+bool
+OGR_FeatureStore::insertFeature( Feature* input )
+{
+    OGR_SCOPE_LOCK();
+    assertWriteLayout();
+    return writeFeature( input );
+}
+
+
+bool
+OGR_FeatureStore::insertFeatures( const FeatureList& input )
+{
+    if ( input.empty() )
+        return true;
+
+    OGR_SCOPE_LOCK();
+    assertWriteLayout();
+
+    // write the batch in a single transaction if the driver supports it; otherwise
+    // a database-backed driver would commit each feature separately.
+    bool use_transaction =
+        OGR_L_TestCapability( layer_handle, OLCTransactions ) &&
+        OGR_L_StartTransaction( layer_handle ) == OGRERR_NONE;
+
+    bool ok = true;
+    for( FeatureList::const_iterator i = input.begin(); i != input.end(); i++ )
+    {
+        if ( !writeFeature( i->get() ) )
+            ok = false;
+    }
+
+    if ( use_transaction && OGR_L_CommitTransaction( layer_handle ) != OGRERR_NONE )
+    {
+        osgGIS::notify(osg::WARN) << "Error: OGR_FeatureStore, OGR_L_CommitTransaction failed!" << std::endl;
+        ok = false;
+    }
+
+    return ok;
+}
+
 const AttributeSchemaTable&
 OGR_FeatureStore::getAttributeSchemas()
 {
@@ -182,6 +182,68 @@ OGR_SpatialReference::transformInPlace( GeoPoint& input ) const
     return result;
 }
 
+bool
+OGR_SpatialReference::transformPointsInPlace(const SpatialReference* input_srs,
+                                             double* x, double* y, double* z,
+                                             unsigned int count ) const
+{
+    if ( !handle || !input_srs ) {
+        osgGIS::notify( osg::WARN ) << "Spatial reference or input SRS is invalid" << std::endl;
+        return false;
+    }
+
+    // geocentric input goes through the point-by-point conversion:
+    if ( input_srs->isGeocentric() )
+    {
+        return SpatialReference::transformPointsInPlace( input_srs, x, y, z, count );
+    }
+
+    const OGR_SpatialReference* input_sr = static_cast<const OGR_SpatialReference*>( input_srs );
+    bool crs_equiv = false;
+    bool mat_equiv = false;
+    testEquivalence( input_sr, /*out*/crs_equiv, /*out*/mat_equiv );
+
+    // pull them out of the source frame:
+    if ( !mat_equiv )
+    {
+        transformPoints( input_sr->inv_ref_frame, x, y, z, count );
+    }
+
+    bool result = true;
+
+    if ( !crs_equiv )
+    {
+        OGR_SCOPE_LOCK();
+
+        void* xform_handle = OCTNewCoordinateTransformation( input_sr->handle, this->handle );
+        if ( !xform_handle ) {
+            osgGIS::notify( osg::WARN ) << "Spatial Reference: SRS xform not possible" << std::endl
+                << "    From => " << input_sr->getWKT() << std::endl
+                << "    To   => " << this->getWKT() << std::endl;
+            return false;
+        }
+
+        // one call for the whole batch:
+        if ( !OCTTransform( xform_handle, count, x, y, z ) )
+        {
+            osgGIS::notify( osg::WARN ) << "Spatial Reference: Failed to xform points from "
+                << input_sr->getName() << " to " << this->getName()
+                << std::endl;
+            result = false;
+        }
+
+        OCTDestroyCoordinateTransformation( xform_handle );
+    }
+
+    // put them into the new ref frame:
+    if ( !mat_equiv )
+    {
+        transformPoints( ref_frame, x, y, z, count );
+    }
+
+    return result;
+}
+
 GeoExtent
 OGR_SpatialReference::transform( const GeoExtent& input ) const
 {
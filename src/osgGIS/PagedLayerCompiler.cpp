@@ -261,7 +261,8 @@ PagedLayerCompiler::compileGeometry(
         env->setExtent( tile_extent );
         env->setInputSRS( layer->getSRS() );
 
-        FeatureCursor cursor = layer->getCursor( env->getExtent() );
+        osg::ref_ptr<AttributeQuery> query = graph->createSourceQuery();
+        FeatureCursor cursor = layer->getCursor( env->getExtent(), query.get() );
         FilterGraphResult r = graph->computeNodes( cursor, env.get(), out );
         if ( !r.isOK() ) out = NULL;
     }
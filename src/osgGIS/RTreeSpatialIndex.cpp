@@ -50,16 +50,82 @@ RTreeSpatialIndex::getCursor( const GeoExtent& query_extent, bool match_exactly
     GeoExtent ex(
         store->getSRS()->transform( query_extent.getSouthwest() ),
         store->getSRS()->transform( query_extent.getNortheast() ) );
-        
+
+    FeatureOIDList vec;
+    findOIDs( ex, vec );
+
+    return FeatureCursor( vec, store.get(), ex, match_exactly );
+}
+
+
+void
+RTreeSpatialIndex::getOIDs( const GeoExtent& query_extent, FeatureOIDList& output )
+{
+    GeoExtent ex(
+        store->getSRS()->transform( query_extent.getSouthwest() ),
+        store->getSRS()->transform( query_extent.getNortheast() ) );
+
+    findOIDs( ex, output );
+}
+
+
+// Finds the OIDs of the features in an extent already expressed in the store's SRS.
+void
+RTreeSpatialIndex::findOIDs( const GeoExtent& store_extent, FeatureOIDList& output )
+{
     //TODO: replace this with an RTree iterator.
-    std::list<FeatureOID> oids = rtree->find( ex );
+    std::list<FeatureOID> oids = rtree->find( store_extent );
 
-    FeatureOIDList vec( oids.size() );
-    int k = 0;
+    output.reserve( output.size() + oids.size() );
     for( std::list<FeatureOID>::iterator i = oids.begin(); i != oids.end(); i++ )
-        vec[k++] = *i;
+        output.push_back( *i );
+}
 
-    return FeatureCursor( vec, store.get(), ex, match_exactly );
+
+void
+RTreeSpatialIndex::getStatistics( const GeoExtent& query_extent, unsigned int& out_features, unsigned int& out_points )
+{
+    FeatureOIDList oids;
+    getOIDs( query_extent, oids );
+
+    out_features = oids.size();
+    out_points = 0;
+    for( FeatureOIDList::const_iterator i = oids.begin(); i != oids.end(); i++ )
+    {
+        PointCountMap::const_iterator j = point_counts.find( *i );
+        if ( j != point_counts.end() )
+            out_points += j->second;
+    }
+}
+
+
+bool
+RTreeSpatialIndex::readPointCounts( std::istream& in )
+{
+    point_counts.clear();
+
+    unsigned int num_entries = 0;
+    if ( !( in >> num_entries ) )
+        return false;
+
+    for( unsigned int i = 0; i < num_entries; i++ )
+    {
+        FeatureOID oid;
+        unsigned int count;
+        if ( !( in >> oid >> count ) )
+            return false;
+        point_counts[oid] = count;
+    }
+    return true;
+}
+
+
+void
+RTreeSpatialIndex::writePointCounts( std::ostream& out )
+{
+    out << point_counts.size() << std::endl;
+    for( PointCountMap::const_iterator i = point_counts.begin(); i != point_counts.end(); i++ )
+        out << i->first << " " << i->second << std::endl;
 }
 
 
@@ -70,6 +136,7 @@ RTreeSpatialIndex::buildIndex()
 
     bool cache_index = Registry::instance()->hasWorkDirectory();
     std::string index_name = osgDB::getSimpleFileName( store->getName() ) + "_spatialindex";
+    std::string points_name = index_name + "_points";
 
     if ( cache_index )
     {
@@ -88,15 +155,27 @@ RTreeSpatialIndex::buildIndex()
                 rtree = new RTree<FeatureOID>();
                 loaded = rtree->readFrom( input, store->getSRS(), extent );
                 input.close();
-                if ( loaded )
-                    osgGIS::notify(osg::NOTICE) << "Loaded cached spatial index OK..";
             }
+
+            // the per-feature point counts live alongside the index; without them
+            // the index cannot estimate costs, so rebuild it.
+            if ( loaded )
+            {
+                std::ifstream points_input( PathUtils::combinePaths(
+                    Registry::instance()->getWorkDirectory(), points_name ).c_str() );
+                loaded = points_input.is_open() && readPointCounts( points_input );
+            }
+
+            if ( loaded )
+                osgGIS::notify(osg::NOTICE) << "Loaded cached spatial index OK..";
         }
     }
     
     if ( !loaded )
     {
         rtree = new RTree<FeatureOID>();
+        point_counts.clear();
+        extent = GeoExtent::invalid();
 
         for( FeatureCursor cursor = store->getCursor(); cursor.hasNext(); )
         {
@@ -105,6 +184,12 @@ RTreeSpatialIndex::buildIndex()
             if ( f_extent.isValid() && !f_extent.isInfinite() )
             {
                 rtree->insert( f_extent, f->getOID() );
+
+                unsigned int num_points = 0;
+                for( GeoShapeList::const_iterator i = f->getShapes().begin(); i != f->getShapes().end(); i++ )
+                    num_points += i->getTotalPointCount();
+                point_counts[f->getOID()] = num_points;
+
                 if ( extent.isValid() )
                     extent.expandToInclude( f_extent );
                 else
@@ -122,6 +207,11 @@ RTreeSpatialIndex::buildIndex()
             std::ofstream output( cache_path.c_str() );
             rtree->writeTo( output, extent );
             output.close();
+
+            std::ofstream points_output( PathUtils::combinePaths(
+                Registry::instance()->getWorkDirectory(), points_name ).c_str() );
+            writePointCounts( points_output );
+            points_output.close();
         }
 
         loaded = true;
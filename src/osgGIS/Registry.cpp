@@ -48,6 +48,7 @@ Registry::Registry()
 	setSRSFactory( new OGR_SpatialReferenceFactory() );
 	setFeatureStoreFactory( new DefaultFeatureStoreFactory() );
     setRasterStoreFactory( new DefaultRasterStoreFactory() );
+    trace_log = new TraceLog();
 }
 
 
@@ -81,6 +82,12 @@ Registry::getGlobalMutex()
     return global_mutex;
 }
 
+TraceLog*
+Registry::getTraceLog()
+{
+    return trace_log.get();
+}
+
 
 FeatureLayer*
 Registry::createFeatureLayer( const std::string& uri )
@@ -38,6 +38,7 @@ first_start_time( rhs.first_start_time ),
 start_time( rhs.start_time ),
 end_time( rhs.end_time ),
 durations( rhs.durations ),
+counters( rhs.counters ),
 sub_reports( rhs.sub_reports ),
 messages( rhs.messages ),
 properties( rhs.properties )
@@ -90,6 +91,18 @@ Report::markEndTime()
     durations.push_back( osg::Timer::instance()->delta_s( start_time, end_time ) );
 }
 
+osg::Timer_t
+Report::getStartTime() const
+{
+    return start_time;
+}
+
+osg::Timer_t
+Report::getEndTime() const
+{
+    return end_time;
+}
+
 double
 Report::getDuration() const
 {
@@ -123,6 +136,25 @@ Report::getMinDuration() const
     return least;
 }
 
+void
+Report::incrementCounter( const std::string& name, double amount )
+{
+    counters[name] += amount;
+}
+
+double
+Report::getCounter( const std::string& name ) const
+{
+    std::map<std::string,double>::const_iterator i = counters.find( name );
+    return i != counters.end()? i->second : 0.0;
+}
+
+const std::map<std::string,double>&
+Report::getCounters() const
+{
+    return counters;
+}
+
 const ReportList&
 Report::getSubReports() const
 {
@@ -135,6 +167,48 @@ Report::addSubReport( Report* sub_report )
     sub_reports.push_back( sub_report );
 }
 
+Report*
+Report::getSubReport( const std::string& name ) const
+{
+    for( ReportList::const_iterator i = sub_reports.begin(); i != sub_reports.end(); i++ )
+    {
+        if ( i->get()->getName() == name )
+            return i->get();
+    }
+    return NULL;
+}
+
+void
+Report::merge( const Report* rhs )
+{
+    if ( !rhs )
+        return;
+
+    if ( first_start_time == 0 || ( rhs->first_start_time != 0 && rhs->first_start_time < first_start_time ) )
+        first_start_time = rhs->first_start_time;
+    if ( rhs->end_time > end_time )
+        end_time = rhs->end_time;
+
+    durations.insert( durations.end(), rhs->durations.begin(), rhs->durations.end() );
+
+    for( std::map<std::string,double>::const_iterator i = rhs->counters.begin(); i != rhs->counters.end(); i++ )
+        counters[i->first] += i->second;
+
+    setState( rhs->state );
+
+    for( ReportList::const_iterator i = rhs->sub_reports.begin(); i != rhs->sub_reports.end(); i++ )
+    {
+        Report* sub_report = getSubReport( i->get()->getName() );
+        if ( !sub_report )
+        {
+            sub_report = new Report();
+            sub_report->setName( i->get()->getName() );
+            addSubReport( sub_report );
+        }
+        sub_report->merge( i->get() );
+    }
+}
+
 void
 Report::setProperty( const Property& p )
 {
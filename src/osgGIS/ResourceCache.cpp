@@ -22,9 +22,17 @@
 
 using namespace osgGIS;
 
-ResourceCache::ResourceCache()
+ResourceCache::ResourceCache( SharedResourceCache* _shared )
 {
-    //NOP
+    shared = _shared;
+}
+
+osg::StateSet*
+ResourceCache::createStateSet( SkinResource* skin )
+{
+    return shared.valid()?
+        skin->createStateSet( SharedResourceCache::createImageView( shared->getImage( skin ) ) ) :
+        skin->createStateSet();
 }
 
 osg::StateSet*
@@ -36,13 +44,13 @@ ResourceCache::getStateSet( SkinResource* skin )
         SkinStateSets::iterator i = findSkin( skin );
         if ( i == skin_state_sets.end() )
         {
-            result = skin->createStateSet();
+            result = createStateSet( skin );
             skin_state_sets.push_back( SkinStateSet( skin, result ) );
             //skin_state_sets[skin] = result;
         }
         else if ( !i->second.valid() ) // null state set..
         {
-            result = skin->createStateSet();
+            result = createStateSet( skin );
             i->second = result;
         }
         else
@@ -63,15 +71,9 @@ ResourceCache::getNode( ModelResource* model, bool optimize )
         if ( i == model_nodes.end() )
         {
             bool simplify_extrefs = true; //TODO
-            result = model->createNode();
+            result = createNode( model, optimize );
             if ( result )
             {
-                if ( optimize )
-                {
-                    //GeomUtils::setDataVarianceRecursively( result, osg::Object::STATIC );
-                    osgUtil::Optimizer o;
-                    o.optimize( result );
-                }
                 model_nodes.push_back( ModelNode( model, result ) );
                 //model_nodes[model->getAbsoluteURI()] = result;
 
@@ -87,6 +89,28 @@ ResourceCache::getNode( ModelResource* model, bool optimize )
     return result;
 }
 
+osg::Node*
+ResourceCache::createNode( ModelResource* model, bool optimize )
+{
+    osg::Node* result = NULL;
+    if ( shared.valid() )
+    {
+        // the shared model is already optimized; make a private copy of it.
+        result = SharedResourceCache::cloneNode( shared->getNode( model, optimize ) );
+    }
+    else
+    {
+        result = model->createNode();
+        if ( result && optimize )
+        {
+            //GeomUtils::setDataVarianceRecursively( result, osg::Object::STATIC );
+            osgUtil::Optimizer o;
+            o.optimize( result );
+        }
+    }
+    return result;
+}
+
 
 osg::Node*
 ResourceCache::getExternalReferenceNode( ModelResource* model )
@@ -197,3 +221,27 @@ ResourceCache::getExternalReferenceModels()
     return results;
 }
 
+void
+ResourceCache::merge( ResourceCache* other )
+{
+    if ( !other || other == this )
+        return;
+
+    for( SkinStateSets::iterator i = other->skin_state_sets.begin(); i != other->skin_state_sets.end(); i++ )
+    {
+        if ( findSkin( i->first.get() ) == skin_state_sets.end() )
+            skin_state_sets.push_back( *i );
+    }
+
+    for( ModelNodes::iterator i = other->model_nodes.begin(); i != other->model_nodes.end(); i++ )
+    {
+        if ( findModel( i->first.get() ) == model_nodes.end() )
+            model_nodes.push_back( *i );
+    }
+
+    for( ModelNodes::iterator i = other->model_proxy_nodes.begin(); i != other->model_proxy_nodes.end(); i++ )
+    {
+        if ( findProxyModel( i->first.get() ) == model_proxy_nodes.end() )
+            model_proxy_nodes.push_back( *i );
+    }
+}
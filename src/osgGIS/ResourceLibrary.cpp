@@ -24,6 +24,8 @@
 #include <osgUtil/Optimizer>
 #include <OpenThreads/ScopedLock>
 #include <algorithm>
+#include <climits>
+#include <float.h>
 #include <osg/Notify>
 
 using namespace osgGIS;
@@ -31,6 +33,27 @@ using namespace OpenThreads;
 
 static std::string EMPTY_STRING = "";
 
+// memoized query results are kept up to this many distinct queries.
+#define MAX_CACHED_QUERIES 4096
+
+
+// Locks the library mutex, unless the library is frozen in which case
+// nothing can change and readers don't need it.
+class LibraryLock
+{
+public:
+    LibraryLock( ReentrantMutex& _mut, bool frozen ) : mut( frozen? NULL : &_mut )
+    {
+        if ( mut ) mut->lock();
+    }
+    ~LibraryLock()
+    {
+        if ( mut ) mut->unlock();
+    }
+private:
+    ReentrantMutex* mut;
+};
+
 
 static std::string
 normalize( const std::string& input )
@@ -43,7 +66,8 @@ normalize( const std::string& input )
 ResourceLibrary::ResourceLibrary( ReentrantMutex& _mut )
 : mut( _mut )
 {
-    //NOP
+    indexes_dirty = false;
+    frozen = false;
 }
 
 //ResourceLibrary::ResourceLibrary( ResourceLibrary* _parent_lib )
@@ -60,6 +84,14 @@ ResourceLibrary::addResource( Resource* resource )
     {
         ScopedLock<ReentrantMutex> sl( mut );
 
+        if ( frozen )
+        {
+            osgGIS::warn() << "ResourceLibrary: cannot add \"" << resource->getName() << "\"; the library is frozen" << std::endl;
+            return;
+        }
+
+        indexes_dirty = true;
+
         if ( dynamic_cast<SkinResource*>( resource ) )
         {
             SkinResource* skin = static_cast<SkinResource*>( resource );
@@ -113,6 +145,14 @@ ResourceLibrary::removeResource( Resource* resource )
     {
         ScopedLock<ReentrantMutex> sl( mut );
 
+        if ( frozen )
+        {
+            osgGIS::warn() << "ResourceLibrary: cannot remove \"" << resource->getName() << "\"; the library is frozen" << std::endl;
+            return;
+        }
+
+        indexes_dirty = true;
+
         if ( dynamic_cast<SkinResource*>( resource ) )
         {
             for( SkinResources::iterator i = skins.begin(); i != skins.end(); i++ )
@@ -197,7 +237,7 @@ ResourceLibrary::removeResource( Resource* resource )
 Resource*
 ResourceLibrary::getResource( const std::string& name )
 {
-    ScopedLock<ReentrantMutex> sl( mut );
+    LibraryLock sl( mut, frozen );
 
     Resource* result = NULL;
     result = getSkin( name );
@@ -208,23 +248,111 @@ ResourceLibrary::getResource( const std::string& name )
     return result;
 }
 
-SkinResource* 
-ResourceLibrary::getSkin( const std::string& name )
+void
+ResourceLibrary::freeze()
 {
     ScopedLock<ReentrantMutex> sl( mut );
+    if ( indexes_dirty )
+        buildIndexes();
+    frozen = true;
+}
 
-    for( SkinResources::const_iterator i = skins.begin(); i != skins.end(); i++ )
+bool
+ResourceLibrary::isFrozen() const
+{
+    return frozen;
+}
+
+void
+ResourceLibrary::buildIndexes()
+{
+    skin_index = Index();
+    skins_by_min_height.clear();
+    skins_by_max_height.clear();
+    skins_by_min_height.reserve( skins.size() );
+    skins_by_max_height.reserve( skins.size() );
+
+    for( unsigned int i = 0; i < skins.size(); i++ )
     {
-        if ( i->get()->getName() == name )
-            return i->get();
+        SkinResource* skin = skins[i].get();
+        skin_index.names.insert( std::make_pair( skin->getName(), i ) );
+        for( TagSet::const_iterator t = skin->getTags().begin(); t != skin->getTags().end(); t++ )
+            skin_index.tags[*t].push_back( i );
+        skins_by_min_height.push_back( HeightEntry( skin->getMinTextureHeightMeters(), i ) );
+        skins_by_max_height.push_back( HeightEntry( skin->getMaxTextureHeightMeters(), i ) );
     }
-    return NULL;
+    std::sort( skins_by_min_height.begin(), skins_by_min_height.end() );
+    std::sort( skins_by_max_height.begin(), skins_by_max_height.end() );
+
+    model_index = Index();
+    for( unsigned int i = 0; i < models.size(); i++ )
+    {
+        ModelResource* model = models[i].get();
+        model_index.names.insert( std::make_pair( model->getName(), i ) );
+        for( TagSet::const_iterator t = model->getTags().begin(); t != model->getTags().end(); t++ )
+            model_index.tags[*t].push_back( i );
+    }
+
+    indexes_dirty = false;
+}
+
+bool
+ResourceLibrary::getCachedQuery( Index& index, const std::string& key, ResourceList& out_results )
+{
+    // a hit moves the query to the front of the order, so this needs the write lock.
+    ScopedWriteLock sl( queries_mut );
+    QueryResults::iterator i = index.queries.find( key );
+    if ( i != index.queries.end() )
+    {
+        index.query_order.splice( index.query_order.begin(), index.query_order, i->second.position );
+        out_results = i->second.results;
+        return true;
+    }
+    return false;
+}
+
+void
+ResourceLibrary::cacheQuery( Index& index, const std::string& key, const ResourceList& results )
+{
+    ScopedWriteLock sl( queries_mut );
+
+    // another thread may have cached the same query in the meantime:
+    QueryResults::iterator i = index.queries.find( key );
+    if ( i != index.queries.end() )
+    {
+        index.query_order.splice( index.query_order.begin(), index.query_order, i->second.position );
+        i->second.results = results;
+        return;
+    }
+
+    // make room by evicting the least recently used query:
+    if ( index.queries.size() >= MAX_CACHED_QUERIES )
+    {
+        index.queries.erase( index.query_order.back() );
+        index.query_order.pop_back();
+    }
+
+    index.query_order.push_front( key );
+    CachedQuery& entry = index.queries[key];
+    entry.results = results;
+    entry.position = index.query_order.begin();
+}
+
+SkinResource* 
+ResourceLibrary::getSkin( const std::string& name )
+{
+    LibraryLock sl( mut, frozen );
+    if ( indexes_dirty )
+        buildIndexes();
+
+    std::map<std::string,unsigned int>::const_iterator i = skin_index.names.find( name );
+    return i != skin_index.names.end()? skins[i->second].get() : NULL;
 }
 
 ResourceList
 ResourceLibrary::getSkins()
 {
-    ScopedLock<ReentrantMutex> sl( mut );
+    LibraryLock sl( mut, frozen );
 
     ResourceList result;
 
@@ -235,35 +363,185 @@ ResourceLibrary::getSkins()
 }
 
 
+// positions of the entries in a sorted height index whose height lies in
+// the range [first,last), in ascending order.
+template<typename ITER>
+static void
+getPositions( ITER first, ITER last, std::vector<unsigned int>& output )
+{
+    output.clear();
+    output.reserve( last - first );
+    for( ; first != last; first++ )
+        output.push_back( first->second );
+    std::sort( output.begin(), output.end() );
+}
+
+// the greatest height in a sorted height index that is no greater than a
+// height, or -DBL_MAX if there is none.
+template<typename ITER>
+static double
+getHeightAtOrBelow( ITER first, ITER last, double height )
+{
+    ITER i = std::upper_bound( first, last, std::make_pair( height, UINT_MAX ) );
+    return i == first? -DBL_MAX : (i-1)->first;
+}
+
+// the least height in a sorted height index that is no less than a height,
+// or DBL_MAX if there is none.
+template<typename ITER>
+static double
+getHeightAtOrAbove( ITER first, ITER last, double height )
+{
+    ITER i = std::lower_bound( first, last, std::make_pair( height, 0U ) );
+    return i == last? DBL_MAX : i->first;
+}
+
+// Key under which to cache a skin query. The query's own hash code carries
+// its heights at full precision, so heights that vary from feature to feature
+// would never hit the cache. Instead, each height is replaced by the skin
+// height that bounds it; every height between two neighboring skin heights
+// selects the same skins, so the key still identifies the result exactly.
+std::string
+ResourceLibrary::getSkinQueryKey( const SkinResourceQuery& q ) const
+{
+    if ( !q.hasTextureHeight() && !q.hasMinTextureHeight() && !q.hasMaxTextureHeight() )
+        return q.getHashCode();
+
+    osg::ref_ptr<SkinResourceQuery> key_query = new SkinResourceQuery( q );
+
+    // min <= h < max
+    if ( q.hasTextureHeight() )
+        key_query->setTextureHeight( std::max(
+            getHeightAtOrBelow( skins_by_min_height.begin(), skins_by_min_height.end(), q.getTextureHeight() ),
+            getHeightAtOrBelow( skins_by_max_height.begin(), skins_by_max_height.end(), q.getTextureHeight() ) ) );
+
+    // min_h <= max
+    if ( q.hasMinTextureHeight() )
+        key_query->setMinTextureHeight(
+            getHeightAtOrAbove( skins_by_max_height.begin(), skins_by_max_height.end(), q.getMinTextureHeight() ) );
+
+    // max_h > min
+    if ( q.hasMaxTextureHeight() )
+        key_query->setMaxTextureHeight(
+            getHeightAtOrAbove( skins_by_min_height.begin(), skins_by_min_height.end(), q.getMaxTextureHeight() ) );
+
+    return key_query->getHashCode();
+}
+
+static bool
+matches( const SkinResourceQuery& q, SkinResource* r )
+{
+    if ( q.hasTextureHeight() && ( q.getTextureHeight() < r->getMinTextureHeightMeters() || q.getTextureHeight() >= r->getMaxTextureHeightMeters() ) )
+        return false;
+    
+    if ( q.hasMinTextureHeight() && q.getMinTextureHeight() > r->getMaxTextureHeightMeters() )
+        return false;
+
+    if ( q.hasMaxTextureHeight() && q.getMaxTextureHeight() <= r->getMinTextureHeightMeters() )
+        return false;
+
+    if ( q.hasRepeatsVertically() && q.getRepeatsVertically() != r->getRepeatsVertically() )
+        return false;
+    
+    if ( q.getTags().size() > 0 && !r->containsTags( q.getTags() ) )
+        return false;
+
+    return true;
+}
+
 ResourceList
 ResourceLibrary::getSkins( const SkinResourceQuery& q )
 {
-    ScopedLock<ReentrantMutex> sl( mut );
+    LibraryLock sl( mut, frozen );
+    if ( indexes_dirty )
+        buildIndexes();
 
     ResourceList result;
-
-    for( SkinResources::const_iterator i = skins.begin(); i != skins.end(); i++ )
+    std::string key = getSkinQueryKey( q );
+    if ( getCachedQuery( skin_index, key, result ) )
+        return result;
+
+    // Narrow the search down to the smallest set of candidates that one of
+    // the indexes can provide, then check each candidate against the full
+    // query. Candidates are visited in library order, like a full scan.
+    const IndexList* candidates = NULL;
+    IndexList height_candidates;
+    unsigned int num_candidates = skins.size();
+
+    for( TagList::const_iterator i = q.getTags().begin(); i != q.getTags().end(); i++ )
     {
-        SkinResource* r = i->get();
+        TagIndex::const_iterator t = skin_index.tags.find( normalize( *i ) );
+        if ( t == skin_index.tags.end() )
+        {
+            cacheQuery( skin_index, key, result );
+            return result;
+        }
+        if ( t->second.size() < num_candidates )
+        {
+            candidates = &t->second;
+            num_candidates = t->second.size();
+        }
+    }
 
-        if ( q.hasTextureHeight() && ( q.getTextureHeight() < r->getMinTextureHeightMeters() || q.getTextureHeight() >= r->getMaxTextureHeightMeters() ) )
-            continue;
-        
-        if ( q.hasMinTextureHeight() && q.getMinTextureHeight() > r->getMaxTextureHeightMeters() )
-            continue;
+    // The height criteria each select a prefix of skins sorted by minimum
+    // height or a suffix of skins sorted by maximum height.
+    HeightIndex::const_iterator first, last;
+    bool use_height = false;
+    unsigned int height_count = num_candidates;
+
+    if ( q.hasTextureHeight() || q.hasMaxTextureHeight() )
+    {
+        // min <= h, and min < max_h
+        HeightIndex::const_iterator end = q.hasTextureHeight()?
+            std::upper_bound( skins_by_min_height.begin(), skins_by_min_height.end(), HeightEntry( q.getTextureHeight(), UINT_MAX ) ) :
+            std::lower_bound( skins_by_min_height.begin(), skins_by_min_height.end(), HeightEntry( q.getMaxTextureHeight(), 0 ) );
+        if ( (unsigned int)(end - skins_by_min_height.begin()) < height_count )
+        {
+            first = skins_by_min_height.begin(); last = end;
+            height_count = last - first;
+            use_height = true;
+        }
+    }
 
-        if ( q.hasMaxTextureHeight() && q.getMaxTextureHeight() <= r->getMinTextureHeightMeters() )
-            continue;
+    if ( q.hasTextureHeight() || q.hasMinTextureHeight() )
+    {
+        // max > h, and max >= min_h
+        HeightIndex::const_iterator begin = q.hasTextureHeight()?
+            std::upper_bound( skins_by_max_height.begin(), skins_by_max_height.end(), HeightEntry( q.getTextureHeight(), UINT_MAX ) ) :
+            std::lower_bound( skins_by_max_height.begin(), skins_by_max_height.end(), HeightEntry( q.getMinTextureHeight(), 0 ) );
+        if ( (unsigned int)(skins_by_max_height.end() - begin) < height_count )
+        {
+            first = begin; last = skins_by_max_height.end();
+            height_count = last - first;
+            use_height = true;
+        }
+    }
 
-        if ( q.hasRepeatsVertically() && q.getRepeatsVertically() != r->getRepeatsVertically() )
-            continue;
-        
-        if ( q.getTags().size() > 0 && !r->containsTags( q.getTags() ) )
-            continue;
+    if ( use_height )
+    {
+        getPositions( first, last, height_candidates );
+        candidates = &height_candidates;
+    }
 
-        result.push_back( r );
+    if ( candidates )
+    {
+        for( IndexList::const_iterator i = candidates->begin(); i != candidates->end(); i++ )
+        {
+            SkinResource* r = skins[*i].get();
+            if ( matches( q, r ) )
+                result.push_back( r );
+        }
+    }
+    else
+    {
+        for( SkinResources::const_iterator i = skins.begin(); i != skins.end(); i++ )
+        {
+            if ( matches( q, i->get() ) )
+                result.push_back( i->get() );
+        }
     }
 
+    cacheQuery( skin_index, key, result );
     return result;
 }
 
@@ -294,21 +572,19 @@ ResourceLibrary::getSkins( const SkinResourceQuery& q )
 ModelResource* 
 ResourceLibrary::getModel( const std::string& name )
 {
-    ScopedLock<ReentrantMutex> sl( mut );
+    LibraryLock sl( mut, frozen );
+    if ( indexes_dirty )
+        buildIndexes();
 
-    for( ModelResources::const_iterator i = models.begin(); i != models.end(); i++ )
-    {
-        if ( i->get()->getName() == name )
-            return i->get();
-    }
-    return NULL;
+    std::map<std::string,unsigned int>::const_iterator i = model_index.names.find( name );
+    return i != model_index.names.end()? models[i->second].get() : NULL;
 }
 
 
 ResourceList
 ResourceLibrary::getModels()
 {
-    ScopedLock<ReentrantMutex> sl( mut );
+    LibraryLock sl( mut, frozen );
 
     ResourceList result;
 
@@ -322,20 +598,44 @@ ResourceLibrary::getModels()
 ResourceList
 ResourceLibrary::getModels( const ModelResourceQuery& q )
 {
-    ScopedLock<ReentrantMutex> sl( mut );
+    LibraryLock sl( mut, frozen );
+    if ( indexes_dirty )
+        buildIndexes();
 
     ResourceList result;
+    if ( getCachedQuery( model_index, q.getHashCode(), result ) )
+        return result;
 
-    for( ModelResources::const_iterator i = models.begin(); i != models.end(); i++ )
+    // candidates are the models with the least common tag of the query.
+    const IndexList* candidates = NULL;
+    for( TagList::const_iterator i = q.getTags().begin(); i != q.getTags().end(); i++ )
     {
-        ModelResource* r = i->get();
-
-        if ( q.getTags().size() > 0 && !r->containsTags( q.getTags() ) )
-            continue;
+        TagIndex::const_iterator t = model_index.tags.find( normalize( *i ) );
+        if ( t == model_index.tags.end() )
+        {
+            cacheQuery( model_index, q.getHashCode(), result );
+            return result;
+        }
+        if ( !candidates || t->second.size() < candidates->size() )
+            candidates = &t->second;
+    }
 
-        result.push_back( r );
+    if ( candidates )
+    {
+        for( IndexList::const_iterator i = candidates->begin(); i != candidates->end(); i++ )
+        {
+            ModelResource* r = models[*i].get();
+            if ( r->containsTags( q.getTags() ) )
+                result.push_back( r );
+        }
+    }
+    else
+    {
+        for( ModelResources::const_iterator i = models.begin(); i != models.end(); i++ )
+            result.push_back( i->get() );
     }
 
+    cacheQuery( model_index, q.getHashCode(), result );
     return result;
 }
 
@@ -410,7 +710,7 @@ ResourceLibrary::newSkinQuery()
 RasterResource*
 ResourceLibrary::getRaster( const std::string& name )
 {
-    ScopedLock<ReentrantMutex> sl( mut );
+    LibraryLock sl( mut, frozen );
 
     for( RasterResourceVec::const_iterator i = rasters.begin(); i != rasters.end(); i++ )
     {
@@ -423,7 +723,7 @@ ResourceLibrary::getRaster( const std::string& name )
 FeatureLayer*
 ResourceLibrary::getFeatureLayer( const std::string& name )
 {
-    ScopedLock<ReentrantMutex> sl( mut );
+    LibraryLock sl( mut, frozen );
 
     for( FeatureLayerResourceVec::const_iterator i = feature_layers.begin(); i != feature_layers.end(); i++ )
     {
@@ -436,7 +736,7 @@ ResourceLibrary::getFeatureLayer( const std::string& name )
 SpatialReference*
 ResourceLibrary::getSRS( const std::string& name )
 {
-    ScopedLock<ReentrantMutex> sl( mut );
+    LibraryLock sl( mut, frozen );
 
     for( SRSResourceVec::const_iterator i = srs_list.begin(); i != srs_list.end(); i++ )
     {
@@ -449,7 +749,7 @@ ResourceLibrary::getSRS( const std::string& name )
 std::string
 ResourceLibrary::getPath( const std::string& name )
 {
-    ScopedLock<ReentrantMutex> sl( mut );
+    LibraryLock sl( mut, frozen );
 
     for( PathResourceVec::const_iterator i = paths.begin(); i != paths.end(); i++ )
     {
@@ -463,7 +763,7 @@ ResourceLibrary::getPath( const std::string& name )
 PathResource*
 ResourceLibrary::getPathResource( const std::string& name )
 {
-    ScopedLock<ReentrantMutex> sl( mut );
+    LibraryLock sl( mut, frozen );
 
     for( PathResourceVec::const_iterator i = paths.begin(); i != paths.end(); i++ )
     {
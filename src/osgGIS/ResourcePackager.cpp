@@ -308,7 +308,7 @@ ResourcePackager::packageResources( ResourceCache* resources, Report* report )
                 {
                     if ( osgDB::fileExists( output_location ) )
                     {
-                        if ( !osgDB::writeImageFile( *(output_image.get()), PathUtils::combinePaths( output_location, filename ), local_options.get() ) )
+                        if ( !FileUtils::writeImageFile( *(output_image.get()), PathUtils::combinePaths( output_location, filename ), local_options.get() ) )
                         {                            
                             std::stringstream msg;
                             msg << "Failed to copy image " << filename << " into the archive";
@@ -355,7 +355,7 @@ ResourcePackager::packageResources( ResourceCache* resources, Report* report )
             {
                 if ( osgDB::fileExists( output_location ) )
                 {
-                    if ( !osgDB::writeNodeFile( *(node.get()), osgDB::concatPaths( output_location, filename ), local_options.get() ) )
+                    if ( !FileUtils::writeNodeFile( *(node.get()), osgDB::concatPaths( output_location, filename ), local_options.get() ) )
                     {
                         std::stringstream msg;
                         msg << "Failed to copy model " << filename << " into the folder " << output_location;
@@ -411,8 +411,10 @@ ResourcePackager::packageNode(osg::Node* node, const std::string& abs_uri)
             write_ok = r.success();
         }
         else
-        {            
-            write_ok = osgDB::writeNodeFile( *node, abs_uri, options.get() );
+        {
+            // write-then-rename, so that an interrupted build never leaves a partial
+            // file behind for the next build to trust:
+            write_ok = FileUtils::writeNodeFile( *node, abs_uri, options.get() );
         }
     }
 
@@ -0,0 +1,280 @@
+/**
+/* osgGIS - GIS Library for OpenSceneGraph
+ * Copyright 2007-2008 Glenn Waldron and Pelican Ventures, Inc.
+ * http://osggis.org
+ *
+ * osgGIS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <osgGIS/SegmentIndex>
+#include <osgGIS/Utils>
+#include <osg/Notify>
+#include <algorithm>
+#include <float.h>
+#include <stdlib.h>
+#include <math.h>
+
+using namespace osgGIS;
+
+
+SegmentIndex::SegmentIndex( FeatureLayer* layer )
+: xmin( 0.0 ), ymin( 0.0 ), cell_size( 1.0 ), num_cols( 0 ), num_rows( 0 )
+{
+    if ( layer )
+    {
+        for( FeatureCursor cursor = layer->getCursor(); cursor.hasNext(); )
+        {
+            Feature* f = cursor.next();
+
+            GeoShape::ShapeType type = f->getShapeType();
+            if ( type != GeoShape::TYPE_LINE && type != GeoShape::TYPE_POLYGON )
+                continue;
+
+            const GeoShapeList& shapes = f->getShapes();
+            for( GeoShapeList::const_iterator i = shapes.begin(); i != shapes.end(); i++ )
+            {
+                for( GeoPartList::const_iterator j = i->getParts().begin(); j != i->getParts().end(); j++ )
+                {
+                    // skip over CW polygons (i.e. holes)
+                    if ( type == GeoShape::TYPE_POLYGON && !GeomUtils::isPolygonCCW( *j ) )
+                        continue;
+
+                    addPart( *j, type == GeoShape::TYPE_POLYGON, f->getOID() );
+                }
+            }
+        }
+    }
+
+    buildGrid();
+
+    osgGIS::notify(osg::INFO) << "SegmentIndex: indexed " << segments.size() << " segments in a "
+        << num_cols << "x" << num_rows << " grid" << std::endl;
+}
+
+SegmentIndex::~SegmentIndex()
+{
+    //NOP
+}
+
+unsigned int
+SegmentIndex::getNumSegments() const
+{
+    return segments.size();
+}
+
+void
+SegmentIndex::addPart( const GeoPointList& part, bool closed, FeatureOID oid )
+{
+    unsigned int n = part.size();
+    unsigned int num_segs = closed && n > 2? n : n-1;
+
+    for( unsigned int i = 0; n > 1 && i < num_segs; i++ )
+    {
+        const GeoPoint& p0 = part[i];
+        const GeoPoint& p1 = part[(i+1) % n];
+
+        // zero-length segments have no direction; skip them.
+        if ( p0.x() == p1.x() && p0.y() == p1.y() )
+            continue;
+
+        Segment seg;
+        seg.ax = p0.x(); seg.ay = p0.y();
+        seg.bx = p1.x(); seg.by = p1.y();
+        seg.oid = oid;
+        segments.push_back( seg );
+    }
+}
+
+void
+SegmentIndex::buildGrid()
+{
+    cell_offsets.assign( 1, 0 );
+    cell_segments.clear();
+
+    if ( segments.size() == 0 )
+        return;
+
+    double xmax = -DBL_MAX, ymax = -DBL_MAX, total_length = 0.0;
+    xmin = DBL_MAX, ymin = DBL_MAX;
+    for( SegmentList::const_iterator i = segments.begin(); i != segments.end(); i++ )
+    {
+        xmin = std::min( xmin, std::min( i->ax, i->bx ) );
+        ymin = std::min( ymin, std::min( i->ay, i->by ) );
+        xmax = std::max( xmax, std::max( i->ax, i->bx ) );
+        ymax = std::max( ymax, std::max( i->ay, i->by ) );
+        total_length += sqrt( (i->bx-i->ax)*(i->bx-i->ax) + (i->by-i->ay)*(i->by-i->ay) );
+    }
+
+    // aim for about one segment per cell, but make cells no smaller than the
+    // average segment so that segments do not straddle too many cells.
+    double num_segs = (double)segments.size();
+    cell_size = std::max( total_length/num_segs, sqrt( (xmax-xmin)*(ymax-ymin)/num_segs ) );
+    if ( cell_size <= 0.0 )
+        cell_size = 1.0;
+
+    num_cols = (int)( (xmax-xmin)/cell_size ) + 1;
+    num_rows = (int)( (ymax-ymin)/cell_size ) + 1;
+
+    // count the segments in each cell, then fill in the packed cell lists.
+    cell_offsets.assign( num_cols*num_rows + 1, 0 );
+    for( int pass = 0; pass < 2; pass++ )
+    {
+        std::vector<unsigned int> fill;
+        if ( pass == 1 )
+        {
+            for( unsigned int c = 1; c < cell_offsets.size(); c++ )
+                cell_offsets[c] += cell_offsets[c-1];
+            cell_segments.resize( cell_offsets.back() );
+            fill.assign( cell_offsets.begin(), cell_offsets.end()-1 );
+        }
+
+        for( unsigned int s = 0; s < segments.size(); s++ )
+        {
+            const Segment& seg = segments[s];
+            int c0 = (int)( (std::min( seg.ax, seg.bx )-xmin)/cell_size );
+            int c1 = (int)( (std::max( seg.ax, seg.bx )-xmin)/cell_size );
+            int r0 = (int)( (std::min( seg.ay, seg.by )-ymin)/cell_size );
+            int r1 = (int)( (std::max( seg.ay, seg.by )-ymin)/cell_size );
+
+            for( int row = r0; row <= r1 && row < num_rows; row++ )
+            {
+                for( int col = c0; col <= c1 && col < num_cols; col++ )
+                {
+                    unsigned int cell = row*num_cols + col;
+                    if ( pass == 0 )
+                        cell_offsets[cell+1]++;
+                    else
+                        cell_segments[ fill[cell]++ ] = s;
+                }
+            }
+        }
+    }
+}
+
+// shortest distance from a point to a line segment; also returns the closest
+// point on the segment.
+static double
+getDistanceToSegment( double ax, double ay, double bx, double by, double cx, double cy, double& out_x, double& out_y )
+{
+    double dx = bx-ax, dy = by-ay;
+    double len2 = dx*dx + dy*dy;
+    double r = len2 > 0.0? ( (cx-ax)*dx + (cy-ay)*dy ) / len2 : 0.0;
+    if ( r < 0.0 ) r = 0.0;
+    else if ( r > 1.0 ) r = 1.0;
+
+    out_x = ax + r*dx;
+    out_y = ay + r*dy;
+    return sqrt( (cx-out_x)*(cx-out_x) + (cy-out_y)*(cy-out_y) );
+}
+
+void
+SegmentIndex::visitCell( int col, int row, double px, double py, unsigned int k, double& max_distance, SegmentHitList& output ) const
+{
+    unsigned int cell = row*num_cols + col;
+    for( unsigned int i = cell_offsets[cell]; i < cell_offsets[cell+1]; i++ )
+    {
+        unsigned int s = cell_segments[i];
+        const Segment& seg = segments[s];
+
+        SegmentHit hit;
+        hit.distance = getDistanceToSegment( seg.ax, seg.ay, seg.bx, seg.by, px, py, hit.x, hit.y );
+        if ( hit.distance > max_distance )
+            continue;
+
+        // a segment that spans several cells will turn up more than once:
+        bool duplicate = false;
+        for( SegmentHitList::const_iterator j = output.begin(); j != output.end() && !duplicate; j++ )
+            duplicate = j->segment == s;
+        if ( duplicate )
+            continue;
+
+        hit.segment = s;
+        hit.oid = seg.oid;
+
+        SegmentHitList::iterator pos = output.begin();
+        while( pos != output.end() && pos->distance <= hit.distance )
+            pos++;
+        output.insert( pos, hit );
+
+        if ( output.size() > k )
+            output.pop_back();
+
+        // once we have k hits, nothing farther than the k-th one matters.
+        if ( output.size() == k )
+            max_distance = output.back().distance;
+    }
+}
+
+// grid column (or row) of an offset from the grid origin. Offsets beyond the
+// grid clamp to the cell just outside it, which is no farther from the grid
+// than the point itself; that keeps the cast in range for far-away points.
+static int
+getCellIndex( double offset, double cell_size, int num_cells )
+{
+    double index = floor( offset/cell_size );
+    return
+        index < -1.0? -1 :
+        index > (double)num_cells? num_cells :
+        (int)index;
+}
+
+bool
+SegmentIndex::getNearestSegments(const GeoPoint& point,
+                                 unsigned int    k,
+                                 double          max_distance,
+                                 SegmentHitList& output ) const
+{
+    output.clear();
+    if ( segments.size() == 0 || k == 0 )
+        return false;
+
+    double px = point.x(), py = point.y();
+    int cc = getCellIndex( px-xmin, cell_size, num_cols );
+    int cr = getCellIndex( py-ymin, cell_size, num_rows );
+
+    // the ring that reaches the far side of the grid:
+    int max_ring = std::max(
+        std::max( abs(cc), abs(cc-(num_cols-1)) ),
+        std::max( abs(cr), abs(cr-(num_rows-1)) ) );
+
+    // search outward in square rings of cells around the point's cell. Every
+    // cell in ring r is at least (r-1) cells away from the point.
+    for( int r = 0; r <= max_ring; r++ )
+    {
+        if ( (double)(r-1)*cell_size > max_distance )
+            break;
+
+        int c0 = cc-r, c1 = cc+r, r0 = cr-r, r1 = cr+r;
+
+        // top and bottom rows of the ring:
+        for( int col = std::max( c0, 0 ); col <= std::min( c1, num_cols-1 ); col++ )
+        {
+            if ( r0 >= 0 && r0 < num_rows )
+                visitCell( col, r0, px, py, k, max_distance, output );
+            if ( r1 != r0 && r1 >= 0 && r1 < num_rows )
+                visitCell( col, r1, px, py, k, max_distance, output );
+        }
+
+        // left and right columns, less the corners:
+        for( int row = std::max( r0+1, 0 ); row <= std::min( r1-1, num_rows-1 ); row++ )
+        {
+            if ( c0 >= 0 && c0 < num_cols )
+                visitCell( c0, row, px, py, k, max_distance, output );
+            if ( c1 != c0 && c1 >= 0 && c1 < num_cols )
+                visitCell( c1, row, px, py, k, max_distance, output );
+        }
+    }
+
+    return output.size() > 0;
+}
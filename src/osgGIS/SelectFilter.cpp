@@ -34,7 +34,8 @@ SelectFilter::SelectFilter()
 
 SelectFilter::SelectFilter( const SelectFilter& rhs )
 : FeatureFilter( rhs ),
-  select_script( rhs.select_script.get() )
+  select_script( rhs.select_script.get() ),
+  select_query( rhs.select_query.get() )
 {
     //NOP
 }
@@ -48,6 +49,7 @@ void
 SelectFilter::setSelectScript( Script* value )
 {
     select_script = value;
+    select_query = value? AttributeQuery::parse( value->getCode() ) : NULL;
 }
 
 Script*
@@ -56,6 +58,12 @@ SelectFilter::getSelectScript() const
     return select_script.get();
 }
 
+AttributeQuery*
+SelectFilter::getAttributeQuery() const
+{
+    return select_query.get();
+}
+
 void
 SelectFilter::setProperty( const Property& p )
 {
@@ -78,7 +86,12 @@ SelectFilter::process( Feature* input, FilterEnv* env )
 {
     FeatureList output;
 
-    if ( getSelectScript() )
+    if ( getAttributeQuery() )
+    {
+        if ( getAttributeQuery()->matches( input ) )
+            output.push_back( input );
+    }
+    else if ( getSelectScript() )
     {
         ScriptResult r = env->getScriptEngine()->run( getSelectScript(), input, env );
 
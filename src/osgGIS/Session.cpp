@@ -28,6 +28,7 @@ using namespace OpenThreads;
 Session::Session()
 {
     resources = new ResourceLibrary( session_mtx );
+    shared_resource_cache = new SharedResourceCache();
 }
 
 Session::~Session()
@@ -44,6 +45,7 @@ Session::derive()
     Session* result = new Session();
     result->scripts.insert( result->scripts.end(), scripts.begin(), scripts.end() );
     result->resources = resources;
+    result->shared_resource_cache = shared_resource_cache;
 
     return result;
 }
@@ -142,3 +144,9 @@ Session::getResourcesUsed( bool reset )
 
     return list;
 }
+
+SharedResourceCache*
+Session::getSharedResourceCache()
+{
+    return shared_resource_cache.get();
+}
@@ -0,0 +1,169 @@
+/**
+/* osgGIS - GIS Library for OpenSceneGraph
+ * Copyright 2007-2008 Glenn Waldron and Pelican Ventures, Inc.
+ * http://osggis.org
+ *
+ * osgGIS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <osgGIS/SharedResourceCache>
+#include <osgUtil/Optimizer>
+#include <OpenThreads/ScopedLock>
+
+using namespace osgGIS;
+using namespace OpenThreads;
+
+// An image that points to the pixel data of a shared image and holds a
+// reference to it so the data stays valid as long as this image exists.
+class ImageView : public osg::Image
+{
+public:
+    ImageView( osg::Image* _source ) : source( _source )
+    {
+        setFileName( source->getFileName() );
+        setImage(
+            source->s(), source->t(), source->r(),
+            source->getInternalTextureFormat(),
+            source->getPixelFormat(),
+            source->getDataType(),
+            source->data(),
+            osg::Image::NO_DELETE,
+            source->getPacking() );
+        setMipmapLevels( source->getMipmapLevels() );
+    }
+
+protected:
+    osg::ref_ptr<osg::Image> source;
+};
+
+
+// Deep-copies a scene graph, except for its images which are replaced with
+// views of the originals.
+class ImageViewCopyOp : public osg::CopyOp
+{
+public:
+    ImageViewCopyOp() : osg::CopyOp( osg::CopyOp::DEEP_COPY_ALL ) { }
+
+    virtual osg::Image* operator() ( const osg::Image* image ) const
+    {
+        return image? SharedResourceCache::createImageView( const_cast<osg::Image*>( image ) ) : NULL;
+    }
+};
+
+
+SharedResourceCache::SharedResourceCache()
+{
+    //NOP
+}
+
+SharedResourceCache::~SharedResourceCache()
+{
+    //NOP
+}
+
+osg::ref_ptr<SharedResourceCache::Entry>
+SharedResourceCache::getEntry( const std::string& key )
+{
+    {
+        ScopedReadLock lock( entries_mutex );
+        EntryMap::iterator i = entries.find( key );
+        if ( i != entries.end() )
+            return i->second;
+    }
+
+    ScopedWriteLock lock( entries_mutex );
+    osg::ref_ptr<Entry>& entry = entries[key];
+    if ( !entry.valid() ) // check again; another thread may have added it
+        entry = new Entry();
+    return entry;
+}
+
+osg::Image*
+SharedResourceCache::getImage( SkinResource* skin )
+{
+    osg::Image* result = NULL;
+    if ( skin )
+    {
+        osg::ref_ptr<Entry> entry = getEntry( "skin:" + skin->getAbsoluteURI() );
+
+        // the first caller loads the image; the others wait here until it's done.
+        // Once loaded, the object never changes, so a hit needs no lock.
+        if ( !entry->loaded )
+        {
+            ScopedLock<Mutex> lock( entry->load_mutex );
+            if ( !entry->loaded ) // check again; another thread may have loaded it
+            {
+                entry->object = skin->createImage();
+                entry->loaded.exchange( 1 );
+                num_loads++;
+            }
+        }
+        result = static_cast<osg::Image*>( entry->object.get() );
+    }
+    return result;
+}
+
+osg::Node*
+SharedResourceCache::getNode( ModelResource* model, bool optimize )
+{
+    osg::Node* result = NULL;
+    if ( model )
+    {
+        osg::ref_ptr<Entry> entry = getEntry( (optimize? "model+opt:" : "model:") + model->getAbsoluteURI() );
+
+        if ( !entry->loaded )
+        {
+            ScopedLock<Mutex> lock( entry->load_mutex );
+            if ( !entry->loaded )
+            {
+                osg::Node* node = model->createNode();
+                if ( node && optimize )
+                {
+                    osgUtil::Optimizer o;
+                    o.optimize( node );
+                }
+                entry->object = node;
+                entry->loaded.exchange( 1 );
+                num_loads++;
+            }
+        }
+        result = static_cast<osg::Node*>( entry->object.get() );
+    }
+    return result;
+}
+
+unsigned int
+SharedResourceCache::getNumLoads() const
+{
+    return num_loads;
+}
+
+void
+SharedResourceCache::clear()
+{
+    ScopedWriteLock lock( entries_mutex );
+    entries.clear();
+}
+
+osg::Image*
+SharedResourceCache::createImageView( osg::Image* image )
+{
+    return image? new ImageView( image ) : NULL;
+}
+
+osg::Node*
+SharedResourceCache::cloneNode( osg::Node* node )
+{
+    return node? static_cast<osg::Node*>( node->clone( ImageViewCopyOp() ) ) : NULL;
+}
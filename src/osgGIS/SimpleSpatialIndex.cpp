@@ -39,17 +39,41 @@ FeatureCursor
 SimpleSpatialIndex::getCursor( const GeoExtent& query_extent, bool match_exactly )
 {
     FeatureOIDList oids;
+    getOIDs( query_extent, oids );
+    return FeatureCursor( oids, store.get(), query_extent, match_exactly );
+}
+
+
+void
+SimpleSpatialIndex::getOIDs( const GeoExtent& query_extent, FeatureOIDList& output )
+{
     for( FeatureCursor cursor = store->getCursor(); cursor.hasNext(); )
 	{
 		Feature* feature = cursor.next();
         const GeoExtent f_extent = feature->getExtent();
         if ( f_extent.intersects( query_extent ) )
         {
-            oids.push_back( feature->getOID() );
+            output.push_back( feature->getOID() );
         }
 	}
+}
 
-    return FeatureCursor( oids, store.get(), query_extent, match_exactly );
+
+void
+SimpleSpatialIndex::getStatistics( const GeoExtent& query_extent, unsigned int& out_features, unsigned int& out_points )
+{
+    out_features = 0;
+    out_points = 0;
+    for( FeatureCursor cursor = store->getCursor(); cursor.hasNext(); )
+	{
+		Feature* feature = cursor.next();
+        if ( feature->getExtent().intersects( query_extent ) )
+        {
+            out_features++;
+            for( GeoShapeList::const_iterator i = feature->getShapes().begin(); i != feature->getShapes().end(); i++ )
+                out_points += i->getTotalPointCount();
+        }
+	}
 }
 
 
@@ -0,0 +1,229 @@
+/**
+/* osgGIS - GIS Library for OpenSceneGraph
+ * Copyright 2007-2008 Glenn Waldron and Pelican Ventures, Inc.
+ * http://osggis.org
+ *
+ * osgGIS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <osgGIS/SimplificationIndex>
+#include <osgGIS/FeatureStore>
+#include <osgGIS/Registry>
+#include <osgGIS/Utils>
+#include <osg/Notify>
+#include <fstream>
+#include <float.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+using namespace osgGIS;
+
+
+SimplificationIndex::SimplificationIndex( FeatureStore* store )
+{
+    buildIndex( store );
+}
+
+
+SimplificationIndex::~SimplificationIndex()
+{
+    //NOP
+}
+
+
+void
+SimplificationIndex::computeImportance( const Feature* feature, std::vector<float>& output )
+{
+    std::vector<double> part_importance;
+
+    const GeoShapeList& shapes = feature->getShapes();
+    for( GeoShapeList::const_iterator i = shapes.begin(); i != shapes.end(); i++ )
+    {
+        for( GeoPartList::const_iterator j = i->getParts().begin(); j != i->getParts().end(); j++ )
+        {
+            if ( i->getShapeType() == GeoShape::TYPE_POINT )
+            {
+                output.insert( output.end(), j->size(), FLT_MAX );
+            }
+            else
+            {
+                GeomUtils::computeVertexImportance( *j, i->getShapeType() == GeoShape::TYPE_POLYGON, part_importance );
+                for( std::vector<double>::const_iterator k = part_importance.begin(); k != part_importance.end(); k++ )
+                    output.push_back( *k < FLT_MAX? (float)*k : FLT_MAX );
+            }
+        }
+    }
+}
+
+
+bool
+SimplificationIndex::simplify( Feature* feature, const std::vector<float>& importance, double tolerance )
+{
+    // check the point count through the const interface first so that a
+    // shared (cached) feature is not copied unless it actually changes:
+    const Feature* const_feature = feature;
+    unsigned int num_points = 0;
+    for( GeoShapeList::const_iterator i = const_feature->getShapes().begin(); i != const_feature->getShapes().end(); i++ )
+        num_points += i->getTotalPointCount();
+
+    if ( num_points != importance.size() )
+        return false;
+
+    std::vector<float>::const_iterator k = importance.begin();
+    GeoShapeList new_shapes;
+
+    for( GeoShapeList::iterator i = feature->getShapes().begin(); i != feature->getShapes().end(); i++ )
+    {
+        unsigned int min_points =
+            i->getShapeType() == GeoShape::TYPE_POLYGON? 3 :
+            i->getShapeType() == GeoShape::TYPE_LINE? 2 :
+            1;
+
+        GeoPartList new_parts;
+
+        for( GeoPartList::iterator j = i->getParts().begin(); j != i->getParts().end(); j++ )
+        {
+            GeoPointList new_part;
+            for( GeoPointList::iterator p = j->begin(); p != j->end(); p++, k++ )
+            {
+                if ( *k > tolerance )
+                    new_part.push_back( *p );
+            }
+
+            if ( new_part.size() >= min_points )
+                new_parts.push_back( new_part );
+        }
+
+        if ( new_parts.size() > 0 )
+        {
+            i->getParts().swap( new_parts );
+            new_shapes.push_back( *i );
+        }
+    }
+
+    feature->getShapes().swap( new_shapes );
+    return true;
+}
+
+
+bool
+SimplificationIndex::simplify( Feature* feature, double tolerance ) const
+{
+    ImportanceTable::const_iterator i = table.find( feature->getOID() );
+    if ( i != table.end() && simplify( feature, i->second, tolerance ) )
+        return true;
+
+    // the feature differs from the one indexed, so rank its points now:
+    std::vector<float> importance;
+    computeImportance( feature, importance );
+    return simplify( feature, importance, tolerance );
+}
+
+
+bool
+SimplificationIndex::buildIndex( FeatureStore* store )
+{
+    bool loaded = false;
+
+    std::string cache_path = FileUtils::getWorkFilePath( store->getName(), "simplification" );
+    bool cache_index = cache_path.length() > 0;
+
+    if ( cache_index )
+    {
+        // the cached index is only valid if it is newer than the feature store.
+        struct stat statbuf;
+        if ( ::stat( cache_path.c_str(), &statbuf ) == 0 && statbuf.st_mtime > store->getModTime() )
+        {
+            std::ifstream input( cache_path.c_str(), std::ios::binary );
+            if ( input.is_open() )
+            {
+                loaded = readFrom( input );
+                input.close();
+                if ( loaded )
+                    osgGIS::notify(osg::INFO) << "Loaded cached simplification index" << std::endl;
+                else
+                    table.clear();
+            }
+        }
+    }
+
+    if ( !loaded )
+    {
+        for( FeatureCursor cursor = store->getCursor(); cursor.hasNext(); )
+        {
+            Feature* f = cursor.next();
+            computeImportance( f, table[ f->getOID() ] );
+        }
+
+        // now cache it to disk.
+        if ( cache_index )
+        {
+            std::string temp_path = FileUtils::getPartialPath( cache_path );
+            std::ofstream output( temp_path.c_str(), std::ios::binary );
+            bool written = writeTo( output );
+            output.close();
+            if ( written && !output.fail() )
+                FileUtils::replaceFile( temp_path, cache_path );
+            else
+                ::remove( temp_path.c_str() );
+        }
+
+        loaded = true;
+    }
+
+    return loaded;
+}
+
+
+// Format: a header line and the number of features, followed by each feature's
+// OID, point count and raw (native byte order) importance values.
+bool
+SimplificationIndex::writeTo( std::ostream& out ) const
+{
+    out << "OSGGIS_SIMPLIFICATION_INDEX_1.0" << std::endl;
+    out << table.size() << std::endl;
+    for( ImportanceTable::const_iterator i = table.begin(); i != table.end(); i++ )
+    {
+        out << i->first << ' ' << i->second.size() << ' ';
+        if ( i->second.size() > 0 )
+            out.write( (const char*)&i->second[0], i->second.size() * sizeof(float) );
+        out << std::endl;
+    }
+    return out.good();
+}
+
+
+bool
+SimplificationIndex::readFrom( std::istream& in )
+{
+    std::string line;
+    std::getline( in, line );
+    if ( line != "OSGGIS_SIMPLIFICATION_INDEX_1.0" ) return false;
+
+    unsigned int num_features = 0;
+    in >> num_features;
+    for( unsigned int i=0; i<num_features && in.good(); i++ )
+    {
+        FeatureOID oid;
+        unsigned int num_points = 0;
+        in >> oid >> num_points;
+        in.get();
+
+        std::vector<float>& importance = table[oid];
+        importance.resize( num_points );
+        if ( num_points > 0 )
+            in.read( (char*)&importance[0], num_points * sizeof(float) );
+    }
+    return !in.fail();
+}
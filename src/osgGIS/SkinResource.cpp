@@ -26,6 +26,8 @@
 #include <osg/TexEnv>
 #include <osg/BlendFunc>
 #include <OpenThreads/ScopedLock>
+#include <sstream>
+#include <iomanip>
 
 using namespace osgGIS;
 using namespace OpenThreads;
@@ -299,6 +301,7 @@ SkinResourceQuery::SkinResourceQuery()
     has_min_tex_height = false;
     has_max_tex_height = false;
     has_repeat_vert    = false;
+    updateHashCode();
 }
 
 void 
@@ -306,6 +309,7 @@ SkinResourceQuery::setTextureHeight( double value )
 {
     tex_height = value;
     has_tex_height = true;
+    updateHashCode();
 }
 
 bool 
@@ -325,6 +329,7 @@ SkinResourceQuery::setMinTextureHeight( double value )
 {
     min_tex_height = value;
     has_min_tex_height = true;
+    updateHashCode();
 }
 
 bool 
@@ -344,6 +349,7 @@ SkinResourceQuery::setMaxTextureHeight( double value )
 {
     max_tex_height = value;
     has_max_tex_height = true;
+    updateHashCode();
 }
 
 bool 
@@ -364,6 +370,7 @@ SkinResourceQuery::setRepeatsVertically( bool value )
 {
     repeat_vert = value;
     has_repeat_vert = true;
+    updateHashCode();
 }
 
 bool 
@@ -382,6 +389,7 @@ void
 SkinResourceQuery::addTag( const char* tag )
 {
     tags.push_back( tag );
+    updateHashCode();
 }
 
 const TagList& 
@@ -392,9 +400,32 @@ SkinResourceQuery::getTags() const
 
 
 const std::string& 
-SkinResourceQuery::getHashCode()
+SkinResourceQuery::getHashCode() const
 {
-    //TODO
-    return EMPTY_STRING;
+    return hash_code;
+}
+
+void
+SkinResourceQuery::updateHashCode()
+{
+    std::stringstream buf;
+    buf << std::setprecision( 17 );
+    if ( has_tex_height )
+        buf << "h=" << tex_height << ";";
+    if ( has_min_tex_height )
+        buf << "min=" << min_tex_height << ";";
+    if ( has_max_tex_height )
+        buf << "max=" << max_tex_height << ";";
+    if ( has_repeat_vert )
+        buf << "rv=" << repeat_vert << ";";
+
+    // tags match regardless of case or order.
+    TagSet tag_set;
+    for( TagList::const_iterator i = tags.begin(); i != tags.end(); i++ )
+        tag_set.insert( StringUtils::toLower( *i ) );
+    for( TagSet::const_iterator i = tag_set.begin(); i != tag_set.end(); i++ )
+        buf << "tag=" << *i << ";";
+
+    hash_code = buf.str();
 }
 
@@ -47,6 +47,46 @@ SpatialReference::applyTo( GeoShape& s ) const
 }
 
 
+bool
+SpatialReference::transformPointsInPlace(const SpatialReference* input_srs,
+                                         double* x, double* y, double* z,
+                                         unsigned int count ) const
+{
+    // generic version; point by point.
+    bool result = true;
+    for( unsigned int i = 0; i < count; i++ )
+    {
+        GeoPoint p( x[i], y[i], z[i], input_srs );
+        if ( transformInPlace( p ) )
+        {
+            x[i] = p.x();
+            y[i] = p.y();
+            z[i] = p.z();
+        }
+        else
+        {
+            result = false;
+        }
+    }
+    return result;
+}
+
+
+void
+SpatialReference::transformPoints(const osg::Matrixd& m,
+                                  double* x, double* y, double* z,
+                                  unsigned int count )
+{
+    for( unsigned int i = 0; i < count; i++ )
+    {
+        osg::Vec3d p = osg::Vec3d( x[i], y[i], z[i] ) * m;
+        x[i] = p.x();
+        y[i] = p.y();
+        z[i] = p.z();
+    }
+}
+
+
 osg::Vec3d
 SpatialReference::getUpVector( const osg::Vec3d& point ) const
 {
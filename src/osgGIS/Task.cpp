@@ -49,3 +49,9 @@ Task::isInExceptionState() const
 {
     return exception_state;
 }
+
+unsigned long long
+Task::getMemoryEstimate() const
+{
+    return 0;
+}
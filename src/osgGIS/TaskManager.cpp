@@ -132,6 +132,9 @@ TaskManager::init( int num_threads )
     }
 
     num_running_tasks = 0;
+    memory_budget = 0;
+    memory_in_use = 0;
+    throttled = false;
 
     for( int i=0; i<num_threads; i++ )
     {
@@ -186,6 +189,154 @@ TaskManager::cancelPendingTasks()
     pending_tasks = TaskQueue();
 }
 
+void
+TaskManager::setMemoryBudget( unsigned long long bytes )
+{
+    memory_budget = bytes;
+}
+
+unsigned long long
+TaskManager::getMemoryBudget() const
+{
+    return memory_budget;
+}
+
+unsigned long long
+TaskManager::getMemoryInUse() const
+{
+    return memory_in_use;
+}
+
+// whether the next pending task fits in the memory budget. If no task is holding
+// memory, it runs regardless, so that an oversized task cannot stall the queue.
+bool
+TaskManager::canDispatch( Task* task )
+{
+    if ( memory_budget == 0 || memory_in_use == 0 )
+        return true;
+
+    return memory_in_use + task->getMemoryEstimate() <= memory_budget;
+}
+
+// counts a task's current memory estimate against the budget, replacing any
+// earlier estimate for the same task.
+void
+TaskManager::chargeMemory( Task* task )
+{
+    releaseMemory( task );
+
+    unsigned long long bytes = task->getMemoryEstimate();
+    task_memory[task] = bytes;
+    memory_in_use += bytes;
+}
+
+void
+TaskManager::releaseMemory( Task* task )
+{
+    TaskMemoryMap::iterator i = task_memory.find( task );
+    if ( i != task_memory.end() )
+    {
+        memory_in_use -= i->second;
+        task_memory.erase( i );
+    }
+}
+
+// A batch of subtasks that several threads work through together.
+class SubtaskBatch : public osg::Referenced
+{
+public:
+    SubtaskBatch( const TaskList& _tasks ) : tasks( _tasks ), next( tasks.begin() ) { }
+
+    // runs subtasks until there are none left to start.
+    void runAll()
+    {
+        while( true )
+        {
+            osg::ref_ptr<Task> task;
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock( mutex );
+                if ( next == tasks.end() )
+                    break;
+                task = next->get();
+                next++;
+            }
+            task->run();
+        }
+    }
+
+    // signalled once by each lent thread as it finishes.
+    AutoResetBlock finished;
+
+private:
+    TaskList tasks;
+    TaskList::const_iterator next;
+    OpenThreads::Mutex mutex;
+};
+
+// Task that a lent thread runs to help work through a batch of subtasks.
+class SubtaskRunner : public Task
+{
+public:
+    SubtaskRunner( SubtaskBatch* _batch ) : Task( "subtasks" ), batch( _batch ) { }
+
+    virtual void run()
+    {
+        batch->runAll();
+        batch->finished.signal();
+    }
+
+private:
+    osg::ref_ptr<SubtaskBatch> batch;
+};
+
+void
+TaskManager::runSubtasks( const TaskList& tasks )
+{
+    // borrow idle threads, as many as there are subtasks beyond the first (which
+    // the calling thread takes):
+    TaskThreadList helpers;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( q_mutex );
+
+        for( TaskThreadList::iterator i = threads.begin(); i != threads.end() && helpers.size()+1 < tasks.size(); i++ )
+        {
+            if ( (*i)->getState() == TaskThread::STATE_READY && lent_threads.find( *i ) == lent_threads.end() &&
+                 (unsigned int)num_running_tasks + lent_threads.size() < threads.size() )
+            {
+                lent_threads.insert( *i );
+                helpers.push_back( *i );
+            }
+        }
+    }
+
+    osg::ref_ptr<SubtaskBatch> batch = new SubtaskBatch( tasks );
+    for( TaskThreadList::iterator i = helpers.begin(); i != helpers.end(); i++ )
+        (*i)->runTask( new SubtaskRunner( batch.get() ) );
+
+    batch->runAll();
+
+    for( unsigned int i = 0; i < helpers.size(); i++ )
+        batch->finished.block();
+
+    // return the threads, once they are through with their runners:
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( q_mutex );
+
+        for( TaskThreadList::iterator i = helpers.begin(); i != helpers.end(); i++ )
+        {
+            while( (*i)->getState() != TaskThread::STATE_RESULT_READY )
+                OpenThreads::Thread::YieldCurrentThread();
+
+            (*i)->removeTask();
+            lent_threads.erase( *i );
+        }
+    }
+
+    // let the manager know that it has threads to dispatch to again:
+    if ( helpers.size() > 0 )
+        activity_block.signal();
+}
+
 unsigned int
 TaskManager::getNumTasks() const
 {
@@ -200,6 +351,9 @@ TaskManager::getNextCompletedTask()
     {
         result = completed_tasks.front().get();
         completed_tasks.pop();
+
+        // the caller has the task now, so it no longer counts against the budget:
+        releaseMemory( result.get() );
     }
 
     return result;
@@ -210,10 +364,17 @@ TaskManager::update()
 {
     if ( multi_threaded )
     {
+        // running tasks may borrow threads at any time (see runSubtasks):
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( q_mutex );
+
         for( TaskThreadList::iterator i = threads.begin(); i != threads.end(); i++ )
         {
             TaskThread* thread = *i;
 
+            // threads running subtasks belong to the task that borrowed them:
+            if ( lent_threads.find( thread ) != lent_threads.end() )
+                continue;
+
             //osgGIS::notify(osg::ALWAYS) <<
             //    "UPDATE: pending=" << pending_tasks.size() << ", running=" << num_running_tasks << ", completed=" << completed_tasks.size() 
             //    << std::endl;
@@ -225,15 +386,30 @@ TaskManager::update()
                 osg::ref_ptr<Task> task = thread->removeTask();
                 completed_tasks.push( task.get() );
                 num_running_tasks--;
+
+                // the task's results stay in memory until the caller collects it:
+                chargeMemory( task.get() );
                 osgGIS::notify(osg::NOTICE) << thread->getID() << "> " << task->getName() << ": completed, time = " << seconds << "s" << std::endl;
             }
 
-            // dispatch any pending tasks:
-            if ( thread->getState() == TaskThread::STATE_READY && pending_tasks.size() > 0 )
+            // dispatch any pending tasks, memory permitting:
+            if ( thread->getState() == TaskThread::STATE_READY && pending_tasks.size() > 0 && !canDispatch( pending_tasks.front().get() ) )
+            {
+                if ( !throttled )
+                {
+                    osgGIS::notify(osg::NOTICE) << "Memory budget reached (" << (memory_in_use/1048576) << " of "
+                        << (memory_budget/1048576) << " MB in use); holding " << pending_tasks.size() << " pending tasks" << std::endl;
+                    throttled = true;
+                }
+            }
+            else if ( thread->getState() == TaskThread::STATE_READY && pending_tasks.size() > 0 &&
+                      (unsigned int)num_running_tasks + lent_threads.size() < threads.size() )
             {
                 osg::ref_ptr<Task> task = pending_tasks.front().get();
                 pending_tasks.pop();
                 num_running_tasks++;
+                chargeMemory( task.get() );
+                throttled = false;
                 thread->runTask( task.get() );
                 osgGIS::notify(osg::NOTICE) << thread->getID() << "> " << task->getName() << ": started" << std::endl;
             }
@@ -265,6 +441,7 @@ TaskManager::update()
                 osg::Timer_t t0 = osg::Timer::instance()->tick();
                 task->run();
                 completed_tasks.push( task.get() );
+                chargeMemory( task.get() );
                 osg::Timer_t t1 = osg::Timer::instance()->tick();
 
                 double seconds = osg::Timer::instance()->delta_s( t0, t1 );
@@ -0,0 +1,195 @@
+/**
+/* osgGIS - GIS Library for OpenSceneGraph
+ * Copyright 2007-2008 Glenn Waldron and Pelican Ventures, Inc.
+ * http://osggis.org
+ *
+ * osgGIS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <osgGIS/TraceLog>
+#include <osgGIS/TaskManager>
+#include <osg/Notify>
+#include <OpenThreads/ScopedLock>
+#include <fstream>
+#include <sstream>
+#include <set>
+#include <stdlib.h>
+
+using namespace osgGIS;
+using namespace OpenThreads;
+
+TraceLog::TraceLog()
+: enabled( false )
+{
+    //NOP
+}
+
+TraceLog::~TraceLog()
+{
+    //NOP
+}
+
+void
+TraceLog::setEnabled( bool value )
+{
+    enabled = value;
+}
+
+bool
+TraceLog::isEnabled() const
+{
+    return enabled;
+}
+
+// The calling thread's ID in the trace: 0 for the main thread, or the number of
+// the TaskManager thread.
+static int
+getTraceThreadId()
+{
+    TaskThread* thread = dynamic_cast<TaskThread*>( OpenThreads::Thread::CurrentThread() );
+    return thread? thread->getID() + 1 : 0;
+}
+
+void
+TraceLog::addEvent(const std::string& name,
+                   const std::string& category,
+                   osg::Timer_t       start,
+                   osg::Timer_t       end,
+                   const Properties&  args )
+{
+    if ( !enabled )
+        return;
+
+    Event event;
+    event.name = name;
+    event.category = category;
+    event.start = start;
+    event.end = end;
+    event.thread_id = getTraceThreadId();
+    event.args = args;
+
+    ScopedLock<Mutex> lock( events_mutex );
+    events.push_back( event );
+}
+
+unsigned int
+TraceLog::getNumEvents() const
+{
+    ScopedLock<Mutex> lock( events_mutex );
+    return events.size();
+}
+
+void
+TraceLog::clear()
+{
+    ScopedLock<Mutex> lock( events_mutex );
+    events.clear();
+}
+
+static std::string
+toJSONString( const std::string& input )
+{
+    std::string output = "\"";
+    for( std::string::const_iterator i = input.begin(); i != input.end(); i++ )
+    {
+        if ( *i == '"' || *i == '\\' )
+            output += '\\';
+        if ( (unsigned char)*i >= 0x20 )
+            output += *i;
+    }
+    return output + "\"";
+}
+
+// numeric values go out as numbers; everything else as a string.
+static std::string
+toJSONValue( const std::string& input )
+{
+    char* end = NULL;
+    strtod( input.c_str(), &end );
+    bool is_number =
+        input.length() > 0 && end && *end == 0 &&
+        input.find_first_not_of( "0123456789+-.eE" ) == std::string::npos;
+    return is_number? input : toJSONString( input );
+}
+
+bool
+TraceLog::write( const std::string& abs_path ) const
+{
+    std::ofstream out( abs_path.c_str() );
+    if ( !out.is_open() )
+    {
+        osgGIS::warn() << "Unable to write trace log to " << abs_path << std::endl;
+        return false;
+    }
+
+    ScopedLock<Mutex> lock( events_mutex );
+
+    // timestamps are in microseconds, relative to the first event:
+    osg::Timer_t origin = 0;
+    std::set<int> thread_ids;
+    for( std::vector<Event>::const_iterator i = events.begin(); i != events.end(); i++ )
+    {
+        if ( origin == 0 || i->start < origin )
+            origin = i->start;
+        thread_ids.insert( i->thread_id );
+    }
+
+    osg::Timer* timer = osg::Timer::instance();
+
+    out << "{\"traceEvents\":[" << std::endl;
+
+    bool first = true;
+    for( std::set<int>::const_iterator i = thread_ids.begin(); i != thread_ids.end(); i++ )
+    {
+        std::stringstream thread_name;
+        if ( *i == 0 )
+            thread_name << "main";
+        else
+            thread_name << "task thread " << *i;
+
+        out << (first? "" : ",\n")
+            << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << *i
+            << ",\"args\":{\"name\":" << toJSONString( thread_name.str() ) << "}}";
+        first = false;
+    }
+
+    for( std::vector<Event>::const_iterator i = events.begin(); i != events.end(); i++ )
+    {
+        out << (first? "" : ",\n")
+            << "{\"name\":" << toJSONString( i->name )
+            << ",\"cat\":" << toJSONString( i->category )
+            << ",\"ph\":\"X\""
+            << ",\"ts\":" << (long long)timer->delta_u( origin, i->start )
+            << ",\"dur\":" << (long long)timer->delta_u( i->start, i->end )
+            << ",\"pid\":1,\"tid\":" << i->thread_id;
+
+        if ( i->args.size() > 0 )
+        {
+            out << ",\"args\":{";
+            for( Properties::const_iterator j = i->args.begin(); j != i->args.end(); j++ )
+            {
+                out << (j != i->args.begin()? "," : "")
+                    << toJSONString( j->getName() ) << ":" << toJSONValue( j->getValue() );
+            }
+            out << "}";
+        }
+        out << "}";
+        first = false;
+    }
+
+    out << std::endl << "],\"displayTimeUnit\":\"ms\"}" << std::endl;
+    out.close();
+
+    return !out.fail();
+}
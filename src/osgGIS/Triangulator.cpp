@@ -0,0 +1,556 @@
+/**
+/* osgGIS - GIS Library for OpenSceneGraph
+ * Copyright 2007-2008 Glenn Waldron and Pelican Ventures, Inc.
+ * http://osggis.org
+ *
+ * osgGIS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <osgGIS/Triangulator>
+#include <osgUtil/Tessellator>
+#include <algorithm>
+#include <vector>
+#include <float.h>
+#include <math.h>
+
+using namespace osgGIS;
+
+// relative difference allowed between the area of a polygon and the total area of
+// its triangles before the triangulation is considered invalid
+#define AREA_TOLERANCE 1e-6
+
+// ear clipping is quadratic in the worst case, so very large polygons (coastlines
+// and the like) go to the tessellator instead
+#define MAX_EAR_CLIP_POINTS 4096
+
+
+// A ring vertex in the ear clipper's circular lists, projected into the plane of
+// the polygon.
+struct EarNode
+{
+    unsigned int i;
+    double x, y;
+    EarNode* prev;
+    EarNode* next;
+};
+
+typedef std::vector<EarNode> EarNodePool;
+
+
+// Twice the signed area of triangle (p,q,r); negative for a counter-clockwise turn.
+static double
+area( const EarNode* p, const EarNode* q, const EarNode* r )
+{
+    return (q->y - p->y) * (r->x - q->x) - (q->x - p->x) * (r->y - q->y);
+}
+
+static bool
+equals( const EarNode* p, const EarNode* q )
+{
+    return p->x == q->x && p->y == q->y;
+}
+
+static bool
+pointInTriangle( double ax, double ay, double bx, double by, double cx, double cy, double px, double py )
+{
+    return
+        (cx - px) * (ay - py) >= (ax - px) * (cy - py) &&
+        (ax - px) * (by - py) >= (bx - px) * (ay - py) &&
+        (bx - px) * (cy - py) >= (cx - px) * (by - py);
+}
+
+static EarNode*
+insertNode( EarNodePool& pool, unsigned int i, double x, double y, EarNode* last )
+{
+    // the pool is reserved up front, so node pointers stay valid:
+    EarNode node;
+    node.i = i;
+    node.x = x;
+    node.y = y;
+    pool.push_back( node );
+    EarNode* p = &pool.back();
+
+    if ( !last )
+    {
+        p->prev = p;
+        p->next = p;
+    }
+    else
+    {
+        p->next = last->next;
+        p->prev = last;
+        last->next->prev = p;
+        last->next = p;
+    }
+    return p;
+}
+
+static void
+removeNode( EarNode* p )
+{
+    p->next->prev = p->prev;
+    p->prev->next = p->next;
+}
+
+// Removes duplicate and collinear points between start and end.
+static EarNode*
+filterPoints( EarNode* start, EarNode* end =NULL )
+{
+    if ( !end )
+        end = start;
+
+    EarNode* p = start;
+    bool again;
+    do
+    {
+        again = false;
+        if ( equals( p, p->next ) || area( p->prev, p, p->next ) == 0.0 )
+        {
+            removeNode( p );
+            p = end = p->prev;
+            if ( p == p->next )
+                break;
+            again = true;
+        }
+        else
+        {
+            p = p->next;
+        }
+    }
+    while( again || p != end );
+
+    return end;
+}
+
+static bool
+isEar( const EarNode* ear )
+{
+    const EarNode* a = ear->prev;
+    const EarNode* b = ear;
+    const EarNode* c = ear->next;
+
+    if ( area( a, b, c ) >= 0.0 )
+        return false; // reflex
+
+    // make sure no other vertex lies within the candidate ear:
+    for( const EarNode* p = c->next; p != a; p = p->next )
+    {
+        if ( !equals( p, a ) &&
+             pointInTriangle( a->x, a->y, b->x, b->y, c->x, c->y, p->x, p->y ) &&
+             area( p->prev, p, p->next ) >= 0.0 )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Clips ears off a ring until only a triangle's worth remains. Returns false if
+// the ring stalls, which happens when it is not a simple polygon.
+static bool
+clipEars( EarNode* ear, std::vector<unsigned int>& output, bool filtered )
+{
+    EarNode* stop = ear;
+
+    while( ear->prev != ear->next )
+    {
+        EarNode* prev = ear->prev;
+        EarNode* next = ear->next;
+
+        if ( isEar( ear ) )
+        {
+            output.push_back( prev->i );
+            output.push_back( ear->i );
+            output.push_back( next->i );
+            removeNode( ear );
+
+            ear = next->next;
+            stop = next->next;
+            continue;
+        }
+
+        ear = next;
+
+        if ( ear == stop )
+        {
+            // no ear found in a full pass: clean up the ring and try once more.
+            return !filtered && clipEars( filterPoints( ear ), output, true );
+        }
+    }
+    return true;
+}
+
+static bool
+locallyInside( const EarNode* a, const EarNode* b )
+{
+    return area( a->prev, a, a->next ) < 0.0 ?
+        area( a, b, a->next ) >= 0.0 && area( a, a->prev, b ) >= 0.0 :
+        area( a, b, a->prev ) < 0.0 || area( a, a->next, b ) < 0.0;
+}
+
+static bool
+sectorContainsSector( const EarNode* m, const EarNode* p )
+{
+    return area( m->prev, m, p->prev ) < 0.0 && area( p->next, m, m->next ) < 0.0;
+}
+
+// Finds an outer ring vertex that can be connected to the leftmost vertex of a
+// hole without crossing any edge.
+static EarNode*
+findHoleBridge( EarNode* hole, EarNode* outer )
+{
+    double hx = hole->x, hy = hole->y;
+    double qx = -DBL_MAX;
+    EarNode* m = NULL;
+
+    // cast a ray to the left of the hole vertex and find the closest edge it hits:
+    EarNode* p = outer;
+    do
+    {
+        if ( hy <= p->y && hy >= p->next->y && p->next->y != p->y )
+        {
+            double x = p->x + (hy - p->y) * (p->next->x - p->x) / (p->next->y - p->y);
+            if ( x <= hx && x > qx )
+            {
+                qx = x;
+                m = p->x < p->next->x ? p : p->next;
+                if ( x == hx )
+                    return m;
+            }
+        }
+        p = p->next;
+    }
+    while( p != outer );
+
+    if ( !m )
+        return NULL;
+
+    // a reflex vertex inside the triangle (hole vertex, hit point, m) would block
+    // the bridge; if there is one, connect to the one with the shallowest angle:
+    EarNode* stop = m;
+    double mx = m->x, my = m->y;
+    double tan_min = DBL_MAX;
+
+    p = m;
+    do
+    {
+        if ( hx >= p->x && p->x >= mx && hx != p->x &&
+             pointInTriangle( hy < my ? hx : qx, hy, mx, my, hy < my ? qx : hx, hy, p->x, p->y ) )
+        {
+            double tan = fabs( hy - p->y ) / ( hx - p->x );
+            if ( locallyInside( p, hole ) &&
+                 ( tan < tan_min || ( tan == tan_min && ( p->x > m->x || ( p->x == m->x && sectorContainsSector( m, p ) ) ) ) ) )
+            {
+                m = p;
+                tan_min = tan;
+            }
+        }
+        p = p->next;
+    }
+    while( p != stop );
+
+    return m;
+}
+
+// Joins two rings (or splits one) with a pair of coincident edges between a and b.
+static EarNode*
+splitPolygon( EarNodePool& pool, EarNode* a, EarNode* b )
+{
+    pool.push_back( *a );
+    EarNode* a2 = &pool.back();
+    pool.push_back( *b );
+    EarNode* b2 = &pool.back();
+
+    EarNode* an = a->next;
+    EarNode* bp = b->prev;
+
+    a->next = b;
+    b->prev = a;
+
+    a2->next = an;
+    an->prev = a2;
+
+    b2->next = a2;
+    a2->prev = b2;
+
+    bp->next = b2;
+    b2->prev = bp;
+
+    return b2;
+}
+
+static bool
+compareX( const EarNode* a, const EarNode* b )
+{
+    return a->x < b->x || ( a->x == b->x && a->y < b->y );
+}
+
+
+// One ring of the polygon, projected into 2D.
+struct Ring
+{
+    unsigned int first, count;
+    double area;
+    int outer; // index of the ring that contains a hole
+};
+
+typedef std::vector<Ring> RingList;
+
+
+static double
+getRingArea( const std::vector<double>& xy, const Ring& ring )
+{
+    double sum = 0.0;
+    for( unsigned int k = 0; k < ring.count; k++ )
+    {
+        unsigned int a = 2*(ring.first + k);
+        unsigned int b = 2*(ring.first + (k+1) % ring.count);
+        sum += xy[a]*xy[b+1] - xy[b]*xy[a+1];
+    }
+    return 0.5 * sum;
+}
+
+static bool
+isPointInRing( const std::vector<double>& xy, const Ring& ring, double x, double y )
+{
+    bool inside = false;
+    for( unsigned int k = 0, j = ring.count-1; k < ring.count; j = k++ )
+    {
+        double xk = xy[2*(ring.first+k)], yk = xy[2*(ring.first+k)+1];
+        double xj = xy[2*(ring.first+j)], yj = xy[2*(ring.first+j)+1];
+        if ( ( (yk > y) != (yj > y) ) && ( x < (xj-xk) * (y-yk) / (yj-yk) + xk ) )
+            inside = !inside;
+    }
+    return inside;
+}
+
+
+Triangulator::Triangulator()
+{
+    num_fallbacks = 0;
+}
+
+unsigned int
+Triangulator::getNumFallbacks() const
+{
+    return num_fallbacks;
+}
+
+void
+Triangulator::triangulate( osg::Geometry* geom )
+{
+    if ( geom && !earClip( geom ) )
+    {
+        osgUtil::Tessellator tess;
+        tess.setTessellationType( osgUtil::Tessellator::TESS_TYPE_GEOMETRY );
+        tess.setWindingType( osgUtil::Tessellator::TESS_WINDING_POSITIVE );
+        tess.retessellatePolygons( *geom );
+        num_fallbacks++;
+    }
+}
+
+bool
+Triangulator::earClip( osg::Geometry* geom )
+{
+    osg::Vec3Array* verts = dynamic_cast<osg::Vec3Array*>( geom->getVertexArray() );
+    if ( !verts || geom->getNumPrimitiveSets() == 0 )
+        return false;
+
+    // collect the rings; anything but LINE_LOOP arrays is left to the tessellator.
+    RingList rings;
+    unsigned int num_points = 0;
+    for( unsigned int p = 0; p < geom->getNumPrimitiveSets(); p++ )
+    {
+        osg::DrawArrays* da = dynamic_cast<osg::DrawArrays*>( geom->getPrimitiveSet( p ) );
+        if ( !da || da->getMode() != osg::PrimitiveSet::LINE_LOOP || (unsigned int)(da->getFirst() + da->getCount()) > verts->size() )
+            return false;
+
+        if ( da->getCount() >= 3 )
+        {
+            Ring ring;
+            ring.first = da->getFirst();
+            ring.count = da->getCount();
+            ring.area = 0.0;
+            ring.outer = -1;
+            rings.push_back( ring );
+            num_points += ring.count;
+        }
+    }
+
+    if ( num_points > MAX_EAR_CLIP_POINTS )
+        return false;
+
+    // find the plane of the polygon (Newell's method) and project into it by
+    // dropping the dominant axis of its normal:
+    osg::Vec3d normal;
+    for( RingList::const_iterator r = rings.begin(); r != rings.end(); r++ )
+    {
+        for( unsigned int k = 0; k < r->count; k++ )
+        {
+            const osg::Vec3& c = (*verts)[r->first + k];
+            const osg::Vec3& n = (*verts)[r->first + (k+1) % r->count];
+            normal.x() += ( (double)c.y() - n.y() ) * ( (double)c.z() + n.z() );
+            normal.y() += ( (double)c.z() - n.z() ) * ( (double)c.x() + n.x() );
+            normal.z() += ( (double)c.x() - n.x() ) * ( (double)c.y() + n.y() );
+        }
+    }
+
+    int axis =
+        fabs( normal.z() ) >= fabs( normal.x() ) && fabs( normal.z() ) >= fabs( normal.y() )? 2 :
+        fabs( normal.x() ) >= fabs( normal.y() )? 0 :
+        1;
+    int u = (axis + 1) % 3, v = (axis + 2) % 3;
+
+    // project relative to the first vertex, to preserve precision:
+    osg::Vec3d origin = rings.size() > 0? osg::Vec3d( (*verts)[rings[0].first] ) : osg::Vec3d();
+    std::vector<double> xy( 2*verts->size() );
+    for( RingList::const_iterator r = rings.begin(); r != rings.end(); r++ )
+    {
+        for( unsigned int k = r->first; k < r->first + r->count; k++ )
+        {
+            osg::Vec3d p = osg::Vec3d( (*verts)[k] ) - origin;
+            xy[2*k]   = p[u];
+            xy[2*k+1] = p[v];
+        }
+    }
+
+    // orient the polygon so that its total area is positive, like GLU does. Under
+    // the positive winding rule, counter-clockwise rings are then filled and
+    // clockwise rings are holes.
+    double total_area = 0.0;
+    for( RingList::iterator r = rings.begin(); r != rings.end(); r++ )
+    {
+        r->area = getRingArea( xy, *r );
+        total_area += r->area;
+    }
+    if ( total_area == 0.0 )
+        return false;
+
+    if ( total_area < 0.0 )
+    {
+        for( unsigned int k = 1; k < xy.size(); k += 2 )
+            xy[k] = -xy[k];
+        for( RingList::iterator r = rings.begin(); r != rings.end(); r++ )
+            r->area = -r->area;
+    }
+
+    // assign each hole to the smallest polygon that contains it:
+    for( unsigned int h = 0; h < rings.size(); h++ )
+    {
+        if ( rings[h].area >= 0.0 )
+            continue;
+
+        double hx = xy[2*rings[h].first], hy = xy[2*rings[h].first+1];
+        for( unsigned int o = 0; o < rings.size(); o++ )
+        {
+            if ( rings[o].area > 0.0 &&
+                 ( rings[h].outer < 0 || rings[o].area < rings[rings[h].outer].area ) &&
+                 isPointInRing( xy, rings[o], hx, hy ) )
+            {
+                rings[h].outer = o;
+            }
+        }
+
+        // a hole outside of every polygon means the rings overlap in ways that
+        // only the tessellator can sort out:
+        if ( rings[h].outer < 0 )
+            return false;
+    }
+
+    // clip each polygon separately:
+    std::vector<unsigned int> indices;
+    indices.reserve( 3 * num_points );
+
+    EarNodePool pool;
+    pool.reserve( num_points + 2*rings.size() );
+
+    for( unsigned int o = 0; o < rings.size(); o++ )
+    {
+        if ( rings[o].area <= 0.0 )
+            continue;
+
+        pool.clear();
+        unsigned int first_index = indices.size();
+
+        EarNode* outer = NULL;
+        for( unsigned int k = rings[o].first; k < rings[o].first + rings[o].count; k++ )
+            outer = insertNode( pool, k, xy[2*k], xy[2*k+1], outer );
+        outer = filterPoints( outer );
+
+        double expected_area = rings[o].area;
+
+        // link in the holes, from left to right:
+        std::vector<EarNode*> holes;
+        for( unsigned int h = 0; h < rings.size(); h++ )
+        {
+            if ( rings[h].outer != (int)o )
+                continue;
+
+            EarNode* hole = NULL;
+            for( unsigned int k = rings[h].first; k < rings[h].first + rings[h].count; k++ )
+                hole = insertNode( pool, k, xy[2*k], xy[2*k+1], hole );
+            hole = filterPoints( hole );
+
+            EarNode* leftmost = hole;
+            EarNode* p = hole;
+            do
+            {
+                if ( compareX( p, leftmost ) )
+                    leftmost = p;
+                p = p->next;
+            }
+            while( p != hole );
+
+            holes.push_back( leftmost );
+            expected_area += rings[h].area;
+        }
+        std::sort( holes.begin(), holes.end(), compareX );
+
+        for( std::vector<EarNode*>::iterator h = holes.begin(); h != holes.end(); h++ )
+        {
+            EarNode* bridge = findHoleBridge( *h, outer );
+            if ( !bridge )
+                return false;
+
+            EarNode* bridge_reverse = splitPolygon( pool, bridge, *h );
+            filterPoints( bridge_reverse, bridge_reverse->next );
+            outer = filterPoints( bridge, bridge->next );
+        }
+
+        if ( outer->next == outer || outer->next->next == outer )
+            continue; // degenerate
+
+        if ( !clipEars( outer, indices, false ) )
+            return false;
+
+        // self-intersecting input does not always stall the clipper, but it
+        // always shows up as a mismatch between the polygon and triangle areas:
+        double tri_area = 0.0;
+        for( unsigned int t = first_index; t < indices.size(); t += 3 )
+        {
+            unsigned int a = indices[t], b = indices[t+1], c = indices[t+2];
+            tri_area += 0.5 * (
+                (xy[2*b] - xy[2*a]) * (xy[2*c+1] - xy[2*a+1]) -
+                (xy[2*c] - xy[2*a]) * (xy[2*b+1] - xy[2*a+1]) );
+        }
+        if ( fabs( tri_area - expected_area ) > AREA_TOLERANCE * rings[o].area )
+            return false;
+    }
+
+    geom->removePrimitiveSet( 0, geom->getNumPrimitiveSets() );
+    if ( indices.size() > 0 )
+        geom->addPrimitiveSet( new osg::DrawElementsUInt( osg::PrimitiveSet::TRIANGLES, indices.begin(), indices.end() ) );
+
+    return true;
+}
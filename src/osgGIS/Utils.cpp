@@ -4,14 +4,31 @@
 #include <osgDB/FileNameUtils>
 #include <osgDB/FileUtils>
 #include <osgDB/ReadFile>
+#include <osgDB/WriteFile>
 #include <osg/NodeVisitor>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/Texture>
 #include <osgUtil/IntersectionVisitor>
 #include <osgUtil/LineSegmentIntersector>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
 #include <iostream>
+#include <sstream>
+#include <iomanip>
 #include <algorithm>
 #include <float.h>
 #include <sys/stat.h>
+#include <stdio.h>
 #include <string>
+#include <set>
+
+#ifdef WIN32
+#  include <process.h>
+#  define getpid _getpid
+#else
+#  include <unistd.h>
+#endif
 
 using namespace osgGIS;
 
@@ -142,6 +159,92 @@ FileUtils::getFileTimeUTC(const std::string& abs_path)
     return 0L;
 }
 
+// Keeps the extension so that the same plugin writes the temporary file. The
+// process ID and a counter keep build processes and threads that write the same
+// shared resource from writing the same temporary file.
+std::string
+FileUtils::getPartialPath( const std::string& abs_path )
+{
+    static OpenThreads::Mutex s_counter_mutex;
+    static unsigned int s_counter = 0;
+    unsigned int count;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock( s_counter_mutex );
+        count = s_counter++;
+    }
+
+    std::string ext = osgDB::getFileExtension( abs_path );
+    std::stringstream buf;
+    buf << osgDB::getNameLessExtension( abs_path ) << ".partial" << getpid() << "_" << count;
+    if ( ext.length() > 0 )
+        buf << "." << ext;
+    return buf.str();
+}
+
+bool
+FileUtils::replaceFile( const std::string& temp_path, const std::string& abs_path )
+{
+    if ( ::rename( temp_path.c_str(), abs_path.c_str() ) != 0 )
+    {
+        // some platforms will not rename over an existing file:
+        ::remove( abs_path.c_str() );
+        if ( ::rename( temp_path.c_str(), abs_path.c_str() ) != 0 )
+        {
+            ::remove( temp_path.c_str() );
+            return false;
+        }
+    }
+    return true;
+}
+
+// The full source name goes into the cache name by way of a hash, so that same-
+// named sources in different folders get different cache files.
+std::string
+FileUtils::getWorkFilePath( const std::string& source_name, const std::string& suffix )
+{
+    if ( !Registry::instance()->hasWorkDirectory() )
+        return "";
+
+    unsigned int hash = 2166136261u; // FNV-1a
+    for( std::string::const_iterator i = source_name.begin(); i != source_name.end(); i++ )
+    {
+        hash ^= (unsigned char)*i;
+        hash *= 16777619u;
+    }
+
+    std::stringstream buf;
+    buf << osgDB::getSimpleFileName( source_name ) << "_" << std::hex << std::setw(8) << std::setfill('0') << hash << "_" << suffix;
+    return PathUtils::combinePaths( Registry::instance()->getWorkDirectory(), buf.str() );
+}
+
+bool
+FileUtils::writeNodeFile(const osg::Node& node,
+                         const std::string& abs_path,
+                         const osgDB::ReaderWriter::Options* options )
+{
+    std::string temp_path = getPartialPath( abs_path );
+    if ( !osgDB::writeNodeFile( node, temp_path, options ) )
+    {
+        ::remove( temp_path.c_str() );
+        return false;
+    }
+    return replaceFile( temp_path, abs_path );
+}
+
+bool
+FileUtils::writeImageFile(const osg::Image& image,
+                          const std::string& abs_path,
+                          const osgDB::ReaderWriter::Options* options )
+{
+    std::string temp_path = getPartialPath( abs_path );
+    if ( !osgDB::writeImageFile( image, temp_path, options ) )
+    {
+        ::remove( temp_path.c_str() );
+        return false;
+    }
+    return replaceFile( temp_path, abs_path );
+}
+
 
 bool
 GeomUtils::isPointInPolygon(const GeoPoint& point,
@@ -196,6 +299,92 @@ GeomUtils::closePolygon( GeoPointList& polygon )
     }
 }
 
+// Distance from a point to the segment (p0,p1), in the XY plane.
+static double
+getSegmentDistance2D( const GeoPoint& p, const GeoPoint& p0, const GeoPoint& p1 )
+{
+    double dx = p1.x() - p0.x(), dy = p1.y() - p0.y();
+    double len2 = dx*dx + dy*dy;
+    double t = len2 > 0.0? ( (p.x()-p0.x())*dx + (p.y()-p0.y())*dy ) / len2 : 0.0;
+    t = t < 0.0? 0.0 : t > 1.0? 1.0 : t;
+    double ex = p0.x() + t*dx - p.x(), ey = p0.y() + t*dy - p.y();
+    return sqrt( ex*ex + ey*ey );
+}
+
+struct ImportanceSpan {
+    ImportanceSpan( unsigned int _first, unsigned int _last, double _bound )
+        : first( _first ), last( _last ), bound( _bound ) { }
+    unsigned int first, last;
+    double bound;
+};
+
+void
+GeomUtils::computeVertexImportance(const GeoPointList& part,
+                                   bool is_ring,
+                                   std::vector<double>& output )
+{
+    unsigned int n = part.size();
+    output.assign( n, DBL_MAX );
+    if ( n < 3 )
+        return;
+
+    // each split point is clamped to the importance of the span that contains
+    // it, since Douglas-Peucker never visits a span whose parent was dropped:
+    std::vector<ImportanceSpan> spans;
+    if ( is_ring )
+    {
+        // anchor the ring at its first point and the point farthest from it:
+        unsigned int far = 0;
+        double far_d2 = -1.0;
+        for( unsigned int i = 1; i < n-1; i++ )
+        {
+            double d2 = ( part[i] - part[0] ).length2();
+            if ( d2 > far_d2 ) { far = i; far_d2 = d2; }
+        }
+        spans.push_back( ImportanceSpan( 0, far, DBL_MAX ) );
+        spans.push_back( ImportanceSpan( far, n-1, DBL_MAX ) );
+    }
+    else
+    {
+        spans.push_back( ImportanceSpan( 0, n-1, DBL_MAX ) );
+    }
+
+    while( spans.size() > 0 )
+    {
+        ImportanceSpan span = spans.back();
+        spans.pop_back();
+        if ( span.last - span.first < 2 )
+            continue;
+
+        unsigned int split = span.first + 1;
+        double split_d = -1.0;
+        for( unsigned int i = span.first + 1; i < span.last; i++ )
+        {
+            double d = getSegmentDistance2D( part[i], part[span.first], part[span.last] );
+            if ( d > split_d ) { split = i; split_d = d; }
+        }
+
+        double importance = std::min( split_d, span.bound );
+        output[split] = importance;
+        spans.push_back( ImportanceSpan( span.first, split, importance ) );
+        spans.push_back( ImportanceSpan( split, span.last, importance ) );
+    }
+
+    // a closed ring only has two distinct anchors, so keep the most important
+    // of the remaining points as well to guarantee a triangle:
+    if ( is_ring && part.front() == part.back() )
+    {
+        unsigned int best = 0;
+        for( unsigned int i = 1; i < n-1; i++ )
+        {
+            if ( output[i] < DBL_MAX && ( best == 0 || output[i] > output[best] ) )
+                best = i;
+        }
+        if ( best > 0 )
+            output[best] = DBL_MAX;
+    }
+}
+
 // note: none of the apply() overrides needs to call traverse(); this is intentional
 struct HasDrawablesVisitor : public osg::NodeVisitor {
     HasDrawablesVisitor() : osg::NodeVisitor( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN ), count(0) { }
@@ -218,6 +407,69 @@ GeomUtils::hasDrawables( osg::Node* node )
     return count > 0;
 }
 
+// adds up the vertex data, primitive indices and texture images in a graph,
+// counting shared objects once.
+struct MemoryUsageVisitor : public osg::NodeVisitor {
+    MemoryUsageVisitor() : osg::NodeVisitor( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN ), bytes(0) { }
+    void apply( osg::Node& node ) {
+        addStateSet( node.getStateSet() );
+        traverse( node );
+    }
+    void apply( osg::Geode& geode ) {
+        addStateSet( geode.getStateSet() );
+        for( unsigned int i = 0; i < geode.getNumDrawables(); i++ ) {
+            osg::Drawable* drawable = geode.getDrawable( i );
+            addStateSet( drawable->getStateSet() );
+            osg::Geometry* geom = drawable->asGeometry();
+            if ( geom ) {
+                addArray( geom->getVertexArray() );
+                addArray( geom->getNormalArray() );
+                addArray( geom->getColorArray() );
+                for( unsigned int j = 0; j < geom->getNumTexCoordArrays(); j++ )
+                    addArray( geom->getTexCoordArray( j ) );
+                for( unsigned int j = 0; j < geom->getNumPrimitiveSets(); j++ ) {
+                    // indices (at most 4 bytes each):
+                    osg::PrimitiveSet* prim_set = geom->getPrimitiveSet( j );
+                    if ( prim_set->getType() >= osg::PrimitiveSet::DrawElementsUBytePrimitiveType && visited.insert( prim_set ).second )
+                        bytes += 4 * prim_set->getNumIndices();
+                }
+            }
+        }
+    }
+    void addArray( const osg::Array* array ) {
+        if ( array && visited.insert( array ).second )
+            bytes += array->getTotalDataSize();
+    }
+    void addStateSet( osg::StateSet* state_set ) {
+        if ( state_set && visited.insert( state_set ).second ) {
+            for( unsigned int unit = 0; unit < state_set->getTextureAttributeList().size(); unit++ ) {
+                osg::Texture* tex = dynamic_cast<osg::Texture*>(
+                    state_set->getTextureAttribute( unit, osg::StateAttribute::TEXTURE ) );
+                for( unsigned int k = 0; tex && k < tex->getNumImages(); k++ ) {
+                    osg::Image* image = tex->getImage( k );
+                    if ( image && visited.insert( image ).second )
+                        bytes += image->getTotalSizeInBytes();
+                }
+            }
+        }
+    }
+    std::set<const osg::Referenced*> visited;
+    unsigned long long bytes;
+};
+
+unsigned long long
+GeomUtils::getMemoryUsage( osg::Node* node )
+{
+    unsigned long long bytes = 0;
+    if ( node )
+    {
+        MemoryUsageVisitor v;
+        node->accept( v );
+        bytes = v.bytes;
+    }
+    return bytes;
+}
+
 struct DVSetter : public osg::NodeVisitor {
     DVSetter( const osg::Object::DataVariance& _dv ) : osg::NodeVisitor( osg::NodeVisitor::TRAVERSE_ALL_CHILDREN ), dv( _dv ) { }
     void apply( osg::Node& node ) {
@@ -370,3 +622,45 @@ GeomUtils::clampToTerrain( const GeoPoint& input, osg::Node* terrain, SpatialRef
     return output;
 }
 
+unsigned int
+GeomUtils::clampToTerrain(const GeoPointList& input,
+                          osg::Node*          terrain,
+                          SpatialReference*   terrain_srs,
+                          SmartReadCallback*  reader,
+                          GeoPointList&       output )
+{
+    output.assign( input.size(), GeoPoint::invalid() );
+    unsigned int num_clamped = 0;
+
+    if ( terrain && terrain_srs && input.size() > 0 )
+    {
+        // one intersector per point, all of them riding the same traversal:
+        osg::ref_ptr<osgUtil::IntersectorGroup> group = new osgUtil::IntersectorGroup();
+        std::vector< osg::ref_ptr<LineSegmentIntersector2> > isectors;
+        isectors.reserve( input.size() );
+
+        for( GeoPointList::const_iterator i = input.begin(); i != input.end(); i++ )
+        {
+            double out_hat = 0;
+            isectors.push_back( createClampingIntersector( *i, out_hat ) );
+            group->addIntersector( isectors.back().get() );
+        }
+
+        RelaxedIntersectionVisitor iv;
+        iv.setIntersector( group.get() );
+        iv.setReadCallback( reader );
+        terrain->accept( iv );
+
+        for( unsigned int i = 0; i < isectors.size(); i++ )
+        {
+            if ( isectors[i]->containsIntersections() )
+            {
+                output[i] = GeoPoint( isectors[i]->getFirstIntersection().getWorldIntersectPoint(), terrain_srs );
+                num_clamped++;
+            }
+        }
+    }
+
+    return num_clamped;
+}
+
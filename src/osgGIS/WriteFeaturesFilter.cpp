@@ -18,7 +18,9 @@
  */
 
 #include <osgGIS/WriteFeaturesFilter>
+#include <osgGIS/SimpleFeature>
 #include <OpenThreads/ScopedLock>
+#include <algorithm>
 
 using namespace osgGIS;
 using namespace OpenThreads;
@@ -27,21 +29,25 @@ using namespace OpenThreads;
 OSGGIS_DEFINE_FILTER( WriteFeaturesFilter );
 
 
+#define DEFAULT_BATCH_SIZE 1000
+
 WriteFeaturesFilter::WriteFeaturesFilter()
 {
-    //NOP
+    batch_size = DEFAULT_BATCH_SIZE;
 }
 
 WriteFeaturesFilter::WriteFeaturesFilter( const WriteFeaturesFilter& rhs )
 : FeatureFilter( rhs ),
-  output_uri( rhs.output_uri )
+  output_uri( rhs.output_uri ),
+  batch_size( rhs.batch_size )
 {
     //NOP
 }
 
 WriteFeaturesFilter::~WriteFeaturesFilter()
 {
-    //NOP
+    // in case the graph never reached a checkpoint:
+    flush();
 }
 
 void
@@ -56,11 +62,25 @@ WriteFeaturesFilter::getOutputURI() const
     return output_uri;
 }
 
+void
+WriteFeaturesFilter::setBatchSize( int value )
+{
+    batch_size = std::max( value, 1 );
+}
+
+int
+WriteFeaturesFilter::getBatchSize() const
+{
+    return batch_size;
+}
+
 void
 WriteFeaturesFilter::setProperty( const Property& p )
 {
     if ( p.getName() == "output_uri" )
         setOutputURI( p.getValue() );
+    else if ( p.getName() == "batch_size" )
+        setBatchSize( p.getIntValue( getBatchSize() ) );
     else
         FeatureFilter::setProperty( p );
 }
@@ -71,11 +91,28 @@ WriteFeaturesFilter::getProperties() const
     Properties p = FeatureFilter::getProperties();
     if ( getOutputURI().length() > 0 )
         p.push_back( Property( "output_uri", getOutputURI() ) );
+    if ( getBatchSize() != DEFAULT_BATCH_SIZE )
+        p.push_back( Property( "batch_size", getBatchSize() ) );
     return p;
 }
 
 #define PROP_FEATURE_STORE "WriteFeaturesFilter:store"
 
+// copies a feature's shapes and attributes, so that filters further down the
+// graph cannot change a buffered feature before it is written.
+static Feature*
+copyFeature( const Feature* input )
+{
+    SimpleFeature* copy = new SimpleFeature();
+    copy->getShapes() = input->getShapes();
+
+    AttributeList attrs = input->getAttributes();
+    for( AttributeList::const_iterator i = attrs.begin(); i != attrs.end(); i++ )
+        copy->setAttribute( *i );
+
+    return copy;
+}
+
 FeatureList
 WriteFeaturesFilter::process( Feature* input, FilterEnv* env )
 {
@@ -84,15 +121,14 @@ WriteFeaturesFilter::process( Feature* input, FilterEnv* env )
     if ( getOutputURI().length() > 0 && input->hasShapeData() )
     {
         // open the feature store as a SESSION property so that all compilers can share it
-        FeatureStore* store = NULL;
-
-        // lock the session while fetching/creating the feature store:
+        if ( !store.valid() )
         {
+            // lock the session while fetching/creating the feature store:
             ScopedLock<ReentrantMutex> session_lock( env->getSession()->getSessionMutex() );
             Property p = env->getSession()->getProperty( PROP_FEATURE_STORE );
             store = dynamic_cast<FeatureStore*>( p.getRefValue() );
 
-            if ( !store )
+            if ( !store.valid() )
             {
                 store = Registry::instance()->getFeatureStoreFactory()->createFeatureStore(
                     getOutputURI(),
@@ -102,21 +138,43 @@ WriteFeaturesFilter::process( Feature* input, FilterEnv* env )
                     env->getInputSRS(),
                     Properties() );
 
-                if ( store )
+                if ( store.valid() )
                 {
-                    env->getSession()->setProperty( Property( PROP_FEATURE_STORE, store ) );
+                    env->getSession()->setProperty( Property( PROP_FEATURE_STORE, store.get() ) );
                     osgGIS::notify(osg::NOTICE) << "WriteFeatures: created feature store \"" << getOutputURI() << "\"" << std::endl;
                 }
             }
         }
 
-        if ( store )
+        if ( store.valid() && batch_size <= 1 )
         {
             store->insertFeature( input );
         }
+        else if ( store.valid() )
+        {
+            buffer.push_back( copyFeature( input ) );
+            if ( (int)buffer.size() >= batch_size )
+                flush();
+        }
     }
     
     output.push_back( input );
     return output;
 }
 
+void
+WriteFeaturesFilter::checkpoint( FilterEnv* env )
+{
+    flush();
+}
+
+void
+WriteFeaturesFilter::flush()
+{
+    if ( store.valid() && buffer.size() > 0 )
+    {
+        store->insertFeatures( buffer );
+    }
+    buffer.clear();
+}
+
@@ -0,0 +1,285 @@
+/**
+/* osgGIS - GIS Library for OpenSceneGraph
+ * Copyright 2007-2008 Glenn Waldron and Pelican Ventures, Inc.
+ * http://osggis.org
+ *
+ * osgGIS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <osgGISProjects/BuildManifest>
+#include <osgGIS/Utils>
+#include <OpenThreads/ScopedLock>
+#include <osgDB/FileUtils>
+#include <sstream>
+#include <stdio.h>
+
+using namespace osgGIS;
+using namespace osgGISProjects;
+using namespace OpenThreads;
+
+#define MANIFEST_HEADER "OSGGIS_BUILD_MANIFEST_1.0"
+#define STATUS_NON_EMPTY "nonempty"
+#define STATUS_EMPTY     "empty"
+#define STATUS_REMOVED   "removed"
+#define STATUS_CHECKPOINT "checkpoint"
+
+
+BuildManifest::BuildManifest( const std::string& _abs_path )
+: abs_path( _abs_path ),
+  journal_path( _abs_path )
+{
+    //NOP
+}
+
+BuildManifest::~BuildManifest()
+{
+    if ( journal.is_open() )
+        journal.close();
+}
+
+const std::string&
+BuildManifest::getAbsolutePath() const {
+    return abs_path;
+}
+
+bool
+BuildManifest::load()
+{
+    ScopedLock<Mutex> lock( mutex );
+
+    entries.clear();
+    unindexed_cells.clear();
+    return read( abs_path );
+}
+
+bool
+BuildManifest::mergeJournal( const std::string& path )
+{
+    ScopedLock<Mutex> lock( mutex );
+
+    // a journal holds no checkpoint lines, so all its cells stay unindexed:
+    return read( path );
+}
+
+void
+BuildManifest::setJournalPath( const std::string& path )
+{
+    ScopedLock<Mutex> lock( mutex );
+
+    if ( journal.is_open() )
+        journal.close();
+    journal_path = path;
+}
+
+// Format: a header line, then one line per recorded entry, each holding the cell
+// status, the signature, and the cell ID (which runs to the end of the line).
+// Later lines override earlier ones for the same cell. A checkpoint line marks
+// the point up to which the index reflects the entries.
+// A journal file has the same format. Reads the lines on top of the current
+// entries; caller must hold the mutex.
+bool
+BuildManifest::read( const std::string& path )
+{
+    std::ifstream input( path.c_str() );
+    if ( !input.is_open() )
+        return false;
+
+    std::string line;
+    std::getline( input, line );
+    if ( line != MANIFEST_HEADER )
+        return false;
+
+    while( std::getline( input, line ) )
+    {
+        // an unterminated last line was cut short by an interrupted build:
+        if ( input.eof() )
+            break;
+
+        std::istringstream buf( line );
+        std::string status, signature, cell_id;
+        buf >> status >> signature;
+        buf.get();
+        std::getline( buf, cell_id );
+
+        if ( status == STATUS_CHECKPOINT )
+        {
+            unindexed_cells.clear();
+            continue;
+        }
+
+        if ( cell_id.length() == 0 )
+            continue;
+
+        unindexed_cells.insert( cell_id );
+
+        if ( status == STATUS_REMOVED )
+        {
+            entries.erase( cell_id );
+        }
+        else
+        {
+            Entry& entry = entries[cell_id];
+            entry.signature = signature;
+            entry.empty = status == STATUS_EMPTY;
+        }
+    }
+
+    return true;
+}
+
+bool
+BuildManifest::save()
+{
+    ScopedLock<Mutex> lock( mutex );
+    return write( abs_path, true );
+}
+
+bool
+BuildManifest::saveJournal()
+{
+    ScopedLock<Mutex> lock( mutex );
+
+    // a journal holds no checkpoint line, so that its cells stay unindexed when
+    // it is merged:
+    return write( journal_path, journal_path == abs_path );
+}
+
+bool
+BuildManifest::checkpoint()
+{
+    ScopedLock<Mutex> lock( mutex );
+    unindexed_cells.clear();
+    return write( abs_path, true );
+}
+
+void
+BuildManifest::getUnindexedCells( std::set<std::string>& output ) const
+{
+    ScopedLock<Mutex> lock( mutex );
+    output.insert( unindexed_cells.begin(), unindexed_cells.end() );
+}
+
+// Rewrites a file with the indexed entries before the checkpoint line (if asked
+// to), and the unindexed ones (including removals) after it. The new file
+// replaces the old one only once it is complete. Caller must hold the mutex.
+bool
+BuildManifest::write( const std::string& path, bool include_indexed )
+{
+    if ( journal.is_open() )
+        journal.close();
+
+    osgDB::makeDirectoryForFile( path );
+
+    std::string temp_path = FileUtils::getPartialPath( path );
+    std::ofstream output( temp_path.c_str(), std::ios::trunc );
+    if ( !output.is_open() )
+        return false;
+
+    output << MANIFEST_HEADER << std::endl;
+    if ( include_indexed )
+    {
+        for( EntryTable::const_iterator i = entries.begin(); i != entries.end(); i++ )
+        {
+            if ( unindexed_cells.find( i->first ) == unindexed_cells.end() )
+            {
+                output << (i->second.empty? STATUS_EMPTY : STATUS_NON_EMPTY) << ' '
+                    << i->second.signature << ' ' << i->first << std::endl;
+            }
+        }
+
+        output << STATUS_CHECKPOINT << std::endl;
+    }
+
+    for( std::set<std::string>::const_iterator i = unindexed_cells.begin(); i != unindexed_cells.end(); i++ )
+    {
+        EntryTable::const_iterator entry = entries.find( *i );
+        if ( entry != entries.end() )
+        {
+            output << (entry->second.empty? STATUS_EMPTY : STATUS_NON_EMPTY) << ' '
+                << entry->second.signature << ' ' << entry->first << std::endl;
+        }
+        else
+        {
+            output << STATUS_REMOVED << " - " << *i << std::endl;
+        }
+    }
+
+    output.close();
+    if ( output.fail() )
+    {
+        ::remove( temp_path.c_str() );
+        return false;
+    }
+
+    return FileUtils::replaceFile( temp_path, path );
+}
+
+bool
+BuildManifest::getEntry( const std::string& cell_id, std::string& out_signature, bool& out_empty ) const
+{
+    ScopedLock<Mutex> lock( mutex );
+
+    EntryTable::const_iterator i = entries.find( cell_id );
+    if ( i == entries.end() )
+        return false;
+
+    out_signature = i->second.signature;
+    out_empty = i->second.empty;
+    return true;
+}
+
+void
+BuildManifest::setEntry( const std::string& cell_id, const std::string& signature, bool empty )
+{
+    ScopedLock<Mutex> lock( mutex );
+
+    Entry& entry = entries[cell_id];
+    entry.signature = signature;
+    entry.empty = empty;
+    unindexed_cells.insert( cell_id );
+    append( cell_id, signature, empty? STATUS_EMPTY : STATUS_NON_EMPTY );
+}
+
+void
+BuildManifest::removeEntry( const std::string& cell_id )
+{
+    ScopedLock<Mutex> lock( mutex );
+
+    if ( entries.erase( cell_id ) > 0 )
+    {
+        unindexed_cells.insert( cell_id );
+        append( cell_id, "-", STATUS_REMOVED );
+    }
+}
+
+// caller must hold the mutex.
+void
+BuildManifest::append( const std::string& cell_id, const std::string& signature, const std::string& status )
+{
+    if ( !journal.is_open() )
+    {
+        if ( !osgDB::fileExists( journal_path ) )
+        {
+            osgDB::makeDirectoryForFile( journal_path );
+            std::ofstream header( journal_path.c_str() );
+            header << MANIFEST_HEADER << std::endl;
+        }
+        journal.open( journal_path.c_str(), std::ios::app );
+    }
+
+    if ( journal.is_open() )
+    {
+        journal << status << ' ' << signature << ' ' << cell_id << std::endl;
+    }
+}
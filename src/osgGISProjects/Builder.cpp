@@ -22,13 +22,17 @@
 #include <osgGISProjects/QuadTreeMapLayerCompiler>
 #include <osgGISProjects/GriddedMapLayerCompiler>
 #include <osgGISProjects/SimpleMapLayerCompiler>
+#include <osgGISProjects/WorkerPool>
 #include <osgGIS/FeatureLayer>
+#include <osgGIS/AttributeIndex>
+#include <osgGIS/SimplificationIndex>
 #include <osgGIS/Registry>
 #include <osgGIS/FilterGraph>
 #include <osgGIS/Resource>
 #include <osgGIS/FeatureStoreCompiler>
 #include <osgGIS/Utils>
 #include <osgGIS/ResourcePackager>
+#include <osgGIS/TaskManager>
 #include <osg/Notify>
 #include <osgDB/ReadFile>
 #include <osgDB/FileUtils>
@@ -37,6 +41,11 @@
 #include <osgDB/Archive>
 #include <osgDB/Registry>
 #include <osgDB/ReaderWriter>
+#include <OpenThreads/Thread>
+#include <algorithm>
+#include <sstream>
+#include <map>
+#include <set>
 
 using namespace osgGISProjects;
 using namespace osgGIS;
@@ -103,6 +112,10 @@ Builder::Builder( Project* _project )
 {
     project = _project;
     num_threads = 0;
+    memory_budget_mb = 0;
+    num_workers = 1;
+    shard_index = 0;
+    shard_count = 1;
 }
 
 void
@@ -111,6 +124,69 @@ Builder::setNumThreads( int _num_threads )
     num_threads = _num_threads;
 }
 
+void
+Builder::setMemoryBudget( unsigned int megabytes )
+{
+    memory_budget_mb = megabytes;
+}
+
+void
+Builder::setWorkers( int _num_workers, const std::string& _worker_command )
+{
+    num_workers = _num_workers;
+    worker_command = _worker_command;
+}
+
+void
+Builder::setShard( int index, int count )
+{
+    shard_index = index;
+    shard_count = count;
+}
+
+int
+Builder::getMaxThreads() const
+{
+    return num_threads > 0? num_threads : std::max( 1, OpenThreads::GetNumberOfProcessors() );
+}
+
+void
+Builder::initWorkDirectory()
+{
+    std::string work_dir_name = project->getAbsoluteWorkingDirectory();
+    if ( work_dir_name.length() == 0 )
+        work_dir_name = "work_" + project->getName();
+
+    std::string work_dir = PathUtils::combinePaths( 
+        project->getBaseURI(),
+        work_dir_name );
+
+    if ( osgDB::makeDirectory( work_dir ) )
+    {
+        Registry::instance()->setWorkDirectory( work_dir );
+    }
+}
+
+Session*
+Builder::createSession()
+{
+    Session* session = new Session();
+
+    // add shared scripts to the session:
+    for( ScriptList::iterator i = project->getScripts().begin(); i != project->getScripts().end(); i++ )
+        session->addScript( i->get() );
+
+    // add shared resources to the session:
+    for( ResourceList::iterator i = project->getResources().begin(); i != project->getResources().end(); i++ )
+        session->getResources()->addResource( i->get() );
+
+    // the project's resources are all in; from here on the library is
+    // only read, by many compiler threads at once.
+    session->getResources()->freeze();
+
+    return session;
+}
+
 bool
 Builder::build()
 {
@@ -119,6 +195,16 @@ Builder::build()
 
     osgGIS::notice() << "No targets specified; building all layers." << std::endl;
 
+    // build all the intermediate sources up front, so that independent ones
+    // can build concurrently:
+    initWorkDirectory();
+    osg::ref_ptr<Session> session = createSession();
+    SourceList sources;
+    for( BuildLayerList::iterator i = project->getLayers().begin(); i != project->getLayers().end(); i++ )
+        collectSources( i->get(), sources );
+    if ( !build( sources, session.get() ) )
+        return false;
+
     bool ok = true;
 
     for( BuildLayerList::iterator i = project->getLayers().begin(); i != project->getLayers().end() && ok; i++ )
@@ -150,6 +236,19 @@ Builder::build( const std::string& target_name )
 }
 
 
+bool
+Builder::buildLayer( const std::string& layer_name )
+{
+    if ( !project.valid() )
+        return false;
+
+    BuildLayer* layer = project->getLayer( layer_name );
+    if ( !layer )
+        osgGIS::warn() << "No layer " << layer_name << " found in the project." << std::endl;
+    return layer? build( layer ) : false;
+}
+
+
 bool
 Builder::build( BuildTarget* target )
 {
@@ -158,6 +257,16 @@ Builder::build( BuildTarget* target )
 
     osgGIS::notice() << "Building target \"" << target->getName() << "\"." << std::endl;
 
+    // build all the intermediate sources up front, so that independent ones
+    // can build concurrently:
+    initWorkDirectory();
+    osg::ref_ptr<Session> session = createSession();
+    SourceList sources;
+    for( BuildLayerList::const_iterator i = target->getLayers().begin(); i != target->getLayers().end(); i++ )
+        collectSources( i->get(), sources );
+    if ( !build( sources, session.get() ) )
+        return false;
+
     bool ok = true;
 
     for( BuildLayerList::const_iterator i = target->getLayers().begin(); i != target->getLayers().end() && ok; i++ )
@@ -176,6 +285,13 @@ Builder::build( BuildTarget* target )
 // builds a source, if necessary.
 bool
 Builder::build( Source* source, Session* session )
+{
+    return build( source, session, getMaxThreads() );
+}
+
+
+bool
+Builder::build( Source* source, Session* session, int source_threads )
 {
     osgGIS::notice() << "Building source " << source->getName() << std::endl;
 
@@ -201,7 +317,7 @@ Builder::build( Source* source, Session* session )
     }
 
     // build it's parent first:
-    if ( !build( parent, session ) )
+    if ( !build( parent, session, source_threads ) )
     {
         osgGIS::warn() << "...ERROR: Failed to build source \"" << parent->getName() << "\", parent of source \"" << source->getName() << "\"" << std::endl;
         return false;
@@ -234,6 +350,9 @@ Builder::build( Source* source, Session* session )
     osg::ref_ptr<FilterEnv> source_env = temp_session->createFilterEnv();
 
     FeatureStoreCompiler compiler( feature_layer.get(), graph );
+    compiler.setNumThreads( source_threads );
+    if ( memory_budget_mb > 0 )
+        compiler.setMemoryBudget( (unsigned long long)memory_budget_mb * 1048576ULL );
 
     if ( !compiler.compile( source->getAbsoluteURI(), source_env.get() ) )
     {
@@ -247,6 +366,129 @@ Builder::build( Source* source, Session* session )
 }
 
 
+void
+Builder::collectSources( BuildLayer* layer, SourceList& output )
+{
+    if ( layer->getSource() )
+        output.push_back( layer->getSource() );
+    collectSources( layer->getSlices(), output );
+}
+
+
+void
+Builder::collectSources( BuildLayerSliceList& slices, SourceList& output )
+{
+    for( BuildLayerSliceList::iterator i = slices.begin(); i != slices.end(); i++ )
+    {
+        if ( i->get()->getSource() )
+            output.push_back( i->get()->getSource() );
+        collectSources( i->get()->getSubSlices(), output );
+    }
+}
+
+
+namespace osgGISProjects
+{
+    // Builds one intermediate source in a task thread.
+    class BuildSourceTask : public Task
+    {
+    public:
+        BuildSourceTask( Builder& _builder, Source* _source, Session* _session, int _source_threads )
+            : builder( _builder ),
+              source( _source ),
+              session( _session ),
+              source_threads( _source_threads ),
+              is_ok( false )
+        {
+            setName( "Source " + source->getName() );
+        }
+
+        void run()
+        {
+            is_ok = builder.build( source.get(), session.get(), source_threads );
+        }
+
+        bool isOK() const { return is_ok; }
+
+    private:
+        Builder&              builder;
+        osg::ref_ptr<Source>  source;
+        osg::ref_ptr<Session> session;
+        int                   source_threads;
+        bool                  is_ok;
+    };
+}
+
+
+bool
+Builder::build( SourceList& sources, Session* session )
+{
+    // sort the intermediate sources by depth (the number of intermediate ancestors),
+    // so that once one depth level is built, all the sources at the next level are
+    // independent of each other and can be built concurrently.
+    typedef std::map<int, SourceList> SourceLevels;
+    SourceLevels levels;
+    std::set<Source*> found;
+
+    for( SourceList::iterator i = sources.begin(); i != sources.end(); i++ )
+    {
+        for( Source* s = i->get(); s && s->isIntermediate() && found.find( s ) == found.end(); s = s->getParentSource() )
+        {
+            found.insert( s );
+            int depth = 0;
+            for( Source* p = s->getParentSource(); p && p->isIntermediate(); p = p->getParentSource() )
+                depth++;
+            levels[depth].push_back( s );
+        }
+    }
+
+    int max_threads = getMaxThreads();
+
+    for( SourceLevels::iterator i = levels.begin(); i != levels.end(); i++ )
+    {
+        SourceList& level = i->second;
+
+        if ( level.size() == 1 || max_threads == 1 )
+        {
+            for( SourceList::iterator j = level.begin(); j != level.end(); j++ )
+            {
+                if ( !build( j->get(), session, max_threads ) )
+                    return false;
+            }
+        }
+        else
+        {
+            // split the threads between the concurrent sources:
+            int num_tasks = std::min( (int)level.size(), max_threads );
+            int source_threads = std::max( 1, max_threads / num_tasks );
+
+            osg::ref_ptr<TaskManager> manager = new TaskManager( num_tasks );
+            for( SourceList::iterator j = level.begin(); j != level.end(); j++ )
+            {
+                manager->queueTask( new BuildSourceTask( *this, j->get(), session, source_threads ) );
+            }
+
+            bool ok = true;
+            while( manager->wait() )
+            {
+                osg::ref_ptr<Task> completed_task = manager->getNextCompletedTask();
+                if ( completed_task.valid() )
+                {
+                    BuildSourceTask* task = static_cast<BuildSourceTask*>( completed_task.get() );
+                    if ( task->isInExceptionState() || !task->isOK() )
+                        ok = false;
+                }
+            }
+
+            if ( !ok )
+                return false;
+        }
+    }
+
+    return true;
+}
+
+
 bool
 Builder::addSlicesToMapLayer(BuildLayerSliceList& slices,
                              const Properties& env_properties,
@@ -315,34 +557,68 @@ Builder::addSlicesToMapLayer(BuildLayerSliceList& slices,
 }
 
 
+// runs worker processes that compile the cells of a layer in shards, and waits
+// for them to finish.
 bool
-Builder::build( BuildLayer* layer )
+Builder::runWorkers( BuildLayer* layer, MapLayer* map_layer )
 {
-    std::string work_dir_name = project->getAbsoluteWorkingDirectory();
-    if ( work_dir_name.length() == 0 )
-        work_dir_name = "work_" + project->getName();
+    // build the cached indexes here, so the workers do not all race to build and
+    // write them: the spatial indexes, and the simplification and attribute
+    // indexes that the levels' graphs push down to the source.
+    for( MapLayerLevelsOfDetail::iterator i = map_layer->getLevels().begin(); i != map_layer->getLevels().end(); i++ )
+    {
+        FeatureLayer* feature_layer = i->get()->getFeatureLayer();
+        feature_layer->assertSpatialIndex();
 
-    std::string work_dir = PathUtils::combinePaths( 
-        project->getBaseURI(),
-        work_dir_name );
+        FilterGraph* graph = i->get()->getFilterGraph();
+        if ( graph )
+        {
+            if ( graph->getSourceTolerance() > 0.0 )
+                feature_layer->getSimplificationIndex();
 
-    if ( osgDB::makeDirectory( work_dir ) )
+            osg::ref_ptr<AttributeQuery> query = graph->createSourceQuery();
+            if ( query.valid() )
+            {
+                for( AttributeQuery::TermList::const_iterator t = query->getTerms().begin(); t != query->getTerms().end(); t++ )
+                {
+                    if ( AttributeIndex::canEvaluate( *t ) )
+                        feature_layer->getAttributeIndex( t->getName() );
+                }
+            }
+        }
+    }
+
+    osg::ref_ptr<WorkerPool> pool = new WorkerPool();
+    for( int i = 0; i < num_workers; i++ )
     {
-        Registry::instance()->setWorkDirectory( work_dir );
+        std::stringstream command;
+        command << worker_command << " --shard " << i << "/" << num_workers
+            << " --layer \"" << layer->getName() << "\"";
+        pool->addWorker( command.str() );
     }
 
-    osgGIS::notice() << "Building layer \"" << layer->getName() << "\"." << std::endl;
+    osgGIS::notice()
+        << "Compiling layer \"" << layer->getName() << "\" in "
+        << num_workers << " worker processes." << std::endl;
 
-    // first create and initialize a Session that will share data across the build.
-    osg::ref_ptr<Session> session = new Session();
+    bool ok = pool->run();
 
-    // add shared scripts to the session:
-    for( ScriptList::iterator i = project->getScripts().begin(); i != project->getScripts().end(); i++ )
-        session->addScript( i->get() );
+    osgGIS::notice()
+        << "Workers compiled " << pool->getNumCellsReported() << " cells." << std::endl;
 
-    // add shared resources to the session:
-    for( ResourceList::iterator i = project->getResources().begin(); i != project->getResources().end(); i++ )
-        session->getResources()->addResource( i->get() );
+    return ok;
+}
+
+
+bool
+Builder::build( BuildLayer* layer )
+{
+    initWorkDirectory();
+
+    osgGIS::notice() << "Building layer \"" << layer->getName() << "\"." << std::endl;
+
+    // first create and initialize a Session that will share data across the build.
+    osg::ref_ptr<Session> session = createSession();
 
     // now establish the source data record form this layer and open a feature layer
     // that connects to that source.
@@ -357,6 +633,17 @@ Builder::build( BuildLayer* layer )
 
 
 
+    // build all the sources this layer uses, independent ones concurrently:
+    SourceList layer_sources;
+    collectSources( layer, layer_sources );
+    if ( !build( layer_sources, session.get() ) )
+    {
+        osgGIS::warn()
+            << "Unable to build the sources for layer \"" << layer->getName() << "\"." 
+            << std::endl;
+        return false;
+    }
+
     // recursively build any sources that need building.
     if ( source && !build( source, session.get() ) )
     {
@@ -425,6 +712,15 @@ Builder::build( BuildLayer* layer )
 
     if ( osgDB::getLowerCaseFileExtension( output_file ) == "osga" )
     {
+        // an archive is written by one process only:
+        if ( shard_count > 1 )
+        {
+            osgGIS::warn()
+                << "Layer \"" << layer->getName() << "\" is written to an archive, and cannot be built in shards."
+                << std::endl;
+            return false;
+        }
+
         archive = osgDB::openArchive( output_file, osgDB::Archive::CREATE, 4096 );
         output_file = "out.ive";
 
@@ -439,6 +735,9 @@ Builder::build( BuildLayer* layer )
         num_threads < 1? new TaskManager() :
         NULL;
 
+    if ( manager.valid() && memory_budget_mb > 0 )
+        manager->setMemoryBudget( (unsigned long long)memory_budget_mb * 1048576ULL );
+
 
 
 
@@ -463,6 +762,17 @@ Builder::build( BuildLayer* layer )
         return false;
     }
 
+    // share a cache of decoded features across all the levels of the layer, since
+    // they (and neighboring cells) read many of the same features:
+    osg::ref_ptr<FeatureCache> feature_cache;
+    int feature_cache_mb = layer->getProperties().getIntValue( "feature_cache_mb", 64 );
+    if ( feature_cache_mb > 0 )
+    {
+        feature_cache = new FeatureCache( (unsigned long long)feature_cache_mb * 1048576 );
+        for( MapLayerLevelsOfDetail::iterator i = map_layer->getLevels().begin(); i != map_layer->getLevels().end(); i++ )
+            i->get()->getFeatureLayer()->setFeatureCache( feature_cache.get() );
+    }
+
     // calculate the grid cell size:
     double col_size = layer->getProperties().getDoubleValue( "col_size", -1.0 );
     double row_size = layer->getProperties().getDoubleValue( "row_size", -1.0 );
@@ -498,19 +808,89 @@ Builder::build( BuildLayer* layer )
     {
         compiler->setAbsoluteOutputURI( output_file );
         compiler->setPaged( layer->getProperties().getBoolValue( "paged", true ) );
+        compiler->setPrePartition( layer->getProperties().getBoolValue( "pre_partition", false ) );
+
+        // split cells whose estimated cost (source features + points) exceeds this:
+        int max_cell_cost = std::max( 0, layer->getProperties().getIntValue( "max_cell_cost", 0 ) );
+        compiler->setMaxCellCost( (unsigned int)max_cell_cost );
+
+        // without a task_order, the compiler picks one (see MapLayerCompiler::setTaskOrder):
+        std::string task_order = layer->getProperties().getValue( "task_order", "" );
+        if ( task_order == "fifo" )
+            compiler->setTaskOrder( MapLayerCompiler::TASK_ORDER_FIFO );
+        else if ( task_order == "zorder" )
+            compiler->setTaskOrder( MapLayerCompiler::TASK_ORDER_Z_ORDER );
+        else if ( task_order == "hilbert" )
+            compiler->setTaskOrder( MapLayerCompiler::TASK_ORDER_HILBERT );
+        else if ( task_order == "largest_first" )
+            compiler->setTaskOrder( MapLayerCompiler::TASK_ORDER_LARGEST_FIRST );
+        else if ( task_order.length() > 0 )
+            osgGIS::warn() << "Unknown task_order \"" << task_order << "\"; using the default" << std::endl;
+
         compiler->setTerrain( terrain_node.get(), terrain_srs.get(), terrain_extent );
+
+        if ( terrain && terrain->getURI().length() > 0 )
+        {
+            // cells compiled against an older terrain are out of date:
+            std::stringstream terrain_version;
+            terrain_version << terrain->getAbsoluteURI() << "@" << FileUtils::getFileTimeUTC( terrain->getAbsoluteURI() );
+            compiler->setTerrainVersion( terrain_version.str() );
+        }
+
         compiler->setArchive( archive.get(), archive_file );
         compiler->setResourcePackager( packager.get() );
 
-        // build the layer and write the root file to output:
-        osg::ref_ptr<osg::Group> result = compiler->compile( manager.get() );
+        if ( shard_count > 1 )
+        {
+            // as a worker, compile one shard of the cells and report each one as
+            // it completes; the process that started us builds the index:
+            compiler->setShard( shard_index, shard_count );
 
-        if ( result.valid() )
+            osg::ref_ptr<CompileSession> cs = compiler->startCompiling( manager.get() );
+            bool more_tasks = true;
+            while( more_tasks )
+            {
+                more_tasks = compiler->continueCompiling( cs.get() );
+                for( osg::ref_ptr<Task> task = cs->getNextCompletedTask(); task.valid(); task = cs->getNextCompletedTask() )
+                {
+                    CellCompiler* cell_compiler = dynamic_cast<CellCompiler*>( task.get() );
+                    if ( cell_compiler && cell_compiler->getResult().isOK() )
+                        WorkerPool::reportCell( cell_compiler->getCellId() );
+                }
+            }
+            compiler->finishCompiling( cs.get() );
+        }
+        else
         {
-            packager->packageNode( result.get(), output_file );
+            // farm the cells out to worker processes; the compilation below then
+            // skips the cells they finished, and builds the index:
+            if ( num_workers > 1 && !archive.valid() && layer->getType() != BuildLayer::TYPE_SIMPLE )
+            {
+                if ( !runWorkers( layer, map_layer.get() ) )
+                {
+                    osgGIS::warn()
+                        << "Not all workers finished; compiling their remaining cells here." << std::endl;
+                }
+            }
+
+            // build the layer and write the root file to output:
+            osg::ref_ptr<osg::Group> result = compiler->compile( manager.get() );
+
+            if ( result.valid() )
+            {
+                packager->packageNode( result.get(), output_file );
+            }
         }
     }
 
+    if ( feature_cache.valid() )
+    {
+        osgGIS::notice()
+            << "Feature cache: " << feature_cache->getHits() << " hits, "
+            << feature_cache->getMisses() << " misses ("
+            << (int)feature_cache->getHitRate() << "% hit rate)" << std::endl;
+    }
+
     if ( archive.valid() )
     {
         archive->close();
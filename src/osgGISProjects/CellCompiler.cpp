@@ -17,11 +17,106 @@
 */
 #include <osgGISProjects/CellCompiler>
 #include <osgGIS/Utils>
+#include <osgGIS/Session>
+#include <osgGIS/TaskManager>
+#include <osgGIS/Registry>
+#include <osgGIS/SpatialIndex>
 #include <osgDB/FileUtils>
+#include <algorithm>
+#include <sstream>
+#include <stdio.h>
 
 using namespace osgGISProjects;
 
 
+// Accumulates a 64-bit FNV-1a hash over the data fed to it.
+class SignatureBuilder
+{
+public:
+    SignatureBuilder() : hash( 14695981039346656037ULL ) { }
+
+    void add( const void* data, unsigned int len )
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>( data );
+        for( unsigned int i=0; i<len; i++ )
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ULL;
+        }
+    }
+
+    void add( const std::string& value )
+    {
+        // include the terminator so that adjacent strings cannot run together
+        add( value.c_str(), value.length()+1 );
+    }
+
+    void add( double value )
+    {
+        add( &value, sizeof(value) );
+    }
+
+    std::string toString() const
+    {
+        char buf[17];
+        sprintf( buf, "%016llx", hash );
+        return std::string( buf );
+    }
+
+private:
+    unsigned long long hash;
+};
+
+// Adds a feature's content (its shapes and attributes) to a signature.
+static void
+addFeature( SignatureBuilder& sig, Feature* feature )
+{
+    const GeoShapeList& shapes = feature->getShapes();
+    for( GeoShapeList::const_iterator i = shapes.begin(); i != shapes.end(); i++ )
+    {
+        sig.add( (double)i->getShapeType() );
+        for( GeoPartList::const_iterator j = i->getParts().begin(); j != i->getParts().end(); j++ )
+        {
+            sig.add( (double)j->size() );
+            for( GeoPointList::const_iterator k = j->begin(); k != j->end(); k++ )
+                sig.add( k->ptr(), sizeof(double)*3 );
+        }
+    }
+
+    AttributeList attrs = feature->getAttributes();
+    for( AttributeList::const_iterator i = attrs.begin(); i != attrs.end(); i++ )
+    {
+        sig.add( i->getKey() );
+        sig.add( std::string( i->asString() ) );
+    }
+}
+
+
+// Compiles one chunk of a cell's features.
+class CellChunkCompiler : public FeatureLayerCompiler
+{
+public:
+    CellChunkCompiler(
+        const std::string&   name,
+        FeatureLayer*        layer,
+        FilterGraph*         graph,
+        FilterEnv*           env,
+        const FeatureCursor& _cursor )
+        : FeatureLayerCompiler( name, layer, graph, env ),
+          cursor( _cursor ) { }
+
+protected:
+    virtual FeatureCursor createSourceCursor( const AttributeQuery* query )
+    {
+        // the cell already applied the query when it created the cursor:
+        return cursor;
+    }
+
+private:
+    FeatureCursor cursor;
+};
+
+
 CellCompiler::CellCompiler(const std::string& _cell_id,
                            const std::string& _abs_output_uri,
                            FeatureLayer*      layer,
@@ -46,6 +141,227 @@ CellCompiler::CellCompiler(const std::string& _cell_id,
     env->setTerrainReadCallback( smart );
     setUserData( _user_data );
     output_status = CellCompiler::OUTPUT_UNKNOWN;
+    num_chunks = 1;
+    task_man = NULL;
+    memory_estimate = 0;
+}
+
+void
+CellCompiler::setBuildManifest( BuildManifest* _manifest, const std::string& _inputs_version )
+{
+    manifest = _manifest;
+    inputs_version = _inputs_version;
+}
+
+const std::string&
+CellCompiler::getSignature() const {
+    return signature;
+}
+
+bool
+CellCompiler::wasCompiled() const {
+    return need_to_compile;
+}
+
+void
+CellCompiler::setFeatureBucket( const std::string& abs_path )
+{
+    bucket_path = abs_path;
+    bucket = NULL;
+}
+
+const std::string&
+CellCompiler::getFeatureBucket() const {
+    return bucket_path;
+}
+
+void
+CellCompiler::setNumChunks( unsigned int value )
+{
+    num_chunks = std::max( value, 1u );
+}
+
+unsigned int
+CellCompiler::getNumChunks() const {
+    return num_chunks;
+}
+
+void
+CellCompiler::setTaskManager( TaskManager* value )
+{
+    task_man = value;
+}
+
+void
+CellCompiler::setMemoryEstimate( unsigned long long bytes )
+{
+    memory_estimate = bytes;
+}
+
+unsigned long long
+CellCompiler::getMemoryEstimate() const {
+    return memory_estimate;
+}
+
+FeatureCursor
+CellCompiler::createSourceCursor( const AttributeQuery* query )
+{
+    if ( bucket_path.length() > 0 )
+    {
+        // the partitioner already applied the query (and simplified the features)
+        // when it filled the bucket.
+        if ( !bucket.valid() )
+            bucket = new FeatureBucket( bucket_path, layer->getSRS() );
+        FeatureCursor cursor = bucket->getCursor();
+        cursor.setSimplification( NULL, filter_graph->getSourceTolerance() );
+        return cursor;
+    }
+    else
+    {
+        return FeatureLayerCompiler::createSourceCursor( query );
+    }
+}
+
+// Hashes everything that determines the content of the cell: the filter graph,
+// the environment, the shared inputs (terrain, scripts and resources), and the
+// input features. Only the features the spatial index finds in the cell count,
+// by their OIDs and content, so that an edit elsewhere in the store does not
+// dirty the cell. Reading them goes through the layer's feature cache, which
+// the compile then reuses if the cell turns out to be dirty.
+std::string
+CellCompiler::computeSignature()
+{
+    SignatureBuilder sig;
+
+    sig.add( filter_graph->getName() );
+    for( FilterList::const_iterator i = filter_graph->getFilters().begin(); i != filter_graph->getFilters().end(); i++ )
+    {
+        sig.add( i->get()->getFilterType() );
+        Properties props = i->get()->getProperties();
+        for( Properties::const_iterator j = props.begin(); j != props.end(); j++ )
+        {
+            sig.add( j->getName() );
+            sig.add( j->getValue() );
+        }
+    }
+
+    sig.add( env->getExtent().toString() );
+    for( Properties::const_iterator i = env->getProperties().begin(); i != env->getProperties().end(); i++ )
+    {
+        sig.add( i->getName() );
+        sig.add( i->getValue() );
+    }
+    sig.add( min_range );
+    sig.add( max_range );
+
+    sig.add( inputs_version );
+    if ( env->getTerrainSRS() )
+        sig.add( env->getTerrainSRS()->getWKT() );
+    if ( layer->getSRS() )
+        sig.add( layer->getSRS()->getWKT() );
+
+    SpatialIndex* index = layer->getSpatialIndex();
+    if ( index )
+    {
+        FeatureOIDList oids;
+        index->getOIDs( env->getExtent(), oids );
+        std::sort( oids.begin(), oids.end() );
+        for( FeatureOIDList::const_iterator i = oids.begin(); i != oids.end(); i++ )
+        {
+            sig.add( (double)*i );
+
+            osg::ref_ptr<Feature> feature = layer->getFeature( *i );
+            if ( feature.valid() )
+                addFeature( sig, feature.get() );
+        }
+    }
+
+    return sig.toString();
+}
+
+// Creates a filter environment for one chunk of the cell. Each chunk needs its
+// own, since filter environments (and their resource caches and script engines)
+// are not meant for use by more than one thread at a time.
+FilterEnv*
+CellCompiler::createChunkEnv()
+{
+    FilterEnv* chunk_env = env->getSession()->createFilterEnv();
+
+    chunk_env->setTerrainNode( env->getTerrainNode() );
+    chunk_env->setTerrainSRS( env->getTerrainSRS() );
+    chunk_env->setInputSRS( env->getInputSRS() );
+
+    chunk_env->setExtent( env->getExtent() );
+
+    for( Properties::const_iterator i = env->getProperties().begin(); i != env->getProperties().end(); i++ )
+        chunk_env->setProperty( *i );
+
+    SmartReadCallback* smart = new SmartReadCallback();
+    smart->setMinRange( min_range );
+    chunk_env->setTerrainReadCallback( smart );
+
+    return chunk_env;
+}
+
+// Compiles the cell's features in parallel chunks, and gathers the chunks'
+// results and statistics as if the cell had been compiled as a whole.
+void
+CellCompiler::runChunks()
+{
+    env->getReport()->markStartTime();
+    env->setInputSRS( layer->getSRS() );
+
+    osg::ref_ptr<AttributeQuery> query = filter_graph->createSourceQuery();
+    FeatureCursor cursor = createSourceCursor( query.get() );
+
+    TaskList chunks;
+    for( unsigned int i = 0; i < num_chunks; i++ )
+    {
+        std::stringstream buf;
+        buf << getName() << " (chunk " << i+1 << "/" << num_chunks << ")";
+
+        chunks.push_back( new CellChunkCompiler(
+            buf.str(), layer.get(), filter_graph.get(), createChunkEnv(), cursor.getPartition( i, num_chunks ) ) );
+    }
+
+    // run the chunks on this thread and on any threads the build isn't using.
+    // Without a task manager, run them here one at a time:
+    if ( task_man )
+    {
+        task_man->runSubtasks( chunks );
+    }
+    else
+    {
+        for( TaskList::iterator i = chunks.begin(); i != chunks.end(); i++ )
+            i->get()->run();
+    }
+
+    osg::ref_ptr<osg::Group> group = new osg::Group();
+    result = FilterGraphResult::ok();
+
+    for( TaskList::iterator i = chunks.begin(); i != chunks.end(); i++ )
+    {
+        CellChunkCompiler* chunk = static_cast<CellChunkCompiler*>( i->get() );
+        if ( !chunk->getResult().isOK() )
+        {
+            result = chunk->getResult();
+        }
+        else if ( chunk->getResultNode() )
+        {
+            group->addChild( chunk->getResultNode() );
+        }
+
+        env->getReport()->merge( chunk->getFilterEnv()->getReport() );
+        env->getResourceCache()->merge( chunk->getFilterEnv()->getResourceCache() );
+    }
+
+    result_node = group.get();
+
+    env->getReport()->markEndTime();
+
+    Registry::instance()->getTraceLog()->addEvent(
+        getName(), "cell",
+        env->getReport()->getStartTime(), env->getReport()->getEndTime() );
 }
 
 const std::string&
@@ -64,13 +380,37 @@ CellCompiler::run() // overrides FeatureLayerCompiler::run()
     // first check to see whether this cell needs compiling:
     need_to_compile = archive.valid() || !osgDB::fileExists( abs_output_uri );
 
+    // with a build manifest, compile the cell only if its inputs changed since the
+    // last build (or if its output went missing):
+    signature = "";
+    bool known_empty = false;
+    if ( manifest.valid() && !archive.valid() && layer.valid() && filter_graph.valid() && env.valid() )
+    {
+        signature = computeSignature();
+
+        std::string recorded_signature;
+        bool recorded_empty = false;
+        if ( manifest->getEntry( cell_id, recorded_signature, recorded_empty ) && recorded_signature == signature )
+        {
+            known_empty = recorded_empty;
+            need_to_compile = !recorded_empty && !osgDB::fileExists( abs_output_uri );
+        }
+        else
+        {
+            need_to_compile = true;
+        }
+    }
+
     output_status = CellCompiler::OUTPUT_UNKNOWN;
     //has_drawables = false;
 
     if ( need_to_compile )
     {
-        // Compile the cell:
-        FeatureLayerCompiler::run();
+        // Compile the cell, splitting it up if it's expensive:
+        if ( num_chunks > 1 && layer.valid() && filter_graph.valid() && env.valid() )
+            runChunks();
+        else
+            FeatureLayerCompiler::run();
 
         // Write the resulting node graph to disk, first ensuring that the output folder exists:
         // TODO: consider whether this belongs in the runSynchronousPostProcess() method
@@ -89,9 +429,15 @@ CellCompiler::run() // overrides FeatureLayerCompiler::run()
     else
     {
         result = FilterGraphResult::ok();
-        output_status = CellCompiler::OUTPUT_ALREADY_EXISTS;
+        output_status = known_empty? CellCompiler::OUTPUT_EMPTY : CellCompiler::OUTPUT_ALREADY_EXISTS;
         //has_drawables = true;
     }
+
+    // release the bucket's copy of the features:
+    bucket = NULL;
+
+    // from here on, the cell holds on to its result until it's packaged:
+    memory_estimate = GeomUtils::getMemoryUsage( getResultNode() );
 }
 
 void
@@ -109,6 +455,16 @@ CellCompiler::runSynchronousPostProcess( Report* report )
         {
             osgGIS::info() << getName() << " resulted in no geometry" << std::endl;
             result_node = NULL;
+
+            if ( manifest.valid() && signature.length() > 0 )
+            {
+                // remove output left over from a previous build so that the index
+                // no longer refers to it:
+                if ( osgDB::fileExists( abs_output_uri ) )
+                    ::remove( abs_output_uri.c_str() );
+
+                manifest->setEntry( cell_id, signature, true );
+            }
             return;
         }
 
@@ -129,6 +485,13 @@ CellCompiler::runSynchronousPostProcess( Report* report )
             {
                 osgGIS::warn() << getName() << " failed to package node to output location" << std::endl;
                 result = FilterGraphResult::error( "Cell built OK, but failed to deploy to disk/archive" );
+
+                if ( manifest.valid() )
+                    manifest->removeEntry( cell_id );
+            }
+            else if ( manifest.valid() && signature.length() > 0 )
+            {
+                manifest->setEntry( cell_id, signature, false );
             }
         }
     }
@@ -138,4 +501,4 @@ CellCompiler::OutputStatus
 CellCompiler::getOutputStatus() const
 {
     return output_status;
-}
\ No newline at end of file
+}
@@ -0,0 +1,308 @@
+/**
+/* osgGIS - GIS Library for OpenSceneGraph
+ * Copyright 2007-2008 Glenn Waldron and Pelican Ventures, Inc.
+ * http://osggis.org
+ *
+ * osgGIS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <osgGISProjects/CellPartitioner>
+#include <osgGIS/FeatureBucket>
+#include <osgGIS/CropFilter>
+#include <osgGIS/DecimateFilter>
+#include <osgGIS/SelectFilter>
+#include <osgGIS/RTree>
+#include <osgGIS/Utils>
+#include <algorithm>
+#include <fstream>
+#include <stdio.h>
+
+using namespace osgGISProjects;
+
+#define DEFAULT_MAX_BUFFER_SIZE 67108864 // 64MB
+
+
+// The cells of one feature layer that share a filter graph, and therefore
+// select and prepare their features the same way.
+class CellGroup
+{
+public:
+    CellGroup( FilterGraph* _graph ) : graph( _graph ), crop( false )
+    {
+        index = new RTree<unsigned int>();
+        query = graph->createSourceQuery();
+        tolerance = graph->getSourceTolerance();
+
+        // a cell that starts by cropping can take its features pre-cropped, as
+        // long as the selection ahead of the crop depends only on attributes
+        // (and any simplification ahead of it is applied first):
+        bool simplified = false;
+        for( FilterList::const_iterator i = graph->getFilters().begin(); i != graph->getFilters().end(); i++ )
+        {
+            SelectFilter* select = dynamic_cast<SelectFilter*>( i->get() );
+            if ( !select )
+            {
+                if ( tolerance > 0.0 && !simplified && dynamic_cast<DecimateFilter*>( i->get() ) )
+                {
+                    simplified = true;
+                    continue;
+                }
+                crop = dynamic_cast<CropFilter*>( i->get() ) != NULL;
+                break;
+            }
+            else if ( !select->getAttributeQuery() )
+            {
+                break;
+            }
+        }
+    }
+
+    osg::ref_ptr<FilterGraph>            graph;
+    osg::ref_ptr<AttributeQuery>         query;
+    osg::ref_ptr< RTree<unsigned int> >  index;
+    double                               tolerance;
+    bool                                 crop;
+};
+
+typedef std::vector<CellGroup> CellGroupList;
+
+
+CellPartitioner::CellPartitioner( const std::string& _abs_path_prefix )
+: abs_path_prefix( _abs_path_prefix ),
+  max_buffer_size( DEFAULT_MAX_BUFFER_SIZE ),
+  buffered_bytes( 0 )
+{
+    //NOP
+}
+
+CellPartitioner::~CellPartitioner()
+{
+    //NOP
+}
+
+void
+CellPartitioner::setMaxBufferSize( unsigned int value )
+{
+    max_buffer_size = value;
+}
+
+unsigned int
+CellPartitioner::getMaxBufferSize() const
+{
+    return max_buffer_size;
+}
+
+void
+CellPartitioner::addCell( CellCompiler* task )
+{
+    if ( task && task->getFeatureLayer() && task->getFilterGraph() && task->getFilterEnv() )
+    {
+        CellEntry entry;
+        entry.task = task;
+        entry.bucket_path = abs_path_prefix + task->getCellId() + ".bucket";
+        cells.push_back( entry );
+
+        task->setFeatureBucket( entry.bucket_path );
+    }
+}
+
+bool
+CellPartitioner::run()
+{
+    // clear out any buckets left over from an interrupted build:
+    removeAllBuckets();
+
+    // partition each distinct feature layer once:
+    std::vector<FeatureLayer*> layers;
+    for( CellEntryList::const_iterator i = cells.begin(); i != cells.end(); i++ )
+    {
+        FeatureLayer* layer = i->task->getFeatureLayer();
+        if ( std::find( layers.begin(), layers.end(), layer ) == layers.end() )
+            layers.push_back( layer );
+    }
+
+    bool ok = true;
+    for( std::vector<FeatureLayer*>::iterator i = layers.begin(); i != layers.end() && ok; i++ )
+    {
+        ok = partition( *i ) && flush();
+    }
+
+    if ( !ok )
+    {
+        osgGIS::warn() << "[CellPartitioner] Partitioning failed; cells will query their feature layers instead" << std::endl;
+
+        buffers.clear();
+        buffered_bytes = 0;
+        removeAllBuckets();
+        for( CellEntryList::iterator i = cells.begin(); i != cells.end(); i++ )
+            i->task->setFeatureBucket( "" );
+    }
+
+    return ok;
+}
+
+bool
+CellPartitioner::partition( FeatureLayer* layer )
+{
+    SpatialReference* layer_srs = layer->getSRS();
+    if ( !layer_srs )
+        return false;
+
+    // index each of the layer's cells by its extent, expressed in the layer's SRS
+    // just as a spatial query on the layer would:
+    CellGroupList groups;
+    for( unsigned int i = 0; i < cells.size(); i++ )
+    {
+        CellCompiler* task = cells[i].task.get();
+        if ( task->getFeatureLayer() != layer )
+            continue;
+
+        CellGroupList::iterator group = groups.begin();
+        while( group != groups.end() && group->graph.get() != task->getFilterGraph() )
+            group++;
+        if ( group == groups.end() )
+            group = groups.insert( groups.end(), CellGroup( task->getFilterGraph() ) );
+
+        const GeoExtent& cell_extent = task->getFilterEnv()->getExtent();
+        GeoExtent layer_extent(
+            layer_srs->transform( cell_extent.getSouthwest() ),
+            layer_srs->transform( cell_extent.getNortheast() ) );
+
+        group->index->insert( layer_extent, i );
+    }
+
+    osgGIS::notice() << "Partitioning features of layer \"" << layer->getName() << "\"..." << std::endl;
+
+    // graphs that start by simplifying get their features simplified up front,
+    // so that the buckets of coarse cells only hold the points they will use:
+    osg::ref_ptr<SimplificationIndex> simplifier;
+    for( CellGroupList::const_iterator group = groups.begin(); group != groups.end() && !simplifier.valid(); group++ )
+    {
+        if ( group->tolerance > 0.0 )
+            simplifier = layer->getSimplificationIndex();
+    }
+
+    osg::ref_ptr<CropFilter> cropper = new CropFilter();
+    unsigned int feature_count = 0;
+
+    for( FeatureCursor cursor = layer->getCursor(); cursor.hasNext(); )
+    {
+        Feature* feature = cursor.next();
+        const GeoExtent& feature_extent = feature->getExtent();
+        if ( !feature_extent.isValid() )
+            continue;
+
+        // encode the feature once for all the cells that take it as is:
+        std::string record;
+        FeatureBucket::encode( feature, record );
+
+        for( CellGroupList::iterator group = groups.begin(); group != groups.end(); group++ )
+        {
+            if ( group->query.valid() && !group->query->matches( feature ) )
+                continue;
+
+            std::list<unsigned int> hits = group->index->find( feature_extent );
+            if ( hits.size() == 0 )
+                continue;
+
+            const std::string* group_record = &record;
+            std::string simplified_record;
+            if ( group->tolerance > 0.0 && simplifier.valid() )
+            {
+                osg::ref_ptr<Feature> copy = FeatureBucket::decode( record.c_str(), layer_srs );
+                if ( simplifier->simplify( copy.get(), group->tolerance ) )
+                {
+                    if ( copy->getShapes().size() == 0 )
+                        continue;
+                    FeatureBucket::encode( copy.get(), simplified_record );
+                    group_record = &simplified_record;
+                }
+            }
+
+            for( std::list<unsigned int>::const_iterator h = hits.begin(); h != hits.end(); h++ )
+            {
+                const CellEntry& cell = cells[*h];
+                FilterEnv* env = cell.task->getFilterEnv();
+
+                if ( group->crop && !env->getExtent().contains( feature_extent ) )
+                {
+                    osg::ref_ptr<Feature> copy = FeatureBucket::decode( group_record->c_str(), layer_srs );
+                    FeatureList cropped = cropper->process( copy.get(), env );
+                    for( FeatureList::iterator j = cropped.begin(); j != cropped.end(); j++ )
+                    {
+                        std::string cropped_record;
+                        FeatureBucket::encode( j->get(), cropped_record );
+                        append( cell.bucket_path, cropped_record );
+                    }
+                }
+                else
+                {
+                    append( cell.bucket_path, *group_record );
+                }
+            }
+        }
+
+        if ( buffered_bytes >= max_buffer_size && !flush() )
+            return false;
+
+        feature_count++;
+    }
+
+    osgGIS::notice() << "Partitioned " << feature_count << " features" << std::endl;
+    return true;
+}
+
+void
+CellPartitioner::append( const std::string& bucket_path, const std::string& record )
+{
+    buffers[bucket_path].append( record );
+    buffered_bytes += record.length();
+}
+
+// Appends the buffered records to their bucket files.
+bool
+CellPartitioner::flush()
+{
+    bool ok = true;
+
+    for( BufferTable::iterator i = buffers.begin(); i != buffers.end() && ok; i++ )
+    {
+        std::ofstream output( i->first.c_str(), std::ios::out | std::ios::app | std::ios::binary );
+        if ( !output.is_open() || !output.write( i->second.c_str(), i->second.length() ) )
+        {
+            osgGIS::warn() << "[CellPartitioner] Unable to write " << i->first << std::endl;
+            ok = false;
+        }
+    }
+
+    buffers.clear();
+    buffered_bytes = 0;
+    return ok;
+}
+
+void
+CellPartitioner::removeBucket( CellCompiler* task )
+{
+    if ( task->getFeatureBucket().length() > 0 )
+        ::remove( task->getFeatureBucket().c_str() );
+}
+
+void
+CellPartitioner::removeAllBuckets()
+{
+    for( CellEntryList::const_iterator i = cells.begin(); i != cells.end(); i++ )
+    {
+        ::remove( i->bucket_path.c_str() );
+    }
+}
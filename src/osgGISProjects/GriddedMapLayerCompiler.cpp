@@ -299,7 +299,7 @@ collectGeometryKeys( GridProfile* profile, MapLayer* map_layer, bool depth_first
 static Task*
 createTask( const GridCellKey& key, MapLayerCompiler* compiler )
 {
-    Task* task = NULL;
+    CellCompiler* task = NULL;
 
     MapLayerLevelOfDetail* def = getLodForKey( key, compiler->getMapLayer() );
     if ( def )
@@ -336,6 +336,11 @@ createTask( const GridCellKey& key, MapLayerCompiler* compiler )
             compiler->getArchive(),
             def->getUserData() );
 
+        task->setBuildManifest( compiler->getBuildManifest(), compiler->getInputsVersion() );
+
+        if ( compiler->getCellPartitioner() )
+            compiler->getCellPartitioner()->addCell( task );
+
         osgGIS::notify( osg::INFO )
             << "Task: Key = " << key.toString() << ", LOD = " << key.getLevel() << ", Extent = " << extent.toString() 
             << " (w=" << extent.getWidth() << ", h=" << extent.getHeight() << ")"
@@ -406,15 +411,20 @@ GriddedMapLayerCompiler::queueTasks( Profile* _profile, TaskManager* task_man )
 
         // make a build task for each quad cell we collected:
         //int total_tasks = keys.size();
+        TaskList tasks;
         for( GridCellKeyList::iterator i = keys.begin(); i != keys.end(); i++ )
         {
             osg::ref_ptr<Cell> cell = new Cell( i->toString(), i->getExtent() );
-            if ( !cell_selector.valid() || cell_selector->selectCell( cell.get() ) )
+            if ( selectCell( cell.get() ) )
             {
-                task_man->queueTask( createTask( *i, this ) );
+                Task* task = createTask( *i, this );
+                if ( task )
+                    tasks.push_back( task );
             }
         }
 
+        queueCellTasks( tasks, task_man );
+
         return keys.size();
     }
     else
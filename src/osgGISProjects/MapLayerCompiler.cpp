@@ -24,6 +24,11 @@
 #include <osgGIS/Session>
 #include <osgGIS/Utils>
 #include <osgGIS/Registry>
+#include <osgGIS/SpatialIndex>
+#include <osgGIS/CollectionFilter>
+#include <osgGIS/CombineLinesFilter>
+#include <osgGIS/ConvexHullFilter>
+#include <osgGIS/WriteFeaturesFilter>
 #include <osgDB/FileUtils>
 #include <osgDB/FileNameUtils>
 #include <osgDB/WriteFile>
@@ -34,7 +39,13 @@
 #include <osg/ProxyNode>
 #include <osg/NodeVisitor>
 #include <osg/Timer>
+#include <osg/Vec2d>
 #include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
 
 using namespace osgGIS;
 using namespace osgGISProjects;
@@ -83,8 +94,8 @@ public:
                         unsigned int _total_tasks,
                         osg::Timer_t _start_time )
         : task_man( _task_man ), profile( _profile ),
-          total_tasks( _total_tasks ), start_time( _start_time ) {
-        //NOP
+          total_tasks( _total_tasks ), tasks_completed( 0 ), start_time( _start_time ) {
+        report = new Report();
     }
 
     void clearTaskQueue()
@@ -110,8 +121,6 @@ public:
 
     Report* getReport()
     {
-        //if ( !report.valid() )
-        //    report = new Report();
         return report.get();
     }
 
@@ -120,10 +129,28 @@ public:
         return profile.get();
     }
 
+    // counts cell tasks only; the index tasks queued along the way do not
+    // figure in the progress report.
+    void incrementTasksCompleted()
+    {
+        tasks_completed++;
+    }
+
+    void setTasksCompleted( unsigned int value )
+    {
+        tasks_completed = value;
+    }
+
+    unsigned int getTasksCompleted() const
+    {
+        return tasks_completed;
+    }
+
 private:
     osg::ref_ptr<TaskManager> task_man;
     osg::Timer_t start_time;
     unsigned int total_tasks;
+    unsigned int tasks_completed;
     osg::Timer_t current_time;
     TaskQueue recently_completed_tasks;
     osg::ref_ptr<osg::Group> scene_graph;
@@ -139,6 +166,12 @@ MapLayerCompiler::MapLayerCompiler( MapLayer* _layer, Session* _session )
     session     = _session;
     paged       = true;
     depth_first = true;
+    pre_partition = false;
+    task_order  = TASK_ORDER_FIFO;
+    task_order_set = false;
+    max_cell_cost = 0;
+    shard_index = 0;
+    shard_count = 1;
 }
 
 MapLayer*
@@ -204,6 +237,365 @@ MapLayerCompiler::getTerrainExtent() const
     return terrain_extent;
 }
 
+void
+MapLayerCompiler::setTerrainVersion( const std::string& value )
+{
+    terrain_version = value;
+}
+
+const std::string&
+MapLayerCompiler::getTerrainVersion() const
+{
+    return terrain_version;
+}
+
+const std::string&
+MapLayerCompiler::getInputsVersion() const
+{
+    return inputs_version;
+}
+
+// FNV-1a hash of the terrain version and of the session's scripts and resources
+// (including the modification times of the resource files).
+static std::string
+computeInputsVersion( const std::string& terrain_version, Session* session )
+{
+    std::stringstream buf;
+    buf << terrain_version;
+
+    if ( session )
+    {
+        for( ScriptList::const_iterator i = session->getScripts().begin(); i != session->getScripts().end(); i++ )
+            buf << '\n' << i->get()->getName() << '\n' << i->get()->getCode();
+
+        ResourceList resources = session->getResources()->getSkins();
+        ResourceList models = session->getResources()->getModels();
+        resources.insert( resources.end(), models.begin(), models.end() );
+        for( ResourceList::const_iterator i = resources.begin(); i != resources.end(); i++ )
+        {
+            Resource* resource = i->get();
+            buf << '\n' << resource->getName() << '\n' << resource->getAbsoluteURI()
+                << '@' << FileUtils::getFileTimeUTC( resource->getAbsoluteURI() );
+
+            Properties props = resource->getProperties();
+            for( Properties::const_iterator j = props.begin(); j != props.end(); j++ )
+                buf << '\n' << j->getName() << '=' << j->getValue();
+        }
+    }
+
+    std::string data = buf.str();
+    unsigned long long hash = 14695981039346656037ULL;
+    for( std::string::const_iterator i = data.begin(); i != data.end(); i++ )
+    {
+        hash ^= (unsigned char)*i;
+        hash *= 1099511628211ULL;
+    }
+
+    char hex[17];
+    sprintf( hex, "%016llx", hash );
+    return std::string( hex );
+}
+
+BuildManifest*
+MapLayerCompiler::getBuildManifest() const
+{
+    return manifest.get();
+}
+
+void
+MapLayerCompiler::setPrePartition( bool value )
+{
+    pre_partition = value;
+}
+
+bool
+MapLayerCompiler::getPrePartition() const
+{
+    return pre_partition;
+}
+
+CellPartitioner*
+MapLayerCompiler::getCellPartitioner() const
+{
+    return partitioner.get();
+}
+
+void
+MapLayerCompiler::setTaskOrder( TaskOrder value )
+{
+    task_order = value;
+    task_order_set = true;
+}
+
+MapLayerCompiler::TaskOrder
+MapLayerCompiler::getTaskOrder() const
+{
+    // chunking only shortens a long cell if it starts early:
+    return
+        task_order_set? task_order :
+        max_cell_cost > 0? TASK_ORDER_LARGEST_FIRST :
+        TASK_ORDER_FIFO;
+}
+
+void
+MapLayerCompiler::setMaxCellCost( unsigned int value )
+{
+    max_cell_cost = value;
+}
+
+unsigned int
+MapLayerCompiler::getMaxCellCost() const
+{
+    return max_cell_cost;
+}
+
+void
+MapLayerCompiler::setShard( unsigned int index, unsigned int count )
+{
+    shard_count = std::max( count, 1u );
+    shard_index = index % shard_count;
+}
+
+unsigned int
+MapLayerCompiler::getShardIndex() const
+{
+    return shard_index;
+}
+
+unsigned int
+MapLayerCompiler::getShardCount() const
+{
+    return shard_count;
+}
+
+// resolution of the grid on which we lay out the space-filling curves:
+#define CURVE_GRID_BITS 16
+
+// most chunks into which to split an expensive cell:
+#define MAX_CELL_CHUNKS 16
+
+// rough memory that compiling a cell takes per source feature and per point,
+// counting the intermediate fragments, geometry and results:
+#define BYTES_PER_FEATURE 1024
+#define BYTES_PER_POINT   256
+
+// position of a grid cell along a Z-order curve.
+static double
+getZOrderIndex( unsigned int x, unsigned int y )
+{
+    unsigned long long d = 0;
+    for( unsigned int b = 0; b < CURVE_GRID_BITS; b++ )
+    {
+        d |= (unsigned long long)( (x >> b) & 1 ) << (2*b);
+        d |= (unsigned long long)( (y >> b) & 1 ) << (2*b+1);
+    }
+    return (double)d;
+}
+
+// position of a grid cell along a Hilbert curve.
+static double
+getHilbertIndex( unsigned int x, unsigned int y )
+{
+    const unsigned int n = 1u << CURVE_GRID_BITS;
+    unsigned long long d = 0;
+    for( unsigned int s = n/2; s > 0; s /= 2 )
+    {
+        unsigned int rx = (x & s) > 0? 1 : 0;
+        unsigned int ry = (y & s) > 0? 1 : 0;
+        d += (unsigned long long)s * (unsigned long long)s * (unsigned long long)( (3*rx) ^ ry );
+
+        // rotate the quadrant so the curve stays continuous:
+        if ( ry == 0 )
+        {
+            if ( rx == 1 )
+            {
+                x = n-1 - x;
+                y = n-1 - y;
+            }
+            std::swap( x, y );
+        }
+    }
+    return (double)d;
+}
+
+// number of source features that the cell's extent takes in, and the number of
+// points in their shapes, according to the layer's spatial index.
+static void
+getCellStatistics( CellCompiler* cell, unsigned int& out_features, unsigned int& out_points )
+{
+    out_features = 0;
+    out_points = 0;
+
+    FeatureLayer* layer = cell->getFeatureLayer();
+    if ( layer && layer->assertSpatialIndex() && layer->getSpatialIndex() )
+    {
+        layer->getSpatialIndex()->getStatistics( cell->getFilterEnv()->getExtent(), out_features, out_points );
+    }
+}
+
+// whether a cell compiled with a filter graph can be split into chunks of
+// features. Without a collection filter, a graph streams features through one
+// at a time, so every filter (including the geometry merging of BuildGeomFilter
+// and the batching of BuildNodesFilter) only ever sees one feature's worth of
+// data. A collection filter gathers the cell's features first, and the filters
+// that work on a whole feature set, or that write one shared output, depend on
+// seeing all of them.
+static bool
+canCompileInChunks( FilterGraph* graph )
+{
+    if ( !graph )
+        return false;
+
+    for( FilterList::const_iterator i = graph->getFilters().begin(); i != graph->getFilters().end(); i++ )
+    {
+        Filter* f = i->get();
+        if ( dynamic_cast<CollectionFilter*>( f ) ||
+             dynamic_cast<CombineLinesFilter*>( f ) ||
+             dynamic_cast<ConvexHullFilter*>( f ) ||
+             dynamic_cast<WriteFeaturesFilter*>( f ) )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+typedef std::pair< double, osg::ref_ptr<Task> > SortedTask;
+
+struct SortedTaskLess
+{
+    bool operator()( const SortedTask& lhs, const SortedTask& rhs ) const {
+        return lhs.first < rhs.first;
+    }
+};
+
+void
+MapLayerCompiler::queueCellTasks( const TaskList& tasks, TaskManager* task_man )
+{
+    std::vector<SortedTask> sorted;
+    sorted.reserve( tasks.size() );
+
+    TaskOrder order = getTaskOrder();
+
+    // estimate the cost (and memory use) of each cell, if we need it:
+    std::vector<double> costs( tasks.size(), 0.0 );
+    if ( order == TASK_ORDER_LARGEST_FIRST || max_cell_cost > 0 || task_man->getMemoryBudget() > 0 )
+    {
+        unsigned int k = 0;
+        for( TaskList::const_iterator i = tasks.begin(); i != tasks.end(); i++, k++ )
+        {
+            CellCompiler* cell = dynamic_cast<CellCompiler*>( i->get() );
+            if ( cell )
+            {
+                unsigned int num_features, num_points;
+                getCellStatistics( cell, num_features, num_points );
+                costs[k] = (double)num_features + (double)num_points;
+
+                cell->setMemoryEstimate(
+                    (unsigned long long)num_features * BYTES_PER_FEATURE +
+                    (unsigned long long)num_points * BYTES_PER_POINT );
+
+                // split up a cell that's over budget, if its graph allows it:
+                if ( max_cell_cost > 0 && costs[k] > (double)max_cell_cost && canCompileInChunks( cell->getFilterGraph() ) )
+                {
+                    double num_chunks = std::min( ceil( costs[k]/(double)max_cell_cost ), (double)MAX_CELL_CHUNKS );
+                    cell->setNumChunks( (unsigned int)num_chunks );
+                    cell->setTaskManager( task_man );
+
+                    osgGIS::info() << cell->getName() << ": estimated cost " << costs[k]
+                        << "; compiling in " << cell->getNumChunks() << " chunks" << std::endl;
+                }
+            }
+        }
+    }
+
+    if ( order == TASK_ORDER_Z_ORDER || order == TASK_ORDER_HILBERT )
+    {
+        // lay a grid over the cell centroids, and find each cell's place on the curve:
+        std::vector<osg::Vec2d> centroids;
+        double xmin = DBL_MAX, ymin = DBL_MAX, xmax = -DBL_MAX, ymax = -DBL_MAX;
+        for( TaskList::const_iterator i = tasks.begin(); i != tasks.end(); i++ )
+        {
+            CellCompiler* cell = dynamic_cast<CellCompiler*>( i->get() );
+            osg::Vec2d c( 0, 0 );
+            if ( cell && cell->getFilterEnv() )
+            {
+                GeoPoint centroid = cell->getFilterEnv()->getExtent().getCentroid();
+                c.set( centroid.x(), centroid.y() );
+            }
+            centroids.push_back( c );
+            xmin = std::min( xmin, c.x() ); xmax = std::max( xmax, c.x() );
+            ymin = std::min( ymin, c.y() ); ymax = std::max( ymax, c.y() );
+        }
+
+        double max_cell = (double)( (1u << CURVE_GRID_BITS) - 1 );
+        double xscale = xmax > xmin? max_cell/(xmax-xmin) : 0.0;
+        double yscale = ymax > ymin? max_cell/(ymax-ymin) : 0.0;
+
+        unsigned int k = 0;
+        for( TaskList::const_iterator i = tasks.begin(); i != tasks.end(); i++, k++ )
+        {
+            unsigned int x = (unsigned int)( (centroids[k].x()-xmin)*xscale + 0.5 );
+            unsigned int y = (unsigned int)( (centroids[k].y()-ymin)*yscale + 0.5 );
+            double index = order == TASK_ORDER_HILBERT? getHilbertIndex( x, y ) : getZOrderIndex( x, y );
+            sorted.push_back( SortedTask( index, i->get() ) );
+        }
+    }
+    else if ( order == TASK_ORDER_LARGEST_FIRST )
+    {
+        unsigned int k = 0;
+        for( TaskList::const_iterator i = tasks.begin(); i != tasks.end(); i++, k++ )
+        {
+            sorted.push_back( SortedTask( -costs[k], i->get() ) );
+        }
+    }
+    else // TASK_ORDER_FIFO
+    {
+        for( TaskList::const_iterator i = tasks.begin(); i != tasks.end(); i++ )
+        {
+            sorted.push_back( SortedTask( 0.0, i->get() ) );
+        }
+    }
+
+    // stable, so that cells on the same spot (like the levels of a grid cell) keep
+    // their relative order:
+    std::stable_sort( sorted.begin(), sorted.end(), SortedTaskLess() );
+
+    for( std::vector<SortedTask>::iterator i = sorted.begin(); i != sorted.end(); i++ )
+    {
+        task_man->queueTask( i->second.get() );
+    }
+}
+
+bool
+MapLayerCompiler::isCellDirty( const std::string& cell_id ) const
+{
+    return !manifest.valid() || dirty_cells.find( cell_id ) != dirty_cells.end();
+}
+
+// FNV-1a hash of a cell ID, which deals the cells out to the shards the same
+// way in every process.
+static unsigned int
+getCellHash( const std::string& cell_id )
+{
+    unsigned int hash = 2166136261u;
+    for( std::string::const_iterator i = cell_id.begin(); i != cell_id.end(); i++ )
+    {
+        hash ^= (unsigned char)*i;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+bool
+MapLayerCompiler::selectCell( Cell* cell ) const
+{
+    if ( cell_selector.valid() && !cell_selector->selectCell( cell ) )
+        return false;
+
+    return shard_count <= 1 || getCellHash( cell->getId() ) % shard_count == shard_index;
+}
+
 void
 MapLayerCompiler::setArchive( osgDB::Archive* _archive, const std::string& _filename )
 {
@@ -272,63 +664,92 @@ MapLayerCompiler::setCellSelector( CellSelector* _selector )
 void
 MapLayerCompiler::setCenterAndRadius( osg::Node* node, const GeoExtent& cell_extent, SmartReadCallback* reader )
 {
-    SpatialReference* srs = map_layer->getOutputSRS( getSession(), getTerrainSRS() );
-    // first get the output srs centroid: 
-    GeoPoint centroid = srs->transform( cell_extent.getCentroid() );
-    GeoPoint sw = srs->transform( cell_extent.getSouthwest() );
+    NodeExtentList nodes;
+    nodes.push_back( std::pair<osg::Node*,GeoExtent>( node, cell_extent ) );
+    setCentersAndRadii( nodes, map_layer->getOutputSRS( getSession(), getTerrainSRS() ), reader );
+}
 
-    double radius = map_layer->getEncodeCellRadius()?
-        (centroid-sw).length() :
-        -1.0;
+void
+MapLayerCompiler::setCentersAndRadii( const NodeExtentList& nodes, SpatialReference* srs, SmartReadCallback* reader )
+{
+    // first get the output srs centroids:
+    GeoPointList centroids;
+    std::vector<double> radii;
+    for( NodeExtentList::const_iterator i = nodes.begin(); i != nodes.end(); i++ )
+    {
+        GeoPoint centroid = srs->transform( i->second.getCentroid() );
+        GeoPoint sw = srs->transform( i->second.getSouthwest() );
+
+        centroids.push_back( centroid );
+        radii.push_back( map_layer->getEncodeCellRadius()?
+            (centroid-sw).length() :
+            -1.0 );
+    }
     
     if ( terrain_node.valid() && terrain_srs.valid() )
     {
-        GeoPoint clamped;
-        for( int t=0; t<5; t++ )
+        // clamp the whole batch at once, then retry the ones that missed:
+        std::vector<unsigned int> misses;
+        for( unsigned int i = 0; i < centroids.size(); i++ )
+            misses.push_back( i );
+
+        for( int t=0; t<5 && misses.size() > 0; t++ )
         {
-            clamped = GeomUtils::clampToTerrain( centroid, terrain_node.get(), terrain_srs.get(), reader );
-            if ( !clamped.isValid() )
-            {
-                // if the clamp failed, it's due to the geocentric intersection bug in which the isect
-                // fails when coplanar with a tile boundary/skirt. Fudge the centroid and try again.
-                double fudge = 0.001*((double)(1+(::rand()%10)));
-                centroid.x() += fudge;
-                centroid.y() -= fudge;
-                centroid.z() += fudge*fudge;
-            }
-            else
+            GeoPointList input, clamped;
+            for( std::vector<unsigned int>::const_iterator k = misses.begin(); k != misses.end(); k++ )
+                input.push_back( centroids[*k] );
+
+            GeomUtils::clampToTerrain( input, terrain_node.get(), terrain_srs.get(), reader, clamped );
+
+            std::vector<unsigned int> still_missing;
+            for( unsigned int k = 0; k < misses.size(); k++ )
             {
-                break;
+                GeoPoint& centroid = centroids[misses[k]];
+                if ( !clamped[k].isValid() )
+                {
+                    // if the clamp failed, it's due to the geocentric intersection bug in which the isect
+                    // fails when coplanar with a tile boundary/skirt. Fudge the centroid and try again.
+                    double fudge = 0.001*((double)(1+(::rand()%10)));
+                    centroid.x() += fudge;
+                    centroid.y() -= fudge;
+                    centroid.z() += fudge*fudge;
+                    still_missing.push_back( misses[k] );
+                }
+                else
+                {
+                    centroid = clamped[k];
+                }
             }
+            misses.swap( still_missing );
         }
 
-        if ( !clamped.isValid() )
+        for( std::vector<unsigned int>::const_iterator k = misses.begin(); k != misses.end(); k++ )
         {
             const SpatialReference* geo = srs->getGeographicSRS();
-            GeoPoint latlon = geo->transform( centroid );
+            GeoPoint latlon = geo->transform( centroids[*k] );
             osgGIS::warn() << "*** UNABLE TO CLAMP CENTROID: ***" << latlon.toString() << std::endl;
         }
-        else
-        {
-            centroid = clamped;
-        }
     }
-    else
+    else if ( nodes.size() > 0 )
     {
-        osgGIS::warn() << "*** Failed to clamp Center/Radius for cell" << std::endl;
+        osgGIS::warn() << "*** Failed to clamp Center/Radius for " << nodes.size() << " cell(s)" << std::endl;
     }
 
-    if ( dynamic_cast<osg::LOD*>( node ) )
-    {
-        osg::LOD* plod = static_cast<osg::LOD*>(node);
-        plod->setCenter( centroid );
-        plod->setRadius( radius );
-    }
-    else if ( dynamic_cast<osg::ProxyNode*>( node ) )
+    for( unsigned int i = 0; i < nodes.size(); i++ )
     {
-        osg::ProxyNode* proxy = static_cast<osg::ProxyNode*>(node);
-        proxy->setCenter( centroid );
-        proxy->setRadius( radius );
+        osg::Node* node = nodes[i].first;
+        if ( dynamic_cast<osg::LOD*>( node ) )
+        {
+            osg::LOD* plod = static_cast<osg::LOD*>(node);
+            plod->setCenter( centroids[i] );
+            plod->setRadius( radii[i] );
+        }
+        else if ( dynamic_cast<osg::ProxyNode*>( node ) )
+        {
+            osg::ProxyNode* proxy = static_cast<osg::ProxyNode*>(node);
+            proxy->setCenter( centroids[i] );
+            proxy->setRadius( radii[i] );
+        }
     }
 }
 
@@ -343,9 +764,90 @@ MapLayerCompiler::startCompiling( TaskManager* my_task_man )
     // make a profile describing this compilation setup:
     osg::ref_ptr<Profile> profile = createProfile();
 
+    // load the manifest from the previous build so the cell tasks can skip
+    // any cells whose inputs have not changed. (Archives are always rebuilt.)
+    manifest = NULL;
+    dirty_cells.clear();
+    if ( !getArchive() && output_uri.length() > 0 )
+    {
+        inputs_version = computeInputsVersion( terrain_version, session.get() );
+
+        std::string manifest_path = osgDB::getNameLessExtension( output_uri ) + ".manifest";
+        manifest = new BuildManifest( manifest_path );
+        manifest->load();
+
+        if ( shard_count > 1 )
+        {
+            // a shard records its cells in its own journal, leaving the manifest
+            // itself to the full compilation. A journal left by an interrupted
+            // run of the same shard still counts; rewrite it, since that run may
+            // have cut its last line short:
+            std::stringstream journal_path;
+            journal_path << manifest_path << ".shard" << shard_index;
+            bool resumed = manifest->mergeJournal( journal_path.str() );
+            manifest->setJournalPath( journal_path.str() );
+            if ( resumed )
+                manifest->saveJournal();
+        }
+        else
+        {
+            // fold in the cells that shards compiled:
+            std::vector<std::string> journal_paths;
+            std::string journal_prefix = osgDB::getSimpleFileName( manifest_path ) + ".shard";
+            osgDB::DirectoryContents files = osgDB::getDirectoryContents( osgDB::getFilePath( manifest_path ) );
+            for( osgDB::DirectoryContents::iterator i = files.begin(); i != files.end(); i++ )
+            {
+                if ( StringUtils::startsWith( *i, journal_prefix, true ) )
+                {
+                    journal_paths.push_back( PathUtils::combinePaths( osgDB::getFilePath( manifest_path ), *i ) );
+                    manifest->mergeJournal( journal_paths.back() );
+                }
+            }
+
+            // cells that an interrupted build (or a shard) compiled, but did not
+            // get to index:
+            manifest->getUnindexedCells( dirty_cells );
+            if ( dirty_cells.size() > 0 )
+            {
+                osgGIS::notice() << "Resuming an interrupted build; " << dirty_cells.size()
+                    << " cells await indexing" << std::endl;
+            }
+
+            // the journals are spent once the manifest holds their entries:
+            if ( manifest->save() )
+            {
+                for( std::vector<std::string>::iterator i = journal_paths.begin(); i != journal_paths.end(); i++ )
+                    ::remove( i->c_str() );
+            }
+        }
+    }
+
+    // to pre-partition the features, the compiler registers each cell with the
+    // partitioner as it creates the cell's task. The bucket files go in the
+    // work directory if there is one, or else next to the output.
+    partitioner = NULL;
+    if ( pre_partition && output_uri.length() > 0 )
+    {
+        std::stringstream prefix_buf;
+        prefix_buf << osgDB::getSimpleFileName( osgDB::getNameLessExtension( output_uri ) ) << "_partition_";
+        if ( shard_count > 1 )
+            prefix_buf << "shard" << shard_index << "_";
+        std::string prefix = prefix_buf.str();
+        prefix = Registry::instance()->hasWorkDirectory()?
+            PathUtils::combinePaths( Registry::instance()->getWorkDirectory(), prefix ) :
+            PathUtils::combinePaths( osgDB::getFilePath( output_uri ), prefix );
+        partitioner = new CellPartitioner( prefix );
+    }
+
     // create and queue up all the tasks to run:
     unsigned int total_tasks = queueTasks( profile.get(), task_man.get() );
 
+    // fill the cells' feature buckets before any of the tasks run:
+    if ( partitioner.valid() )
+    {
+        partitioner->run();
+    }
+
     // configure the packager so that skins and model end up in the right place:
     if ( resource_packager.valid() )
     {
@@ -364,7 +866,13 @@ MapLayerCompiler::startCompiling( TaskManager* my_task_man )
 
     // create and return a compile session that should be sent to continueCompiling()
     // and finishCompiling().
-    return new CompileSessionImpl( task_man.get(), profile.get(), total_tasks, osg::Timer::instance()->tick() );
+    CompileSessionImpl* cs = new CompileSessionImpl( task_man.get(), profile.get(), total_tasks, osg::Timer::instance()->tick() );
+
+    // any cells the selector skipped count as completed:
+    if ( task_man->getNumTasks() < total_tasks )
+        cs->setTasksCompleted( total_tasks - task_man->getNumTasks() );
+
+    return cs;
 }
 
 bool
@@ -377,9 +885,20 @@ MapLayerCompiler::continueCompiling( CompileSession* cs_interface )
     if( cs->getTaskManager()->wait( 1000L ) )
     {
         osg::ref_ptr<Task> completed_task = cs->getTaskManager()->getNextCompletedTask();
-        if ( completed_task.valid() )
+        CellCompiler* cell_compiler = dynamic_cast<CellCompiler*>( completed_task.get() );
+        if ( completed_task.valid() && !cell_compiler )
+        {
+            // an index task that the layer compiler queued along the way:
+            processCompletedIndexTask( completed_task.get() );
+        }
+        else if ( completed_task.valid() )
         {
-            CellCompiler* cell_compiler = reinterpret_cast<CellCompiler*>( completed_task.get() );
+            cs->incrementTasksCompleted();
+
+            // the cell no longer needs its pre-partitioned features:
+            if ( partitioner.valid() )
+                partitioner->removeBucket( cell_compiler );
+
             if ( cell_compiler->isInExceptionState() )
             {
                 //TODO: replace this with Report facility
@@ -391,14 +910,26 @@ MapLayerCompiler::continueCompiling( CompileSession* cs_interface )
             {
                 cell_compiler->runSynchronousPostProcess( cs->getReport() );
 
+                // roll the cell's statistics up into the layer's:
+                cs->getReport()->merge( cell_compiler->getFilterEnv()->getReport() );
+
+                // remember which cells changed so we only rebuild the index nodes above them
+                if ( cell_compiler->wasCompiled() )
+                    dirty_cells.insert( cell_compiler->getCellId() );
+
                 // give the layer compiler an opportunity to do something:
                 processCompletedTask( cell_compiler );
 
+                // ..such as building the index nodes above cells that are now all done
+                // (unless compiling a shard, which leaves the index to the full compilation):
+                if ( shard_count <= 1 )
+                    queueIndexTasks( cs->getProfile(), cs->getTaskManager() );
+
                 // record the completed task to the caller can see it
                 cs->getTaskQueue().push( cell_compiler );
 
                 unsigned int total_tasks = cs->getTotalTasks();
-                unsigned int tasks_completed = total_tasks - cs->getTaskManager()->getNumTasks();
+                unsigned int tasks_completed = cs->getTasksCompleted();
 
                 float p = 100.0f * (float)tasks_completed/(float)total_tasks;
                 float elapsed = (float)cs->getElapsedTimeSeconds();
@@ -428,14 +959,61 @@ MapLayerCompiler::continueCompiling( CompileSession* cs_interface )
     return cs->getTaskManager()->hasMoreTasks();
 }
 
+// Prints the per-filter statistics that the layer's cells rolled up into the
+// layer report.
+static void
+printProfile( Report* report )
+{
+    if ( report->getSubReports().size() == 0 )
+        return;
+
+    osgGIS::notice() << "Filter profile (" << report->getDuration() << " s in cells):" << std::endl;
+    for( ReportList::const_iterator i = report->getSubReports().begin(); i != report->getSubReports().end(); i++ )
+    {
+        Report* filter_report = i->get();
+        std::stringstream buf;
+        buf << "  " << std::setw(24) << std::left << filter_report->getName()
+            << std::setw(10) << std::right << std::fixed << std::setprecision(3) << filter_report->getDuration() << " s";
+
+        const std::map<std::string,double>& counters = filter_report->getCounters();
+        for( std::map<std::string,double>::const_iterator j = counters.begin(); j != counters.end(); j++ )
+        {
+            if ( j->first.find( "_time" ) != std::string::npos )
+                buf << ", " << j->first << " = " << std::setprecision(3) << j->second << " s";
+            else
+                buf << ", " << j->first << " = " << std::setprecision(0) << j->second;
+        }
+        osgGIS::notice() << buf.str() << std::endl;
+    }
+
+    const std::map<std::string,double>& counters = report->getCounters();
+    for( std::map<std::string,double>::const_iterator j = counters.begin(); j != counters.end(); j++ )
+    {
+        osgGIS::notice() << "  " << j->first << " = " << j->second << std::endl;
+    }
+}
+
 bool 
 MapLayerCompiler::finishCompiling( CompileSession* cs_interface )
 {
     CompileSessionImpl* cs = static_cast<CompileSessionImpl*>( cs_interface );
 
     cs->clearTaskQueue();
+
+    if ( partitioner.valid() )
+    {
+        partitioner->removeAllBuckets();
+        partitioner = NULL;
+    }
     
-    buildIndex( cs->getProfile(), cs->getOrCreateSceneGraph() );
+    if ( shard_count <= 1 )
+    {
+        buildIndex( cs->getProfile(), cs->getOrCreateSceneGraph() );
+
+        // the index now reflects every cell, so a later build need not revisit them:
+        if ( manifest.valid() )
+            manifest->checkpoint();
+    }
 
     if ( cs->getOrCreateSceneGraph() )
     {
@@ -450,6 +1028,8 @@ MapLayerCompiler::finishCompiling( CompileSession* cs_interface )
         << "Compilation finished, total time = " << cs->getElapsedTimeSeconds() << " seconds"
         << std::endl;
 
+    printProfile( cs->getReport() );
+
     return true;
 }
 
@@ -481,6 +1061,10 @@ MapLayerCompiler::compileIndexOnly( CompileSession* cs_interface )
     // make a profile describing this compilation setup:
     osg::ref_ptr<Profile> profile = createProfile();
 
+    // without a compilation pass we cannot tell which cells changed, so
+    // rebuild every index node:
+    manifest = NULL;
+
     buildIndex( profile.get(), cs->getOrCreateSceneGraph() );
 
     if ( cs->getOrCreateSceneGraph() )
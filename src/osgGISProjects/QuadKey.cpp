@@ -21,12 +21,16 @@
 #include <osgGIS/GeoExtent>
 #include <osgGIS/Registry>
 #include <sstream>
+#include <algorithm>
 
 using namespace osgGISProjects;
 using namespace osgGIS;
 
 #define DEFAULT_STRING_STYLE STYLE_QUADKEY
 
+// the key code holds two bits per LOD, behind the LOD marker bit:
+#define MAX_LOD 31
+
 QuadMap::QuadMap()
 : bounds( GeoExtent::invalid() ),
   string_style( DEFAULT_STRING_STYLE )
@@ -126,8 +130,51 @@ QuadMap::setStringStyle( QuadMap::StringStyle value ) {
 /*****************************************************************************/
 
 
+// spreads the low 32 bits of a value out to the even bits of a 64-bit value.
+static unsigned long long
+spreadBits( unsigned long long v )
+{
+    v &= 0x00000000ffffffffULL;
+    v = (v | (v << 16)) & 0x0000ffff0000ffffULL;
+    v = (v | (v <<  8)) & 0x00ff00ff00ff00ffULL;
+    v = (v | (v <<  4)) & 0x0f0f0f0f0f0f0f0fULL;
+    v = (v | (v <<  2)) & 0x3333333333333333ULL;
+    v = (v | (v <<  1)) & 0x5555555555555555ULL;
+    return v;
+}
+
+// gathers the even bits of a 64-bit value back into 32 bits.
+static unsigned int
+gatherBits( unsigned long long v )
+{
+    v &= 0x5555555555555555ULL;
+    v = (v | (v >>  1)) & 0x3333333333333333ULL;
+    v = (v | (v >>  2)) & 0x0f0f0f0f0f0f0f0fULL;
+    v = (v | (v >>  4)) & 0x00ff00ff00ff00ffULL;
+    v = (v | (v >>  8)) & 0x0000ffff0000ffffULL;
+    v = (v | (v >> 16)) & 0x00000000ffffffffULL;
+    return (unsigned int)v;
+}
+
+// the quadrant digit of a level is (x bit) + 2*(y bit), so the x bits go in the even
+// bit positions. The leading 1 marks the LOD.
+static unsigned long long
+encode( unsigned int cell_x, unsigned int cell_y, unsigned int lod )
+{
+    unsigned int mask = (1u << lod) - 1u;
+    return (1ULL << (2*lod)) | spreadBits( cell_x & mask ) | (spreadBits( cell_y & mask ) << 1);
+}
+
+static unsigned long long
+getMorton( unsigned long long code, unsigned int lod )
+{
+    return code & ~(1ULL << (2*lod));
+}
+
+
 QuadKey::QuadKey( const QuadKey& rhs )
-: qstr( rhs.qstr ),
+: code( rhs.code ),
+  lod( rhs.lod ),
   extent( rhs.extent ),
   map( rhs.map )
 {
@@ -135,43 +182,73 @@ QuadKey::QuadKey( const QuadKey& rhs )
 }
 
 QuadKey::QuadKey( const std::string& _qstr, const QuadMap& _map )
-: qstr( _qstr ),
+: code( 1ULL ),
+  lod( 0 ),
   map( _map ),
   extent( GeoExtent::invalid() )
 {
+    // accept both string styles; the quadrant digits follow the "L<lod>_" prefix:
+    std::string::size_type start = _qstr.length() > 0 && _qstr[0] == 'L'? _qstr.find( '_' ) : std::string::npos;
+    start = start != std::string::npos? start+1 : 0;
+
+    for( std::string::size_type i = start; i < _qstr.length() && lod < MAX_LOD; i++ )
+    {
+        code = (code << 2) | (unsigned long long)( (_qstr[i]-'0') & 3 );
+        lod++;
+    }
 }
 
-QuadKey::QuadKey( unsigned int cell_x, unsigned int cell_y, unsigned int lod, const QuadMap& _map )
-: map( _map ),
+QuadKey::QuadKey( unsigned int cell_x, unsigned int cell_y, unsigned int _lod, const QuadMap& _map )
+: code( encode( cell_x, cell_y, std::min( _lod, (unsigned int)MAX_LOD ) ) ),
+  lod( std::min( _lod, (unsigned int)MAX_LOD ) ),
+  map( _map ),
   extent( GeoExtent::invalid() )
 {
-    std::stringstream ss;
-    for( unsigned i = lod; i > 0; i-- )
-    {
-        char digit = '0';
-        unsigned int mask = 1 << (i-1);
-        if ( (cell_x & mask) != 0 )
-        {
-            digit++;
-        }
-        if ( (cell_y & mask) != 0 )
-        {
-            digit += 2;
-        }
-        ss << digit;
-    }
-    qstr = ss.str();
+    //NOP
+}
+
+QuadKey::QuadKey( unsigned long long _code, unsigned int _lod, const QuadMap& _map )
+: code( _code ),
+  lod( _lod ),
+  map( _map ),
+  extent( GeoExtent::invalid() )
+{
+    //NOP
 }
 
 unsigned int
 QuadKey::getLOD() const
 {
-    return qstr.length();
+    return lod;
+}
+
+unsigned int
+QuadKey::getCellX() const
+{
+    return gatherBits( getMorton( code, lod ) );
+}
+
+unsigned int
+QuadKey::getCellY() const
+{
+    return gatherBits( getMorton( code, lod ) >> 1 );
+}
+
+unsigned long long
+QuadKey::getCode() const
+{
+    return code;
 }
 
 std::string
 QuadKey::toString() const
 {
+    std::string qstr( lod, '0' );
+    for( unsigned int i = 0; i < lod; i++ )
+    {
+        qstr[lod-1-i] = (char)( '0' + ((code >> (2*i)) & 3) );
+    }
+
     switch( map.getStringStyle() )
     {
     case QuadMap::STYLE_LOD_QUADKEY:
@@ -192,15 +269,26 @@ QuadKey::getMap() const
 QuadKey
 QuadKey::createSubKey( unsigned int quadrant ) const
 {
-    return QuadKey( qstr + (char)('0'+quadrant), getMap() );
+    return lod < MAX_LOD?
+        QuadKey( (code << 2) | (unsigned long long)(quadrant & 3), lod+1, map ) :
+        QuadKey( *this );
 }
 
 QuadKey
 QuadKey::createParentKey() const
 {
-    return qstr.length() > 0?
-        QuadKey( qstr.substr( 0, qstr.length()-1 ), map ) :
-        QuadKey( qstr, map );
+    return lod > 0?
+        QuadKey( code >> 2, lod-1, map ) :
+        QuadKey( *this );
+}
+
+QuadKey
+QuadKey::createNeighborKey( int dx, int dy ) const
+{
+    // encode() wraps the cell coordinates to the LOD:
+    unsigned int x = getCellX() + (unsigned int)dx;
+    unsigned int y = getCellY() + (unsigned int)dy;
+    return QuadKey( encode( x, y, lod ), lod, map );
 }
 
 void
@@ -214,21 +302,10 @@ QuadKey::getExtent() const
 {
     if ( !extent.isValid() )
     {
-        unsigned int lod = getLOD();
-        double xmin = map.getBounds().getXMin();
-        double ymin = map.getBounds().getYMin();
-        double dx = map.getBounds().getWidth();
-        double dy = map.getBounds().getHeight();
-        for( unsigned int i=0; i<lod; i++ )
-        {
-            dx *= 0.5;
-            dy *= 0.5;
-            switch( qstr[i] ) {
-                case '1': xmin += dx; break;
-                case '2': ymin += dy; break;
-                case '3': xmin += dx; ymin += dy; break;
-            }
-        }
+        double dx, dy;
+        getCellSize( dx, dy );
+        double xmin = map.getBounds().getXMin() + dx * (double)getCellX();
+        double ymin = map.getBounds().getYMin() + dy * (double)getCellY();
         double xmax = xmin + dx;
         double ymax = ymin + dy;
         const_cast<QuadKey*>(this)->extent = 
@@ -237,8 +314,22 @@ QuadKey::getExtent() const
     return extent;
 }
 
+// Z-order: compare the quadrant digits as if both keys were at the same LOD,
+// and put a parent ahead of its descendants.
 bool
 QuadKey::operator < ( const QuadKey& rhs ) const
 {
-    return toString() < rhs.toString();
+    if ( lod == rhs.lod )
+        return code < rhs.code;
+
+    unsigned int max_lod = std::max( lod, rhs.lod );
+    unsigned long long lhs_morton = getMorton( code, lod ) << (2*(max_lod-lod));
+    unsigned long long rhs_morton = getMorton( rhs.code, rhs.lod ) << (2*(max_lod-rhs.lod));
+    return lhs_morton != rhs_morton? lhs_morton < rhs_morton : lod < rhs.lod;
+}
+
+bool
+QuadKey::operator == ( const QuadKey& rhs ) const
+{
+    return code == rhs.code;
 }
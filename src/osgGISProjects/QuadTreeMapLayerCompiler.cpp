@@ -39,6 +39,7 @@
 #include <osg/Geometry>
 #include <sstream>
 #include <algorithm>
+#include <stdio.h>
 
 using namespace osgGIS;
 using namespace osgGISProjects;
@@ -89,6 +90,104 @@ getDefinition( const QuadKey& key, MapLayer* map_layer )
     return NULL;
 }
 
+/*****************************************************************************/
+
+// Builds the index nodes for a batch of quadkeys at the same LOD. The task builds
+// the nodes and clamps all their centroids to the terrain in a worker thread; the
+// compiler writes the nodes out once the task completes.
+class QuadTreeMapLayerCompiler::IndexTask : public Task
+{
+public:
+    IndexTask(QuadTreeMapLayerCompiler* _compiler,
+              const QuadKeyList&        _keys,
+              MapLayerLevelOfDetail*    _sub_level_def,
+              SpatialReference*         _output_srs )
+    : Task( "index " + _keys.front().toString() ),
+      compiler( _compiler ),
+      keys( _keys ),
+      sub_level_def( _sub_level_def ),
+      output_srs( _output_srs ) { }
+
+    // forces the index node of the key to be rebuilt even if its file exists.
+    void setDirty( const QuadKey& key )
+    {
+        dirty_keys.insert( key );
+    }
+
+    void setCellOutput( const QuadKey& cell_key, bool has_output )
+    {
+        cell_outputs[cell_key] = has_output;
+    }
+
+    void run()
+    {
+        osg::ref_ptr<SmartReadCallback> reader = new SmartReadCallback();
+        NodeExtentList nodes_to_center;
+
+        for( QuadKeyList::const_iterator i = keys.begin(); i != keys.end(); i++ )
+        {
+            IndexNode entry( *i );
+            entry.out_file = compiler->createAbsPathFromTemplate( "i" + i->toString() );
+
+            // an index node only refers to the geometry cells directly beneath it,
+            // so it only needs rebuilding if one of those changed:
+            entry.rebuild = dirty_keys.find( *i ) != dirty_keys.end() || !osgDB::fileExists( entry.out_file );
+
+            if ( entry.rebuild )
+            {
+                entry.node = sub_level_def.valid() ?
+                    compiler->createIntermediateIndexNode( *i, sub_level_def->getMinRange(), sub_level_def->getMaxRange(), cell_outputs, nodes_to_center ) :
+                    compiler->createLeafIndexNode( *i, cell_outputs, nodes_to_center );
+            }
+
+            index_nodes.push_back( entry );
+        }
+
+        compiler->setCentersAndRadii( nodes_to_center, output_srs.get(), reader.get() );
+    }
+
+    // writes the index nodes, and records which keys now have an index file.
+    void runSynchronousPostProcess( std::map<QuadKey,bool>& index_outputs )
+    {
+        for( std::vector<IndexNode>::const_iterator i = index_nodes.begin(); i != index_nodes.end(); i++ )
+        {
+            if ( i->node.valid() )
+            {
+                if ( !FileUtils::writeNodeFile( *(i->node.get()), i->out_file ) )
+                {
+                    osgGIS::warn() << "FAILED to write index file " << i->out_file << std::endl;
+                }
+            }
+            else if ( i->rebuild && osgDB::fileExists( i->out_file ) )
+            {
+                // all the cells beneath this one are now empty:
+                ::remove( i->out_file.c_str() );
+            }
+
+            index_outputs[i->key] = i->node.valid() || !i->rebuild;
+        }
+    }
+
+private:
+    struct IndexNode {
+        IndexNode( const QuadKey& _key ) : key( _key ), rebuild( false ) { }
+        QuadKey key;
+        std::string out_file;
+        bool rebuild;
+        osg::ref_ptr<osg::Node> node;
+    };
+
+    osg::ref_ptr<QuadTreeMapLayerCompiler> compiler;
+    QuadKeyList keys;
+    osg::ref_ptr<MapLayerLevelOfDetail> sub_level_def;
+    osg::ref_ptr<SpatialReference> output_srs;
+    QuadKeySet dirty_keys;
+    CellOutputMap cell_outputs;
+    std::vector<IndexNode> index_nodes;
+};
+
+/*****************************************************************************/
+
 Task*
 QuadTreeMapLayerCompiler::createQuadKeyTask( const QuadKey& key )
 {
@@ -100,7 +199,7 @@ QuadTreeMapLayerCompiler::createQuadKeyTask( const QuadKey& key )
 
     std::string abs_path = createAbsPathFromTemplate( "g" + key.toString() );
 
-    Task* task = NULL;
+    CellCompiler* task = NULL;
 
     MapLayerLevelOfDetail* def = getDefinition( key.createParentKey(), map_layer.get() );
     if ( def )
@@ -123,6 +222,11 @@ QuadTreeMapLayerCompiler::createQuadKeyTask( const QuadKey& key )
             getArchive(),
             def->getUserData() );
 
+        task->setBuildManifest( getBuildManifest(), getInputsVersion() );
+
+        if ( getCellPartitioner() )
+            getCellPartitioner()->addCell( task );
+
         osgGIS::info()
             << "Task: Key = " << key.toString() << ", LOD = " << key.getLOD() << ", Extent = " << key.getExtent().toString() 
             << " (w=" << key.getExtent().getWidth() << ", h=" << key.getExtent().getHeight() << ")"
@@ -198,17 +302,35 @@ QuadTreeMapLayerCompiler::queueTasks( Profile* _profile, TaskManager* task_man )
         QuadKeyList keys;
         collectGeometryKeys( profile->getQuadMap(), keys );
 
+        cell_outputs.clear();
+        cell_keys.clear();
+        num_pending_cells.clear();
+        ready_index_keys.clear();
+        index_outputs.clear();
+
         // make a build task for each quad cell we collected:
         //int total_tasks = keys.size();
+        TaskList tasks;
         for( QuadKeyList::iterator i = keys.begin(); i != keys.end(); i++ )
         {
-            osg::ref_ptr<Cell> cell = new Cell( i->toString(), i->getExtent() );
-            if ( !cell_selector.valid() || cell_selector->selectCell( cell.get() ) ) //i->toString() ) )
+            std::string cell_id = i->toString();
+            osg::ref_ptr<Cell> cell = new Cell( cell_id, i->getExtent() );
+            if ( selectCell( cell.get() ) )
             {
-                task_man->queueTask( createQuadKeyTask( *i ) );
+                Task* task = createQuadKeyTask( *i );
+                if ( task )
+                {
+                    tasks.push_back( task );
+
+                    // the index node above the cell waits for all its queued cells:
+                    cell_keys.insert( std::pair<std::string,QuadKey>( cell_id, *i ) );
+                    num_pending_cells[i->createParentKey()]++;
+                }
             }
         }
 
+        queueCellTasks( tasks, task_man );
+
         return keys.size();
     }
     else
@@ -220,9 +342,10 @@ QuadTreeMapLayerCompiler::queueTasks( Profile* _profile, TaskManager* task_man )
 // builds an index node (pointers to quadkey geometry nodes) that references 
 // subtiles.
 osg::Node*
-QuadTreeMapLayerCompiler::createIntermediateIndexNode(const QuadKey& key,
+QuadTreeMapLayerCompiler::createIntermediateIndexNode(const QuadKey&        key,
                                                       float min_range, float max_range,
-                                                      SmartReadCallback* reader )
+                                                      const CellOutputMap&  outputs,
+                                                      NodeExtentList&       nodes_to_center )
 {
     osg::Group* group = NULL;
 
@@ -230,7 +353,7 @@ QuadTreeMapLayerCompiler::createIntermediateIndexNode(const QuadKey& key,
     {
         QuadKey subkey = key.createSubKey( quadrant );
 
-        if ( osgDB::fileExists( createAbsPathFromTemplate( "g"+subkey.toString() ) ) )
+        if ( hasCellOutput( subkey, outputs ) )
         {
             if ( !group )
             {
@@ -242,7 +365,7 @@ QuadTreeMapLayerCompiler::createIntermediateIndexNode(const QuadKey& key,
 
             // enter the subtile set as a paged index node reference:
             osg::PagedLOD* plod = new osg::PagedLOD();
-            setCenterAndRadius( plod, subkey.getExtent(), reader );
+            nodes_to_center.push_back( std::pair<osg::Node*,GeoExtent>( plod, subkey.getExtent() ) );
 
 
 #ifdef USE_PAGEDLODS_IN_INDEX
@@ -314,7 +437,9 @@ QuadTreeMapLayerCompiler::createIntermediateIndexNode(const QuadKey& key,
 // creates an index node (pointer to quadkey geometry nodes) that has no
 // children.
 osg::Node*
-QuadTreeMapLayerCompiler::createLeafIndexNode( const QuadKey& key, SmartReadCallback* reader )
+QuadTreeMapLayerCompiler::createLeafIndexNode(const QuadKey&       key,
+                                              const CellOutputMap& outputs,
+                                              NodeExtentList&      nodes_to_center )
 {
     osg::Group* group = NULL;
 
@@ -322,7 +447,7 @@ QuadTreeMapLayerCompiler::createLeafIndexNode( const QuadKey& key, SmartReadCall
     {
         QuadKey quadrant_key = key.createSubKey( i );
 
-        if ( osgDB::fileExists( createAbsPathFromTemplate( "g"+quadrant_key.toString() ) ) )
+        if ( hasCellOutput( quadrant_key, outputs ) )
         {
             if ( !group )
             {
@@ -336,7 +461,7 @@ QuadTreeMapLayerCompiler::createLeafIndexNode( const QuadKey& key, SmartReadCall
             pointer->setRange( 0, 0, 1e10 );
             pointer->setPriorityScale( 0, 1000.0f ); // top priority!
             pointer->setPriorityOffset( 0, 1000.0f );
-            setCenterAndRadius( pointer, quadrant_key.getExtent(), reader );
+            nodes_to_center.push_back( std::pair<osg::Node*,GeoExtent>( pointer, quadrant_key.getExtent() ) );
 #else
             osg::ProxyNode* pointer = new osg::ProxyNode();
             pointer->setLoadingExternalReferenceMode( osg::ProxyNode::LOAD_IMMEDIATELY );
@@ -351,6 +476,17 @@ QuadTreeMapLayerCompiler::createLeafIndexNode( const QuadKey& key, SmartReadCall
     return group;
 }
 
+// whether the geometry cell has an output file. The record of completed cells tells us
+// that for cells compiled in this session; we only go to the disk for the others.
+bool
+QuadTreeMapLayerCompiler::hasCellOutput( const QuadKey& key, const CellOutputMap& outputs )
+{
+    CellOutputMap::const_iterator i = outputs.find( key );
+    return i != outputs.end()?
+        i->second :
+        osgDB::fileExists( createAbsPathFromTemplate( "g"+key.toString() ) );
+}
+
 // assembles the list of quadkeys for which to build geometry cells. We can derive the set
 // of index cells from this set of geometry cells if necessary.
 void
@@ -384,12 +520,137 @@ QuadTreeMapLayerCompiler::collectGeometryKeys( const QuadMap& qmap, QuadKeyList&
     }
 }
 
-// builds and writes all the index nodes.
+// creates a task that builds the index nodes for a batch of keys at the same LOD.
+QuadTreeMapLayerCompiler::IndexTask*
+QuadTreeMapLayerCompiler::createIndexTask( const QuadKeyList& keys )
+{
+    if ( keys.size() == 0 )
+        return NULL;
+
+    // the index nodes point to the cells of the level beneath the keys' level (if any):
+    const QuadKey& first = keys.front();
+    unsigned int depth = first.getLOD() - getTopLod( first.getMap(), map_layer.get() );
+
+    MapLayerLevelsOfDetail& levels = map_layer->getLevels();
+    MapLayerLevelsOfDetail::iterator i = levels.begin();
+    while( i != levels.end() && i->get()->getDepth() != depth )
+        i++;
+    if ( i == levels.end() )
+        return NULL;
+
+    MapLayerLevelOfDetail* sub_level_def = i+1 != levels.end()? (i+1)->get() : NULL;
+
+    IndexTask* task = new IndexTask( this, keys, sub_level_def, getOutputSRS() );
+
+    for( QuadKeyList::const_iterator k = keys.begin(); k != keys.end(); k++ )
+    {
+        for( unsigned int q = 0; q < 4; q++ )
+        {
+            QuadKey cell_key = k->createSubKey( q );
+            CellOutputMap::const_iterator j = cell_outputs.find( cell_key );
+            if ( j != cell_outputs.end() )
+                task->setCellOutput( cell_key, j->second );
+        }
+
+        // the manifest tracks cells by name:
+        for( unsigned int q = 0; q < 4; q++ )
+        {
+            if ( isCellDirty( k->createSubKey( q ).toString() ) )
+            {
+                task->setDirty( *k );
+                break;
+            }
+        }
+    }
+
+    return task;
+}
+
+void
+QuadTreeMapLayerCompiler::processCompletedTask( CellCompiler* task )
+{
+    std::map<std::string,QuadKey>::iterator cell = cell_keys.find( task->getCellId() );
+    if ( cell == cell_keys.end() )
+        return;
+
+    // remember whether the cell produced output, so that the index need not look
+    // for it on disk:
+    QuadKey cell_key = cell->second;
+    if ( task->getResult().isOK() )
+    {
+        switch( task->getOutputStatus() )
+        {
+        case CellCompiler::OUTPUT_NON_EMPTY:
+        case CellCompiler::OUTPUT_ALREADY_EXISTS:
+            cell_outputs[cell_key] = true;
+            break;
+        case CellCompiler::OUTPUT_EMPTY:
+            cell_outputs[cell_key] = false;
+            break;
+        default:
+            break;
+        }
+    }
+
+    // once all the cells beneath an index node are done, the node is ready to build:
+    QuadKey parent = cell_key.createParentKey();
+    if ( --num_pending_cells[parent] == 0 )
+    {
+        ready_index_keys.push_back( parent );
+        num_pending_cells.erase( parent );
+    }
+    cell_keys.erase( cell );
+}
+
+void
+QuadTreeMapLayerCompiler::queueIndexTasks( Profile* profile, TaskManager* task_man )
+{
+    // batch up the ready keys by LOD so that each task clamps all of its centroids
+    // in one pass over the terrain:
+    std::map<unsigned int,QuadKeyList> batches;
+    for( QuadKeyList::const_iterator i = ready_index_keys.begin(); i != ready_index_keys.end(); i++ )
+    {
+        batches[i->getLOD()].push_back( *i );
+    }
+    ready_index_keys.clear();
+
+    for( std::map<unsigned int,QuadKeyList>::const_iterator i = batches.begin(); i != batches.end(); i++ )
+    {
+        IndexTask* task = createIndexTask( i->second );
+        if ( task )
+        {
+            task_man->queueTask( task );
+        }
+    }
+}
+
+void
+QuadTreeMapLayerCompiler::processCompletedIndexTask( Task* task )
+{
+    IndexTask* index_task = dynamic_cast<IndexTask*>( task );
+    if ( index_task )
+    {
+        if ( index_task->isInExceptionState() )
+        {
+            // buildIndex() will try these keys again:
+            osgGIS::notify( osg::WARN ) << "ERROR: " << task->getName() << " failed; unhandled exception state."
+                << std::endl;
+        }
+        else
+        {
+            index_task->runSynchronousPostProcess( index_outputs );
+        }
+    }
+}
+
+// builds and writes the index nodes that the cell tasks did not already trigger
+// (e.g. those above failed or unselected cells, or all of them when we are only
+// building the index), and then assembles the root of the scene graph.
 void
 QuadTreeMapLayerCompiler::buildIndex( Profile* _profile, osg::Group* scene_graph )
 {
     QuadTreeProfile* profile = dynamic_cast<QuadTreeProfile*>( _profile );
-    if ( !profile ) return;
+    if ( !profile || map_layer->getLevels().size() == 0 ) return;
 
     osgGIS::notice() << "Rebuilding index..." << std::endl;
 
@@ -397,80 +658,80 @@ QuadTreeMapLayerCompiler::buildIndex( Profile* _profile, osg::Group* scene_graph
     // make pagedlod/lod centroids.
     SpatialReference* output_srs = map_layer->getOutputSRS( getSession(), getTerrainSRS() );
 
-    // first build the very top level.
-    //scene_graph = new osg::Group();
-
     // the starting LOD is the best fit the the cell size:
     unsigned int top_lod = getTopLod( profile->getQuadMap(), map_layer.get() );
 
-    osg::ref_ptr<SmartReadCallback> reader = new SmartReadCallback();
-
+    // build the outstanding index nodes, in one batch per level:
     for( MapLayerLevelsOfDetail::iterator i = map_layer->getLevels().begin(); i != map_layer->getLevels().end(); i++ )
     {
-        MapLayerLevelOfDetail* level_def = i->get();
-        unsigned int lod = top_lod + level_def->getDepth();
+        unsigned int lod = top_lod + i->get()->getDepth();
 
-        MapLayerLevelOfDetail* sub_level_def = i+1 != map_layer->getLevels().end()? (i+1)->get() : NULL;
-        float min_range, max_range;
-        if ( sub_level_def )
-        {
-            min_range = sub_level_def->getMinRange();
-            max_range = sub_level_def->getMaxRange();
-        }
-        
         // get the extent of tiles that we will build based on the AOI:
         unsigned int cell_xmin, cell_ymin, cell_xmax, cell_ymax;
         profile->getQuadMap().getCells(
             map_layer->getAreaOfInterest(), lod,
             cell_xmin, cell_ymin, cell_xmax, cell_ymax );
 
+        QuadKeyList keys;
         for( unsigned int y = cell_ymin; y <= cell_ymax; y++ )
         {
             for( unsigned int x = cell_xmin; x <= cell_xmax; x++ )
             {
-                osg::ref_ptr<osg::Node> node;
-
-                QuadKey key( x, y, lod, profile->getQuadMap() );  
-
-                //osgGIS::notify( osg::NOTICE )
-                //    << "Cell: " << std::endl
-                //    << "   Quadkey = " << key.toString() << std::endl
-                //    << "   LOD = " << key.getLOD() << std::endl
-                //    << "   Extent = " << key.getExtent().toString() << " (w=" << key.getExtent().getWidth() << ", h=" << key.getExtent().getHeight() << ")" << std::endl
-                //    << std::endl;
-
-                node = sub_level_def ?
-                    createIntermediateIndexNode( key, min_range, max_range, reader.get() ) :
-                    createLeafIndexNode( key, reader.get() );
-                
-                if ( node.valid() )
+                QuadKey key( x, y, lod, profile->getQuadMap() );
+                if ( index_outputs.find( key ) == index_outputs.end() )
                 {
-                    std::string out_file = createAbsPathFromTemplate( "i" + key.toString() );
-
-                    if ( !osgDB::writeNodeFile( *(node.get()), out_file ) )
-                    {
-                        osgGIS::warn() << "FAILED to write index file " << out_file << std::endl;
-                    }
-                    
-                    // at the top level, assemble the root node
-                    if ( i == map_layer->getLevels().begin() )
-                    {
-                        double top_min_range = sub_level_def? 0 : level_def->getMinRange();
-
-                        osg::PagedLOD* plod = new osg::PagedLOD();
-                        plod->setName( key.toString() );
-                        plod->setFileName( 0, createRelPathFromTemplate( "i" + key.toString() ) );
-                        plod->setRange( 0, top_min_range, level_def->getMaxRange() );
-                        plod->setPriorityScale( 0, MY_PRIORITY_SCALE );
-                        setCenterAndRadius( plod, key.getExtent(), reader.get() );
-
-                        //osgGIS::notice() << "QK=" << key.toString() << ", Ex=" << key.getExtent().toString() << ", Cen=" << key.getExtent().getCentroid().toString() << std::endl;
-
-
-                        scene_graph->addChild( plod );
-                    }
+                    keys.push_back( key );
                 }
             }
         }
+
+        osg::ref_ptr<IndexTask> task = createIndexTask( keys );
+        if ( task.valid() )
+        {
+            task->run();
+            task->runSynchronousPostProcess( index_outputs );
+        }
     }
+
+    // at the top level, assemble the root node:
+    MapLayerLevelOfDetail* level_def = map_layer->getLevels().begin()->get();
+    bool has_sub_level = map_layer->getLevels().size() > 1;
+    double top_min_range = has_sub_level? 0 : level_def->getMinRange();
+
+    unsigned int cell_xmin, cell_ymin, cell_xmax, cell_ymax;
+    profile->getQuadMap().getCells(
+        map_layer->getAreaOfInterest(), top_lod,
+        cell_xmin, cell_ymin, cell_xmax, cell_ymax );
+
+    NodeExtentList roots;
+    for( unsigned int y = cell_ymin; y <= cell_ymax; y++ )
+    {
+        for( unsigned int x = cell_xmin; x <= cell_xmax; x++ )
+        {
+            QuadKey key( x, y, top_lod, profile->getQuadMap() );
+
+            std::map<QuadKey,bool>::const_iterator output = index_outputs.find( key );
+            if ( output != index_outputs.end() && output->second )
+            {
+                osg::PagedLOD* plod = new osg::PagedLOD();
+                plod->setName( key.toString() );
+                plod->setFileName( 0, createRelPathFromTemplate( "i" + key.toString() ) );
+                plod->setRange( 0, top_min_range, level_def->getMaxRange() );
+                plod->setPriorityScale( 0, MY_PRIORITY_SCALE );
+                roots.push_back( std::pair<osg::Node*,GeoExtent>( plod, key.getExtent() ) );
+
+                scene_graph->addChild( plod );
+            }
+        }
+    }
+
+    osg::ref_ptr<SmartReadCallback> reader = new SmartReadCallback();
+    setCentersAndRadii( roots, output_srs, reader.get() );
+
+    // done with this compilation's record of cells:
+    cell_outputs.clear();
+    cell_keys.clear();
+    num_pending_cells.clear();
+    ready_index_keys.clear();
+    index_outputs.clear();
 }
@@ -0,0 +1,158 @@
+/**
+/* osgGIS - GIS Library for OpenSceneGraph
+ * Copyright 2007-2008 Glenn Waldron and Pelican Ventures, Inc.
+ * http://osggis.org
+ *
+ * osgGIS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <osgGISProjects/WorkerPool>
+#include <osgGIS/Notify>
+#include <osgGIS/Utils>
+#include <OpenThreads/Thread>
+#include <OpenThreads/ScopedLock>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef WIN32
+#  define popen _popen
+#  define pclose _pclose
+#endif
+
+using namespace osgGISProjects;
+
+#define CELL_PREFIX "@cell "
+#define MAX_LINE_LENGTH 4096
+
+
+namespace osgGISProjects
+{
+    // runs one worker process and feeds its output back to the pool.
+    class WorkerThread : public OpenThreads::Thread
+    {
+    public:
+        WorkerThread( WorkerPool* _pool, unsigned int _index, const std::string& _command )
+            : pool( _pool ), index( _index ), command( _command ), ok( false ) { }
+
+        void run()
+        {
+            FILE* pipe = popen( command.c_str(), "r" );
+            if ( !pipe )
+            {
+                osgGIS::warn() << "[worker " << index << "] Unable to start \"" << command << "\"" << std::endl;
+                return;
+            }
+
+            char buf[MAX_LINE_LENGTH];
+            while( fgets( buf, MAX_LINE_LENGTH, pipe ) )
+            {
+                std::string line( buf );
+                while( line.length() > 0 && (line[line.length()-1] == '\n' || line[line.length()-1] == '\r') )
+                    line.erase( line.length()-1 );
+                pool->processLine( index, line );
+            }
+
+            ok = pclose( pipe ) == 0;
+        }
+
+        bool succeeded() const { return ok; }
+
+    private:
+        WorkerPool* pool;
+        unsigned int index;
+        std::string command;
+        bool ok;
+    };
+}
+
+
+WorkerPool::WorkerPool()
+{
+    num_cells_reported = 0;
+}
+
+
+WorkerPool::~WorkerPool()
+{
+    //NOP
+}
+
+
+void
+WorkerPool::addWorker( const std::string& command )
+{
+    commands.push_back( command );
+}
+
+
+bool
+WorkerPool::run()
+{
+    num_cells_reported = 0;
+
+    std::vector<WorkerThread*> threads;
+    for( unsigned int i = 0; i < commands.size(); i++ )
+    {
+        WorkerThread* thread = new WorkerThread( this, i, commands[i] );
+        thread->startThread();
+        threads.push_back( thread );
+    }
+
+    bool ok = true;
+    for( unsigned int i = 0; i < threads.size(); i++ )
+    {
+        threads[i]->join();
+        if ( !threads[i]->succeeded() )
+        {
+            osgGIS::warn() << "[worker " << i << "] Exited with an error" << std::endl;
+            ok = false;
+        }
+        delete threads[i];
+    }
+
+    return ok;
+}
+
+
+unsigned int
+WorkerPool::getNumCellsReported() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> sl( mutex );
+    return num_cells_reported;
+}
+
+
+void
+WorkerPool::processLine( unsigned int worker, const std::string& line )
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> sl( mutex );
+
+    if ( osgGIS::StringUtils::startsWith( line, CELL_PREFIX, true ) )
+    {
+        num_cells_reported++;
+        osgGIS::info() << "[worker " << worker << "] Finished cell " << line.substr( strlen(CELL_PREFIX) ) << std::endl;
+    }
+    else if ( line.length() > 0 )
+    {
+        osgGIS::notice() << "[worker " << worker << "] " << line << std::endl;
+    }
+}
+
+
+void
+WorkerPool::reportCell( const std::string& cell_id )
+{
+    std::cout << CELL_PREFIX << cell_id << std::endl;
+}
@@ -37,7 +37,10 @@
 #include <osg/Group>
 #include <osgDB/WriteFile>
 #include <osgViewer/Viewer>
+#include <OpenThreads/Thread>
 #include <iostream>
+#include <sstream>
+#include <algorithm>
 
 #define NOUT osgGIS::notice()
 #define ENDL std::endl
@@ -49,6 +52,14 @@ std::string target_name = "";
 bool list_targets = false;
 bool test_sources = false;
 int num_threads = 1; // defaults to logical proc count
+int memory_budget = 0; // megabytes; 0 = no limit
+std::string trace_file = "";
+int num_workers = 1; // worker processes per layer
+int worker_threads = 0; // threads per worker; 0 = split --threads among the workers
+int worker_memory_budget = 0; // megabytes per worker; 0 = split --memory-budget among the workers
+int shard_index = 0; // worker mode: which shard of the layer's cells to build..
+int shard_count = 1; // ..out of how many
+std::string layer_name = ""; // worker mode: layer to build
 
 int
 die( const std::string& msg )
@@ -75,6 +86,12 @@ static void usage( const char* prog, const char* msg )
     NOUT << "Optional:" << ENDL;
     NOUT << "    --list-targets       - show all available targets in project" << ENDL;
     NOUT << "    --threads <num>      - number of parallel build threads to use" << ENDL;
+    NOUT << "    --memory-budget <MB> - approximate memory limit for the cells in progress" << ENDL;
+    NOUT << "    --trace <file>       - writes a timeline of the build (Chrome trace event JSON)" << ENDL;
+    NOUT << "    --workers <num>      - number of worker processes across which to split each layer's cells" << ENDL;
+    NOUT << "                           (the workers share the --threads and --memory-budget settings)" << ENDL;
+    NOUT << "    --worker-threads <num>      - number of threads for each worker, instead of a share of --threads" << ENDL;
+    NOUT << "    --worker-memory-budget <MB> - memory limit for each worker, instead of a share of --memory-budget" << ENDL;
     NOUT << "    --version            - dumps the osgGIS library version and exits" << ENDL;
 }
 
@@ -118,6 +135,46 @@ parseCommandLine( int argc, char** argv )
         sscanf( temp.c_str(), "%d", &num_threads );
     }
 
+    if ( arguments.read( "--memory-budget", temp ) )
+    {
+        sscanf( temp.c_str(), "%d", &memory_budget );
+    }
+
+    if ( arguments.read( "--trace", temp ) )
+    {
+        trace_file = temp;
+    }
+
+    if ( arguments.read( "--workers", temp ) )
+    {
+        sscanf( temp.c_str(), "%d", &num_workers );
+    }
+
+    if ( arguments.read( "--worker-threads", temp ) )
+    {
+        sscanf( temp.c_str(), "%d", &worker_threads );
+    }
+
+    if ( arguments.read( "--worker-memory-budget", temp ) )
+    {
+        sscanf( temp.c_str(), "%d", &worker_memory_budget );
+    }
+
+    // internal: the options with which --workers runs each worker process
+    if ( arguments.read( "--shard", temp ) )
+    {
+        if ( sscanf( temp.c_str(), "%d/%d", &shard_index, &shard_count ) != 2 || shard_index < 0 || shard_index >= shard_count )
+        {
+            usage( arguments.getApplicationName().c_str(), "Bad --shard value; expected <index>/<count>" );
+            exit(-1);
+        }
+    }
+
+    if ( arguments.read( "--layer", temp ) )
+    {
+        layer_name = temp;
+    }
+
     if ( arguments.read( "--version" ) )
     {
         osgGIS::notice() << "osgGIS version " << OSGGIS_VERSION_STRING << std::endl;
@@ -131,6 +188,30 @@ parseCommandLine( int argc, char** argv )
 }
 
 
+// command line that runs a worker process on the same project. Unless told
+// otherwise, the workers split the build's threads and memory budget between
+// them, so that together they stay within the limits given for the build.
+static std::string
+getWorkerCommand( const char* prog )
+{
+    int workers = std::max( num_workers, 1 );
+
+    int threads = worker_threads > 0? worker_threads :
+        std::max( 1, ( num_threads > 0? num_threads : OpenThreads::GetNumberOfProcessors() ) / workers );
+
+    int budget = worker_memory_budget > 0? worker_memory_budget :
+        memory_budget > 0? std::max( 1, memory_budget / workers ) :
+        0;
+
+    std::stringstream buf;
+    buf << "\"" << prog << "\" --project-file \"" << project_file << "\""
+        << " --threads " << threads;
+    if ( budget > 0 )
+        buf << " --memory-budget " << budget;
+    return buf.str();
+}
+
+
 int
 main(int argc, char* argv[])
 {
@@ -165,17 +246,41 @@ main(int argc, char* argv[])
     {
         //std::string base_uri = osgDB::getFilePath( project_file );
 
+        if ( trace_file.length() > 0 )
+            registry->getTraceLog()->setEnabled( true );
+
         osgGISProjects::Builder builder( project.get() ); //, base_uri );
         if ( num_threads > 0 )
             builder.setNumThreads( num_threads );
+        if ( memory_budget > 0 )
+            builder.setMemoryBudget( memory_budget );
 
         osg::Timer_t start = osg::Timer::instance()->tick();
 
+        if ( layer_name.length() > 0 )
+        {
+            // build just the one layer (or, as a worker process, our shard of
+            // its cells), and let the exit code tell whether it worked:
+            builder.setShard( shard_index, shard_count );
+            if ( !builder.buildLayer( layer_name ) )
+                return die( "Failed to build layer " + layer_name );
+            return 0;
+        }
+
+        if ( num_workers > 1 )
+            builder.setWorkers( num_workers, getWorkerCommand( argv[0] ) );
+
         builder.build( target_name );
 
         osg::Timer_t end = osg::Timer::instance()->tick();
         osgGIS::notice() << "Done, total build time = " << osg::Timer::instance()->delta_s( start, end ) 
             << "s" << std::flush << std::endl;
+
+        if ( trace_file.length() > 0 && registry->getTraceLog()->write( trace_file ) )
+        {
+            osgGIS::notice() << "Wrote " << registry->getTraceLog()->getNumEvents()
+                << " trace events to " << trace_file << std::endl;
+        }
     }
 
 	return 0;
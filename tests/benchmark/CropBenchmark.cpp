@@ -0,0 +1,560 @@
+/**
+/* osgGIS - GIS Library for OpenSceneGraph
+ * Copyright 2007-2008 Glenn Waldron and Pelican Ventures, Inc.
+ * http://osggis.org
+ *
+ * osgGIS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * Compares CropFilter's polygon cropping against the original (pre-rectangle-
+ * clipper) implementation, on the polygons of a real shapefile and on a large
+ * synthetic coastline. Each polygon is cropped to every cell of a grid laid over
+ * its extent; the benchmark reports the runtime of both and checks that the
+ * cropped areas agree.
+ */
+
+#include <osgGIS/CropFilter>
+#include <osgGIS/FeatureLayer>
+#include <osgGIS/FilterEnv>
+#include <osgGIS/Registry>
+#include <osgGIS/Session>
+#include <osgGIS/SimpleFeature>
+#include <osgGIS/Utils>
+#include <osg/Timer>
+#include <iostream>
+#include <stack>
+#include <math.h>
+#include <stdlib.h>
+
+using namespace osgGIS;
+
+#define GRID_SIZE 4
+#define COASTLINE_POINTS 100000
+#define AREA_TOLERANCE 1e-6
+
+#ifndef UINT
+#  define UINT unsigned int
+#endif
+
+typedef std::vector<UINT> UINTList;
+
+
+// The polygon cropping code as it was before the rectangle clipper.
+namespace legacy
+{
+    bool
+    pointInsideOrOnLine( const GeoPoint& p, const GeoPoint& s1, const GeoPoint& s2 )
+    {
+        osg::Vec3d cross = (s2-s1) ^ (p-s1);
+        return cross.z() >= 0.0;
+    }
+
+
+    bool
+    extentInsideOrOnLine( const GeoExtent& p, const GeoPoint& s1, const GeoPoint& s2 )
+    {
+        return 
+            pointInsideOrOnLine( p.getSouthwest(), s1, s2 ) &&
+            pointInsideOrOnLine( p.getNortheast(), s1, s2 );
+    }
+
+
+    bool
+    getIsectPoint( const GeoPoint& p1, const GeoPoint& p2, const GeoPoint& p3, const GeoPoint& p4, GeoPoint& out )
+    {
+        double denom = (p4.y()-p3.y())*(p2.x()-p1.x()) - (p4.x()-p3.x())*(p2.y()-p1.y());
+        if ( denom == 0.0 )
+        {
+            out = GeoPoint::invalid(); // parallel lines
+            return false;
+        }
+
+        double ua_num = (p4.x()-p3.x())*(p1.y()-p3.y()) - (p4.y()-p3.y())*(p1.x()-p3.x());
+        double ub_num = (p2.x()-p1.x())*(p1.y()-p3.y()) - (p2.y()-p1.y())*(p1.x()-p3.x());
+
+        double ua = ua_num/denom;
+        double ub = ub_num/denom;
+
+        if ( ua < 0.0 || ua > 1.0 ) // || ub < 0.0 || ub > 1.0 )
+        {
+            out = GeoPoint::invalid(); // isect point is on line, but not on line segment
+            return false;
+        }
+
+        double x = p1.x() + ua*(p2.x()-p1.x());
+        double y = p1.y() + ua*(p2.y()-p1.y());
+        double z = p1.getDim() > 2? p1.z() + ua*(p2.z()-p1.z()) : 0.0; //right?
+        out = GeoPoint( x, y, z, p1.getSRS() );
+        return true;
+    }
+
+
+
+    #define STAGE_SOUTH 0
+    #define STAGE_EAST  1
+    #define STAGE_NORTH 2
+    #define STAGE_WEST  3
+
+
+    void
+    spatialInsert( UINTList& list, UINT value, UINT stage, const GeoPointList& points )
+    {
+        UINTList::iterator i;
+        double x, y;
+        
+        switch( stage )
+        {
+        case STAGE_SOUTH:
+            x = points[value].x();
+            for( i = list.begin(); i != list.end() && x < points[*i].x(); i++ );
+            list.insert( i, value );
+            break;
+
+        case STAGE_EAST:
+            y = points[value].y();
+            for( i = list.begin(); i != list.end() && y < points[*i].y(); i++ );
+            list.insert( i, value );
+            break;
+
+        case STAGE_NORTH:
+            x = points[value].x();
+            for( i = list.begin(); i != list.end() && x > points[*i].x(); i++ );
+            list.insert( i, value );
+            break;
+
+        case STAGE_WEST:
+            y = points[value].y();
+            for( i = list.begin(); i != list.end() && y > points[*i].y(); i++ );
+            list.insert( i, value );
+            break;
+        }
+    }
+
+    UINT
+    findIndexOf( const UINTList& list, UINT value )
+    {
+        for( UINT i=0; i<list.size(); i++ )
+            if ( list[i] == value )
+                return i;
+        return 0;
+    }
+
+    class DeferredPart {
+    public:
+        DeferredPart( const GeoPointList& a, UINT b, UINT c )
+            : part( a ), 
+              part_start_ptr( b ),
+              waiting_on_ptr( c ) { }
+        GeoPointList part;
+        UINT part_start_ptr;
+        UINT waiting_on_ptr;
+    };
+
+
+    static void
+    scrubPart( GeoPointList& part )
+    {
+        while( part.size() > 0 && part.front() == part.back() )
+            part.erase( part.end()-1 );
+    }
+
+
+    // poly clipping algorithm Aug 2007
+    bool
+    cropPolygonPart( const GeoPointList& initial_input, const GeoExtent& window, GeoPartList& final_outputs )
+    {
+        // trivial rejection for a non-polygon:
+        if ( initial_input.size() < 3 )
+        {
+            return false;
+        }
+
+        // check for trivial acceptance.
+        if ( window.contains( initial_input ) )
+        {
+            final_outputs.push_back( initial_input );
+            return true;
+        }
+
+        // prepare the list of input parts to process.
+        GeoPartList inputs;
+        inputs.push_back( initial_input );
+
+        // run the algorithm against all four sides of the window in succession.
+        for( UINT stage = 0; stage < 4; stage++ )
+        {
+            GeoPoint s1, s2;
+            switch( stage )
+            {
+                case STAGE_SOUTH: s1 = window.getSouthwest(), s2 = window.getSoutheast(); break;
+                case STAGE_EAST:  s1 = window.getSoutheast(), s2 = window.getNortheast(); break;
+                case STAGE_NORTH: s1 = window.getNortheast(), s2 = window.getNorthwest(); break;
+                case STAGE_WEST:  s1 = window.getNorthwest(), s2 = window.getSouthwest(); break;
+            }
+
+            // output parts to send to the next stage (or to return).
+            GeoPartList outputs;
+
+            // run against each input part.
+            for( GeoPartList::iterator i = inputs.begin(); i != inputs.end(); i++ )
+            {
+                //GeoPointList& input = *i;
+                GeoPointList input = *i;
+                scrubPart( input );
+
+                // trivially reject a degenerate part (should never happen ;)
+                if ( input.size() < 3 )
+                {
+                    continue;
+                }
+                
+                // trivially accept if the window contains the entire extent of the part:
+                GeoExtent input_extent;
+                input_extent.expandToInclude( input );
+
+                // trivially accept when the part lies entirely within the line:
+                if ( extentInsideOrOnLine( input_extent, s1, s2 ) )
+                {
+                    outputs.push_back( input );
+                    continue;
+                }
+
+                // trivially reject when there's no overlap:
+                if ( !window.intersects( input_extent ) || extentInsideOrOnLine( input_extent, s2, s1 ) )
+                {
+                    continue;
+                }                
+
+                // close the part in preparation for cropping. The cropping process with undo
+                // this automatically.
+                input.push_back( input.front() );
+
+                // 1a. Traverse the part and find all intersections. Insert them into the input shape.
+                // 1b. Create a traversal-order list, ordering the isect points in the order in which they are encountered.
+                // 1c. Create a spatial-order list, ordering the isect points along the boundary segment in the direction of the segment.
+                GeoPointList working;
+                UINTList traversal_order;
+                UINTList spatial_order;
+                GeoPoint prev_p;
+                bool was_inside = true;
+
+                for( UINT input_i = 0; input_i < input.size(); input_i++ )
+                {
+                    const GeoPoint& p = input[ input_i ];
+                    bool is_inside = pointInsideOrOnLine( p, s1, s2 );
+
+                    if ( input_i > 0 )
+                    {
+                        if ( was_inside != is_inside ) // entering or exiting
+                        {
+                            GeoPoint isect_p;
+                            if ( getIsectPoint( prev_p, p, s1, s2, /*out*/ isect_p ) )
+                            {
+                                working.push_back( isect_p );
+                                traversal_order.push_back( working.size()-1 );
+                                spatialInsert( spatial_order, working.size()-1, stage, working );
+                            }
+                            else
+                            {
+                                osgGIS::notify( osg::WARN ) 
+                                    << "getIsectPoint failed" << std::endl;
+                            }
+                        }
+                    }
+
+                    working.push_back( p );
+                    prev_p = p;
+                    was_inside = is_inside;
+                }
+
+                if ( spatial_order.size() == 0 )
+                {
+                    outputs.push_back( input );
+                    continue;
+                }
+
+                // 2. Start at the point preceding the first isect point (in spatial order). This will be the first
+                //    outside point (since the first isect point is always an ENTRY.
+                UINT overall_start_ptr = spatial_order[0];
+                UINT shape_ptr = overall_start_ptr;
+
+                // initialize the isect traversal pointer to start at the spatial order's first isect point:
+                UINT trav_ptr = findIndexOf( traversal_order, spatial_order[0] );
+                UINT traversals = 0;
+
+                std::stack<DeferredPart> part_stack;
+                GeoPointList current_part;
+
+                // Process until we make it all the way around.
+                while( traversals < traversal_order.size() )
+                {
+                    // 4. We are outside. Find the next ENTRY point and either start a NEW part, or RESUME
+                    //    a previously deferred part that is on top of the stack.
+                    shape_ptr = traversal_order[trav_ptr]; // next ENTRY
+                    trav_ptr = (trav_ptr + 1) % traversal_order.size();
+                    traversals++;
+
+                    UINT part_start_ptr = shape_ptr;
+
+                    if ( part_stack.size() > 0 && part_stack.top().waiting_on_ptr == part_start_ptr )
+                    {
+                        // time to resume a part that we deferred earlier.
+                        DeferredPart& top = part_stack.top();
+                        current_part = top.part;
+                        part_start_ptr = top.part_start_ptr;
+                        part_stack.pop();
+                    }
+                    else
+                    {
+                        // start a new part
+                        current_part = GeoPointList();
+                    }
+
+                    // 5. Traverse to the next EXIT, adding all points along the way. 
+                    //    Then check the spatial order of the EXIT against the part's starting point. If the former
+                    //    is ONE MORE than the latter, close out the part.
+                    for( bool part_done = false; !part_done && traversals < traversal_order.size(); )
+                    {
+                        UINT next_exit_ptr = traversal_order[trav_ptr];
+                        trav_ptr = (trav_ptr + 1) % traversal_order.size();
+                        traversals++;
+                    
+                        for( ; shape_ptr != next_exit_ptr; shape_ptr = (shape_ptr+1)%working.size() )
+                        {
+                            current_part.push_back( working[shape_ptr] );
+                        }
+
+                        // record the exit point:
+                        current_part.push_back( working[next_exit_ptr] );
+
+                        UINT part_start_order = findIndexOf( spatial_order, part_start_ptr );
+                        UINT next_exit_order = findIndexOf( spatial_order, next_exit_ptr );
+                        if ( next_exit_order - part_start_order == 1 )
+                        {
+                            outputs.push_back( current_part );
+                            part_done = true;
+                            continue;
+                        }
+
+                        // 6. Find the next ENTRY. If the spatial order of the ENTRY is one less than the 
+                        //    spatial ordering of the preceding EXIT, continue on with the part.
+                        UINT next_entry_ptr = traversal_order[trav_ptr];
+                        trav_ptr = (trav_ptr + 1) % traversal_order.size();
+                        traversals++;
+
+                        // check whether we are back at the beginning:
+                        if ( traversals >= traversal_order.size() )
+                        {
+                            current_part.push_back( working[next_entry_ptr] );
+                            continue;
+                        }
+
+                        // check whether we are continuing the current part:
+                        UINT next_entry_order = findIndexOf( spatial_order, next_entry_ptr );
+                        if ( next_exit_order - next_entry_order == 1 )
+                        {
+                            shape_ptr = next_entry_ptr; // skip ahead to the entry point
+                            continue;
+                        }
+
+                        // 7. We encountered an out-of-order traversal, so need to push the current part onto
+                        //    the deferral stack until later, and start a new part.
+                        part_stack.push( DeferredPart(
+                            current_part,
+                            part_start_ptr,
+                            spatial_order[next_exit_order-1] ) );
+
+                        current_part = GeoPointList();
+                        //current_part.push_back( working[next_entry_ptr] );
+                        part_start_ptr = next_entry_ptr;
+                        shape_ptr = next_entry_ptr;
+                    }
+                }
+
+                // pop any parts left on the stack (they're complete now)
+                while( part_stack.size() > 0 )
+                {
+                    GeoPointList& part = part_stack.top().part;
+                    part.push_back( working[part_stack.top().waiting_on_ptr] );
+                    outputs.push_back( part );
+                    part_stack.pop();
+                }
+            }
+
+            // set up for next iteration
+            outputs.swap( inputs );
+        }
+
+        // go through and make sure no polys are "closed" (probably unnecessary).
+        //for( GeoPartList::iterator k = inputs.begin(); k != inputs.end(); k++ )
+        //{
+        //    while ( k->size() > 3 && k->front() == k->back() )
+        //        k->erase( k->end()-1 );
+        //}
+
+        final_outputs.swap( inputs );
+        return true;
+    }
+
+}
+
+
+static double
+getArea( const GeoPointList& part )
+{
+    double area = 0.0;
+    for( UINT i = 0; i < part.size(); i++ )
+    {
+        const GeoPoint& p0 = part[i];
+        const GeoPoint& p1 = part[(i+1)%part.size()];
+        area += p0.x()*p1.y() - p1.x()*p0.y();
+    }
+    return fabs( 0.5*area );
+}
+
+static double
+getArea( const GeoPartList& parts )
+{
+    double area = 0.0;
+    for( GeoPartList::const_iterator i = parts.begin(); i != parts.end(); i++ )
+        area += getArea( *i );
+    return area;
+}
+
+// a noisy, star-shaped polygon with lots of points, like a detailed coastline.
+static GeoPointList
+createCoastline( const SpatialReference* srs )
+{
+    srand( 1 );
+    GeoPointList part;
+    part.reserve( COASTLINE_POINTS );
+    for( UINT i = 0; i < COASTLINE_POINTS; i++ )
+    {
+        double a = 2.0*osg::PI*(double)i/(double)COASTLINE_POINTS;
+        double r = 10.0 + 2.0*sin( 40.0*a ) + 0.5*(double)rand()/(double)RAND_MAX;
+        part.push_back( GeoPoint( r*cos(a), r*sin(a), srs ) );
+    }
+    return part;
+}
+
+static void
+collectPolygons( const std::string& uri, GeoPartList& output )
+{
+    osg::ref_ptr<FeatureLayer> layer = Registry::instance()->createFeatureLayer( uri );
+    if ( !layer.valid() )
+    {
+        std::cout << "Unable to open " << uri << "; using synthetic data only" << std::endl;
+        return;
+    }
+
+    for( FeatureCursor cursor = layer->getCursor(); cursor.hasNext(); )
+    {
+        Feature* f = cursor.next();
+        if ( f->getShapeType() != GeoShape::TYPE_POLYGON )
+            continue;
+
+        for( GeoShapeList::const_iterator i = f->getShapes().begin(); i != f->getShapes().end(); i++ )
+            for( GeoPartList::const_iterator j = i->getParts().begin(); j != i->getParts().end(); j++ )
+                if ( j->size() >= 3 && GeomUtils::isPolygonCCW( *j ) )
+                    output.push_back( *j );
+    }
+}
+
+
+int
+runCropBenchmark( int argc, char* argv[] )
+{
+    osg::ref_ptr<SpatialReference> srs = Registry::SRSFactory()->createWGS84();
+
+    GeoPartList polygons;
+    if ( argc > 0 )
+        collectPolygons( argv[0], polygons );
+    polygons.push_back( createCoastline( srs.get() ) );
+
+    osg::ref_ptr<Session> session = new Session();
+    osg::ref_ptr<FilterEnv> env = session->createFilterEnv();
+    osg::ref_ptr<CropFilter> filter = new CropFilter();
+
+    double legacy_time = 0.0, new_time = 0.0, max_error = 0.0;
+    UINT total_points = 0, legacy_parts = 0, new_parts = 0;
+
+    for( GeoPartList::const_iterator i = polygons.begin(); i != polygons.end(); i++ )
+    {
+        const GeoPointList& polygon = *i;
+        total_points += polygon.size();
+
+        GeoExtent bounds;
+        bounds.expandToInclude( polygon );
+        double dx = bounds.getWidth()/(double)GRID_SIZE;
+        double dy = bounds.getHeight()/(double)GRID_SIZE;
+
+        for( UINT row = 0; row < GRID_SIZE; row++ )
+        {
+            for( UINT col = 0; col < GRID_SIZE; col++ )
+            {
+                GeoExtent window(
+                    bounds.getXMin() + dx*(double)col, bounds.getYMin() + dy*(double)row,
+                    bounds.getXMin() + dx*(double)(col+1), bounds.getYMin() + dy*(double)(row+1),
+                    srs.get() );
+
+                // original implementation:
+                osg::Timer_t t0 = osg::Timer::instance()->tick();
+                GeoPartList legacy_output;
+                legacy::cropPolygonPart( polygon, window, legacy_output );
+                osg::Timer_t t1 = osg::Timer::instance()->tick();
+                legacy_time += osg::Timer::instance()->delta_s( t0, t1 );
+
+                // current implementation, through the filter:
+                osg::ref_ptr<Feature> feature = new SimpleFeature();
+                feature->getShapes().push_back( GeoShape( GeoShape::TYPE_POLYGON, srs.get() ) );
+                feature->getShapes().back().getParts().push_back( polygon );
+                env->setExtent( window );
+
+                t0 = osg::Timer::instance()->tick();
+                FeatureList output = filter->process( feature.get(), env.get() );
+                t1 = osg::Timer::instance()->tick();
+                new_time += osg::Timer::instance()->delta_s( t0, t1 );
+
+                GeoPartList new_output;
+                for( FeatureList::iterator f = output.begin(); f != output.end(); f++ )
+                    for( GeoShapeList::const_iterator s = f->get()->getShapes().begin(); s != f->get()->getShapes().end(); s++ )
+                        new_output.insert( new_output.end(), s->getParts().begin(), s->getParts().end() );
+
+                double legacy_area = getArea( legacy_output );
+                double new_area = getArea( new_output );
+                double error = fabs( legacy_area-new_area ) / std::max( 1.0, legacy_area );
+                max_error = std::max( max_error, error );
+
+                legacy_parts += legacy_output.size();
+                new_parts += new_output.size();
+            }
+        }
+    }
+
+    std::cout
+        << polygons.size() << " polygons, " << total_points << " points, "
+        << GRID_SIZE << "x" << GRID_SIZE << " crop windows each" << std::endl
+        << "  original: " << legacy_time << " s, " << legacy_parts << " output parts" << std::endl
+        << "  current:  " << new_time << " s, " << new_parts << " output parts" << std::endl
+        << "  max relative area difference: " << max_error << std::endl;
+
+    if ( max_error > AREA_TOLERANCE )
+    {
+        std::cout << "FAILED: cropped areas differ" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,205 @@
+/**
+/* osgGIS - GIS Library for OpenSceneGraph
+ * Copyright 2007-2008 Glenn Waldron and Pelican Ventures, Inc.
+ * http://osggis.org
+ *
+ * osgGIS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * Compares the analytic wall and roof normals generated by ExtrudeGeomFilter
+ * against the SmoothingVisitor pass they replaced. A large layer of synthetic
+ * buildings (boxes, L-shapes and round towers) is extruded both ways; the
+ * benchmark reports the runtime of each and checks that every analytic normal
+ * matches the geometric normal of the flat face it belongs to.
+ */
+
+#include <osgGIS/ExtrudeGeomFilter>
+#include <osgGIS/Triangulator>
+#include <osgGIS/Registry>
+#include <osg/Geometry>
+#include <osg/TriangleIndexFunctor>
+#include <osg/Timer>
+#include <osgUtil/SmoothingVisitor>
+#include <iostream>
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+
+using namespace osgGIS;
+
+#define NUM_BUILDINGS 100000
+#define TOWER_SEGMENTS 24
+#define NORMAL_TOLERANCE 1e-3
+
+#ifndef UINT
+#  define UINT unsigned int
+#endif
+
+
+// exposes the extrusion routine of the filter.
+class BenchmarkExtrudeFilter : public ExtrudeGeomFilter
+{
+public:
+    bool extrude( const GeoShape& shape, const SpatialReference* srs, double height, osg::Geometry* walls, osg::Geometry* roof )
+    {
+        return extrudeWallsUp( shape, srs, height, true, walls, roof, NULL, osg::Vec4(1,1,1,1), NULL );
+    }
+};
+
+
+struct NormalCheckOp
+{
+    NormalCheckOp() : verts( NULL ), normals( NULL ), max_error( 0.0 ) { }
+    void operator()( unsigned int i1, unsigned int i2, unsigned int i3 )
+    {
+        osg::Vec3 face = ((*verts)[i2] - (*verts)[i1]) ^ ((*verts)[i3] - (*verts)[i1]);
+        if ( face.normalize() < 1e-6f )
+            return; // degenerate
+
+        max_error = std::max( max_error, (double)(1.0f - face * (*normals)[i1]) );
+        max_error = std::max( max_error, (double)(1.0f - face * (*normals)[i2]) );
+        max_error = std::max( max_error, (double)(1.0f - face * (*normals)[i3]) );
+    }
+    const osg::Vec3Array* verts;
+    const osg::Vec3Array* normals;
+    double max_error;
+};
+
+// largest deviation (1 - cosine) between a vertex normal and the normal of a
+// triangle that uses it.
+static double
+getNormalError( osg::Geometry* geom )
+{
+    osg::TriangleIndexFunctor<NormalCheckOp> op;
+    op.verts = static_cast<const osg::Vec3Array*>( geom->getVertexArray() );
+    op.normals = static_cast<const osg::Vec3Array*>( geom->getNormalArray() );
+    if ( !op.normals || op.normals->size() != op.verts->size() )
+        return 1.0;
+    geom->accept( op );
+    return op.max_error;
+}
+
+// boxes, L-shapes and round towers, like a city's buildings.
+static void
+createBuildings( const SpatialReference* srs, std::vector<GeoShape>& output )
+{
+    srand( 1 );
+    for( UINT i = 0; i < NUM_BUILDINGS; i++ )
+    {
+        double x = (double)(i % 1000) * 50.0;
+        double y = (double)(i / 1000) * 50.0;
+        double w = 10.0 + 30.0*(double)rand()/(double)RAND_MAX;
+        double h = 10.0 + 30.0*(double)rand()/(double)RAND_MAX;
+
+        GeoShape shape( GeoShape::TYPE_POLYGON, srs );
+        GeoPointList& part = shape.addPart();
+        switch( i % 3 )
+        {
+        case 0:
+            part.push_back( GeoPoint( x, y, srs ) );
+            part.push_back( GeoPoint( x+w, y, srs ) );
+            part.push_back( GeoPoint( x+w, y+h, srs ) );
+            part.push_back( GeoPoint( x, y+h, srs ) );
+            break;
+
+        case 1:
+            part.push_back( GeoPoint( x, y, srs ) );
+            part.push_back( GeoPoint( x+w, y, srs ) );
+            part.push_back( GeoPoint( x+w, y+h*0.5, srs ) );
+            part.push_back( GeoPoint( x+w*0.5, y+h*0.5, srs ) );
+            part.push_back( GeoPoint( x+w*0.5, y+h, srs ) );
+            part.push_back( GeoPoint( x, y+h, srs ) );
+            break;
+
+        case 2:
+            for( UINT j = 0; j < TOWER_SEGMENTS; j++ )
+            {
+                double a = 2.0*osg::PI*(double)j/(double)TOWER_SEGMENTS;
+                part.push_back( GeoPoint( x + 0.5*w*(1.0+cos(a)), y + 0.5*w*(1.0+sin(a)), srs ) );
+            }
+            break;
+        }
+        output.push_back( shape );
+    }
+}
+
+
+int
+runExtrudeBenchmark( int argc, char* argv[] )
+{
+    osg::ref_ptr<SpatialReference> srs = Registry::SRSFactory()->createWGS84();
+    std::vector<GeoShape> buildings;
+    createBuildings( srs.get(), buildings );
+
+    osg::ref_ptr<BenchmarkExtrudeFilter> filter = new BenchmarkExtrudeFilter();
+    Triangulator triangulator;
+    UINT num_walls = buildings.size();
+
+    // original implementation: extrude, then smooth the walls and roofs.
+    std::vector< osg::ref_ptr<osg::Geometry> > old_walls( num_walls ), old_roofs( num_walls );
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+    for( UINT i = 0; i < num_walls; i++ )
+    {
+        old_walls[i] = new osg::Geometry();
+        old_roofs[i] = new osg::Geometry();
+        double height = 10.0 + (double)(i % 20);
+        filter->extrude( buildings[i], srs.get(), height, old_walls[i].get(), old_roofs[i].get() );
+        triangulator.triangulate( old_roofs[i].get() );
+
+        osgUtil::SmoothingVisitor smoother;
+        smoother.smooth( *old_walls[i].get() );
+        smoother.smooth( *old_roofs[i].get() );
+    }
+    osg::Timer_t t1 = osg::Timer::instance()->tick();
+    double old_time = osg::Timer::instance()->delta_s( t0, t1 );
+
+    // current implementation: the extrusion generates the normals.
+    std::vector< osg::ref_ptr<osg::Geometry> > new_walls( num_walls ), new_roofs( num_walls );
+    t0 = osg::Timer::instance()->tick();
+    for( UINT i = 0; i < num_walls; i++ )
+    {
+        new_walls[i] = new osg::Geometry();
+        new_roofs[i] = new osg::Geometry();
+        double height = 10.0 + (double)(i % 20);
+        filter->extrude( buildings[i], srs.get(), height, new_walls[i].get(), new_roofs[i].get() );
+        triangulator.triangulate( new_roofs[i].get() );
+    }
+    t1 = osg::Timer::instance()->tick();
+    double new_time = osg::Timer::instance()->delta_s( t0, t1 );
+
+    double max_error = 0.0;
+    UINT old_verts = 0, new_verts = 0;
+    for( UINT i = 0; i < num_walls; i++ )
+    {
+        max_error = std::max( max_error, getNormalError( new_walls[i].get() ) );
+        max_error = std::max( max_error, getNormalError( new_roofs[i].get() ) );
+        old_verts += old_walls[i]->getVertexArray()->getNumElements();
+        new_verts += new_walls[i]->getVertexArray()->getNumElements();
+    }
+
+    std::cout
+        << num_walls << " buildings" << std::endl
+        << "  SmoothingVisitor: " << old_time << " s (" << old_verts << " wall vertices)" << std::endl
+        << "  analytic normals: " << new_time << " s (" << new_verts << " wall vertices)" << std::endl
+        << "  max normal deviation from flat faces: " << max_error << std::endl;
+
+    if ( max_error > NORMAL_TOLERANCE )
+    {
+        std::cout << "FAILED: normals do not match the faces" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,132 @@
+/**
+/* osgGIS - GIS Library for OpenSceneGraph
+ * Copyright 2007-2008 Glenn Waldron and Pelican Ventures, Inc.
+ * http://osggis.org
+ *
+ * osgGIS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * Measures the throughput, in points per second, of transforming lat/long
+ * points into a localized geocentric SRS, comparing the batch transform
+ * (SpatialReference::transformPointsInPlace, also used for shapes) against
+ * the point-by-point path that shapes used before. Checks that both produce
+ * the same coordinates.
+ */
+
+#include <osgGIS/Registry>
+#include <osgGIS/GeoShape>
+#include <osg/Timer>
+#include <iostream>
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+
+using namespace osgGIS;
+
+#define NUM_POINTS 1000000
+#define POINTS_PER_SHAPE 1000
+#define POSITION_TOLERANCE 1e-6
+
+#ifndef UINT
+#  define UINT unsigned int
+#endif
+
+
+static double
+randomValue( double min, double max )
+{
+    return min + (max-min)*(double)rand()/(double)RAND_MAX;
+}
+
+
+int
+runGeocentricBenchmark( int argc, char* argv[] )
+{
+    SpatialReferenceFactory* factory = Registry::SRSFactory();
+    osg::ref_ptr<SpatialReference> geog = factory->createWGS84();
+
+    // localize the output around the middle of the data, like a cell would:
+    osg::ref_ptr<SpatialReference> geoc = factory->createGeocentricSRS( geog.get() );
+    GeoPoint center = geoc->transform( GeoPoint( osg::Vec3d( 10.5, 45.5, 0.0 ), geog.get() ) );
+    osg::ref_ptr<SpatialReference> local_geoc = factory->createGeocentricSRS(
+        geog.get(), osg::Matrixd::translate( -center ) );
+
+    srand( 1 );
+    std::vector<double> lon( NUM_POINTS ), lat( NUM_POINTS ), hgt( NUM_POINTS );
+    for( UINT i = 0; i < NUM_POINTS; i++ )
+    {
+        lon[i] = randomValue( 10.0, 11.0 );
+        lat[i] = randomValue( 45.0, 46.0 );
+        hgt[i] = randomValue( 0.0, 500.0 );
+    }
+
+    // point by point:
+    std::vector<GeoPoint> points( NUM_POINTS );
+    for( UINT i = 0; i < NUM_POINTS; i++ )
+        points[i] = GeoPoint( lon[i], lat[i], hgt[i], geog.get() );
+
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+    for( UINT i = 0; i < NUM_POINTS; i++ )
+        local_geoc->transformInPlace( points[i] );
+    osg::Timer_t t1 = osg::Timer::instance()->tick();
+    double point_time = osg::Timer::instance()->delta_s( t0, t1 );
+
+    // coordinate arrays:
+    std::vector<double> x( lon ), y( lat ), z( hgt );
+    t0 = osg::Timer::instance()->tick();
+    local_geoc->transformPointsInPlace( geog.get(), &x[0], &y[0], &z[0], NUM_POINTS );
+    t1 = osg::Timer::instance()->tick();
+    double batch_time = osg::Timer::instance()->delta_s( t0, t1 );
+
+    // shapes, which now use the batch transform:
+    std::vector<GeoShape> shapes;
+    for( UINT i = 0; i < NUM_POINTS; i += POINTS_PER_SHAPE )
+    {
+        shapes.push_back( GeoShape( GeoShape::TYPE_LINE, geog.get() ) );
+        GeoPointList& part = shapes.back().addPart();
+        for( UINT j = i; j < i+POINTS_PER_SHAPE && j < NUM_POINTS; j++ )
+            part.push_back( GeoPoint( lon[j], lat[j], hgt[j], geog.get() ) );
+    }
+
+    t0 = osg::Timer::instance()->tick();
+    for( UINT i = 0; i < shapes.size(); i++ )
+        local_geoc->transformInPlace( shapes[i] );
+    t1 = osg::Timer::instance()->tick();
+    double shape_time = osg::Timer::instance()->delta_s( t0, t1 );
+
+    double max_error = 0.0;
+    for( UINT i = 0; i < NUM_POINTS; i++ )
+    {
+        const GeoPoint& p = points[i];
+        const GeoPoint& s = shapes[i/POINTS_PER_SHAPE].getPart(0)[i%POINTS_PER_SHAPE];
+        max_error = std::max( max_error, (osg::Vec3d( x[i], y[i], z[i] ) - p).length() );
+        max_error = std::max( max_error, (osg::Vec3d( s ) - p).length() );
+    }
+
+    std::cout
+        << NUM_POINTS << " points, geographic to localized geocentric" << std::endl
+        << "  point by point: " << (double)NUM_POINTS/point_time << " points/s" << std::endl
+        << "  batch arrays:   " << (double)NUM_POINTS/batch_time << " points/s" << std::endl
+        << "  batch shapes:   " << (double)NUM_POINTS/shape_time << " points/s" << std::endl
+        << "  max position difference: " << max_error << " m" << std::endl;
+
+    if ( max_error > POSITION_TOLERANCE )
+    {
+        std::cout << "FAILED: batch results do not match" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,231 @@
+/**
+/* osgGIS - GIS Library for OpenSceneGraph
+ * Copyright 2007-2008 Glenn Waldron and Pelican Ventures, Inc.
+ * http://osggis.org
+ *
+ * osgGIS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * Compares the ear-clipping Triangulator against the GLU tessellator it replaced
+ * in the geometry-building filters. Each polygon of a real shapefile (and of a
+ * large set of synthetic building footprints, some with courtyards) is built
+ * into a ring geometry the way BuildGeomFilter builds it and then triangulated
+ * both ways; the benchmark reports the runtime of each and checks that the
+ * triangulated areas agree.
+ */
+
+#include <osgGIS/Triangulator>
+#include <osgGIS/FeatureLayer>
+#include <osgGIS/Registry>
+#include <osg/Geometry>
+#include <osg/TriangleFunctor>
+#include <osg/Timer>
+#include <osgUtil/Tessellator>
+#include <iostream>
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+
+using namespace osgGIS;
+
+#define NUM_FOOTPRINTS 100000
+#define AREA_TOLERANCE 1e-4
+
+#ifndef UINT
+#  define UINT unsigned int
+#endif
+
+
+// a polygon as a list of rings, the first of which is the outer boundary.
+typedef std::vector<GeoPointList> RingList;
+typedef std::vector<RingList> PolygonList;
+
+
+struct AreaOp
+{
+    AreaOp() : area( 0.0 ) { }
+    void operator()( const osg::Vec3& v1, const osg::Vec3& v2, const osg::Vec3& v3, bool )
+    {
+        area += 0.5 * ( (v2-v1) ^ (v3-v1) ).length();
+    }
+    double area;
+};
+
+static double
+getTriangleArea( osg::Geometry* geom )
+{
+    osg::TriangleFunctor<AreaOp> op;
+    geom->accept( op );
+    return op.area;
+}
+
+static osg::Geometry*
+createGeometry( const RingList& rings )
+{
+    osg::Geometry* geom = new osg::Geometry();
+    osg::Vec3Array* verts = new osg::Vec3Array();
+    geom->setVertexArray( verts );
+
+    for( RingList::const_iterator i = rings.begin(); i != rings.end(); i++ )
+    {
+        UINT first = verts->size();
+        for( GeoPointList::const_iterator j = i->begin(); j != i->end(); j++ )
+            verts->push_back( *j );
+        geom->addPrimitiveSet( new osg::DrawArrays( osg::PrimitiveSet::LINE_LOOP, first, verts->size()-first ) );
+    }
+    return geom;
+}
+
+static void
+addRect( RingList& rings, double x, double y, double w, double h, bool hole, const SpatialReference* srs )
+{
+    GeoPointList ring;
+    ring.push_back( GeoPoint( x, y, srs ) );
+    ring.push_back( GeoPoint( x+w, y, srs ) );
+    ring.push_back( GeoPoint( x+w, y+h, srs ) );
+    ring.push_back( GeoPoint( x, y+h, srs ) );
+    if ( hole )
+        std::reverse( ring.begin(), ring.end() );
+    rings.push_back( ring );
+}
+
+// rectangles, L-shapes and courtyard blocks, like a city's building footprints.
+static void
+createFootprints( const SpatialReference* srs, PolygonList& output )
+{
+    srand( 1 );
+    for( UINT i = 0; i < NUM_FOOTPRINTS; i++ )
+    {
+        double x = (double)(i % 1000) * 50.0;
+        double y = (double)(i / 1000) * 50.0;
+        double w = 10.0 + 30.0*(double)rand()/(double)RAND_MAX;
+        double h = 10.0 + 30.0*(double)rand()/(double)RAND_MAX;
+
+        RingList rings;
+        switch( i % 3 )
+        {
+        case 0:
+            addRect( rings, x, y, w, h, false, srs );
+            break;
+
+        case 1:
+            {
+                GeoPointList ring;
+                ring.push_back( GeoPoint( x, y, srs ) );
+                ring.push_back( GeoPoint( x+w, y, srs ) );
+                ring.push_back( GeoPoint( x+w, y+h*0.5, srs ) );
+                ring.push_back( GeoPoint( x+w*0.5, y+h*0.5, srs ) );
+                ring.push_back( GeoPoint( x+w*0.5, y+h, srs ) );
+                ring.push_back( GeoPoint( x, y+h, srs ) );
+                rings.push_back( ring );
+            }
+            break;
+
+        case 2:
+            addRect( rings, x, y, w, h, false, srs );
+            addRect( rings, x+w*0.25, y+h*0.25, w*0.5, h*0.5, true, srs );
+            break;
+        }
+        output.push_back( rings );
+    }
+}
+
+static void
+collectPolygons( const std::string& uri, PolygonList& output )
+{
+    osg::ref_ptr<FeatureLayer> layer = Registry::instance()->createFeatureLayer( uri );
+    if ( !layer.valid() )
+    {
+        std::cout << "Unable to open " << uri << "; using synthetic data only" << std::endl;
+        return;
+    }
+
+    for( FeatureCursor cursor = layer->getCursor(); cursor.hasNext(); )
+    {
+        Feature* f = cursor.next();
+        for( GeoShapeList::const_iterator i = f->getShapes().begin(); i != f->getShapes().end(); i++ )
+        {
+            if ( i->getShapeType() == GeoShape::TYPE_POLYGON && i->getPartCount() > 0 )
+                output.push_back( i->getParts() );
+        }
+    }
+}
+
+
+int
+runTriangulateBenchmark( int argc, char* argv[] )
+{
+    PolygonList polygons;
+    if ( argc > 0 )
+        collectPolygons( argv[0], polygons );
+    osg::ref_ptr<SpatialReference> srs = Registry::SRSFactory()->createWGS84();
+    createFootprints( srs.get(), polygons );
+
+    // build all the geometry up front so that only the triangulation is timed:
+    std::vector< osg::ref_ptr<osg::Geometry> > glu_geoms, new_geoms;
+    UINT total_points = 0;
+    for( PolygonList::const_iterator i = polygons.begin(); i != polygons.end(); i++ )
+    {
+        glu_geoms.push_back( createGeometry( *i ) );
+        new_geoms.push_back( createGeometry( *i ) );
+        for( RingList::const_iterator j = i->begin(); j != i->end(); j++ )
+            total_points += j->size();
+    }
+
+    // original implementation:
+    osg::Timer_t t0 = osg::Timer::instance()->tick();
+    for( UINT i = 0; i < glu_geoms.size(); i++ )
+    {
+        osgUtil::Tessellator tess;
+        tess.setTessellationType( osgUtil::Tessellator::TESS_TYPE_GEOMETRY );
+        tess.setWindingType( osgUtil::Tessellator::TESS_WINDING_POSITIVE );
+        tess.retessellatePolygons( *glu_geoms[i].get() );
+    }
+    osg::Timer_t t1 = osg::Timer::instance()->tick();
+    double glu_time = osg::Timer::instance()->delta_s( t0, t1 );
+
+    // current implementation:
+    Triangulator triangulator;
+    t0 = osg::Timer::instance()->tick();
+    for( UINT i = 0; i < new_geoms.size(); i++ )
+    {
+        triangulator.triangulate( new_geoms[i].get() );
+    }
+    t1 = osg::Timer::instance()->tick();
+    double new_time = osg::Timer::instance()->delta_s( t0, t1 );
+
+    double max_error = 0.0;
+    for( UINT i = 0; i < glu_geoms.size(); i++ )
+    {
+        double glu_area = getTriangleArea( glu_geoms[i].get() );
+        double new_area = getTriangleArea( new_geoms[i].get() );
+        double error = fabs( glu_area-new_area ) / std::max( 1.0, glu_area );
+        max_error = std::max( max_error, error );
+    }
+
+    std::cout
+        << polygons.size() << " polygons, " << total_points << " points" << std::endl
+        << "  GLU tessellator: " << glu_time << " s" << std::endl
+        << "  ear clipping:    " << new_time << " s (" << triangulator.getNumFallbacks() << " fell back on GLU)" << std::endl
+        << "  max relative area difference: " << max_error << std::endl;
+
+    if ( max_error > AREA_TOLERANCE )
+    {
+        std::cout << "FAILED: triangulated areas differ" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
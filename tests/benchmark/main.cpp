@@ -0,0 +1,91 @@
+/**
+/* osgGIS - GIS Library for OpenSceneGraph
+ * Copyright 2007-2008 Glenn Waldron and Pelican Ventures, Inc.
+ * http://osggis.org
+ *
+ * osgGIS is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * osggis_test_benchmark - Performance benchmarks
+ *
+ * Times optimized code paths against the implementations they replaced, and
+ * verifies that both produce the same results.
+ */
+
+#include <iostream>
+#include <string>
+
+extern int runCropBenchmark( int argc, char* argv[] );
+extern int runExtrudeBenchmark( int argc, char* argv[] );
+extern int runGeocentricBenchmark( int argc, char* argv[] );
+extern int runTriangulateBenchmark( int argc, char* argv[] );
+
+struct Benchmark
+{
+    const char* name;
+    int (*run)( int argc, char* argv[] );
+};
+
+static Benchmark benchmarks[] =
+{
+    { "crop", runCropBenchmark },
+    { "extrude", runExtrudeBenchmark },
+    { "geocentric", runGeocentricBenchmark },
+    { "triangulate", runTriangulateBenchmark },
+    { NULL, NULL }
+};
+
+static void
+usage( const char* prog )
+{
+    std::cout << "usage: " << prog << " {all";
+    for( Benchmark* b = benchmarks; b->name; b++ )
+        std::cout << "|" << b->name;
+    std::cout << "} [args...]" << std::endl;
+}
+
+int
+main(int argc, char* argv[])
+{
+    if ( argc < 2 )
+    {
+        usage( argv[0] );
+        return 1;
+    }
+
+    std::string which = argv[1];
+    bool found = false;
+    int result = 0;
+
+    for( Benchmark* b = benchmarks; b->name; b++ )
+    {
+        if ( which == "all" || which == b->name )
+        {
+            found = true;
+            std::cout << "=== " << b->name << " ===" << std::endl;
+            int r = b->run( argc-2, argv+2 );
+            if ( r != 0 )
+                result = r;
+        }
+    }
+
+    if ( !found )
+    {
+        usage( argv[0] );
+        return 1;
+    }
+
+    return result;
+}